@@ -49,6 +49,7 @@ extern const Command pickle_command;
 extern const Command repack_command;
 extern const Command retrace_command;
 extern const Command sed_command;
+extern const Command symbolize_command;
 extern const Command trace_command;
 extern const Command trim_command;
 extern const Command info_command;
@@ -43,7 +43,7 @@
 #include "cli.hpp"
 #include "cli_pager.hpp"
 
-#include "trace_parser.hpp"
+#include "trace_parser_parallel.hpp"
 #include "trace_dump_internal.hpp"
 #include "trace_callset.hpp"
 #include "trace_option.hpp"
@@ -250,7 +250,8 @@ command(int argc, char *argv[])
     }
 
     for (int i = optind; i < argc; ++i) {
-        trace::Parser p;
+        trace::ParallelParser p;
+        p.setUseArenas(true);
 
         if (!p.open(argv[i])) {
             return 1;
@@ -265,6 +266,11 @@ command(int argc, char *argv[])
             }
         }
 
+        // Skip straight to the first call when the trace is indexed
+        if (calls.getFirst() > 0) {
+            p.seekToCall(calls.getFirst());
+        }
+
         trace::Call *call;
         while ((call = p.parse_call())) {
             if (call->no > calls.getLast()) {
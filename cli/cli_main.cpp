@@ -74,6 +74,7 @@ static const Command * commands[] = {
     &leaks_command,
     &pickle_command,
     &sed_command,
+    &symbolize_command,
     &repack_command,
     &retrace_command,
     &trace_command,
@@ -35,7 +35,7 @@
 #include "cli.hpp"
 #include "cli_pager.hpp"
 
-#include "trace_parser.hpp"
+#include "trace_parser_parallel.hpp"
 #include "trace_model.hpp"
 #include "trace_callset.hpp"
 
@@ -268,7 +268,7 @@ command(int argc, char *argv[])
     PickleVisitor visitor(writer, symbolic);
 
     for (int i = optind; i < argc; ++i) {
-        trace::Parser parser;
+        trace::ParallelParser parser;
 
         if (!parser.open(argv[i])) {
             return 1;
@@ -25,19 +25,38 @@
 
 
 #include <assert.h>
+#include <limits.h> // for CHAR_MAX
 #include <string.h>
 #include <getopt.h>
 
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <random>
+#include <string>
+#include <vector>
 
 #include "cli.hpp"
 
+#include <brotli/decode.h>
 #include <brotli/encode.h>
 #include <zlib.h>  // for crc32
 
+#ifdef HAVE_ZSTD
+#include <zdict.h>
+#endif
+
+#include "os_thread.hpp"
+#include "os_time.hpp"
+#include "trace_codec.hpp"
 #include "trace_file.hpp"
 #include "trace_ostream.hpp"
+#include "trace_parser.hpp"
+#include "trace_snappy.hpp"
 
 
 static const char *synopsis = "Repack a trace file with different compression.";
@@ -50,21 +69,45 @@ usage(void)
         << synopsis << "\n"
         << "\n"
         << "Snappy compression allows for faster replay and smaller memory footprint,\n"
-        << "at the expense of a slightly smaller compression ratio than zlib\n"
+        << "at the expense of a slightly smaller compression ratio than zlib.  LZ4 and\n"
+        << "Zstandard compression are as fast or faster, and Zstandard compresses better.\n"
+        << "Snappy, LZ4 and Zstandard traces are also indexed, for quick seeking to\n"
+        << "frames and calls.\n"
         << "\n"
         << "    -b,--brotli[=QUALITY]  Use Brotli compression (quality " << BROTLI_MIN_QUALITY << "-" << BROTLI_MAX_QUALITY << ", default " << BROTLI_DEFAULT_QUALITY << ")\n"
         << "    -z,--zlib              Use ZLib compression\n"
+        << "    -4,--lz4[=LEVEL]       Use LZ4 compression (high compression when LEVEL is given)\n"
+        << "    -Z,--zstd[=LEVEL]      Use Zstandard compression (default level 1)\n"
+        << "    -D,--dictionary=FILE   Use the given Zstandard dictionary\n"
+        << "    --train-dictionary=FILE\n"
+        << "                           Train a Zstandard dictionary on the trace, save it\n"
+        << "                           to FILE, and use it\n"
+        << "    -j,--threads=N         Compress on N threads (default: number of CPUs)\n"
+        << "\n"
+        << "Blocks of the trace are compressed independently, so that zlib traces consist\n"
+        << "of several gzip members.  Brotli traces are compressed as a single stream on\n"
+        << "one thread, unless -j is given: they then consist of several streams, of\n"
+        << "which older versions of apitrace only read the first.\n"
         << "\n";
 }
 
+enum {
+    TRAIN_DICTIONARY_OPT = CHAR_MAX + 1,
+};
+
 const static char *
-shortOptions = "hbz";
+shortOptions = "hbz4ZD:j:";
 
 const static struct option
 longOptions[] = {
     {"help", no_argument, 0, 'h'},
     {"brotli", optional_argument, 0, 'b'},
     {"zlib", no_argument, 0, 'z'},
+    {"lz4", optional_argument, 0, '4'},
+    {"zstd", optional_argument, 0, 'Z'},
+    {"dictionary", required_argument, 0, 'D'},
+    {"train-dictionary", required_argument, 0, TRAIN_DICTIONARY_OPT},
+    {"threads", required_argument, 0, 'j'},
     {0, 0, 0, 0}
 };
 
@@ -72,121 +115,829 @@ enum Format {
     FORMAT_SNAPPY = 0,
     FORMAT_ZLIB,
     FORMAT_BROTLI,
+    FORMAT_LZ4,
+    FORMAT_ZSTD,
 };
 
 
-static int
-repack_generic(trace::File *inFile, trace::OutStream *outFile)
+/*
+ * Dictionary training parameters, as recommended by zstd: about a hundred
+ * times more sample data than the dictionary size, in small samples.
+ */
+#define DICTIONARY_SIZE (112 * 1024)
+#define DICTIONARY_SAMPLE_SIZE (16 * 1024)
+#define DICTIONARY_MAX_SAMPLES 1024
+
+/*
+ * Size of the blocks compressed independently.  Chunked traces must use
+ * their chunk size, while for zlib and brotli larger blocks lose less
+ * compression, at the expense of memory.
+ */
+#define ZLIB_BLOCK_SIZE (4 * 1024 * 1024)
+#define BROTLI_BLOCK_SIZE (16 * 1024 * 1024)
+
+/*
+ * Memory budget of the repack pipeline, which bounds the number of threads,
+ * and so of blocks in flight.
+ */
+#define PIPELINE_MAX_MEMORY (1024 * 1024 * 1024)
+
+/*
+ * Approximate memory used by a Brotli encoder per byte of block, at quality
+ * 10 and above, which use much more than the lower ones.
+ */
+#define BROTLI_ENCODER_MEMORY_FACTOR 12
+
+
+/*
+ * Blocks are compressed independently of each other, so that they can be
+ * compressed concurrently, and each yields a self-contained piece of the
+ * output.  Instances are only used by one thread.
+ */
+class BlockCodec
 {
-    const size_t size = 8192;
-    char *buf = new char[size];
-    size_t read;
+public:
+    virtual ~BlockCodec() {}
+
+    virtual bool
+    compress(const std::vector<char> &block, std::string &output) = 0;
+
+    /**
+     * Decompress a piece of the output into a block, which is already sized
+     * to the expected length.
+     */
+    virtual bool
+    decompress(const std::string &output, std::vector<char> &block) = 0;
+};
+
+typedef std::function<BlockCodec *(void)> BlockCodecFactory;
+
 
-    while ((read = inFile->read(buf, size)) != 0) {
-        outFile->write(buf, read);
+/*
+ * Chunks of snappy, LZ4 and Zstandard traces.
+ */
+class ChunkedBlockCodec : public BlockCodec
+{
+public:
+    ChunkedBlockCodec(const trace::CodecOptions &options) :
+        m_codec(trace::createChunkCodec(options))
+    {}
+
+    bool
+    compress(const std::vector<char> &block, std::string &output) override {
+        if (!m_codec) {
+            return false;
+        }
+        output.resize(4 + m_codec->maxCompressedLength(block.size()));
+        size_t length = m_codec->compress(block.data(), block.size(), &output[4]);
+        if (!length) {
+            return false;
+        }
+        for (unsigned i = 0; i < 4; ++i) {
+            output[i] = char(length >> (8 * i));
+        }
+        output.resize(4 + length);
+        return true;
     }
 
-    delete [] buf;
+    bool
+    decompress(const std::string &output, std::vector<char> &block) override {
+        size_t length;
+        return m_codec &&
+               output.size() >= 4 &&
+               m_codec->getUncompressedLength(&output[4], output.size() - 4, length) &&
+               length == block.size() &&
+               m_codec->uncompress(&output[4], output.size() - 4,
+                                   block.data(), length, false) == length;
+    }
 
-    return EXIT_SUCCESS;
-}
+private:
+    std::unique_ptr<trace::ChunkCodec> m_codec;
+};
 
 
-static int
-repack_brotli(trace::File *inFile, const char *outFileName, int quality)
+/*
+ * Gzip members, which readers decompress one after the other.
+ */
+class ZLibBlockCodec : public BlockCodec
 {
-    BrotliEncoderState *s = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
-    if (!s) {
-        return EXIT_FAILURE;
+public:
+    bool
+    compress(const std::vector<char> &block, std::string &output) override {
+        z_stream stream;
+        memset(&stream, 0, sizeof stream);
+        // Default compression, as gzopen does, with a gzip header
+        if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+        output.resize(deflateBound(&stream, uLong(block.size())));
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(block.data()));
+        stream.avail_in = uInt(block.size());
+        stream.next_out = reinterpret_cast<Bytef *>(&output[0]);
+        stream.avail_out = uInt(output.size());
+        int ret = deflate(&stream, Z_FINISH);
+        output.resize(stream.total_out);
+        deflateEnd(&stream);
+        return ret == Z_STREAM_END;
     }
 
-    // Brotli default quality is 11.  There used to be problems using quality
-    // higher than 9:
-    //
-    // - Some traces cause compression to be extremely slow.  Possibly the same
-    //   issue as https://github.com/google/brotli/issues/330
-    // - Some traces get lower compression ratio with 11 than 9.  Possibly the
-    //   same issue as https://github.com/google/brotli/issues/222
-    //
-    // but not any more.
-    BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, quality);
+    bool
+    decompress(const std::string &output, std::vector<char> &block) override {
+        z_stream stream;
+        memset(&stream, 0, sizeof stream);
+        if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+            return false;
+        }
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(output.data()));
+        stream.avail_in = uInt(output.size());
+        stream.next_out = reinterpret_cast<Bytef *>(block.data());
+        stream.avail_out = uInt(block.size());
+        int ret = inflate(&stream, Z_FINISH);
+        bool ok = ret == Z_STREAM_END &&
+                  stream.total_out == block.size() &&
+                  stream.avail_in == 0;
+        inflateEnd(&stream);
+        return ok;
+    }
+};
 
-    // The larger the window, the higher the compression ratio and
-    // decompression speeds, so choose the maximum.
-    BrotliEncoderSetParameter(s, BROTLI_PARAM_LGWIN, 24);
 
+/*
+ * Brotli streams, which readers decompress one after the other.
+ */
+class BrotliBlockCodec : public BlockCodec
+{
+public:
+    BrotliBlockCodec(int quality) :
+        m_quality(quality)
+    {}
+
+    bool
+    compress(const std::vector<char> &block, std::string &output) override {
+        size_t length = BrotliEncoderMaxCompressedSize(block.size());
+        output.resize(length);
+        // The larger the window, the higher the compression ratio and
+        // decompression speeds, so choose the maximum.
+        if (!BrotliEncoderCompress(m_quality, 24, BROTLI_MODE_GENERIC,
+                                   block.size(),
+                                   reinterpret_cast<const uint8_t *>(block.data()),
+                                   &length,
+                                   reinterpret_cast<uint8_t *>(&output[0]))) {
+            return false;
+        }
+        output.resize(length);
+        return true;
+    }
+
+    bool
+    decompress(const std::string &output, std::vector<char> &block) override {
+        size_t length = block.size();
+        return BrotliDecoderDecompress(output.size(),
+                                       reinterpret_cast<const uint8_t *>(output.data()),
+                                       &length,
+                                       reinterpret_cast<uint8_t *>(block.data())) == BROTLI_DECODER_RESULT_SUCCESS &&
+               length == block.size();
+    }
+
+private:
+    int m_quality;
+};
+
+
+/*
+ * Input of the repack pipeline, read into the blocks of the pipeline, so that
+ * the trace can be parsed as it is read.  Offsets are relative to the blocks,
+ * which are numbered in order.
+ */
+class BlockFile : public trace::File
+{
+public:
+    typedef std::function<std::vector<char> *(void)> AcquireFunction;
+    typedef std::function<void(void)> CommitFunction;
+
+    /**
+     * acquire waits for the next block to be free, returning null when the
+     * pipeline failed; commit hands it over once filled.
+     */
+    BlockFile(trace::File *inFile, size_t blockSize,
+              const AcquireFunction &acquire, const CommitFunction &commit) :
+        m_inFile(inFile),
+        m_blockSize(blockSize),
+        m_acquire(acquire),
+        m_commit(commit)
+    {
+        m_isOpened = true;
+    }
+
+    ~BlockFile() {
+        close();
+    }
+
+    bool supportsOffsets(void) const override {
+        return true;
+    }
+
+    File::Offset currentOffset(void) const override {
+        if (!m_block) {
+            return File::Offset(m_blockNo, 0);
+        }
+        return File::Offset(m_blockNo, uint32_t(m_windowPtr - m_block->data()));
+    }
+
+protected:
+    bool rawOpen(const char *filename) override {
+        return true;
+    }
+
+    size_t rawRead(void *buffer, size_t length) override {
+        char *dst = static_cast<char *>(buffer);
+        size_t total = 0;
+        do {
+            size_t available = std::min(size_t(m_windowEnd - m_windowPtr), length - total);
+            memcpy(dst + total, m_windowPtr, available);
+            m_windowPtr += available;
+            total += available;
+        } while (total < length && nextBlock());
+        return total;
+    }
+
+    int rawGetc(void) override {
+        if (m_windowPtr == m_windowEnd && !nextBlock()) {
+            return -1;
+        }
+        return (unsigned char)*m_windowPtr++;
+    }
+
+    bool rawSkip(size_t length) override {
+        while (size_t(m_windowEnd - m_windowPtr) < length) {
+            length -= m_windowEnd - m_windowPtr;
+            m_windowPtr = m_windowEnd;
+            if (!nextBlock()) {
+                return false;
+            }
+        }
+        m_windowPtr += length;
+        return true;
+    }
+
+    void rawClose(void) override {
+        // Read whatever the parser left
+        while (nextBlock()) {
+        }
+    }
+
+    int rawPercentRead(void) override {
+        return m_inFile->percentRead();
+    }
+
+private:
+    bool nextBlock(void) {
+        if (m_block) {
+            m_commit();
+            m_block = nullptr;
+            ++m_blockNo;
+        }
+        m_windowPtr = m_windowEnd = nullptr;
+        if (m_eof) {
+            return false;
+        }
+
+        m_block = m_acquire();
+        if (!m_block) {
+            m_eof = true;
+            return false;
+        }
+
+        m_block->resize(m_blockSize);
+        size_t size = 0;
+        size_t read;
+        while (size < m_blockSize &&
+               (read = m_inFile->read(&(*m_block)[size], m_blockSize - size)) != 0) {
+            size += read;
+        }
+        m_block->resize(size);
+        if (!size) {
+            m_block = nullptr;
+            m_eof = true;
+            return false;
+        }
+
+        m_windowPtr = m_block->data();
+        m_windowEnd = m_windowPtr + size;
+        return true;
+    }
+
+    trace::File *m_inFile;
+    size_t m_blockSize;
+    AcquireFunction m_acquire;
+    CommitFunction m_commit;
+    std::vector<char> *m_block = nullptr;
+    uint64_t m_blockNo = 0;
+    bool m_eof = false;
+};
+
+
+static void
+reportProgress(uint64_t inSize, uint64_t outSize, long long startTime, bool done)
+{
+    double seconds = double(os::getTime() - startTime) / os::timeFrequency;
+    double inMiB = double(inSize) / (1024 * 1024);
+    double outMiB = double(outSize) / (1024 * 1024);
+    fprintf(stderr, "\r%.1f MiB read, %.1f MiB written (%.1f%%), %.1f s, %.1f MiB/s",
+            inMiB, outMiB, inSize ? 100.0 * outSize / inSize : 0.0,
+            seconds, seconds > 0 ? inMiB / seconds : 0.0);
+    if (done) {
+        fprintf(stderr, "\n");
+    }
+    fflush(stderr);
+}
+
+
+/*
+ * Repack through a pipeline: a thread reads the input in blocks, a pool of
+ * threads compresses them, and the calling thread writes them out in order.
+ *
+ * The output is verified alongside: the input CRC is computed as blocks are
+ * read, while another thread reads back each block once written, decompresses
+ * it, and computes the CRC of the result.
+ *
+ * codecMemory is the memory a codec uses to compress a block, beyond the
+ * block and its output.
+ *
+ * When indexOptions is given, the output is a chunked trace with one chunk per
+ * block: the input is scanned as it is read, and the index is written after
+ * the last chunk.
+ */
+static int
+repack_pipeline(trace::File *inFile, const char *outFileName,
+                const std::string &header, size_t blockSize,
+                const BlockCodecFactory &factory, size_t codecMemory,
+                unsigned numThreads,
+                const trace::CodecOptions *indexOptions = nullptr)
+{
     FILE *fout = fopen(outFileName, "wb");
     if (!fout) {
+        std::cerr << "error: failed to open " << outFileName << " for writing\n";
         return EXIT_FAILURE;
     }
+    fwrite(header.data(), 1, header.size(), fout);
+
+    struct Block {
+        enum State {
+            EMPTY = 0,
+            READ,
+            COMPRESSED,
+        };
+        State state = EMPTY;
+        std::vector<char> data;
+        std::string output;
+    };
 
+    // Each thread costs two blocks in flight, plus what its codec uses
+    size_t threadMemory = 2 * blockSize + codecMemory;
+    size_t maxThreads = (PIPELINE_MAX_MEMORY - blockSize) / threadMemory;
+    numThreads = std::max<size_t>(std::min<size_t>(numThreads, maxThreads), 1);
+
+    // Enough blocks to keep all threads busy while one is being written
+    std::vector<Block> blocks(2 * numThreads + 1);
+
+    struct WrittenBlock {
+        uint64_t offset;
+        size_t size;
+        size_t uncompressedSize;
+    };
+
+    // Blocks written but not verified yet
+    std::deque<WrittenBlock> written;
+    bool writeDone = false;
+
+    os::mutex mutex;
+    os::condition_variable cond;
+    uint64_t nextRead = 0;
+    uint64_t nextCompress = 0;
+    uint64_t nextWrite = 0;
+    bool eof = false;
+    bool failed = false;
+    uint64_t inSize = 0;
     uLong inCrc = crc32(0L, Z_NULL, 0);
-    static const size_t kFileBufferSize = 1 << 16;
-    uint8_t *input = (uint8_t *)malloc(kFileBufferSize * 2);
-    uint8_t *output = input + kFileBufferSize;
-    size_t available_in = 0;
-    const uint8_t *next_in = nullptr;
-    size_t available_out = kFileBufferSize;
-    uint8_t *next_out = output;
-    bool is_eof = false;
-    do {
-        if (available_in == 0 && !is_eof) {
-            available_in = inFile->read(input, kFileBufferSize);
-            next_in = input;
-            if (available_in == 0) {
-                is_eof = true;
-            } else {
-                crc32(inCrc, reinterpret_cast<const Bytef *>(input), available_in);
+
+    // Index of the input, with block numbers as chunk offsets
+    trace::Index index;
+    bool indexed = false;
+
+    os::thread reader([&] () {
+        auto acquire = [&] () -> std::vector<char> * {
+            os::unique_lock<os::mutex> lock(mutex);
+            Block &block = blocks[nextRead % blocks.size()];
+            while (!failed && block.state != Block::EMPTY) {
+                cond.wait(lock);
             }
+            return failed ? nullptr : &block.data;
+        };
+        auto commit = [&] () {
+            Block &block = blocks[nextRead % blocks.size()];
+            size_t size = block.data.size();
+            inCrc = crc32(inCrc, reinterpret_cast<const Bytef *>(block.data.data()), uInt(size));
+            os::unique_lock<os::mutex> lock(mutex);
+            inSize += size;
+            block.state = Block::READ;
+            ++nextRead;
+            cond.notify_all();
+        };
+        BlockFile *file = new BlockFile(inFile, blockSize, acquire, commit);
+
+        if (indexOptions) {
+            // The parser reads the whole input through the file, and owns it
+            trace::Parser parser;
+            if (parser.openFile(file)) {
+                parser.scanIndex(index);
+                indexed = true;
+            }
+        } else {
+            file->close();
+            delete file;
         }
 
-        if (!BrotliEncoderCompressStream(s,
-                                         is_eof ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS,
-                                         &available_in, &next_in,
-                                         &available_out, &next_out, nullptr)) {
-            std::cerr << "error: failed to compress data\n";
-            return EXIT_FAILURE;
+        os::unique_lock<os::mutex> lock(mutex);
+        eof = true;
+        cond.notify_all();
+    });
+
+    std::vector<os::thread> compressors;
+    for (unsigned i = 0; i < numThreads; ++i) {
+        compressors.emplace_back([&] () {
+            std::unique_ptr<BlockCodec> compressor(factory());
+            os::unique_lock<os::mutex> lock(mutex);
+            while (true) {
+                while (!failed && !eof && nextCompress == nextRead) {
+                    cond.wait(lock);
+                }
+                if (failed || nextCompress == nextRead) {
+                    return;
+                }
+                Block &block = blocks[nextCompress % blocks.size()];
+                ++nextCompress;
+
+                lock.unlock();
+                bool ok = compressor->compress(block.data, block.output);
+                lock.lock();
+
+                if (!ok) {
+                    std::cerr << "error: failed to compress data\n";
+                    failed = true;
+                }
+                block.state = Block::COMPRESSED;
+                cond.notify_all();
+            }
+        });
+    }
+
+    uLong outCrc = crc32(0L, Z_NULL, 0);
+    os::thread verifier([&] () {
+        std::unique_ptr<BlockCodec> codec(factory());
+        std::ifstream stream(outFileName, std::ios::binary);
+        std::string output;
+        std::vector<char> block;
+        os::unique_lock<os::mutex> lock(mutex);
+        while (true) {
+            while (!failed && !writeDone && written.empty()) {
+                cond.wait(lock);
+            }
+            if (failed || written.empty()) {
+                return;
+            }
+            WrittenBlock entry = written.front();
+            written.pop_front();
+
+            lock.unlock();
+            output.resize(entry.size);
+            block.resize(entry.uncompressedSize);
+            stream.clear();
+            stream.seekg(entry.offset, std::ios::beg);
+            stream.read(&output[0], entry.size);
+            bool ok = !stream.fail() && codec->decompress(output, block);
+            if (ok) {
+                outCrc = crc32(outCrc, reinterpret_cast<const Bytef *>(block.data()), uInt(block.size()));
+            }
+            lock.lock();
+
+            if (!ok) {
+                std::cerr << "error: failed to decompress " << outFileName << " at offset " << entry.offset << "\n";
+                failed = true;
+                cond.notify_all();
+            }
         }
+    });
+
+    long long startTime = os::getTime();
+    long long lastReport = startTime;
+    uint64_t outSize = header.size();
+    // Output offset of every block
+    std::vector<uint64_t> blockOffsets;
+    {
+        os::unique_lock<os::mutex> lock(mutex);
+        while (!failed) {
+            Block &block = blocks[nextWrite % blocks.size()];
+            while (!failed && block.state != Block::COMPRESSED &&
+                   !(eof && nextWrite == nextRead)) {
+                cond.wait(lock);
+            }
+            if (failed || block.state != Block::COMPRESSED) {
+                break;
+            }
+
+            uint64_t readSize = inSize;
+            lock.unlock();
+            uint64_t offset = outSize;
+            blockOffsets.push_back(offset);
+            fwrite(block.output.data(), 1, block.output.size(), fout);
+            // Make it visible to the verifier
+            fflush(fout);
+            outSize += block.output.size();
+            long long now = os::getTime();
+            if (now - lastReport >= os::timeFrequency) {
+                reportProgress(readSize, outSize, startTime, false);
+                lastReport = now;
+            }
+            lock.lock();
 
-        if (available_out != kFileBufferSize) {
-            size_t out_size = kFileBufferSize - available_out;
-            fwrite(output, 1, out_size, fout);
             if (ferror(fout)) {
                 std::cerr << "error: failed to write to " << outFileName << "\n";
-                return EXIT_FAILURE;
+                failed = true;
+            }
+            written.push_back({offset, block.output.size(), block.data.size()});
+            block.state = Block::EMPTY;
+            ++nextWrite;
+            cond.notify_all();
+        }
+        writeDone = true;
+        cond.notify_all();
+    }
+
+    reader.join();
+    for (auto & compressor : compressors) {
+        compressor.join();
+    }
+    verifier.join();
+
+    if (!failed && indexOptions) {
+        if (indexed) {
+            auto mapOffset = [&] (trace::File::Offset &offset) {
+                // An empty trace has no block to point into
+                offset.chunk = offset.chunk < blockOffsets.size()
+                               ? blockOffsets[offset.chunk] : outSize;
+            };
+            for (auto & sig : index.sigs) {
+                mapOffset(sig.offset);
+            }
+            for (auto & frame : index.frames) {
+                mapOffset(frame.offset);
             }
-            available_out = kFileBufferSize;
-            next_out = output;
+            for (auto & call : index.calls) {
+                mapOffset(call.offset);
+            }
+            for (auto & blob : index.blobs) {
+                mapOffset(blob);
+            }
+
+            std::string data;
+            index.serialize(data);
+            std::unique_ptr<trace::ChunkCodec> codec(trace::createChunkCodec(*indexOptions));
+            std::string chunk;
+            trace::buildChunkedIndex(chunk, codec.get(), outSize, data.data(), data.size());
+            fwrite(chunk.data(), 1, chunk.size(), fout);
+        }
+        if (!indexed || ferror(fout)) {
+            std::cerr << "error: failed to write index to " << outFileName << "\n";
+            failed = true;
         }
-    } while(!BrotliEncoderIsFinished(s));
+    }
 
     fclose(fout);
 
-    BrotliEncoderDestroyInstance(s);
+    if (failed) {
+        return EXIT_FAILURE;
+    }
+
+    reportProgress(inSize, outSize, startTime, true);
+
+    if (inCrc != outCrc) {
+        std::cerr << "error: CRC mismatch reading " << outFileName << "\n";
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 
-    // Do a CRC check
-    std::unique_ptr<trace::File> outFileIn(trace::File::createBrotli());
-    if (!outFileIn->open(outFileName)) {
-        std::cerr << "error: failed to open " << outFileName << " for reading\n";
+/*
+ * Compress into a single Brotli stream, which all versions can read, and
+ * verify it alongside by decompressing each piece of output as it is written.
+ */
+static int
+repack_brotli_stream(trace::File *inFile, const char *outFileName, int quality)
+{
+    FILE *fout = fopen(outFileName, "wb");
+    if (!fout) {
+        std::cerr << "error: failed to open " << outFileName << " for writing\n";
         return EXIT_FAILURE;
     }
+
+    BrotliEncoderState *encoder = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    BrotliDecoderState *decoder = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+    BrotliEncoderSetParameter(encoder, BROTLI_PARAM_QUALITY, quality);
+    // The larger the window, the higher the compression ratio and
+    // decompression speeds, so choose the maximum.
+    BrotliEncoderSetParameter(encoder, BROTLI_PARAM_LGWIN, 24);
+
+    static const size_t kBufferSize = 1 << 16;
+    std::vector<uint8_t> input(kBufferSize);
+    std::vector<uint8_t> output(kBufferSize);
+    std::vector<uint8_t> decoded(kBufferSize);
+
+    uLong inCrc = crc32(0L, Z_NULL, 0);
     uLong outCrc = crc32(0L, Z_NULL, 0);
+    uint64_t inSize = 0;
+    uint64_t outSize = 0;
+    long long startTime = os::getTime();
+    long long lastReport = startTime;
+
+    size_t availableIn = 0;
+    const uint8_t *nextIn = nullptr;
+    bool eof = false;
+    bool ok = true;
     do {
-        available_in = inFile->read(input, kFileBufferSize);
-        crc32(inCrc, reinterpret_cast<const Bytef *>(input), available_in);
-    } while (available_in > 0);
+        if (availableIn == 0 && !eof) {
+            availableIn = inFile->read(input.data(), input.size());
+            nextIn = input.data();
+            if (availableIn == 0) {
+                eof = true;
+            } else {
+                inCrc = crc32(inCrc, input.data(), uInt(availableIn));
+                inSize += availableIn;
+            }
+        }
+
+        size_t availableOut = output.size();
+        uint8_t *nextOut = output.data();
+        if (!BrotliEncoderCompressStream(encoder,
+                                         eof ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS,
+                                         &availableIn, &nextIn,
+                                         &availableOut, &nextOut, nullptr)) {
+            std::cerr << "error: failed to compress data\n";
+            ok = false;
+            break;
+        }
+
+        size_t size = nextOut - output.data();
+        if (!size) {
+            continue;
+        }
+
+        fwrite(output.data(), 1, size, fout);
+        if (ferror(fout)) {
+            std::cerr << "error: failed to write to " << outFileName << "\n";
+            ok = false;
+            break;
+        }
+
+        // Decode what was just written
+        size_t availableDecodeIn = size;
+        const uint8_t *nextDecodeIn = output.data();
+        BrotliDecoderResult result;
+        do {
+            size_t availableDecoded = decoded.size();
+            uint8_t *nextDecoded = decoded.data();
+            result = BrotliDecoderDecompressStream(decoder,
+                                                   &availableDecodeIn, &nextDecodeIn,
+                                                   &availableDecoded, &nextDecoded, nullptr);
+            outCrc = crc32(outCrc, decoded.data(), uInt(nextDecoded - decoded.data()));
+        } while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT);
+        if (result == BROTLI_DECODER_RESULT_ERROR) {
+            std::cerr << "error: failed to decompress " << outFileName << " at offset " << outSize << "\n";
+            ok = false;
+            break;
+        }
+
+        outSize += size;
+        long long now = os::getTime();
+        if (now - lastReport >= os::timeFrequency) {
+            reportProgress(inSize, outSize, startTime, false);
+            lastReport = now;
+        }
+    } while (!BrotliEncoderIsFinished(encoder));
+
+    BrotliDecoderDestroyInstance(decoder);
+    BrotliEncoderDestroyInstance(encoder);
+    fclose(fout);
+
+    if (!ok) {
+        return EXIT_FAILURE;
+    }
+
+    reportProgress(inSize, outSize, startTime, true);
+
     if (inCrc != outCrc) {
         std::cerr << "error: CRC mismatch reading " << outFileName << "\n";
         return EXIT_FAILURE;
     }
 
-    free(input);
-
     return EXIT_SUCCESS;
 }
 
+
+/*
+ * Zero threads means the default, a single stream.
+ */
 static int
-repack(const char *inFileName, const char *outFileName, Format format, int quality)
+repack_brotli(trace::File *inFile, const char *outFileName, int quality,
+              unsigned numThreads)
+{
+    // Brotli default quality is 11.  There used to be problems using quality
+    // higher than 9:
+    //
+    // - Some traces cause compression to be extremely slow.  Possibly the same
+    //   issue as https://github.com/google/brotli/issues/330
+    // - Some traces get lower compression ratio with 11 than 9.  Possibly the
+    //   same issue as https://github.com/google/brotli/issues/222
+    //
+    // but not any more.
+    if (!numThreads) {
+        return repack_brotli_stream(inFile, outFileName, quality);
+    }
+
+    auto factory = [quality] () -> BlockCodec * {
+        return new BrotliBlockCodec(quality);
+    };
+    size_t codecMemory = quality >= 10 ? BROTLI_ENCODER_MEMORY_FACTOR * BROTLI_BLOCK_SIZE
+                                       : BROTLI_BLOCK_SIZE;
+    return repack_pipeline(inFile, outFileName, std::string(),
+                           BROTLI_BLOCK_SIZE, factory, codecMemory, numThreads);
+}
+
+#ifdef HAVE_ZSTD
+
+/*
+ * Train a Zstandard dictionary on samples evenly picked from the whole trace.
+ */
+static bool
+train_dictionary(const char *inFileName, std::string &dictionary)
+{
+    std::unique_ptr<trace::File> inFile(trace::File::createForRead(inFileName));
+    if (!inFile) {
+        return false;
+    }
+
+    // Reservoir sampling, with a fixed seed for reproducible dictionaries
+    std::vector<char> samples(DICTIONARY_MAX_SAMPLES * DICTIONARY_SAMPLE_SIZE);
+    std::vector<size_t> sampleSizes;
+    std::minstd_rand random;
+    std::vector<char> buffer(DICTIONARY_SAMPLE_SIZE);
+    size_t read;
+    for (size_t count = 0;
+         (read = inFile->read(buffer.data(), buffer.size())) != 0;
+         ++count) {
+        size_t i;
+        if (count < DICTIONARY_MAX_SAMPLES) {
+            i = count;
+            sampleSizes.push_back(0);
+        } else {
+            i = std::uniform_int_distribution<size_t>(0, count)(random);
+            if (i >= DICTIONARY_MAX_SAMPLES) {
+                continue;
+            }
+        }
+        memcpy(&samples[i * DICTIONARY_SAMPLE_SIZE], buffer.data(), read);
+        sampleSizes[i] = read;
+    }
+
+    // Samples must be contiguous, and only the last one can be short
+    size_t samplesSize = 0;
+    for (size_t i = 0; i < sampleSizes.size(); ++i) {
+        memmove(&samples[samplesSize], &samples[i * DICTIONARY_SAMPLE_SIZE], sampleSizes[i]);
+        samplesSize += sampleSizes[i];
+    }
+
+    dictionary.resize(DICTIONARY_SIZE);
+    size_t size = ZDICT_trainFromBuffer(&dictionary[0], dictionary.size(),
+                                        samples.data(), sampleSizes.data(),
+                                        unsigned(sampleSizes.size()));
+    if (ZDICT_isError(size)) {
+        std::cerr << "error: failed to train dictionary: " << ZDICT_getErrorName(size) << "\n";
+        return false;
+    }
+    dictionary.resize(size);
+
+    return true;
+}
+
+#endif /* HAVE_ZSTD */
+
+
+static int
+repack(const char *inFileName, const char *outFileName, Format format, int quality,
+       const std::string &dictionary, unsigned numThreads)
 {
     int ret = EXIT_FAILURE;
 
@@ -195,19 +946,41 @@ repack(const char *inFileName, const char *outFileName, Format format, int quali
         return 1;
     }
 
-    trace::OutStream *outFile = nullptr;
-    if (format == FORMAT_SNAPPY) {
-        outFile = trace::createSnappyStream(outFileName);
-    } else if (format == FORMAT_BROTLI) {
-        ret = repack_brotli(inFile, outFileName, quality);
-        delete inFile;
-        return ret;
-    } else if (format == FORMAT_ZLIB) {
-        outFile = trace::createZLibStream(outFileName);
+    // Brotli defaults to a single stream instead
+    if (!numThreads && format != FORMAT_BROTLI) {
+        numThreads = std::max(os::thread::hardware_concurrency(), 1U);
     }
-    if (outFile) {
-        ret = repack_generic(inFile, outFile);
-        delete outFile;
+
+    if (format == FORMAT_BROTLI) {
+        ret = repack_brotli(inFile, outFileName, quality, numThreads);
+    } else if (format == FORMAT_ZLIB) {
+        auto factory = [] () -> BlockCodec * {
+            return new ZLibBlockCodec;
+        };
+        ret = repack_pipeline(inFile, outFileName, std::string(),
+                              ZLIB_BLOCK_SIZE, factory, ZLIB_BLOCK_SIZE,
+                              numThreads);
+    } else {
+        trace::CodecOptions options;
+        if (format == FORMAT_LZ4) {
+            options.codec = trace::CODEC_LZ4;
+        } else if (format == FORMAT_ZSTD) {
+            options.codec = trace::CODEC_ZSTD;
+        }
+        options.level = format == FORMAT_SNAPPY ? 0 : quality;
+        options.dictionary = dictionary;
+
+        // Fail early if the codec isn't supported
+        if (std::unique_ptr<trace::ChunkCodec>(trace::createChunkCodec(options))) {
+            std::string header;
+            trace::writeChunkedHeader(header, options);
+            auto factory = [&options] () -> BlockCodec * {
+                return new ChunkedBlockCodec(options);
+            };
+            ret = repack_pipeline(inFile, outFileName, header,
+                                  SNAPPY_CHUNK_SIZE, factory, SNAPPY_CHUNK_SIZE,
+                                  numThreads, &options);
+        }
     }
 
     delete inFile;
@@ -221,6 +994,10 @@ command(int argc, char *argv[])
     Format format = FORMAT_SNAPPY;
     int opt;
     int quality = BROTLI_DEFAULT_QUALITY;
+    const char *dictionaryFileName = nullptr;
+    const char *trainDictionaryFileName = nullptr;
+    // Zero until given, as it changes the layout of Brotli traces
+    unsigned numThreads = 0;
     while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
         switch (opt) {
         case 'h':
@@ -239,6 +1016,27 @@ command(int argc, char *argv[])
         case 'z':
             format = FORMAT_ZLIB;
             break;
+        case '4':
+            format = FORMAT_LZ4;
+            quality = optarg ? atoi(optarg) : 0;
+            break;
+        case 'Z':
+            format = FORMAT_ZSTD;
+            quality = optarg ? atoi(optarg) : 0;
+            break;
+        case 'D':
+            dictionaryFileName = optarg;
+            break;
+        case TRAIN_DICTIONARY_OPT:
+            trainDictionaryFileName = optarg;
+            break;
+        case 'j':
+            if (atoi(optarg) < 1) {
+                std::cerr << "error: invalid number of threads " << optarg << "\n";
+                return 1;
+            }
+            numThreads = atoi(optarg);
+            break;
         default:
             std::cerr << "error: unexpected option `" << (char)opt << "`\n";
             usage();
@@ -252,7 +1050,39 @@ command(int argc, char *argv[])
         return 1;
     }
 
-    return repack(argv[optind], argv[optind + 1], format, quality);
+    std::string dictionary;
+    if (dictionaryFileName || trainDictionaryFileName) {
+        if (format != FORMAT_ZSTD) {
+            std::cerr << "error: dictionaries require Zstandard compression\n";
+            return 1;
+        }
+    }
+    if (dictionaryFileName) {
+        std::ifstream stream(dictionaryFileName, std::ios::binary);
+        if (!stream) {
+            std::cerr << "error: failed to read " << dictionaryFileName << "\n";
+            return 1;
+        }
+        dictionary.assign(std::istreambuf_iterator<char>(stream),
+                          std::istreambuf_iterator<char>());
+    } else if (trainDictionaryFileName) {
+#ifdef HAVE_ZSTD
+        if (!train_dictionary(argv[optind], dictionary)) {
+            return 1;
+        }
+        std::ofstream stream(trainDictionaryFileName, std::ios::binary);
+        stream.write(dictionary.data(), dictionary.size());
+        if (!stream) {
+            std::cerr << "error: failed to write " << trainDictionaryFileName << "\n";
+            return 1;
+        }
+#else
+        std::cerr << "error: zstd compression is not supported by this build\n";
+        return 1;
+#endif
+    }
+
+    return repack(argv[optind], argv[optind + 1], format, quality, dictionary, numThreads);
 }
 
 const Command repack_command = {
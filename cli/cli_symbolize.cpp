@@ -0,0 +1,511 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <limits.h> // for CHAR_MAX
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <elf.h>
+#endif
+
+#include "cli.hpp"
+
+#include "os_string.hpp"
+
+#include "trace_format.hpp"
+#include "trace_parser.hpp"
+#include "trace_writer.hpp"
+
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+
+/*
+ * Number of addresses passed to each addr2line invocation.
+ */
+#define ADDRESSES_PER_BATCH 256
+
+
+static const char *synopsis = "Resolve the symbols of backtraces captured raw.";
+
+
+static void
+usage(void)
+{
+    std::cout
+        << "usage: apitrace symbolize [OPTIONS] TRACE_FILE\n"
+        << synopsis << "\n"
+        "\n"
+        "    -h, --help               Show detailed help for symbolize options and exit\n"
+        "    -o, --output=TRACE_FILE  Output trace file\n"
+        "    --addr2line=PROGRAM      Program used to resolve addresses [addr2line]\n"
+        "\n"
+        "Backtraces captured with APITRACE_BACKTRACE_RAW set only hold module\n"
+        "offsets, which are resolved against the modules found at the same paths.\n"
+        "Modules whose build ID differs from the one recorded in the trace are\n"
+        "skipped, as their offsets would resolve to the wrong symbols.\n"
+    ;
+}
+
+
+enum {
+    ADDR2LINE_OPT = CHAR_MAX + 1,
+};
+
+const static char *
+shortOptions = "ho:";
+
+const static struct option
+longOptions[] = {
+    {"help", no_argument, 0, 'h'},
+    {"output", required_argument, 0, 'o'},
+    {"addr2line", required_argument, 0, ADDR2LINE_OPT},
+    {0, 0, 0, 0}
+};
+
+
+struct Symbol {
+    std::string function;
+    std::string filename;
+    int linenumber = -1;
+};
+
+typedef std::map<long long, Symbol> ModuleSymbols;
+typedef std::map<std::string, ModuleSymbols> Symbols;
+
+// Offsets of the raw frames, and build IDs, by module
+typedef std::map<std::string, std::set<long long> > ModuleOffsets;
+typedef std::map<std::string, std::string> ModuleBuildIds;
+
+
+static inline bool
+isRaw(const trace::StackFrame *frame)
+{
+    return frame->module &&
+           !frame->function &&
+           !frame->filename &&
+           frame->offset >= 0;
+}
+
+
+static char *
+copyString(const std::string &str)
+{
+    char *copy = new char [str.length() + 1];
+    memcpy(copy, str.c_str(), str.length() + 1);
+    return copy;
+}
+
+
+static std::string
+quote(const std::string &str)
+{
+#ifdef _WIN32
+    return "\"" + str + "\"";
+#else
+    std::string quoted = "'";
+    for (char c : str) {
+        if (c == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "'";
+#endif
+}
+
+
+static bool
+readLine(FILE *fp, std::string &line)
+{
+    line.clear();
+    int c;
+    while ((c = fgetc(fp)) != EOF && c != '\n') {
+        line += char(c);
+    }
+    return c != EOF || !line.empty();
+}
+
+
+/**
+ * Resolve a batch of offsets within a module, with addr2line, which prints
+ * the function and the location of each, on separate lines.
+ */
+static bool
+resolveBatch(const std::string &addr2line,
+             const std::string &module,
+             const std::vector<long long> &offsets,
+             ModuleSymbols &symbols)
+{
+    std::string command = quote(addr2line) + " -C -f -e " + quote(module);
+    for (long long offset : offsets) {
+        char address[32];
+        snprintf(address, sizeof address, " 0x%llx", offset);
+        command += address;
+    }
+
+    FILE *fp = popen(command.c_str(), "r");
+    if (!fp) {
+        return false;
+    }
+
+    std::string function;
+    std::string location;
+    for (long long offset : offsets) {
+        if (!readLine(fp, function) ||
+            !readLine(fp, location)) {
+            break;
+        }
+
+        Symbol &symbol = symbols[offset];
+        if (function != "??") {
+            symbol.function = function;
+        }
+        size_t colon = location.rfind(':');
+        if (colon != std::string::npos &&
+            location.compare(0, colon, "??") != 0) {
+            symbol.filename = location.substr(0, colon);
+            const char *line = location.c_str() + colon + 1;
+            if (*line >= '0' && *line <= '9') {
+                int linenumber = atoi(line);
+                if (linenumber > 0) {
+                    symbol.linenumber = linenumber;
+                }
+            }
+        }
+    }
+
+    return pclose(fp) == 0;
+}
+
+
+#ifdef __linux__
+
+template <typename Ehdr, typename Phdr, typename Nhdr>
+static bool
+readElfBuildId(std::ifstream &stream, std::string &buildId)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    Ehdr ehdr;
+    stream.seekg(0);
+    if (!stream.read(reinterpret_cast<char *>(&ehdr), sizeof ehdr)) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < ehdr.e_phnum; ++i) {
+        Phdr phdr;
+        stream.seekg(ehdr.e_phoff + i * ehdr.e_phentsize);
+        if (!stream.read(reinterpret_cast<char *>(&phdr), sizeof phdr)) {
+            return false;
+        }
+        if (phdr.p_type != PT_NOTE) {
+            continue;
+        }
+
+        std::vector<char> notes(phdr.p_filesz);
+        stream.seekg(phdr.p_offset);
+        if (!stream.read(notes.data(), notes.size())) {
+            return false;
+        }
+
+        size_t align = phdr.p_align == 8 ? 8 : 4;
+        size_t offset = 0;
+        while (offset + sizeof(Nhdr) <= notes.size()) {
+            Nhdr nhdr;
+            memcpy(&nhdr, &notes[offset], sizeof nhdr);
+            size_t name = offset + sizeof nhdr;
+            size_t desc = name + ((nhdr.n_namesz + align - 1) & ~(align - 1));
+            offset = desc + ((nhdr.n_descsz + align - 1) & ~(align - 1));
+            if (offset > notes.size()) {
+                break;
+            }
+            if (nhdr.n_type == NT_GNU_BUILD_ID &&
+                nhdr.n_namesz == 4 && memcmp(&notes[name], "GNU", 4) == 0) {
+                buildId.clear();
+                for (size_t j = 0; j < nhdr.n_descsz; ++j) {
+                    unsigned char c = notes[desc + j];
+                    buildId += hex[c >> 4];
+                    buildId += hex[c & 0xf];
+                }
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+#endif /* __linux__ */
+
+
+/**
+ * Read the build ID of a module, as hex, from its NT_GNU_BUILD_ID note.
+ */
+static bool
+readBuildId(const std::string &module, std::string &buildId)
+{
+#ifdef __linux__
+    std::ifstream stream(module, std::ios::binary);
+    unsigned char ident[EI_NIDENT];
+    if (!stream.read(reinterpret_cast<char *>(ident), sizeof ident) ||
+        memcmp(ident, ELFMAG, SELFMAG) != 0) {
+        return false;
+    }
+    if (ident[EI_CLASS] == ELFCLASS64) {
+        return readElfBuildId<Elf64_Ehdr, Elf64_Phdr, Elf64_Nhdr>(stream, buildId);
+    }
+    if (ident[EI_CLASS] == ELFCLASS32) {
+        return readElfBuildId<Elf32_Ehdr, Elf32_Phdr, Elf32_Nhdr>(stream, buildId);
+    }
+#endif
+    return false;
+}
+
+
+/**
+ * Gather the offsets of raw frames, grouped by module, and the build IDs of
+ * the modules.
+ */
+static bool
+collectOffsets(const char *inFileName,
+               ModuleOffsets &offsets,
+               ModuleBuildIds &buildIds)
+{
+    trace::Parser p;
+    if (!p.open(inFileName)) {
+        std::cerr << "error: failed to open " << inFileName << "\n";
+        return false;
+    }
+
+    std::vector<bool> seen;
+    trace::Call *call;
+    while ((call = p.parse_call())) {
+        if (call->backtrace) {
+            for (auto frame : *call->backtrace) {
+                if (frame->id >= seen.size()) {
+                    seen.resize(frame->id + 1);
+                }
+                if (!seen[frame->id]) {
+                    seen[frame->id] = true;
+                    if (isRaw(frame)) {
+                        offsets[frame->module].insert(frame->offset);
+                    }
+                    if (frame->module && frame->buildId) {
+                        buildIds[frame->module] = frame->buildId;
+                    }
+                }
+            }
+        }
+        delete call;
+    }
+
+    return true;
+}
+
+
+static int
+symbolize_trace(const char *inFileName,
+                std::string &outFileName,
+                const std::string &addr2line)
+{
+    ModuleOffsets offsets;
+    ModuleBuildIds buildIds;
+    if (!collectOffsets(inFileName, offsets, buildIds)) {
+        return 1;
+    }
+
+    Symbols symbols;
+    for (auto & kv : offsets) {
+        const std::string &module = kv.first;
+
+        auto recorded = buildIds.find(module);
+        if (recorded != buildIds.end()) {
+            std::string buildId;
+            if (!readBuildId(module, buildId)) {
+                std::cerr << "warning: skipping " << module << ", as its build ID can't be read\n";
+                continue;
+            }
+            if (buildId != recorded->second) {
+                std::cerr << "warning: skipping " << module << ", as its build ID " << buildId
+                          << " doesn't match the traced " << recorded->second << "\n";
+                continue;
+            }
+        }
+
+        std::vector<long long> batch;
+        for (long long offset : kv.second) {
+            batch.push_back(offset);
+            if (batch.size() == ADDRESSES_PER_BATCH) {
+                if (!resolveBatch(addr2line, module, batch, symbols[module])) {
+                    break;
+                }
+                batch.clear();
+            }
+        }
+        if (!batch.empty()) {
+            resolveBatch(addr2line, module, batch, symbols[module]);
+        }
+        if (symbols[module].empty()) {
+            std::cerr << "warning: failed to resolve symbols of " << module << "\n";
+        }
+    }
+
+    trace::Parser p;
+    if (!p.open(inFileName)) {
+        std::cerr << "error: failed to open " << inFileName << "\n";
+        return 1;
+    }
+
+    if (outFileName.empty()) {
+        os::String base(inFileName);
+        base.trimExtension();
+
+        outFileName = std::string(base.str()) + std::string("-symbolized.trace");
+    }
+
+    trace::Writer writer;
+    // Keep the build IDs of the frames left raw
+    writer.setModuleBuildIds(p.getVersion() >= TRACE_VERSION_BUILD_ID);
+    if (!writer.open(outFileName.c_str(), p.getVersion(), p.getProperties())) {
+        std::cerr << "error: failed to create " << outFileName << "\n";
+        return 1;
+    }
+
+    // Frames are shared among calls, so they only need patching once
+    std::vector<bool> patched;
+    unsigned numResolved = 0;
+
+    trace::Call *call;
+    while ((call = p.parse_call())) {
+        if (call->backtrace) {
+            for (auto frame : *call->backtrace) {
+                if (frame->id >= patched.size()) {
+                    patched.resize(frame->id + 1);
+                }
+                if (patched[frame->id] || !isRaw(frame)) {
+                    continue;
+                }
+                patched[frame->id] = true;
+
+                auto module = symbols.find(frame->module);
+                if (module == symbols.end()) {
+                    continue;
+                }
+                auto it = module->second.find(frame->offset);
+                if (it == module->second.end()) {
+                    continue;
+                }
+
+                const Symbol &symbol = it->second;
+                if (!symbol.function.empty()) {
+                    frame->function = copyString(symbol.function);
+                    // Offsets are relative to the function when known
+                    frame->offset = -1;
+                    ++numResolved;
+                }
+                if (!symbol.filename.empty()) {
+                    frame->filename = copyString(symbol.filename);
+                    frame->linenumber = symbol.linenumber;
+                }
+            }
+        }
+
+        writer.writeCall(call);
+
+        delete call;
+    }
+
+    std::cerr << "Resolved " << numResolved << " stack frames\n";
+    std::cerr << "Symbolized trace is available as " << outFileName << "\n";
+
+    return 0;
+}
+
+
+static int
+command(int argc, char *argv[])
+{
+    std::string outFileName;
+    std::string addr2line = "addr2line";
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, shortOptions, longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'h':
+            usage();
+            return 0;
+        case 'o':
+            outFileName = optarg;
+            break;
+        case ADDR2LINE_OPT:
+            addr2line = optarg;
+            break;
+        default:
+            std::cerr << "error: unexpected option `" << (char)opt << "`\n";
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind >= argc) {
+        std::cerr << "error: apitrace symbolize requires a trace file as an argument.\n";
+        usage();
+        return 1;
+    }
+
+    if (argc > optind + 1) {
+        std::cerr << "error: extraneous arguments:";
+        for (int i = optind + 1; i < argc; i++) {
+            std::cerr << " " << argv[i];
+        }
+        std::cerr << "\n";
+        usage();
+        return 1;
+    }
+
+    return symbolize_trace(argv[optind], outFileName, addr2line);
+}
+
+
+const Command symbolize_command = {
+    "symbolize",
+    synopsis,
+    usage,
+    command
+};
@@ -0,0 +1,13 @@
+# Find LZ4 - Extremely fast compression
+#
+# This module defines
+#  LZ4_FOUND - whether the lz4 library was found
+#  LZ4_LIBRARIES - the lz4 library
+#  LZ4_INCLUDE_DIR - the include path of the lz4 library
+#
+
+find_path (LZ4_INCLUDE_DIR NAMES lz4.h lz4hc.h)
+find_library (LZ4_LIBRARIES NAMES lz4)
+
+include (FindPackageHandleStandardArgs)
+find_package_handle_standard_args (LZ4 DEFAULT_MSG LZ4_LIBRARIES LZ4_INCLUDE_DIR)
@@ -0,0 +1,13 @@
+# Find ZSTD - Zstandard fast real-time compression
+#
+# This module defines
+#  ZSTD_FOUND - whether the zstd library was found
+#  ZSTD_LIBRARIES - the zstd library
+#  ZSTD_INCLUDE_DIR - the include path of the zstd library
+#
+
+find_path (ZSTD_INCLUDE_DIR NAMES zstd.h zdict.h)
+find_library (ZSTD_LIBRARIES NAMES zstd)
+
+include (FindPackageHandleStandardArgs)
+find_package_handle_standard_args (ZSTD DEFAULT_MSG ZSTD_LIBRARIES ZSTD_INCLUDE_DIR)
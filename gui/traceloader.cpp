@@ -66,7 +66,11 @@ void TraceLoader::loadTrace(const QString &filename)
 
     emit startedParsing();
 
-    scanTrace();
+    if (m_parser.hasIndex()) {
+        scanIndex();
+    } else {
+        scanTrace();
+    }
 
     emit guessedApi(static_cast<int>(m_parser.api));
     emit finishedParsing();
@@ -171,6 +175,47 @@ void TraceLoader::scanTrace()
     emit framesLoaded(frames);
 }
 
+/*
+ * Build the frame list straight from the trace index, without scanning the
+ * whole trace.
+ */
+void TraceLoader::scanIndex()
+{
+    QList<ApiTraceFrame*> frames;
+    const trace::Index &index = m_parser.getIndex();
+
+    for (size_t i = 0; i < index.frames.size(); ++i) {
+        const trace::IndexCall &start = index.frames[i];
+        trace::CallNo end = i + 1 < index.frames.size()
+            ? index.frames[i + 1].no : index.numCalls;
+        int numOfCalls = end - start.no;
+
+        FrameBookmark frameBookmark;
+        frameBookmark.start.offset = start.offset;
+        frameBookmark.start.next_call_no = start.no;
+        frameBookmark.numberOfCalls = numOfCalls;
+
+        ApiTraceFrame *currentFrame = new ApiTraceFrame();
+        currentFrame->number = i;
+        currentFrame->setNumChildren(numOfCalls);
+        currentFrame->setLastCallIndex(end - 1);
+        frames.append(currentFrame);
+
+        m_createdFrames.append(currentFrame);
+        m_frameBookmarks[i] = frameBookmark;
+    }
+
+    // Seeking loads the signatures defined until then, which is also what
+    // determines the API.
+    if (!m_frameBookmarks.isEmpty()) {
+        m_parser.setBookmark(m_frameBookmarks.last().start);
+    }
+
+    emit parsed(100);
+
+    emit framesLoaded(frames);
+}
+
 
 ApiTraceCallSignature * TraceLoader::signature(unsigned id)
 {
@@ -93,6 +93,7 @@ private:
     void loadHelpFile();
     void guessApi(const trace::Call *call);
     void scanTrace();
+    void scanIndex();
 
     void searchNext(const ApiTrace::SearchRequest &request);
     void searchPrev(const ApiTrace::SearchRequest &request);
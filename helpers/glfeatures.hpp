@@ -158,6 +158,8 @@ struct Features
 
     unsigned texture_3d:1;
     unsigned pixel_buffer_object:1;
+    unsigned map_buffer_range:1;
+    unsigned sync:1;
     unsigned read_buffer:1;
     unsigned framebuffer_object:1;
     unsigned read_framebuffer_object:1;
@@ -0,0 +1,266 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include "glindices.hpp"
+
+#include <stdint.h>
+
+#include "os.hpp"
+#include "os_cpu.hpp"
+
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#  define HAVE_X86_SIMD
+#  include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#  define HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
+
+/*
+ * Scalar version, used for the elements which don't fill a whole vector.
+ */
+template< class T >
+static inline GLuint
+maxIndexScalar(const T *p, size_t count, bool restart, GLuint restartIndex, GLuint maxIndex = 0)
+{
+    for (size_t i = 0; i < count; ++i) {
+        GLuint index = p[i];
+        if (restart && index == restartIndex) {
+            continue;
+        }
+        if (index > maxIndex) {
+            maxIndex = index;
+        }
+    }
+    return maxIndex;
+}
+
+
+/*
+ * Vector versions.  Restart indices are zeroed before taking the maximum, so
+ * they never win.  Restart indices which the type can't represent match no
+ * element, so there's nothing to mask then.
+ */
+
+#ifdef HAVE_X86_SIMD
+
+OS_TARGET_SSE41 static inline __m128i sse41_set1(uint8_t x)  { return _mm_set1_epi8((char)x); }
+OS_TARGET_SSE41 static inline __m128i sse41_set1(uint16_t x) { return _mm_set1_epi16((short)x); }
+OS_TARGET_SSE41 static inline __m128i sse41_set1(uint32_t x) { return _mm_set1_epi32((int)x); }
+
+OS_TARGET_SSE41 static inline __m128i sse41_cmpeq(__m128i a, __m128i b, uint8_t)  { return _mm_cmpeq_epi8(a, b); }
+OS_TARGET_SSE41 static inline __m128i sse41_cmpeq(__m128i a, __m128i b, uint16_t) { return _mm_cmpeq_epi16(a, b); }
+OS_TARGET_SSE41 static inline __m128i sse41_cmpeq(__m128i a, __m128i b, uint32_t) { return _mm_cmpeq_epi32(a, b); }
+
+OS_TARGET_SSE41 static inline __m128i sse41_max(__m128i a, __m128i b, uint8_t)  { return _mm_max_epu8(a, b); }
+OS_TARGET_SSE41 static inline __m128i sse41_max(__m128i a, __m128i b, uint16_t) { return _mm_max_epu16(a, b); }
+OS_TARGET_SSE41 static inline __m128i sse41_max(__m128i a, __m128i b, uint32_t) { return _mm_max_epu32(a, b); }
+
+template< class T >
+OS_TARGET_SSE41 static GLuint
+maxIndexSse41(const T *p, size_t count, bool restart, GLuint restartIndex)
+{
+    const size_t lanes = sizeof(__m128i) / sizeof(T);
+    const bool mask = restart && restartIndex <= T(~T(0));
+    const __m128i restartVec = sse41_set1(T(restartIndex));
+
+    __m128i maxVec0 = _mm_setzero_si128();
+    __m128i maxVec1 = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 * lanes <= count; i += 2 * lanes) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i + lanes));
+        if (mask) {
+            v0 = _mm_andnot_si128(sse41_cmpeq(v0, restartVec, T()), v0);
+            v1 = _mm_andnot_si128(sse41_cmpeq(v1, restartVec, T()), v1);
+        }
+        maxVec0 = sse41_max(maxVec0, v0, T());
+        maxVec1 = sse41_max(maxVec1, v1, T());
+    }
+    maxVec0 = sse41_max(maxVec0, maxVec1, T());
+
+    T maxLanes[lanes];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(maxLanes), maxVec0);
+    GLuint maxIndex = maxIndexScalar(maxLanes, lanes, false, 0);
+
+    return maxIndexScalar(p + i, count - i, restart, restartIndex, maxIndex);
+}
+
+OS_TARGET_AVX2 static inline __m256i avx2_set1(uint8_t x)  { return _mm256_set1_epi8((char)x); }
+OS_TARGET_AVX2 static inline __m256i avx2_set1(uint16_t x) { return _mm256_set1_epi16((short)x); }
+OS_TARGET_AVX2 static inline __m256i avx2_set1(uint32_t x) { return _mm256_set1_epi32((int)x); }
+
+OS_TARGET_AVX2 static inline __m256i avx2_cmpeq(__m256i a, __m256i b, uint8_t)  { return _mm256_cmpeq_epi8(a, b); }
+OS_TARGET_AVX2 static inline __m256i avx2_cmpeq(__m256i a, __m256i b, uint16_t) { return _mm256_cmpeq_epi16(a, b); }
+OS_TARGET_AVX2 static inline __m256i avx2_cmpeq(__m256i a, __m256i b, uint32_t) { return _mm256_cmpeq_epi32(a, b); }
+
+OS_TARGET_AVX2 static inline __m256i avx2_max(__m256i a, __m256i b, uint8_t)  { return _mm256_max_epu8(a, b); }
+OS_TARGET_AVX2 static inline __m256i avx2_max(__m256i a, __m256i b, uint16_t) { return _mm256_max_epu16(a, b); }
+OS_TARGET_AVX2 static inline __m256i avx2_max(__m256i a, __m256i b, uint32_t) { return _mm256_max_epu32(a, b); }
+
+template< class T >
+OS_TARGET_AVX2 static GLuint
+maxIndexAvx2(const T *p, size_t count, bool restart, GLuint restartIndex)
+{
+    const size_t lanes = sizeof(__m256i) / sizeof(T);
+    const bool mask = restart && restartIndex <= T(~T(0));
+    const __m256i restartVec = avx2_set1(T(restartIndex));
+
+    __m256i maxVec0 = _mm256_setzero_si256();
+    __m256i maxVec1 = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 2 * lanes <= count; i += 2 * lanes) {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i + lanes));
+        if (mask) {
+            v0 = _mm256_andnot_si256(avx2_cmpeq(v0, restartVec, T()), v0);
+            v1 = _mm256_andnot_si256(avx2_cmpeq(v1, restartVec, T()), v1);
+        }
+        maxVec0 = avx2_max(maxVec0, v0, T());
+        maxVec1 = avx2_max(maxVec1, v1, T());
+    }
+    maxVec0 = avx2_max(maxVec0, maxVec1, T());
+
+    T maxLanes[lanes];
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(maxLanes), maxVec0);
+    GLuint maxIndex = maxIndexScalar(maxLanes, lanes, false, 0);
+
+    return maxIndexScalar(p + i, count - i, restart, restartIndex, maxIndex);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+#ifdef HAVE_NEON
+
+template< class T >
+struct NeonOps;
+
+template<>
+struct NeonOps<uint8_t> {
+    typedef uint8x16_t V;
+    static inline V load(const uint8_t *p) { return vld1q_u8(p); }
+    static inline void store(uint8_t *p, V v) { vst1q_u8(p, v); }
+    static inline V dup(uint8_t x) { return vdupq_n_u8(x); }
+    static inline V zero(void) { return vdupq_n_u8(0); }
+    static inline V mask(V v, V r) { return vbicq_u8(v, vceqq_u8(v, r)); }
+    static inline V max(V a, V b) { return vmaxq_u8(a, b); }
+};
+
+template<>
+struct NeonOps<uint16_t> {
+    typedef uint16x8_t V;
+    static inline V load(const uint16_t *p) { return vld1q_u16(p); }
+    static inline void store(uint16_t *p, V v) { vst1q_u16(p, v); }
+    static inline V dup(uint16_t x) { return vdupq_n_u16(x); }
+    static inline V zero(void) { return vdupq_n_u16(0); }
+    static inline V mask(V v, V r) { return vbicq_u16(v, vceqq_u16(v, r)); }
+    static inline V max(V a, V b) { return vmaxq_u16(a, b); }
+};
+
+template<>
+struct NeonOps<uint32_t> {
+    typedef uint32x4_t V;
+    static inline V load(const uint32_t *p) { return vld1q_u32(p); }
+    static inline void store(uint32_t *p, V v) { vst1q_u32(p, v); }
+    static inline V dup(uint32_t x) { return vdupq_n_u32(x); }
+    static inline V zero(void) { return vdupq_n_u32(0); }
+    static inline V mask(V v, V r) { return vbicq_u32(v, vceqq_u32(v, r)); }
+    static inline V max(V a, V b) { return vmaxq_u32(a, b); }
+};
+
+template< class T >
+static GLuint
+maxIndexNeon(const T *p, size_t count, bool restart, GLuint restartIndex)
+{
+    typedef NeonOps<T> Neon;
+
+    const size_t lanes = 16 / sizeof(T);
+    const bool mask = restart && restartIndex <= T(~T(0));
+    const typename Neon::V restartVec = Neon::dup(T(restartIndex));
+
+    typename Neon::V maxVec0 = Neon::zero();
+    typename Neon::V maxVec1 = Neon::zero();
+    size_t i = 0;
+    for (; i + 2 * lanes <= count; i += 2 * lanes) {
+        typename Neon::V v0 = Neon::load(p + i);
+        typename Neon::V v1 = Neon::load(p + i + lanes);
+        if (mask) {
+            v0 = Neon::mask(v0, restartVec);
+            v1 = Neon::mask(v1, restartVec);
+        }
+        maxVec0 = Neon::max(maxVec0, v0);
+        maxVec1 = Neon::max(maxVec1, v1);
+    }
+    maxVec0 = Neon::max(maxVec0, maxVec1);
+
+    T maxLanes[lanes];
+    Neon::store(maxLanes, maxVec0);
+    GLuint maxIndex = maxIndexScalar(maxLanes, lanes, false, 0);
+
+    return maxIndexScalar(p + i, count - i, restart, restartIndex, maxIndex);
+}
+
+#endif /* HAVE_NEON */
+
+
+template< class T >
+static inline GLuint
+maxIndex(const T *p, size_t count, bool restart, GLuint restartIndex)
+{
+#if defined(HAVE_X86_SIMD)
+    static const unsigned features = os::getCpuFeatures();
+    if (features & os::CPU_AVX2) {
+        return maxIndexAvx2(p, count, restart, restartIndex);
+    }
+    if (features & os::CPU_SSE41) {
+        return maxIndexSse41(p, count, restart, restartIndex);
+    }
+#elif defined(HAVE_NEON)
+    return maxIndexNeon(p, count, restart, restartIndex);
+#endif
+    return maxIndexScalar(p, count, restart, restartIndex);
+}
+
+
+GLuint
+_gl_max_index(GLenum type, const void *indices, size_t count,
+              bool restart, GLuint restartIndex)
+{
+    switch (type) {
+    case GL_UNSIGNED_BYTE:
+        return maxIndex(static_cast<const uint8_t *>(indices), count, restart, restartIndex);
+    case GL_UNSIGNED_SHORT:
+        return maxIndex(static_cast<const uint16_t *>(indices), count, restart, restartIndex);
+    case GL_UNSIGNED_INT:
+        return maxIndex(static_cast<const uint32_t *>(indices), count, restart, restartIndex);
+    default:
+        os::log("apitrace: warning: %s: unknown GLenum 0x%04X\n", __FUNCTION__, type);
+        return 0;
+    }
+}
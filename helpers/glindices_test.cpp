@@ -0,0 +1,116 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include <stdint.h>
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+// After gtest, as GL headers define macros which clash with it
+#include "glindices.hpp"
+
+
+template< class T >
+static GLuint
+referenceMaxIndex(const std::vector<T> &indices, size_t offset, size_t count,
+                  bool restart, GLuint restartIndex)
+{
+    GLuint maxIndex = 0;
+    for (size_t i = offset; i < offset + count; ++i) {
+        GLuint index = indices[i];
+        if (!(restart && index == restartIndex) && index > maxIndex) {
+            maxIndex = index;
+        }
+    }
+    return maxIndex;
+}
+
+
+template< class T >
+static void
+testType(GLenum type)
+{
+    std::minstd_rand rng(0);
+
+    const GLuint restartIndices[] = { 0, 7, T(~T(0)), 0x10000, 0xffffffff };
+
+    for (size_t count : { 0, 1, 3, 15, 16, 17, 31, 64, 65, 1000 }) {
+        std::vector<T> indices(count + 8);
+
+        for (unsigned round = 0; round < 8; ++round) {
+            // Mostly small indices, with the occasional restart index or
+            // maximum value
+            for (auto &index : indices) {
+                switch (rng() % 16) {
+                case 0:
+                    index = T(~T(0));
+                    break;
+                case 1:
+                    index = 7;
+                    break;
+                default:
+                    index = T(rng() % 64);
+                }
+            }
+
+            // Unaligned starts
+            size_t offset = round % 8;
+
+            for (GLuint restartIndex : restartIndices) {
+                for (bool restart : { false, true }) {
+                    EXPECT_EQ(_gl_max_index(type, indices.data() + offset, count, restart, restartIndex),
+                              referenceMaxIndex(indices, offset, count, restart, restartIndex))
+                        << "count " << count << " restart " << restart << " " << restartIndex;
+                }
+            }
+        }
+    }
+}
+
+
+TEST(glindices, max_index_ubyte)
+{
+    testType<uint8_t>(GL_UNSIGNED_BYTE);
+}
+
+TEST(glindices, max_index_ushort)
+{
+    testType<uint16_t>(GL_UNSIGNED_SHORT);
+}
+
+TEST(glindices, max_index_uint)
+{
+    testType<uint32_t>(GL_UNSIGNED_INT);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
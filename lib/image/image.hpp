@@ -33,6 +33,10 @@
 #include <iostream>
 
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "os_thread.hpp"
 
 
 namespace image {
@@ -44,6 +48,44 @@ enum ChannelType {
 };
 
 
+/**
+ * Recycles the pixel buffers of deleted images for new images of the same
+ * size, so that taking many snapshots doesn't keep going back to the heap.
+ * Holds on to at most the given number of free buffers.
+ */
+class Pool {
+public:
+    Pool(size_t maxBuffers);
+    ~Pool();
+
+    unsigned char *
+    allocate(size_t size);
+
+    void
+    release(unsigned char *pixels, size_t size);
+
+    // Allocations served from free buffers, and from the heap
+    size_t hits = 0;
+    size_t misses = 0;
+
+private:
+    os::mutex mutex;
+    size_t maxBuffers;
+    std::vector<std::pair<size_t, unsigned char *> > buffers;
+};
+
+
+/**
+ * Have new images take their pixels from the given pool, or from the heap
+ * when null.  The pool must outlive the images allocated from it.
+ */
+void
+setPool(Pool *pool);
+
+Pool *
+getPool(void);
+
+
 class Image {
 public:
     unsigned width;
@@ -61,6 +103,9 @@ public:
 
     std::string label;
 
+    // Pool the pixels go back to, if any
+    Pool *pool;
+
     inline Image(unsigned w, unsigned h, unsigned c = 4, bool f = false, ChannelType t = TYPE_UNORM8) :
         width(w),
         height(h),
@@ -69,11 +114,18 @@ public:
         bytesPerChannel(t == TYPE_FLOAT ? 4 : 1),
         bytesPerPixel(channels * bytesPerChannel),
         flipped(f),
-        pixels(new unsigned char[h*w*bytesPerPixel])
-    {}
+        pool(getPool())
+    {
+        size_t size = size_t(h)*w*bytesPerPixel;
+        pixels = pool ? pool->allocate(size) : new unsigned char[size];
+    }
 
     inline ~Image() {
-        delete [] pixels;
+        if (pool) {
+            pool->release(pixels, size_t(height)*width*bytesPerPixel);
+        } else {
+            delete [] pixels;
+        }
     }
 
     // Absolute stride
@@ -120,6 +172,17 @@ public:
     bool
     writePNG(const char *filename, bool strip_alpha = false) const;
 
+    /**
+     * Faster alternative to writePNG, trading a somewhat larger file for
+     * throughput: rows are filtered with a fixed filter, and stripes of rows
+     * are deflated on up to numThreads threads.
+     */
+    bool
+    writePNGFast(std::ostream &os, bool strip_alpha = false, unsigned numThreads = 1) const;
+
+    bool
+    writePNGFast(const char *filename, bool strip_alpha = false, unsigned numThreads = 1) const;
+
     void
     writeRAW(std::ostream &os) const;
 
@@ -0,0 +1,153 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Benchmark for encoding snapshots, comparing the libpng encoder with the
+ * fast one on 1080p and 4K images.
+ *
+ * Usage: image_bench [THREADS [ITERATIONS]]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <sstream>
+
+#include "os_thread.hpp"
+#include "os_time.hpp"
+#include "image.hpp"
+
+
+using namespace image;
+
+
+/*
+ * Something resembling a rendered frame: smooth gradients, with a few hard
+ * edges, and alpha mostly opaque.
+ */
+static Image *
+makeImage(unsigned width, unsigned height, ChannelType type)
+{
+    Image *image = new Image(width, height, 4, true, type);
+    for (unsigned y = 0; y < height; ++y) {
+        for (unsigned x = 0; x < width; ++x) {
+            float rgba[4] = {
+                float(x) / width,
+                float(y) / height,
+                ((x / 64) ^ (y / 64)) & 1 ? 0.75f : 0.25f,
+                x < width / 8 ? 0.5f : 1.0f
+            };
+            size_t i = (size_t(y) * width + x) * 4;
+            for (unsigned c = 0; c < 4; ++c) {
+                if (type == TYPE_FLOAT) {
+                    ((float *)image->pixels)[i + c] = rgba[c];
+                } else {
+                    image->pixels[i + c] = rgba[c] * 255.0f + 0.5f;
+                }
+            }
+        }
+    }
+    return image;
+}
+
+
+static bool
+encode(const Image &image, unsigned numThreads, std::string &png)
+{
+    std::ostringstream os;
+    bool ok = numThreads ? image.writePNGFast(os, true, numThreads) : image.writePNG(os, true);
+    png = os.str();
+    return ok;
+}
+
+
+static void
+bench(const char *name, const Image &image, unsigned numThreads, unsigned iterations)
+{
+    std::string png;
+
+    long long startTime = os::getTime();
+    for (unsigned i = 0; i < iterations; ++i) {
+        if (!encode(image, numThreads, png)) {
+            fprintf(stderr, "error: failed to encode %s\n", name);
+            exit(1);
+        }
+    }
+    double seconds = double(os::getTime() - startTime) / os::timeFrequency / iterations;
+
+    // Check the output decodes to the same pixels as libpng's
+    std::string reference;
+    encode(image, 0, reference);
+    std::istringstream expectedStream(reference);
+    std::istringstream actualStream(png);
+    std::unique_ptr<Image> expected(readPNG(expectedStream));
+    std::unique_ptr<Image> actual(readPNG(actualStream));
+    if (!expected || !actual ||
+        memcmp(actual->pixels, expected->pixels, size_t(image.width) * image.height * 3) != 0) {
+        fprintf(stderr, "error: %s doesn't decode to the expected pixels\n", name);
+        exit(1);
+    }
+
+    double megapixels = double(image.width) * image.height * 1e-6;
+    printf("%-16s %-16s %8.2f ms %8.1f Mpixels/s %8.0f KiB\n",
+           name,
+           numThreads ? (numThreads > 1 ? "fast, threaded" : "fast") : "libpng",
+           seconds * 1e3, megapixels / seconds, png.size() / 1024.0);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    unsigned numThreads = argc > 1 ? atoi(argv[1]) : os::thread::hardware_concurrency();
+    unsigned iterations = argc > 2 ? atoi(argv[2]) : 4;
+
+    static const struct {
+        const char *name;
+        unsigned width;
+        unsigned height;
+        ChannelType type;
+    } cases[] = {
+        {"1080p RGBA8", 1920, 1080, TYPE_UNORM8},
+        {"4K RGBA8", 3840, 2160, TYPE_UNORM8},
+        {"1080p float", 1920, 1080, TYPE_FLOAT},
+        {"4K float", 3840, 2160, TYPE_FLOAT},
+    };
+
+    for (auto & c : cases) {
+        std::unique_ptr<Image> image(makeImage(c.width, c.height, c.type));
+        bench(c.name, *image, 0, iterations);
+        bench(c.name, *image, 1, iterations);
+        if (numThreads > 1) {
+            bench(c.name, *image, numThreads, iterations);
+        }
+    }
+
+    return 0;
+}
@@ -33,11 +33,28 @@
 #include <stdlib.h>
 #include <math.h>
 
+#include <string.h>
+
+#include <algorithm>
 #include <fstream>
+#include <initializer_list>
+#include <string>
+#include <vector>
 
+#include "os_cpu.hpp"
+#include "os_thread.hpp"
 #include "image.hpp"
 
 
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#  define HAVE_X86_SIMD
+#  include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#  define HAVE_NEON
+#  include <arm_neon.h>
+#endif
+
+
 namespace image {
 
 
@@ -181,6 +198,431 @@ Image::writePNG(const char *filename, bool strip_alpha) const
 }
 
 
+/*
+ * Fast PNG encoder.
+ *
+ * Every row but the first is stored with the Up filter, which is cheap and
+ * does well enough on rendered images.  The image is split in stripes of
+ * rows which are deflated independently, on several threads, and joined into
+ * a single zlib stream as pigz does: all stripes but the last end with a sync
+ * flush, so they end on a byte boundary, and their Adler-32 checksums are
+ * combined into the stream's.
+ */
+
+
+// Least filtered bytes per stripe, so that small images aren't split needlessly
+static const size_t pngMinStripeBytes = 128 * 1024;
+
+// Slack past the end of packed rows, for the vector stores
+static const size_t pngRowSlack = 16;
+
+
+static void
+stripAlphaScalar(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+    for (unsigned x = 0; x < width; ++x) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst += 3;
+        src += 4;
+    }
+}
+
+
+static void
+filterUpScalar(unsigned char *dst, const unsigned char *src, const unsigned char *prev, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        dst[i] = src[i] - prev[i];
+    }
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ * Four pixels at a time.  Each store writes four bytes past the pixels it
+ * produces, hence pngRowSlack.
+ */
+OS_TARGET_SSE41 static void
+stripAlphaSse41(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    unsigned x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 4*x));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 3*x), _mm_shuffle_epi8(v, shuffle));
+    }
+    stripAlphaScalar(dst + 3*x, src + 4*x, width - x);
+}
+
+OS_TARGET_SSE41 static void
+filterUpSse41(unsigned char *dst, const unsigned char *src, const unsigned char *prev, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(prev + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_sub_epi8(a, b));
+    }
+    filterUpScalar(dst + i, src + i, prev + i, size - i);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+
+#ifdef HAVE_NEON
+
+static void
+stripAlphaNeon(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+    unsigned x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t rgba = vld4q_u8(src + 4*x);
+        uint8x16x3_t rgb;
+        rgb.val[0] = rgba.val[0];
+        rgb.val[1] = rgba.val[1];
+        rgb.val[2] = rgba.val[2];
+        vst3q_u8(dst + 3*x, rgb);
+    }
+    stripAlphaScalar(dst + 3*x, src + 4*x, width - x);
+}
+
+static void
+filterUpNeon(unsigned char *dst, const unsigned char *src, const unsigned char *prev, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        vst1q_u8(dst + i, vsubq_u8(vld1q_u8(src + i), vld1q_u8(prev + i)));
+    }
+    filterUpScalar(dst + i, src + i, prev + i, size - i);
+}
+
+#endif /* HAVE_NEON */
+
+
+static inline void
+stripAlpha(unsigned char *dst, const unsigned char *src, unsigned width)
+{
+#if defined(HAVE_X86_SIMD)
+    static const unsigned features = os::getCpuFeatures();
+    if (features & os::CPU_SSE41) {
+        stripAlphaSse41(dst, src, width);
+        return;
+    }
+#elif defined(HAVE_NEON)
+    stripAlphaNeon(dst, src, width);
+    return;
+#endif
+    stripAlphaScalar(dst, src, width);
+}
+
+
+static inline void
+filterUp(unsigned char *dst, const unsigned char *src, const unsigned char *prev, size_t size)
+{
+#if defined(HAVE_X86_SIMD)
+    static const unsigned features = os::getCpuFeatures();
+    if (features & os::CPU_SSE41) {
+        filterUpSse41(dst, src, prev, size);
+        return;
+    }
+#elif defined(HAVE_NEON)
+    filterUpNeon(dst, src, prev, size);
+    return;
+#endif
+    filterUpScalar(dst, src, prev, size);
+}
+
+
+/*
+ * Get row y (counting from the top) with the channels to encode, as 8 bit
+ * values.  Rows needing no conversion are returned in place, so flipped
+ * images cost nothing more than walking the rows backwards.
+ */
+static const unsigned char *
+packRow(const Image &image, unsigned y, unsigned outChannels, unsigned char *buf)
+{
+    const unsigned char *row = image.start() + (ptrdiff_t)y * image.stride();
+
+    switch (image.channelType) {
+    case TYPE_UNORM8:
+        if (outChannels == image.channels) {
+            return row;
+        }
+        assert(image.channels == 4 && outChannels == 3);
+        stripAlpha(buf, row, image.width);
+        return buf;
+    case TYPE_FLOAT:
+        {
+            const float *rowFloat = (const float *)row;
+            unsigned char *dst = buf;
+            for (unsigned x = 0; x < image.width; ++x) {
+                for (unsigned channel = 0; channel < outChannels; ++channel) {
+                    float c = rowFloat[channel];
+                    bool srgb = image.channels >= 3 && channel < 3;
+                    *dst++ = srgb ? floatToSRGB(c) : floatToUnorm8(c);
+                }
+                rowFloat += image.channels;
+            }
+        }
+        return buf;
+    }
+
+    assert(0);
+    return buf;
+}
+
+
+static bool
+deflateBytes(z_stream &strm, const unsigned char *data, size_t size, int flush,
+             std::string &out)
+{
+    strm.next_in = const_cast<Bytef *>(data);
+    strm.avail_in = size;
+    for (;;) {
+        if (strm.avail_out == 0) {
+            size_t used = strm.total_out;
+            out.resize(out.size() * 2);
+            strm.next_out = reinterpret_cast<Bytef *>(&out[used]);
+            strm.avail_out = out.size() - used;
+        }
+        int ret = deflate(&strm, flush);
+        if (ret == Z_STREAM_ERROR) {
+            return false;
+        }
+        if (ret == Z_STREAM_END ||
+            (flush != Z_FINISH && strm.avail_in == 0 && strm.avail_out != 0)) {
+            return true;
+        }
+    }
+}
+
+
+struct PNGStripe
+{
+    unsigned firstRow;
+    unsigned endRow;
+
+    // Raw deflate data, and the Adler-32 of the filtered rows
+    std::string data;
+    uLong adler;
+    bool ok;
+};
+
+
+static void
+deflateStripe(const Image *image, unsigned outChannels, PNGStripe *stripe, bool last)
+{
+    size_t rowBytes = size_t(image->width) * outChannels;
+    std::vector<unsigned char> line(1 + rowBytes);
+    std::vector<unsigned char> buf0(rowBytes + pngRowSlack);
+    std::vector<unsigned char> buf1(rowBytes + pngRowSlack);
+    unsigned char *curBuf = buf0.data();
+    unsigned char *prevBuf = buf1.data();
+
+    stripe->ok = false;
+
+    z_stream strm;
+    memset(&strm, 0, sizeof strm);
+    if (deflateInit2(&strm, png_compression_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+
+    size_t size = (stripe->endRow - stripe->firstRow) * line.size();
+    stripe->data.resize(deflateBound(&strm, size) + 64);
+    strm.next_out = reinterpret_cast<Bytef *>(&stripe->data[0]);
+    strm.avail_out = stripe->data.size();
+
+    // The Up filter looks at the previous row, even across stripes
+    const unsigned char *prev = nullptr;
+    if (stripe->firstRow > 0) {
+        prev = packRow(*image, stripe->firstRow - 1, outChannels, prevBuf);
+    }
+
+    uLong adler = adler32(0, Z_NULL, 0);
+    bool ok = true;
+    for (unsigned y = stripe->firstRow; ok && y < stripe->endRow; ++y) {
+        const unsigned char *cur = packRow(*image, y, outChannels, curBuf);
+        if (prev) {
+            line[0] = PNG_FILTER_VALUE_UP;
+            filterUp(&line[1], cur, prev, rowBytes);
+        } else {
+            line[0] = PNG_FILTER_VALUE_NONE;
+            memcpy(&line[1], cur, rowBytes);
+        }
+        adler = adler32(adler, line.data(), line.size());
+
+        int flush = y + 1 < stripe->endRow ? Z_NO_FLUSH : last ? Z_FINISH : Z_SYNC_FLUSH;
+        ok = deflateBytes(strm, line.data(), line.size(), flush, stripe->data);
+
+        prev = cur;
+        if (cur == curBuf) {
+            std::swap(curBuf, prevBuf);
+        }
+    }
+
+    stripe->data.resize(strm.total_out);
+    stripe->adler = adler;
+    stripe->ok = ok;
+
+    deflateEnd(&strm);
+}
+
+
+static inline void
+putBE32(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+
+struct PNGPiece
+{
+    const void *data;
+    size_t size;
+};
+
+
+static void
+writePNGChunk(std::ostream &os, const char *type, std::initializer_list<PNGPiece> pieces)
+{
+    size_t length = 0;
+    for (auto & piece : pieces) {
+        length += piece.size;
+    }
+
+    unsigned char header[8];
+    putBE32(header, length);
+    memcpy(header + 4, type, 4);
+    os.write((const char *)header, sizeof header);
+
+    uLong crc = crc32(0, header + 4, 4);
+    for (auto & piece : pieces) {
+        os.write((const char *)piece.data, piece.size);
+        crc = crc32(crc, (const Bytef *)piece.data, piece.size);
+    }
+
+    unsigned char trailer[4];
+    putBE32(trailer, crc);
+    os.write((const char *)trailer, sizeof trailer);
+}
+
+
+bool
+Image::writePNGFast(std::ostream &os, bool strip_alpha, unsigned numThreads) const
+{
+    int color_type;
+    unsigned outChannels = channels;
+
+    switch (channels) {
+    case 4:
+        if (strip_alpha) {
+            color_type = PNG_COLOR_TYPE_RGB;
+            outChannels = 3;
+        } else {
+            color_type = PNG_COLOR_TYPE_RGB_ALPHA;
+        }
+        break;
+    case 3:
+        color_type = PNG_COLOR_TYPE_RGB;
+        break;
+    case 2:
+        color_type = PNG_COLOR_TYPE_GRAY_ALPHA;
+        break;
+    case 1:
+        color_type = PNG_COLOR_TYPE_GRAY;
+        break;
+    default:
+        assert(0);
+        return false;
+    }
+
+    if (width == 0 || height == 0) {
+        return false;
+    }
+
+    size_t lineBytes = 1 + size_t(width) * outChannels;
+    size_t numStripes = lineBytes * height / pngMinStripeBytes;
+    numStripes = std::min<size_t>(numStripes, numThreads);
+    numStripes = std::max<size_t>(numStripes, 1);
+
+    std::vector<PNGStripe> stripes(numStripes);
+    for (size_t i = 0; i < numStripes; ++i) {
+        stripes[i].firstRow = height * i / numStripes;
+        stripes[i].endRow = height * (i + 1) / numStripes;
+    }
+
+    std::vector<os::thread> threads;
+    threads.reserve(numStripes - 1);
+    for (size_t i = 1; i < numStripes; ++i) {
+        threads.emplace_back(deflateStripe, this, outChannels, &stripes[i], i + 1 == numStripes);
+    }
+    deflateStripe(this, outChannels, &stripes[0], numStripes == 1);
+    for (auto & thread : threads) {
+        thread.join();
+    }
+
+    uLong adler = stripes[0].adler;
+    for (size_t i = 0; i < numStripes; ++i) {
+        if (!stripes[i].ok) {
+            return false;
+        }
+        if (i > 0) {
+            z_off_t size = (stripes[i].endRow - stripes[i].firstRow) * lineBytes;
+            adler = adler32_combine(adler, stripes[i].adler, size);
+        }
+    }
+
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    os.write((const char *)signature, sizeof signature);
+
+    unsigned char ihdr[13];
+    putBE32(ihdr, width);
+    putBE32(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = color_type;
+    ihdr[10] = PNG_COMPRESSION_TYPE_BASE;
+    ihdr[11] = PNG_FILTER_TYPE_BASE;
+    ihdr[12] = PNG_INTERLACE_NONE;
+    writePNGChunk(os, "IHDR", {{ihdr, sizeof ihdr}});
+
+    // One IDAT per stripe, with the zlib header in the first and the
+    // checksum in the last
+    static const unsigned char zlibHeader[2] = {0x78, 0x01};
+    unsigned char zlibTrailer[4];
+    putBE32(zlibTrailer, adler);
+    for (size_t i = 0; i < numStripes; ++i) {
+        bool first = i == 0;
+        bool last = i + 1 == numStripes;
+        writePNGChunk(os, "IDAT", {
+            {zlibHeader, first ? sizeof zlibHeader : 0},
+            {stripes[i].data.data(), stripes[i].data.size()},
+            {zlibTrailer, last ? sizeof zlibTrailer : 0}
+        });
+    }
+
+    writePNGChunk(os, "IEND", {});
+
+    return os.good();
+}
+
+
+bool
+Image::writePNGFast(const char *filename, bool strip_alpha, unsigned numThreads) const
+{
+    std::ofstream os(filename, std::ofstream::binary);
+    if (!os) {
+        return false;
+    }
+    return writePNGFast(os, strip_alpha, numThreads);
+}
+
+
 static void
 pngReadCallback(png_structp png_ptr, png_bytep data, png_size_t length)
 {
@@ -270,7 +712,7 @@ readPNG(const char *filename)
     if (!is) {
         return NULL;
     }
-    return readPNG(filename);
+    return readPNG(is);
 }
 
 
@@ -0,0 +1,131 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <string.h>
+
+#include <memory>
+#include <sstream>
+
+#include "image.hpp"
+
+#include "gtest/gtest.h"
+
+
+using namespace image;
+
+
+static Image *
+makeImage(unsigned width, unsigned height, unsigned channels,
+          ChannelType type = TYPE_UNORM8, bool flipped = false)
+{
+    Image *image = new Image(width, height, channels, flipped, type);
+    size_t count = size_t(width) * height * channels;
+    for (size_t i = 0; i < count; ++i) {
+        unsigned value = (i * 7 + i / 13) % 256;
+        if (type == TYPE_FLOAT) {
+            // Include values out of range, to check clamping
+            ((float *)image->pixels)[i] = value / 200.0f - 0.1f;
+        } else {
+            image->pixels[i] = value;
+        }
+    }
+    return image;
+}
+
+
+/*
+ * The fast encoder must decode to the same pixels as the libpng one.
+ */
+static void
+checkFast(const Image &image, bool strip_alpha, unsigned numThreads)
+{
+    std::stringstream reference;
+    ASSERT_TRUE(image.writePNG(reference, strip_alpha));
+    std::unique_ptr<Image> expected(readPNG(reference));
+    ASSERT_TRUE(expected);
+
+    std::stringstream fast;
+    ASSERT_TRUE(image.writePNGFast(fast, strip_alpha, numThreads));
+    std::unique_ptr<Image> actual(readPNG(fast));
+    ASSERT_TRUE(actual);
+
+    ASSERT_EQ(actual->width, expected->width);
+    ASSERT_EQ(actual->height, expected->height);
+    ASSERT_EQ(actual->channels, expected->channels);
+    size_t size = size_t(actual->width) * actual->height * actual->channels;
+    EXPECT_EQ(memcmp(actual->pixels, expected->pixels, size), 0);
+}
+
+
+TEST(image_png, fast_unorm8)
+{
+    for (unsigned channels = 1; channels <= 4; ++channels) {
+        std::unique_ptr<Image> image(makeImage(37, 11, channels));
+        checkFast(*image, false, 1);
+    }
+
+    // Widths which don't fill whole vectors
+    for (unsigned width = 1; width < 40; ++width) {
+        std::unique_ptr<Image> image(makeImage(width, 3, 4));
+        checkFast(*image, true, 1);
+    }
+}
+
+
+TEST(image_png, fast_flipped)
+{
+    std::unique_ptr<Image> image(makeImage(33, 17, 4, TYPE_UNORM8, true));
+    checkFast(*image, false, 1);
+    checkFast(*image, true, 1);
+}
+
+
+TEST(image_png, fast_float)
+{
+    std::unique_ptr<Image> image(makeImage(21, 9, 4, TYPE_FLOAT));
+    checkFast(*image, false, 1);
+    checkFast(*image, true, 1);
+}
+
+
+TEST(image_png, fast_threads)
+{
+    // Large enough to be split in several stripes, with uneven row counts
+    std::unique_ptr<Image> image(makeImage(301, 997, 4));
+    checkFast(*image, false, 3);
+    checkFast(*image, true, 8);
+
+    std::unique_ptr<Image> flipped(makeImage(256, 1021, 4, TYPE_FLOAT, true));
+    checkFast(*flipped, true, 4);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,107 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include "image.hpp"
+
+
+namespace image {
+
+
+static Pool *currentPool = nullptr;
+
+
+void
+setPool(Pool *pool)
+{
+    currentPool = pool;
+}
+
+
+Pool *
+getPool(void)
+{
+    return currentPool;
+}
+
+
+Pool::Pool(size_t _maxBuffers) :
+    maxBuffers(_maxBuffers)
+{
+}
+
+
+Pool::~Pool()
+{
+    for (auto & buffer : buffers) {
+        delete [] buffer.second;
+    }
+}
+
+
+unsigned char *
+Pool::allocate(size_t size)
+{
+    {
+        os::unique_lock<os::mutex> lock(mutex);
+        for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+            if (it->first == size) {
+                unsigned char *pixels = it->second;
+                buffers.erase(it);
+                ++hits;
+                return pixels;
+            }
+        }
+        ++misses;
+    }
+
+    return new unsigned char[size];
+}
+
+
+void
+Pool::release(unsigned char *pixels, size_t size)
+{
+    if (!maxBuffers) {
+        delete [] pixels;
+        return;
+    }
+
+    unsigned char *oldest = nullptr;
+    {
+        os::unique_lock<os::mutex> lock(mutex);
+        // Drop the oldest buffer when full, as sizes may have changed since
+        if (buffers.size() >= maxBuffers) {
+            oldest = buffers.front().second;
+            buffers.erase(buffers.begin());
+        }
+        buffers.emplace_back(size, pixels);
+    }
+
+    delete [] oldest;
+}
+
+
+} /* namespace image */
@@ -35,14 +35,18 @@
 #include <set>
 #include <vector>
 #include "os.hpp"
+#include "os_string.hpp"
+#include "os_thread.hpp"
 
 #if defined(ANDROID)
 #  include <dlfcn.h>
 #elif HAVE_BACKTRACE
 #  include <stdint.h>
 #  include <dlfcn.h>
+#  include <link.h>
 #  include <unistd.h>
 #  include <map>
+#  include <string>
 #  include <vector>
 #  include <cxxabi.h>
 #  include <backtrace.h>
@@ -268,8 +272,14 @@ public:
     }
 };
 
+bool backtrace_is_raw(void) {
+    return false;
+}
+
 std::vector<RawStackFrame> get_backtrace() {
     static DalvikBacktraceProvider backtraceProvider;
+    static os::mutex mutex;
+    os::unique_lock<os::mutex> lock(mutex);
     return backtraceProvider.parseBacktrace(backtraceProvider.getBacktrace());
 }
 
@@ -331,15 +341,35 @@ static void dumpFrame(const RawStackFrame &frame)
 
 #define BT_DEPTH 10
 
+bool backtrace_is_raw(void) {
+    const char *env = getenv("APITRACE_BACKTRACE_RAW");
+    return env && strcmp(env, "0") != 0;
+}
+
 class libbacktraceProvider {
     struct backtrace_state *state;
     int skipFrames;
     Id nextFrameId;
     std::map<uintptr_t, std::vector<RawStackFrame> > cache;
-    std::vector<RawStackFrame> *current, *current_frames;
+    // Build IDs of the modules seen so far, which may be empty
+    std::map<std::string, std::string> buildIds;
+    std::vector<RawStackFrame> *current_frames;
     RawStackFrame *current_frame;
     bool missingDwarf;
 
+    /*
+     * Guards the cache and the members above, so that threads only wait on
+     * each other to look up frames, not to unwind their stacks.
+     */
+    os::mutex mutex;
+
+    /*
+     * Whether to only record modules and offsets, leaving symbol lookups to
+     * `apitrace symbolize`.
+     */
+    bool raw;
+    os::String processName;
+
     static void bt_err_callback(void *vdata, const char *msg, int errnum)
     {
         libbacktraceProvider *this_ = (libbacktraceProvider*)vdata;
@@ -394,23 +424,142 @@ class libbacktraceProvider {
                                        : pc - (uintptr_t)info.dli_fbase;
     }
 
+    struct ModuleLookup {
+        uintptr_t pc;
+        const char *name;
+        uintptr_t base;
+        const ElfW(Phdr) *phdrs;
+        unsigned numPhdrs;
+    };
+
+    static int dl_find_module(struct dl_phdr_info *info, size_t size, void *data)
+    {
+        ModuleLookup *lookup = (ModuleLookup *)data;
+        for (unsigned i = 0; i < info->dlpi_phnum; ++i) {
+            const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+            uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+            if (phdr.p_type == PT_LOAD &&
+                lookup->pc >= start && lookup->pc - start < phdr.p_memsz) {
+                lookup->name = info->dlpi_name;
+                lookup->base = info->dlpi_addr;
+                lookup->phdrs = info->dlpi_phdr;
+                lookup->numPhdrs = info->dlpi_phnum;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    /*
+     * Read the NT_GNU_BUILD_ID note of a loaded module, as hex.
+     */
+    static std::string readBuildId(const ModuleLookup &lookup)
+    {
+        static const char hex[] = "0123456789abcdef";
+        std::string buildId;
+        for (unsigned i = 0; i < lookup.numPhdrs; ++i) {
+            const ElfW(Phdr) &phdr = lookup.phdrs[i];
+            if (phdr.p_type != PT_NOTE) {
+                continue;
+            }
+            size_t align = phdr.p_align == 8 ? 8 : 4;
+            const char *note = (const char *)(lookup.base + phdr.p_vaddr);
+            const char *end = note + phdr.p_memsz;
+            while (note + sizeof(ElfW(Nhdr)) <= end) {
+                const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)note;
+                const char *name = note + sizeof *nhdr;
+                const unsigned char *desc = (const unsigned char *)
+                    (name + ((nhdr->n_namesz + align - 1) & ~(align - 1)));
+                note = (const char *)desc + ((nhdr->n_descsz + align - 1) & ~(align - 1));
+                if (note > end) {
+                    break;
+                }
+                if (nhdr->n_type == NT_GNU_BUILD_ID &&
+                    nhdr->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+                    for (unsigned j = 0; j < nhdr->n_descsz; ++j) {
+                        buildId += hex[desc[j] >> 4];
+                        buildId += hex[desc[j] & 0xf];
+                    }
+                    return buildId;
+                }
+            }
+        }
+        return buildId;
+    }
+
+    /*
+     * Unlike dladdr, this doesn't look for the closest symbol, which takes
+     * time proportional to the size of the symbol table.
+     *
+     * libbacktrace already steps return addresses back by one byte, into the
+     * call instruction, so the offsets resolve to the calling line as they
+     * are.  The first frame of each module also gets the module's build ID,
+     * so that symbolizing can tell whether it still has the same binary.
+     */
+    void raw_fill(RawStackFrame *frame, uintptr_t pc)
+    {
+        ModuleLookup lookup = {pc, NULL, 0, NULL, 0};
+        if (dl_iterate_phdr(dl_find_module, &lookup)) {
+            // The main program has no name
+            frame->module = lookup.name && lookup.name[0] ? lookup.name : processName.str();
+            frame->offset = pc - lookup.base;
+            auto inserted = buildIds.emplace(frame->module, std::string());
+            if (inserted.second) {
+                inserted.first->second = readBuildId(lookup);
+                if (!inserted.first->second.empty()) {
+                    frame->buildId = inserted.first->second.c_str();
+                }
+            }
+        } else {
+            frame->offset = pc;
+        }
+    }
+
+    struct Unwinding {
+        uintptr_t pcs[BT_DEPTH];
+        unsigned numPcs;
+    };
+
+    static void bt_unwind_err_callback(void *vdata, const char *msg, int errnum)
+    {
+        if (errnum)
+            os::log("libbacktrace: %s: %s\n", msg, strerror(errnum));
+        else
+            os::log("libbacktrace: %s\n", msg);
+    }
+
+    /*
+     * Every program counter yields at least one frame, so there is no need
+     * for more than BT_DEPTH of them.
+     */
     static int bt_callback(void *vdata, uintptr_t pc)
     {
-        libbacktraceProvider *this_ = (libbacktraceProvider*)vdata;
-        std::vector<RawStackFrame> &frames = this_->cache[pc];
+        Unwinding *unwinding = (Unwinding*)vdata;
+        unwinding->pcs[unwinding->numPcs++] = pc;
+        return unwinding->numPcs >= BT_DEPTH;
+    }
+
+    const std::vector<RawStackFrame> &lookupFrames(uintptr_t pc)
+    {
+        std::vector<RawStackFrame> &frames = cache[pc];
+        if (!frames.size() && raw) {
+            RawStackFrame frame;
+            raw_fill(&frame, pc);
+            frame.id = nextFrameId++;
+            frames.push_back(frame);
+        }
         if (!frames.size()) {
             RawStackFrame frame;
             dl_fill(&frame, pc);
-            this_->current_frame = &frame;
-            this_->current_frames = &frames;
-            backtrace_pcinfo(this_->state, pc, bt_full_callback, bt_err_callback, vdata);
+            current_frame = &frame;
+            current_frames = &frames;
+            backtrace_pcinfo(state, pc, bt_full_callback, bt_err_callback, this);
             if (!frames.size()) {
-                frame.id = this_->nextFrameId++;
+                frame.id = nextFrameId++;
                 frames.push_back(frame);
             }
         }
-        this_->current->insert(this_->current->end(), frames.begin(), frames.end());
-        return this_->current->size() >= BT_DEPTH;
+        return frames;
     }
 
     static int bt_full_dump_callback(void *vdata, uintptr_t pc,
@@ -441,16 +590,27 @@ class libbacktraceProvider {
 
 public:
     libbacktraceProvider():
-        state(backtrace_create_state(NULL, 0, bt_err_callback, NULL))
+        // Threaded, as stacks are unwound without holding the mutex
+        state(backtrace_create_state(NULL, 1, bt_err_callback, NULL)),
+        processName(getProcessName())
     {
+        raw = backtrace_is_raw();
+
         backtrace_simple(state, 0, bt_countskip, bt_err_callback, this);
     }
 
     std::vector<RawStackFrame> getParsedBacktrace()
     {
+        Unwinding unwinding;
+        unwinding.numPcs = 0;
+        backtrace_simple(state, skipFrames, bt_callback, bt_unwind_err_callback, &unwinding);
+
         std::vector<RawStackFrame> parsedBacktrace;
-        current = &parsedBacktrace;
-        backtrace_simple(state, skipFrames, bt_callback, bt_err_callback, this);
+        os::unique_lock<os::mutex> lock(mutex);
+        for (unsigned i = 0; i < unwinding.numPcs && parsedBacktrace.size() < BT_DEPTH; ++i) {
+            const std::vector<RawStackFrame> &frames = lookupFrames(unwinding.pcs[i]);
+            parsedBacktrace.insert(parsedBacktrace.end(), frames.begin(), frames.end());
+        }
         return parsedBacktrace;
     }
 
@@ -473,6 +633,10 @@ void dump_backtrace() {
 
 #else /* !HAVE_BACKTRACE */
 
+bool backtrace_is_raw(void) {
+    return false;
+}
+
 std::vector<RawStackFrame> get_backtrace() {
     return std::vector<RawStackFrame>();
 }
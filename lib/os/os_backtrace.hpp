@@ -38,6 +38,12 @@ using trace::RawStackFrame;
 std::vector<RawStackFrame> get_backtrace();
 bool backtrace_is_needed(const char* fname);
 
+/**
+ * Whether backtraces only hold modules, their build IDs, and offsets, as
+ * requested with APITRACE_BACKTRACE_RAW.
+ */
+bool backtrace_is_raw(void);
+
 void dump_backtrace();
 
 
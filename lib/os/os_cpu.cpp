@@ -0,0 +1,138 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include "os_cpu.hpp"
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#  include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+#endif
+
+
+namespace os {
+
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+
+static inline void
+cpuid(unsigned leaf, unsigned regs[4])
+{
+    int info[4];
+    __cpuidex(info, leaf, 0);
+    for (unsigned i = 0; i < 4; ++i) {
+        regs[i] = info[i];
+    }
+}
+
+static inline unsigned long long
+xgetbv(void)
+{
+    return _xgetbv(0);
+}
+
+#  define HAVE_CPUID
+
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+static inline void
+cpuid(unsigned leaf, unsigned regs[4])
+{
+    if (!__get_cpuid_count(leaf, 0, &regs[0], &regs[1], &regs[2], &regs[3])) {
+        regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    }
+}
+
+static inline unsigned long long
+xgetbv(void)
+{
+    unsigned eax, edx;
+    __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((unsigned long long)edx << 32) | eax;
+}
+
+#  define HAVE_CPUID
+
+#endif
+
+
+static unsigned
+detectCpuFeatures(void)
+{
+    unsigned features = 0;
+
+#ifdef HAVE_CPUID
+    unsigned regs[4];
+
+    cpuid(0, regs);
+    const unsigned maxLeaf = regs[0];
+    if (maxLeaf < 1) {
+        return 0;
+    }
+
+    cpuid(1, regs);
+    const unsigned ecx = regs[2];
+    if (ecx & (1U << 19)) {
+        features |= CPU_SSE41;
+    }
+    if (ecx & (1U << 20)) {
+        features |= CPU_SSE42;
+    }
+
+    // AVX registers must also be saved by the OS
+    const bool osxsave = (ecx & (1U << 27)) != 0;
+    const bool avx = (ecx & (1U << 28)) != 0;
+    if (maxLeaf >= 7 && osxsave && avx &&
+        (xgetbv() & 0x6) == 0x6) {
+        cpuid(7, regs);
+        if (regs[1] & (1U << 5)) {
+            features |= CPU_AVX2;
+        }
+    }
+#elif defined(__ARM_FEATURE_CRC32) || (defined(__APPLE__) && defined(__aarch64__))
+    features |= CPU_ARM_CRC32;
+#elif defined(__aarch64__) && defined(__linux__)
+    if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        features |= CPU_ARM_CRC32;
+    }
+#endif
+
+    return features;
+}
+
+
+unsigned
+getCpuFeatures(void)
+{
+    static const unsigned features = detectCpuFeatures();
+    return features;
+}
+
+
+} /* namespace os */
@@ -0,0 +1,73 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Runtime detection of CPU features, for picking the fastest code path.
+ */
+
+#pragma once
+
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#  define OS_TARGET_SSE41 __attribute__((target("sse4.1")))
+#  define OS_TARGET_SSE42 __attribute__((target("sse4.2")))
+#  define OS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+   // MSVC allows intrinsics of any instruction set anywhere
+#  define OS_TARGET_SSE41
+#  define OS_TARGET_SSE42
+#  define OS_TARGET_AVX2
+#endif
+
+#if defined(__clang__) && defined(__aarch64__)
+#  define OS_TARGET_ARM_CRC32 __attribute__((target("crc")))
+#elif defined(__GNUC__) && defined(__aarch64__)
+#  define OS_TARGET_ARM_CRC32 __attribute__((target("+crc")))
+#else
+#  define OS_TARGET_ARM_CRC32
+#endif
+
+
+namespace os {
+
+    enum CpuFeature {
+        CPU_SSE41 = 1 << 0,
+        CPU_SSE42 = 1 << 1,
+        CPU_AVX2  = 1 << 2,
+        CPU_ARM_CRC32 = 1 << 3,
+    };
+
+    /**
+     * Bitmask of CpuFeature supported by both the CPU and the OS.
+     */
+    unsigned
+    getCpuFeatures(void);
+
+    inline bool
+    hasCpuFeature(CpuFeature feature) {
+        return (getCpuFeatures() & feature) != 0;
+    }
+
+} /* namespace os */
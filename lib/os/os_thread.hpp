@@ -117,6 +117,15 @@ namespace os {
 #endif
         }
 
+        inline bool
+        try_lock(void) {
+#ifdef _WIN32
+            return TryEnterCriticalSection(&_native_handle) != 0;
+#else
+            return pthread_mutex_trylock(&_native_handle) == 0;
+#endif
+        }
+
         inline void
         unlock(void) {
 #ifdef _WIN32
@@ -27,6 +27,8 @@
 
 #pragma once
 
+#include <assert.h>
+
 #include <algorithm>
 #include <cstddef>
 #include <functional>
@@ -38,10 +40,19 @@
 
 class ThreadPool {
 public:
-    ThreadPool(size_t);
+    // max_queued bounds the tasks waiting for a worker, zero meaning no bound
+    ThreadPool(size_t, size_t max_queued = 0);
+    // blocks while the queue is full
     template<class F, class... Args>
     void enqueue(F&& f, Args&&... args);
+    // runs the remaining tasks and joins the workers
+    void finish();
     ~ThreadPool();
+
+    // most tasks ever waiting for a worker
+    size_t maxQueued() const { return max_depth; }
+    // times enqueue had to wait for room in the queue
+    size_t numWaits() const { return num_waits; }
 private:
     // need to keep track of threads so we can join them
     std::vector<os::thread> workers;
@@ -51,13 +62,21 @@ private:
     // synchronization
     os::mutex queue_mutex;
     os::condition_variable condition;
+    os::condition_variable space;
     bool stop;
+
+    size_t max_queued;
+    size_t max_depth;
+    size_t num_waits;
 };
 
 
 // the constructor just launches some amount of workers
-inline ThreadPool::ThreadPool(size_t threads)
-    :   stop(false)
+inline ThreadPool::ThreadPool(size_t threads, size_t max_queued)
+    :   stop(false),
+        max_queued(max_queued),
+        max_depth(0),
+        num_waits(0)
 {
     for(size_t i = 0;i<threads;++i)
         workers.emplace_back(
@@ -76,6 +95,7 @@ inline ThreadPool::ThreadPool(size_t threads)
                         task = std::move(this->tasks.front());
                         this->tasks.pop();
                     }
+                    this->space.notify_one();
 
                     task();
                 }
@@ -95,13 +115,18 @@ void ThreadPool::enqueue(F&& f, Args&&... args)
         // don't allow enqueueing after stopping the pool
         assert(!stop);
 
+        if (max_queued && tasks.size() >= max_queued) {
+            ++num_waits;
+            space.wait(lock, [this]{ return tasks.size() < max_queued; });
+        }
+
         tasks.emplace(task);
+        max_depth = std::max(max_depth, tasks.size());
     }
     condition.notify_one();
 }
 
-// the destructor joins all threads
-inline ThreadPool::~ThreadPool()
+inline void ThreadPool::finish()
 {
     {
         os::unique_lock<os::mutex> lock(queue_mutex);
@@ -110,4 +135,11 @@ inline ThreadPool::~ThreadPool()
     condition.notify_all();
     for(os::thread &worker: workers)
         worker.join();
+    workers.clear();
+}
+
+// the destructor joins all threads
+inline ThreadPool::~ThreadPool()
+{
+    finish();
 }
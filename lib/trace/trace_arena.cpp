@@ -0,0 +1,86 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <algorithm>
+
+#include "trace_arena.hpp"
+
+
+/*
+ * Largest size of the blocks allocated as the arena grows, as opposed to
+ * blocks dedicated to large allocations.
+ */
+#define TRACE_ARENA_MAX_BLOCK_SIZE (1024 * 1024)
+
+
+namespace trace {
+
+
+Arena::~Arena()
+{
+    for (auto it = m_finalizers.rbegin(); it != m_finalizers.rend(); ++it) {
+        it->first(it->second);
+    }
+
+    while (m_blocks) {
+        Block *next = m_blocks->next;
+        ::operator delete(m_blocks);
+        m_blocks = next;
+    }
+}
+
+
+void *
+Arena::allocateBlock(size_t size, size_t align)
+{
+    static const size_t headerSize =
+        (sizeof(Block) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+    size_t needed = headerSize + size + align;
+    size_t blockSize = std::max(needed, m_nextBlockSize);
+
+    Block *block = static_cast<Block *>(::operator new(blockSize));
+    block->next = m_blocks;
+    m_blocks = block;
+
+    char *start = reinterpret_cast<char *>(block) + headerSize;
+    char *end = reinterpret_cast<char *>(block) + blockSize;
+
+    if (needed > m_nextBlockSize) {
+        // Dedicated block, so carry on with the current one afterwards
+        uintptr_t ptr = (uintptr_t(start) + align - 1) & ~uintptr_t(align - 1);
+        return reinterpret_cast<void *>(ptr);
+    }
+
+    m_nextBlockSize = std::min(m_nextBlockSize * 2, size_t(TRACE_ARENA_MAX_BLOCK_SIZE));
+
+    m_ptr = start;
+    m_end = end;
+    return allocate(size, align);
+}
+
+
+} /* namespace trace */
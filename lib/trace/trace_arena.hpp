@@ -0,0 +1,170 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Bump allocator for the values of a call.
+ */
+
+#pragma once
+
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+#include <utility>
+#include <vector>
+
+
+/*
+ * Size of the block embedded in the arena itself, which is enough for the
+ * arguments of most calls.
+ */
+#define TRACE_ARENA_INLINE_SIZE 512
+
+
+namespace trace {
+
+
+/**
+ * Memory obtained from an arena is released all at once when the arena is
+ * destroyed, and destructors of objects placed in it are not run, unless
+ * explicitly registered with addFinalizer.
+ */
+class Arena
+{
+public:
+    typedef void (*Finalizer)(void *object);
+
+    Arena() :
+        m_ptr(m_inline),
+        m_end(m_inline + sizeof m_inline)
+    {}
+
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena & operator = (const Arena &) = delete;
+
+    inline void *
+    allocate(size_t size, size_t align = alignof(max_align_t)) {
+        assert((align & (align - 1)) == 0);
+        uintptr_t ptr = (uintptr_t(m_ptr) + align - 1) & ~uintptr_t(align - 1);
+        if (ptr + size <= uintptr_t(m_end)) {
+            m_ptr = reinterpret_cast<char *>(ptr + size);
+            return reinterpret_cast<void *>(ptr);
+        }
+        return allocateBlock(size, align);
+    }
+
+    template< class T >
+    inline T *
+    allocateArray(size_t count) {
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    template< class T, class... Args >
+    inline T *
+    create(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * Have a function called on the given object when the arena is
+     * destroyed.
+     */
+    void addFinalizer(Finalizer finalizer, void *object) {
+        m_finalizers.emplace_back(finalizer, object);
+    }
+
+private:
+    struct Block {
+        Block *next;
+    };
+
+    char *m_ptr;
+    char *m_end;
+
+    Block *m_blocks = nullptr;
+    size_t m_nextBlockSize = 4096;
+
+    std::vector< std::pair<Finalizer, void *> > m_finalizers;
+
+    alignas(max_align_t) char m_inline[TRACE_ARENA_INLINE_SIZE];
+
+    void *allocateBlock(size_t size, size_t align);
+};
+
+
+/**
+ * Standard allocator which uses the given arena, or the heap when it's null.
+ */
+template< class T >
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    Arena *arena;
+
+    ArenaAllocator(Arena *_arena = nullptr) noexcept :
+        arena(_arena)
+    {}
+
+    template< class U >
+    ArenaAllocator(const ArenaAllocator<U> &other) noexcept :
+        arena(other.arena)
+    {}
+
+    T *
+    allocate(size_t count) {
+        if (arena) {
+            return arena->allocateArray<T>(count);
+        }
+        return static_cast<T *>(::operator new(count * sizeof(T)));
+    }
+
+    void
+    deallocate(T *ptr, size_t count) noexcept {
+        if (!arena) {
+            ::operator delete(ptr);
+        }
+    }
+
+    template< class U >
+    bool operator == (const ArenaAllocator<U> &other) const noexcept {
+        return arena == other.arena;
+    }
+
+    template< class U >
+    bool operator != (const ArenaAllocator<U> &other) const noexcept {
+        return arena != other.arena;
+    }
+};
+
+
+} /* namespace trace */
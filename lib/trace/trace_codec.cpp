@@ -0,0 +1,442 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include "trace_codec.hpp"
+
+#include <algorithm>
+#include <memory>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <snappy.h>
+#include <snappy-sinksource.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "os.hpp"
+#include "trace_snappy.hpp"
+
+
+/*
+ * Dictionaries are meant to be a few hundred KiB at most, so anything much
+ * larger points to a corrupted header.
+ */
+#define ZSTD_MAX_DICTIONARY_SIZE (16 * 1024 * 1024)
+
+#define ZSTD_DEFAULT_LEVEL 1
+
+
+namespace trace {
+
+
+static inline void
+encodeUInt32(char *buf, uint32_t value)
+{
+    for (unsigned i = 0; i < 4; ++i) {
+        buf[i] = char(value >> (8 * i));
+    }
+}
+
+
+static inline uint32_t
+decodeUInt32(const char *buf)
+{
+    const unsigned char *ubuf = reinterpret_cast<const unsigned char *>(buf);
+    return  (uint32_t)ubuf[0]        |
+           ((uint32_t)ubuf[1] <<  8) |
+           ((uint32_t)ubuf[2] << 16) |
+           ((uint32_t)ubuf[3] << 24);
+}
+
+
+class SnappyCodec : public ChunkCodec
+{
+public:
+    size_t
+    maxCompressedLength(size_t length) const override {
+        return snappy::MaxCompressedLength(length);
+    }
+
+    size_t
+    compress(const char *data, size_t length, char *compressed) override {
+        size_t compressedLength;
+        snappy::RawCompress(data, length, compressed, &compressedLength);
+        return compressedLength;
+    }
+
+    bool
+    getUncompressedLength(const char *compressed, size_t compressedLength,
+                          size_t &length) override {
+        return snappy::GetUncompressedLength(compressed, compressedLength, &length);
+    }
+
+    size_t
+    uncompress(const char *compressed, size_t compressedLength,
+               char *data, size_t length, bool partial) override {
+        if (partial) {
+            snappy::ByteArraySource source(compressed, compressedLength);
+            snappy::UncheckedByteArraySink sink(data);
+            return snappy::UncompressAsMuchAsPossible(&source, &sink);
+        }
+        if (!snappy::RawUncompress(compressed, compressedLength, data)) {
+            return 0;
+        }
+        return length;
+    }
+};
+
+
+#ifdef HAVE_LZ4
+
+/*
+ * LZ4 blocks don't record their uncompressed length, so each chunk starts
+ * with it.
+ */
+class LZ4Codec : public ChunkCodec
+{
+public:
+    LZ4Codec(int level) :
+        m_level(level)
+    {}
+
+    size_t
+    maxCompressedLength(size_t length) const override {
+        return 4 + LZ4_compressBound(int(length));
+    }
+
+    size_t
+    compress(const char *data, size_t length, char *compressed) override {
+        int capacity = int(maxCompressedLength(length) - 4);
+        int result;
+        if (m_level > 0) {
+            result = LZ4_compress_HC(data, compressed + 4, int(length), capacity, m_level);
+        } else {
+            result = LZ4_compress_default(data, compressed + 4, int(length), capacity);
+        }
+        if (result <= 0) {
+            return 0;
+        }
+        encodeUInt32(compressed, uint32_t(length));
+        return 4 + result;
+    }
+
+    bool
+    getUncompressedLength(const char *compressed, size_t compressedLength,
+                          size_t &length) override {
+        if (compressedLength < 4) {
+            return false;
+        }
+        length = decodeUInt32(compressed);
+        return true;
+    }
+
+    size_t
+    uncompress(const char *compressed, size_t compressedLength,
+               char *data, size_t length, bool partial) override {
+        if (compressedLength < 4) {
+            return 0;
+        }
+        int result;
+        if (partial) {
+            result = LZ4_decompress_safe_partial(compressed + 4, data,
+                                                 int(compressedLength - 4),
+                                                 int(length), int(length));
+        } else {
+            result = LZ4_decompress_safe(compressed + 4, data,
+                                         int(compressedLength - 4), int(length));
+        }
+        return result > 0 ? size_t(result) : 0;
+    }
+
+private:
+    int m_level;
+};
+
+#endif /* HAVE_LZ4 */
+
+
+#ifdef HAVE_ZSTD
+
+/*
+ * Each chunk is a Zstandard frame, which records its uncompressed length.
+ */
+class ZstdCodec : public ChunkCodec
+{
+public:
+    ZstdCodec(const CodecOptions &options) :
+        m_level(options.level ? options.level : ZSTD_DEFAULT_LEVEL)
+    {
+        m_cctx = ZSTD_createCCtx();
+        m_dctx = ZSTD_createDCtx();
+        if (!options.dictionary.empty()) {
+            m_cdict = ZSTD_createCDict(options.dictionary.data(),
+                                       options.dictionary.size(), m_level);
+            m_ddict = ZSTD_createDDict(options.dictionary.data(),
+                                       options.dictionary.size());
+        }
+    }
+
+    ~ZstdCodec() {
+        ZSTD_freeCDict(m_cdict);
+        ZSTD_freeDDict(m_ddict);
+        ZSTD_freeCCtx(m_cctx);
+        ZSTD_freeDCtx(m_dctx);
+    }
+
+    size_t
+    maxCompressedLength(size_t length) const override {
+        return ZSTD_compressBound(length);
+    }
+
+    size_t
+    compress(const char *data, size_t length, char *compressed) override {
+        size_t capacity = maxCompressedLength(length);
+        size_t result;
+        if (m_cdict) {
+            result = ZSTD_compress_usingCDict(m_cctx, compressed, capacity,
+                                              data, length, m_cdict);
+        } else {
+            result = ZSTD_compressCCtx(m_cctx, compressed, capacity,
+                                       data, length, m_level);
+        }
+        return ZSTD_isError(result) ? 0 : result;
+    }
+
+    bool
+    getUncompressedLength(const char *compressed, size_t compressedLength,
+                          size_t &length) override {
+        unsigned long long size = ZSTD_getFrameContentSize(compressed, compressedLength);
+        if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR ||
+            size != size_t(size)) {
+            return false;
+        }
+        length = size;
+        return true;
+    }
+
+    size_t
+    uncompress(const char *compressed, size_t compressedLength,
+               char *data, size_t length, bool partial) override {
+        if (partial) {
+            return uncompressPartial(compressed, compressedLength, data, length);
+        }
+        size_t result;
+        if (m_ddict) {
+            result = ZSTD_decompress_usingDDict(m_dctx, data, length,
+                                                compressed, compressedLength, m_ddict);
+        } else {
+            result = ZSTD_decompressDCtx(m_dctx, data, length,
+                                         compressed, compressedLength);
+        }
+        return ZSTD_isError(result) ? 0 : result;
+    }
+
+private:
+    int m_level;
+    ZSTD_CCtx *m_cctx = nullptr;
+    ZSTD_DCtx *m_dctx = nullptr;
+    ZSTD_CDict *m_cdict = nullptr;
+    ZSTD_DDict *m_ddict = nullptr;
+
+    size_t
+    uncompressPartial(const char *compressed, size_t compressedLength,
+                      char *data, size_t length) {
+        ZSTD_DCtx_reset(m_dctx, ZSTD_reset_session_only);
+        ZSTD_DCtx_refDDict(m_dctx, m_ddict);
+        ZSTD_inBuffer input = {compressed, compressedLength, 0};
+        ZSTD_outBuffer output = {data, length, 0};
+        while (input.pos < input.size && output.pos < output.size) {
+            size_t result = ZSTD_decompressStream(m_dctx, &output, &input);
+            if (ZSTD_isError(result)) {
+                break;
+            }
+        }
+        ZSTD_DCtx_reset(m_dctx, ZSTD_reset_session_and_parameters);
+        return output.pos;
+    }
+};
+
+#endif /* HAVE_ZSTD */
+
+
+ChunkCodec *
+createChunkCodec(const CodecOptions &options)
+{
+    switch (options.codec) {
+    case CODEC_SNAPPY:
+        return new SnappyCodec;
+    case CODEC_LZ4:
+#ifdef HAVE_LZ4
+        return new LZ4Codec(options.level);
+#else
+        break;
+#endif
+    case CODEC_ZSTD:
+#ifdef HAVE_ZSTD
+        return new ZstdCodec(options);
+#else
+        break;
+#endif
+    }
+
+    os::log("error: %s compression is not supported by this build\n",
+            getCodecName(options.codec));
+    return nullptr;
+}
+
+
+const char *
+getCodecName(Codec codec)
+{
+    switch (codec) {
+    case CODEC_SNAPPY:
+        return "snappy";
+    case CODEC_LZ4:
+        return "lz4";
+    case CODEC_ZSTD:
+        return "zstd";
+    }
+    return "unknown";
+}
+
+
+bool
+parseCodecOptions(const char *spec, CodecOptions &options)
+{
+    const char *sep = strchr(spec, ':');
+    std::string name(spec, sep ? sep - spec : strlen(spec));
+
+    if (name == "snappy") {
+        options.codec = CODEC_SNAPPY;
+    } else if (name == "lz4") {
+        options.codec = CODEC_LZ4;
+    } else if (name == "zstd") {
+        options.codec = CODEC_ZSTD;
+    } else {
+        return false;
+    }
+
+    options.level = 0;
+    if (sep) {
+        char *end;
+        options.level = strtol(sep + 1, &end, 10);
+        if (end == sep + 1 || *end) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool
+getChunkedCodec(unsigned char byte1, unsigned char byte2, Codec &codec)
+{
+    if (byte1 != SNAPPY_BYTE1) {
+        return false;
+    }
+    switch (byte2) {
+    case SNAPPY_BYTE2:
+        codec = CODEC_SNAPPY;
+        return true;
+    case LZ4_BYTE2:
+        codec = CODEC_LZ4;
+        return true;
+    case ZSTD_BYTE2:
+        codec = CODEC_ZSTD;
+        return true;
+    }
+    return false;
+}
+
+
+void
+writeChunkedHeader(std::string &header, const CodecOptions &options)
+{
+    header.clear();
+    header.push_back(SNAPPY_BYTE1);
+    switch (options.codec) {
+    case CODEC_SNAPPY:
+        header.push_back(SNAPPY_BYTE2);
+        break;
+    case CODEC_LZ4:
+        header.push_back(LZ4_BYTE2);
+        break;
+    case CODEC_ZSTD:
+        header.push_back(ZSTD_BYTE2);
+        char buf[4];
+        encodeUInt32(buf, uint32_t(options.dictionary.size()));
+        header.append(buf, sizeof buf);
+        header.append(options.dictionary);
+        break;
+    }
+}
+
+
+bool
+readChunkedHeader(const ReadAtFunc &readAt, CodecOptions &options, uint64_t &dataOffset)
+{
+    unsigned char header[2];
+    if (!readAt(0, header, sizeof header) ||
+        !getChunkedCodec(header[0], header[1], options.codec)) {
+        return false;
+    }
+    dataOffset = sizeof header;
+
+    options.level = 0;
+    options.dictionary.clear();
+    if (options.codec == CODEC_ZSTD) {
+        char buf[4];
+        if (!readAt(dataOffset, buf, sizeof buf)) {
+            return false;
+        }
+        dataOffset += sizeof buf;
+
+        size_t size = decodeUInt32(buf);
+        if (size > ZSTD_MAX_DICTIONARY_SIZE) {
+            return false;
+        }
+        options.dictionary.resize(size);
+        if (size && !readAt(dataOffset, &options.dictionary[0], size)) {
+            return false;
+        }
+        dataOffset += size;
+    }
+
+    return true;
+}
+
+
+} /* namespace trace */
@@ -0,0 +1,138 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Compression of the chunks of seekable traces.
+ *
+ * Snappy, LZ4 and Zstandard traces share the same chunked layout (see
+ * FORMAT.markdown), and only differ in their header and in how each chunk is
+ * compressed.
+ */
+
+#pragma once
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+
+
+namespace trace {
+
+
+enum Codec {
+    CODEC_SNAPPY = 0,
+    CODEC_LZ4,
+    CODEC_ZSTD,
+};
+
+
+struct CodecOptions {
+    Codec codec = CODEC_SNAPPY;
+
+    // Codec specific compression level, or zero for the default
+    int level = 0;
+
+    // Zstandard dictionary, stored in the trace header
+    std::string dictionary;
+};
+
+
+/**
+ * Instances hold whatever compression contexts they need, and therefore must
+ * not be used by several threads at once.
+ */
+class ChunkCodec {
+public:
+    virtual ~ChunkCodec() {}
+
+    virtual size_t
+    maxCompressedLength(size_t length) const = 0;
+
+    /**
+     * Returns the compressed length, or zero on failure.
+     */
+    virtual size_t
+    compress(const char *data, size_t length, char *compressed) = 0;
+
+    virtual bool
+    getUncompressedLength(const char *compressed, size_t compressedLength,
+                          size_t &length) = 0;
+
+    /**
+     * Uncompress into a buffer of the length obtained with
+     * getUncompressedLength.  When partial, the compressed data was
+     * truncated, and as much as possible of it is recovered.  Returns the
+     * uncompressed length, or zero on failure.
+     */
+    virtual size_t
+    uncompress(const char *compressed, size_t compressedLength,
+               char *data, size_t length, bool partial) = 0;
+};
+
+
+/**
+ * Returns null, after logging an error, when the codec isn't supported by
+ * this build.
+ */
+ChunkCodec *
+createChunkCodec(const CodecOptions &options);
+
+const char *
+getCodecName(Codec codec);
+
+/**
+ * Parse a "name[:level]" codec specification.
+ */
+bool
+parseCodecOptions(const char *spec, CodecOptions &options);
+
+/**
+ * Whether the two bytes starting a file are those of a chunked trace, and
+ * with which codec.
+ */
+bool
+getChunkedCodec(unsigned char byte1, unsigned char byte2, Codec &codec);
+
+/**
+ * Serialize the header of a chunked trace.
+ */
+void
+writeChunkedHeader(std::string &header, const CodecOptions &options);
+
+typedef std::function<bool (uint64_t offset, void *buffer, size_t length)> ReadAtFunc;
+
+/**
+ * Parse the header of a chunked trace, given a function which reads from
+ * absolute file offsets, and get the offset of its first chunk.
+ */
+bool
+readChunkedHeader(const ReadAtFunc &readAt, CodecOptions &options, uint64_t &dataOffset);
+
+
+} /* namespace trace */
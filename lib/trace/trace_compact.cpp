@@ -0,0 +1,519 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <string.h>
+#include <wchar.h>
+
+#include "trace_compact.hpp"
+
+
+namespace trace {
+
+
+static_assert(alignof(EnumSig) >= 4 && alignof(BitmaskSig) >= 4,
+              "signature pointers must leave room for the tag bits");
+
+
+static char *
+copyString(const char *str) {
+    size_t len = strlen(str);
+    char *copy = new char[len + 1];
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+
+/*
+ * Deep copy of a value.
+ */
+class ValueCloner : public Visitor
+{
+public:
+    Value *result = nullptr;
+
+    static Value *
+    clone(Value *value) {
+        if (!value) {
+            return nullptr;
+        }
+        ValueCloner cloner;
+        value->visit(cloner);
+        return cloner.result;
+    }
+
+    void visit(Null *) override { result = new Null; }
+    void visit(Bool *node) override { result = new Bool(node->value); }
+    void visit(SInt *node) override { result = new SInt(node->value); }
+    void visit(UInt *node) override { result = new UInt(node->value); }
+    void visit(Float *node) override { result = new Float(node->value); }
+    void visit(Double *node) override { result = new Double(node->value); }
+    void visit(String *node) override { result = new String(copyString(node->value)); }
+    void visit(Enum *node) override { result = new Enum(node->sig, node->value); }
+    void visit(Bitmask *node) override { result = new Bitmask(node->sig, node->value); }
+    void visit(Pointer *node) override { result = new Pointer(node->value); }
+
+    void visit(WString *node) override {
+        size_t len = wcslen(node->value);
+        wchar_t *copy = new wchar_t[len + 1];
+        wmemcpy(copy, node->value, len + 1);
+        result = new WString(copy);
+    }
+
+    void visit(Struct *node) override {
+        Struct *copy = new Struct(const_cast<StructSig *>(node->sig));
+        for (size_t i = 0; i < node->members.size(); ++i) {
+            copy->members[i] = clone(node->members[i]);
+        }
+        result = copy;
+    }
+
+    void visit(Array *node) override {
+        Array *copy = new Array(node->values.size());
+        for (size_t i = 0; i < node->values.size(); ++i) {
+            copy->values[i] = clone(node->values[i]);
+        }
+        result = copy;
+    }
+
+    void visit(Blob *node) override {
+        Blob *copy = new Blob(node->size);
+        memcpy(copy->buf, node->buf, node->size);
+        result = copy;
+    }
+
+    void visit(Repr *node) override {
+        result = new Repr(clone(node->humanValue), clone(node->machineValue));
+    }
+};
+
+
+/*
+ * Fills a CompactValue from a regular value.
+ */
+class CompactValue::Compactor : public Visitor
+{
+protected:
+    CompactValue &cv;
+    bool adopt;
+
+    template< typename T >
+    inline void
+    done(T *node) {
+        if (adopt) {
+            delete node;
+        }
+    }
+
+    inline void
+    outOfLine(Value *node) {
+        cv.setKind(KIND_VALUE);
+        cv.m_data.value = adopt ? node : ValueCloner::clone(node);
+    }
+
+public:
+    Compactor(CompactValue &_cv, bool _adopt) :
+        cv(_cv),
+        adopt(_adopt)
+    {}
+
+    void visit(Null *node) override {
+        cv.setKind(KIND_NULL);
+        done(node);
+    }
+
+    void visit(Bool *node) override {
+        cv.setKind(KIND_BOOL);
+        cv.m_data.b = node->value;
+        done(node);
+    }
+
+    void visit(SInt *node) override {
+        cv.setKind(KIND_SINT);
+        cv.m_data.i = node->value;
+        done(node);
+    }
+
+    void visit(UInt *node) override {
+        cv.setKind(KIND_UINT);
+        cv.m_data.u = node->value;
+        done(node);
+    }
+
+    void visit(Float *node) override {
+        cv.setKind(KIND_FLOAT);
+        cv.m_data.f = node->value;
+        done(node);
+    }
+
+    void visit(Double *node) override {
+        cv.setKind(KIND_DOUBLE);
+        cv.m_data.d = node->value;
+        done(node);
+    }
+
+    void visit(String *node) override {
+        cv.setKind(KIND_STRING);
+        if (adopt) {
+            cv.m_data.str = node->value;
+            node->value = nullptr;
+            delete node;
+        } else {
+            cv.m_data.str = copyString(node->value);
+        }
+    }
+
+    void visit(Enum *node) override {
+        cv.m_tag = reinterpret_cast<uintptr_t>(node->sig) | TAG_ENUM;
+        cv.m_data.i = node->value;
+        done(node);
+    }
+
+    void visit(Bitmask *node) override {
+        cv.m_tag = reinterpret_cast<uintptr_t>(node->sig) | TAG_BITMASK;
+        cv.m_data.u = node->value;
+        done(node);
+    }
+
+    void visit(Pointer *node) override {
+        cv.setKind(KIND_POINTER);
+        cv.m_data.u = node->value;
+        done(node);
+    }
+
+    void visit(WString *node) override { outOfLine(node); }
+    void visit(Struct *node) override { outOfLine(node); }
+    void visit(Array *node) override { outOfLine(node); }
+    void visit(Blob *node) override { outOfLine(node); }
+    void visit(Repr *node) override { outOfLine(node); }
+};
+
+
+CompactValue::CompactValue(Value *value, bool adopt) :
+    m_tag(KIND_NONE << TAG_SHIFT)
+{
+    m_data.u = 0;
+    if (value) {
+        Compactor compactor(*this, adopt);
+        value->visit(compactor);
+    }
+}
+
+
+void
+CompactValue::release(void) {
+    switch (kind()) {
+    case KIND_STRING:
+        delete [] m_data.str;
+        break;
+    case KIND_VALUE:
+        delete m_data.value;
+        break;
+    default:
+        break;
+    }
+    setKind(KIND_NONE);
+}
+
+
+bool
+CompactValue::toBool(void) const {
+    switch (kind()) {
+    case KIND_NONE:
+    case KIND_NULL:
+        return false;
+    case KIND_BOOL:
+        return m_data.b;
+    case KIND_FLOAT:
+        return m_data.f != 0;
+    case KIND_DOUBLE:
+        return m_data.d != 0;
+    case KIND_STRING:
+        return true;
+    case KIND_VALUE:
+        return m_data.value->toBool();
+    default:
+        return m_data.u != 0;
+    }
+}
+
+
+signed long long
+CompactValue::toSInt(void) const {
+    switch (kind()) {
+    case KIND_NULL:
+        return 0;
+    case KIND_BOOL:
+        return static_cast<signed long long>(m_data.b);
+    case KIND_SINT:
+    case KIND_ENUM:
+        return m_data.i;
+    case KIND_UINT:
+    case KIND_BITMASK:
+        assert(static_cast<signed long long>(m_data.u) >= 0);
+        return static_cast<signed long long>(m_data.u);
+    case KIND_FLOAT:
+        return static_cast<signed long long>(m_data.f);
+    case KIND_DOUBLE:
+        return static_cast<signed long long>(m_data.d);
+    case KIND_VALUE:
+        return m_data.value->toSInt();
+    default:
+        assert(0);
+        return 0;
+    }
+}
+
+
+unsigned long long
+CompactValue::toUInt(void) const {
+    switch (kind()) {
+    case KIND_NULL:
+        return 0;
+    case KIND_BOOL:
+        return static_cast<unsigned long long>(m_data.b);
+    case KIND_SINT:
+    case KIND_ENUM:
+        assert(m_data.i >= 0);
+        return static_cast<unsigned long long>(m_data.i);
+    case KIND_UINT:
+    case KIND_BITMASK:
+        return m_data.u;
+    case KIND_FLOAT:
+        return static_cast<unsigned long long>(m_data.f);
+    case KIND_DOUBLE:
+        return static_cast<unsigned long long>(m_data.d);
+    case KIND_VALUE:
+        return m_data.value->toUInt();
+    default:
+        assert(0);
+        return 0;
+    }
+}
+
+
+float
+CompactValue::toFloat(void) const {
+    switch (kind()) {
+    case KIND_FLOAT:
+        return m_data.f;
+    case KIND_DOUBLE:
+        return static_cast<float>(m_data.d);
+    case KIND_SINT:
+    case KIND_ENUM:
+        return static_cast<float>(m_data.i);
+    case KIND_VALUE:
+        return m_data.value->toFloat();
+    default:
+        return static_cast<float>(toUInt());
+    }
+}
+
+
+double
+CompactValue::toDouble(void) const {
+    switch (kind()) {
+    case KIND_FLOAT:
+        return m_data.f;
+    case KIND_DOUBLE:
+        return m_data.d;
+    case KIND_SINT:
+    case KIND_ENUM:
+        return static_cast<double>(m_data.i);
+    case KIND_VALUE:
+        return m_data.value->toDouble();
+    default:
+        return static_cast<double>(toUInt());
+    }
+}
+
+
+void *
+CompactValue::toPointer(void) const {
+    switch (kind()) {
+    case KIND_NULL:
+        return nullptr;
+    case KIND_POINTER:
+        return (void *)m_data.u;
+    case KIND_VALUE:
+        return m_data.value->toPointer();
+    default:
+        assert(0);
+        return nullptr;
+    }
+}
+
+
+const char *
+CompactValue::toString(void) const {
+    switch (kind()) {
+    case KIND_NULL:
+        return nullptr;
+    case KIND_STRING:
+        return m_data.str;
+    case KIND_VALUE:
+        return m_data.value->toString();
+    default:
+        assert(0);
+        return nullptr;
+    }
+}
+
+
+void
+CompactValue::visit(Visitor &visitor) const {
+    switch (kind()) {
+    case KIND_NONE:
+        break;
+    case KIND_NULL: {
+        Null node;
+        visitor.visit(&node);
+        break;
+    }
+    case KIND_BOOL: {
+        Bool node(m_data.b);
+        visitor.visit(&node);
+        break;
+    }
+    case KIND_SINT: {
+        SInt node(m_data.i);
+        visitor.visit(&node);
+        break;
+    }
+    case KIND_UINT: {
+        UInt node(m_data.u);
+        visitor.visit(&node);
+        break;
+    }
+    case KIND_FLOAT: {
+        Float node(m_data.f);
+        visitor.visit(&node);
+        break;
+    }
+    case KIND_DOUBLE: {
+        Double node(m_data.d);
+        visitor.visit(&node);
+        break;
+    }
+    case KIND_POINTER: {
+        Pointer node(m_data.u);
+        visitor.visit(&node);
+        break;
+    }
+    case KIND_STRING: {
+        String node(m_data.str);
+        visitor.visit(&node);
+        node.value = nullptr;
+        break;
+    }
+    case KIND_ENUM: {
+        Enum node(enumSig(), m_data.i);
+        visitor.visit(&node);
+        break;
+    }
+    case KIND_BITMASK: {
+        Bitmask node(bitmaskSig(), m_data.u);
+        visitor.visit(&node);
+        break;
+    }
+    case KIND_VALUE:
+        m_data.value->visit(visitor);
+        break;
+    }
+}
+
+
+Value *
+CompactValue::toValue(void) const {
+    switch (kind()) {
+    case KIND_NONE:
+        return nullptr;
+    case KIND_NULL:
+        return new Null;
+    case KIND_BOOL:
+        return new Bool(m_data.b);
+    case KIND_SINT:
+        return new SInt(m_data.i);
+    case KIND_UINT:
+        return new UInt(m_data.u);
+    case KIND_FLOAT:
+        return new Float(m_data.f);
+    case KIND_DOUBLE:
+        return new Double(m_data.d);
+    case KIND_POINTER:
+        return new Pointer(m_data.u);
+    case KIND_STRING:
+        return new String(copyString(m_data.str));
+    case KIND_ENUM:
+        return new Enum(enumSig(), m_data.i);
+    case KIND_BITMASK:
+        return new Bitmask(bitmaskSig(), m_data.u);
+    case KIND_VALUE:
+        return ValueCloner::clone(m_data.value);
+    }
+    assert(0);
+    return nullptr;
+}
+
+
+CompactCall::CompactCall(Call &call) :
+    thread_id(call.thread_id),
+    no(call.no),
+    sig(call.sig),
+    flags(call.flags),
+    backtrace(call.backtrace)
+{
+    // Values of arena backed calls go away with the call
+    bool adopt = call.arena == nullptr;
+
+    args.reserve(call.args.size());
+    for (auto & arg : call.args) {
+        args.emplace_back(arg.value, adopt);
+        if (adopt) {
+            arg.value = nullptr;
+        }
+    }
+
+    ret = CompactValue(call.ret, adopt);
+    if (adopt) {
+        call.ret = nullptr;
+    }
+}
+
+
+Call *
+CompactCall::toCall(void) const {
+    Call *call = new Call(sig, flags, thread_id);
+    call->no = no;
+    for (size_t i = 0; i < args.size(); ++i) {
+        call->args[i].value = args[i].toValue();
+    }
+    call->ret = ret.toValue();
+    call->backtrace = backtrace;
+    return call;
+}
+
+
+} /* namespace trace */
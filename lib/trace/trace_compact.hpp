@@ -0,0 +1,248 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Compact representation of calls, for tools which keep many of them in
+ * memory at once.
+ *
+ * Scalars, strings, enums and bitmasks are held inline in a 16 bytes tagged
+ * union, while structs, arrays, blobs and the other rare kinds remain
+ * out-of-line trace::Value nodes.
+ */
+
+#pragma once
+
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "trace_model.hpp"
+
+
+namespace trace {
+
+
+class CompactValue
+{
+public:
+    enum Kind {
+        KIND_NONE = 0,  // absent value, i.e, a NULL Value *
+        KIND_NULL,
+        KIND_BOOL,
+        KIND_SINT,
+        KIND_UINT,
+        KIND_FLOAT,
+        KIND_DOUBLE,
+        KIND_POINTER,
+        KIND_STRING,
+        KIND_ENUM,
+        KIND_BITMASK,
+        KIND_VALUE,     // out-of-line node
+    };
+
+    CompactValue() :
+        m_tag(KIND_NONE << TAG_SHIFT)
+    {
+        m_data.u = 0;
+    }
+
+    /**
+     * Take the contents of value.
+     *
+     * When adopt is true, value is consumed (deleted or kept as the
+     * out-of-line node); otherwise it is copied, as needed for values living
+     * in an arena.
+     */
+    CompactValue(Value *value, bool adopt);
+
+    ~CompactValue() {
+        release();
+    }
+
+    CompactValue(CompactValue && other) noexcept :
+        m_data(other.m_data),
+        m_tag(other.m_tag)
+    {
+        other.m_tag = KIND_NONE << TAG_SHIFT;
+    }
+
+    CompactValue &
+    operator = (CompactValue && other) noexcept {
+        if (this != &other) {
+            release();
+            m_data = other.m_data;
+            m_tag = other.m_tag;
+            other.m_tag = KIND_NONE << TAG_SHIFT;
+        }
+        return *this;
+    }
+
+    CompactValue(const CompactValue &) = delete;
+    CompactValue & operator = (const CompactValue &) = delete;
+
+    inline Kind
+    kind(void) const {
+        switch (m_tag & TAG_MASK) {
+        case TAG_ENUM:
+            return KIND_ENUM;
+        case TAG_BITMASK:
+            return KIND_BITMASK;
+        default:
+            return static_cast<Kind>(m_tag >> TAG_SHIFT);
+        }
+    }
+
+    explicit operator bool (void) const {
+        return kind() != KIND_NONE;
+    }
+
+    bool toBool(void) const;
+    signed long long toSInt(void) const;
+    unsigned long long toUInt(void) const;
+    float toFloat(void) const;
+    double toDouble(void) const;
+    void *toPointer(void) const;
+    const char *toString(void) const;
+
+    const EnumSig *
+    enumSig(void) const {
+        assert(kind() == KIND_ENUM);
+        return reinterpret_cast<const EnumSig *>(m_tag & ~TAG_MASK);
+    }
+
+    const BitmaskSig *
+    bitmaskSig(void) const {
+        assert(kind() == KIND_BITMASK);
+        return reinterpret_cast<const BitmaskSig *>(m_tag & ~TAG_MASK);
+    }
+
+    /**
+     * Out-of-line node, or NULL for inline kinds.
+     */
+    Value *
+    value(void) const {
+        return kind() == KIND_VALUE ? m_data.value : nullptr;
+    }
+
+    const Array *toArray(void) const { return kind() == KIND_VALUE ? m_data.value->toArray() : nullptr; }
+    const Struct *toStruct(void) const { return kind() == KIND_VALUE ? m_data.value->toStruct() : nullptr; }
+    Blob *toBlob(void) const { return kind() == KIND_VALUE ? m_data.value->toBlob() : nullptr; }
+
+    /**
+     * Visit as if this was a regular trace::Value.
+     *
+     * Inline kinds are presented as temporaries, so visitors must not keep
+     * the pointers they are given.
+     */
+    void visit(Visitor &visitor) const;
+
+    /**
+     * Expand into a newly allocated trace::Value, or NULL for KIND_NONE.
+     */
+    Value *toValue(void) const;
+
+private:
+    /*
+     * The low bits of the tag tell enums and bitmasks, whose signature
+     * pointer is stored in the remaining bits, from the other kinds.
+     */
+    enum {
+        TAG_KIND = 0,
+        TAG_ENUM = 1,
+        TAG_BITMASK = 2,
+        TAG_MASK = 3,
+        TAG_SHIFT = 2,
+    };
+
+    union {
+        bool b;
+        signed long long i;
+        unsigned long long u;
+        float f;
+        double d;
+        const char *str;
+        Value *value;
+    } m_data;
+
+    uintptr_t m_tag;
+
+    class Compactor;
+
+    inline void
+    setKind(Kind kind) {
+        m_tag = uintptr_t(kind) << TAG_SHIFT;
+    }
+
+    void release(void);
+};
+
+static_assert(sizeof(CompactValue) <= 16, "CompactValue should be 16 bytes or less");
+
+
+/**
+ * Compact counterpart of trace::Call.
+ */
+class CompactCall
+{
+public:
+    unsigned thread_id;
+    unsigned no;
+    const FunctionSig *sig;
+    std::vector<CompactValue> args;
+    CompactValue ret;
+
+    CallFlags flags;
+    Backtrace* backtrace;
+
+    /**
+     * Move the values out of call, which is left without arguments and
+     * should be deleted afterwards.  Values of arena backed calls are
+     * copied.
+     */
+    explicit CompactCall(Call &call);
+
+    inline const char *
+    name(void) const {
+        return sig->name;
+    }
+
+    inline const CompactValue &
+    arg(unsigned index) const {
+        assert(index < args.size());
+        return args[index];
+    }
+
+    /**
+     * Expand into a newly allocated trace::Call, for the code which expects
+     * one, such as the retracers.
+     */
+    Call *toCall(void) const;
+};
+
+
+} /* namespace trace */
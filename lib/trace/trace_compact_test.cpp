@@ -0,0 +1,161 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <string.h>
+
+#include <sstream>
+#include <string>
+
+#include "trace_compact.hpp"
+#include "trace_dump.hpp"
+
+#include "gtest/gtest.h"
+
+
+using namespace trace;
+
+
+static const char *arg_names[] = {"a", "b", "c", "d", "e", "f", "g", "h", "i", "j"};
+static const FunctionSig sig = {0, "glFoo", 10, arg_names};
+
+static const EnumValue enum_values[] = {{"GL_ONE", 1}, {"GL_TWO", 2}};
+static const EnumSig enum_sig = {0, 2, enum_values};
+
+static const BitmaskFlag bitmask_flags[] = {{"GL_BIT0", 1}, {"GL_BIT1", 2}};
+static const BitmaskSig bitmask_sig = {0, 2, bitmask_flags};
+
+static const char *member_names[] = {"x", "y"};
+static StructSig struct_sig = {0, "Point", 2, member_names};
+
+
+static char *
+newString(const char *str) {
+    char *copy = new char[strlen(str) + 1];
+    strcpy(copy, str);
+    return copy;
+}
+
+
+static Call *
+newCall(Arena *arena = nullptr) {
+    Call *call = new Call(&sig, 0, 7, arena);
+    call->no = 42;
+    call->args[0].value = new UInt(1234);
+    call->args[1].value = new SInt(-5);
+    call->args[2].value = new Float(0.5f);
+    call->args[3].value = new String(newString("hello"));
+    call->args[4].value = new Enum(&enum_sig, 2);
+    call->args[5].value = new Bitmask(&bitmask_sig, 3);
+    call->args[6].value = new Pointer(0x1000);
+
+    Struct *point = new Struct(&struct_sig);
+    point->members[0] = new SInt(1);
+    point->members[1] = new Double(2.5);
+    call->args[7].value = point;
+
+    Array *array = new Array(2);
+    array->values[0] = new Bool(true);
+    array->values[1] = new Null;
+    call->args[8].value = array;
+
+    // args[9] left absent
+
+    call->ret = new Blob(3);
+    memcpy(call->ret->toBlob()->buf, "abc", 3);
+    return call;
+}
+
+
+template< typename C >
+static std::string
+dumpCall(C &call) {
+    std::ostringstream os;
+    dump(call, os, DUMP_FLAG_NO_COLOR);
+    return os.str();
+}
+
+
+TEST(trace_compact, size)
+{
+    EXPECT_LE(sizeof(CompactValue), 16);
+}
+
+
+TEST(trace_compact, roundtrip)
+{
+    Call *call = newCall();
+    std::string expected = dumpCall(*call);
+
+    CompactCall compact(*call);
+    delete call;
+
+    EXPECT_EQ(compact.no, 42);
+    EXPECT_EQ(compact.thread_id, 7);
+    EXPECT_EQ(compact.arg(0).kind(), CompactValue::KIND_UINT);
+    EXPECT_EQ(compact.arg(0).toUInt(), 1234);
+    EXPECT_EQ(compact.arg(1).toSInt(), -5);
+    EXPECT_STREQ(compact.arg(3).toString(), "hello");
+    EXPECT_EQ(compact.arg(4).enumSig(), &enum_sig);
+    EXPECT_EQ(compact.arg(5).bitmaskSig(), &bitmask_sig);
+    EXPECT_EQ(compact.arg(6).toPointer(), (void *)0x1000);
+    EXPECT_TRUE(compact.arg(7).toStruct() != nullptr);
+    EXPECT_FALSE(compact.arg(9));
+
+    EXPECT_EQ(dumpCall(compact), expected);
+
+    Call *expanded = compact.toCall();
+    EXPECT_EQ(dumpCall(*expanded), expected);
+    delete expanded;
+}
+
+
+TEST(trace_compact, arena)
+{
+    // Values of arena backed calls are copied rather than adopted.  Here
+    // they actually live on the heap, so release them by hand afterwards.
+    Call *call = newCall(new Arena);
+    std::string expected = dumpCall(*call);
+
+    CompactCall compact(*call);
+    ASSERT_TRUE(compact.arg(7).value() != nullptr);
+    EXPECT_TRUE(compact.arg(7).value() != call->args[7].value);
+
+    for (auto & arg : call->args) {
+        delete arg.value;
+    }
+    delete call->ret;
+    delete call;
+
+    EXPECT_EQ(dumpCall(compact), expected);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
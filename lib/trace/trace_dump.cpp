@@ -253,7 +253,18 @@ void Dumper::visit(Backtrace & backtrace) {
     }
 }
 
-void Dumper::visit(Call *call)
+static inline Value *
+argValue(const Arg &arg) {
+    return arg.value;
+}
+
+static inline const CompactValue &
+argValue(const CompactValue &arg) {
+    return arg;
+}
+
+template< typename C >
+void Dumper::visitCall(C *call)
 {
     CallFlags callFlags = call->flags;
 
@@ -280,8 +291,8 @@ void Dumper::visit(Call *call)
         if (!(dumpFlags & DUMP_FLAG_NO_ARG_NAMES)) {
             os << italic << call->sig->arg_names[i] << normal << " = ";
         }
-        if (call->args[i].value) {
-            _visit(call->args[i].value);
+        if (argValue(call->args[i])) {
+            _visit(argValue(call->args[i]));
         } else {
            os << "?";
         }
@@ -319,16 +330,43 @@ void Dumper::visit(Call *call)
 }
 
 
+void Dumper::visit(Call *call)
+{
+    visitCall(call);
+}
+
+void Dumper::visit(CompactCall *call)
+{
+    visitCall(call);
+}
+
 void dump(Value *value, std::ostream &os, DumpFlags flags) {
     Dumper d(os, flags);
     value->visit(d);
 }
 
 
+std::ostream &
+operator << (std::ostream &os, Value *value) {
+    if (value) {
+        dump(value, os);
+    } else {
+        os << "NULL";
+    }
+    return os;
+}
+
+
 void dump(Call &call, std::ostream &os, DumpFlags flags) {
     Dumper d(os, flags);
     d.visit(&call);
 }
 
 
+void dump(CompactCall &call, std::ostream &os, DumpFlags flags) {
+    Dumper d(os, flags);
+    d.visit(&call);
+}
+
+
 } /* namespace trace */
@@ -72,5 +72,10 @@ inline std::ostream & operator <<(std::ostream &os, Call &call) {
 }
 
 
+class CompactCall;
+
+void dump(CompactCall &call, std::ostream &os, DumpFlags flags = 0);
+
+
 } /* namespace trace */
 
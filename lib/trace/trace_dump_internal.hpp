@@ -27,6 +27,7 @@
 #pragma once
 
 #include "highlight.hpp"
+#include "trace_compact.hpp"
 #include "trace_dump.hpp"
 
 
@@ -74,6 +75,17 @@ public:
     virtual void visit(StackFrame *frame);
     virtual void visit(Backtrace & backtrace);
     virtual void visit(Call *call);
+    virtual void visit(CompactCall *call);
+
+protected:
+    using Visitor::_visit;
+
+    inline void _visit(const CompactValue &value) {
+        value.visit(*this);
+    }
+
+    template< typename C >
+    void visitCall(C *call);
 };
 
 
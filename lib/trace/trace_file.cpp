@@ -58,3 +58,13 @@ void File::setCurrentOffset(const File::Offset &offset)
     assert(0);
 }
 
+std::shared_ptr<char> File::pinWindow(void)
+{
+    return nullptr;
+}
+
+bool File::getIndex(std::string &data) const
+{
+    return false;
+}
+
@@ -27,7 +27,11 @@
 #pragma once
 
 #include <fstream>
+#include <memory>
+#include <string>
+#include <assert.h>
 #include <stdint.h>
+#include <string.h>
 
 
 namespace trace {
@@ -46,14 +50,25 @@ public:
 public:
     static File *createZLib(void);
     static File *createBrotli(void);
-    static File *createSnappy(void);
-    static File *createForRead(const char *filename);
+    /**
+     * Snappy, LZ4 or Zstandard compressed traces, as told by their header.
+     */
+    static File *createChunked(void);
+    static File *createForRead(const char *filename, bool readAhead = true);
 public:
     File(void);
     virtual ~File();
 
     bool isOpened(void) const;
 
+    /**
+     * Whether the implementation may read and decompress ahead on background
+     * threads.  Must be set before opening.
+     */
+    void setReadAhead(bool enable) {
+        m_readAhead = enable;
+    }
+
     bool open(const char *filename);
     size_t read(void *buffer, size_t length);
     void close(void);
@@ -61,9 +76,37 @@ public:
     bool skip(size_t length);
     int percentRead(void);
 
+    /**
+     * Contiguous data which can be consumed right away, without further
+     * decompression.  It may be empty (e.g., at chunk boundaries, or for
+     * implementations which don't expose their buffers), in which case the
+     * regular methods must be used instead.
+     */
+    inline const char *peek(size_t &length) const {
+        length = m_windowEnd - m_windowPtr;
+        return m_windowPtr;
+    }
+
+    inline void advance(size_t length) {
+        assert(length <= size_t(m_windowEnd - m_windowPtr));
+        m_windowPtr += length;
+    }
+
+    /**
+     * Share ownership of the buffer backing the current window, so that data
+     * obtained with peek() remains valid after the window moves on.  Returns
+     * null when the implementation doesn't support it.
+     */
+    virtual std::shared_ptr<char> pinWindow(void);
+
     virtual bool supportsOffsets(void) const;
     virtual File::Offset currentOffset(void) const;
     virtual void setCurrentOffset(const File::Offset &offset);
+
+    /**
+     * Get the serialized trace index, if the file has one.
+     */
+    virtual bool getIndex(std::string &data) const;
 protected:
     virtual bool rawOpen(const char *filename) = 0;
     virtual size_t rawRead(void *buffer, size_t length) = 0;
@@ -74,6 +117,15 @@ protected:
 
 protected:
     bool m_isOpened = false;
+    bool m_readAhead = true;
+
+    /*
+     * Window of decompressed data, which implementations keep pointing into
+     * their read buffer, so that the inline methods can consume data without
+     * virtual calls.
+     */
+    const char *m_windowPtr = nullptr;
+    const char *m_windowEnd = nullptr;
 };
 
 inline bool File::isOpened(void) const
@@ -93,6 +145,11 @@ inline bool File::open(const char *filename)
 
 inline size_t File::read(void *buffer, size_t length)
 {
+    if (size_t(m_windowEnd - m_windowPtr) >= length) {
+        memcpy(buffer, m_windowPtr, length);
+        m_windowPtr += length;
+        return length;
+    }
     if (!m_isOpened) {
         return 0;
     }
@@ -117,6 +174,9 @@ inline void File::close(void)
 
 inline int File::getc(void)
 {
+    if (m_windowPtr < m_windowEnd) {
+        return (unsigned char)*m_windowPtr++;
+    }
     if (!m_isOpened) {
         return -1;
     }
@@ -125,6 +185,10 @@ inline int File::getc(void)
 
 inline bool File::skip(size_t length)
 {
+    if (size_t(m_windowEnd - m_windowPtr) >= length) {
+        m_windowPtr += length;
+        return true;
+    }
     if (!m_isOpened) {
         return false;
     }
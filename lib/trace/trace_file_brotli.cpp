@@ -53,6 +53,8 @@ protected:
     virtual bool rawSkip(size_t length) override;
     virtual int  rawPercentRead(void) override;
 private:
+    bool fillInput(void);
+
     BrotliDecoderState *state;
     std::ifstream m_stream;
     static const size_t kFileBufferSize = 65536;
@@ -96,18 +98,17 @@ size_t BrotliFile::rawRead(void *buffer, size_t length)
                                                &available_in, &next_in,
                                                &available_out, &next_out, &total_out);
         if (result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
-            if (m_stream.fail()) {
+            if (!fillInput()) {
                 break;
             }
-            m_stream.read((char *)input, kFileBufferSize);
-            available_in = kFileBufferSize;
-            if (m_stream.fail()) {
-                available_in = m_stream.gcount();
-                if (!available_in) {
-                    break;
-                }
+        } else if (result == BROTLI_DECODER_RESULT_SUCCESS && available_out) {
+            // Traces repacked on several threads consist of several
+            // concatenated streams
+            if (!available_in && !fillInput()) {
+                break;
             }
-            next_in = input;
+            BrotliDecoderDestroyInstance(state);
+            state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
         } else {
             assert(result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT ||
                    result == BROTLI_DECODER_RESULT_SUCCESS);
@@ -120,6 +121,23 @@ size_t BrotliFile::rawRead(void *buffer, size_t length)
     return next_out - output;
 }
 
+bool BrotliFile::fillInput(void)
+{
+    if (m_stream.fail()) {
+        return false;
+    }
+    m_stream.read((char *)input, kFileBufferSize);
+    available_in = kFileBufferSize;
+    if (m_stream.fail()) {
+        available_in = m_stream.gcount();
+        if (!available_in) {
+            return false;
+        }
+    }
+    next_in = input;
+    return true;
+}
+
 int BrotliFile::rawGetc()
 {
     unsigned char c;
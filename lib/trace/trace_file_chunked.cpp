@@ -0,0 +1,1111 @@
+/**************************************************************************
+ *
+ * Copyright 2011 Zack Rusin
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Chunked file format.
+ * --------------------
+ *
+ * Snappy at its core is just a compressoin algorithm so we're
+ * creating a new file format which uses snappy compression
+ * to hold the trace data.  LZ4 and Zstandard compressed traces
+ * use the same format, with a different header (see
+ * trace_codec.hpp).
+ *
+ * The file is composed of a number of chunks, they are:
+ * chunk {
+ *     uint32 - specifying the length of the compressed data
+ *     compressed data, in little endian
+ * }
+ * File can contain any number of such chunks.
+ * The default size of an uncompressed chunk is specified in
+ * SNAPPY_CHUNK_SIZE.
+ *
+ * The file may end with an index pseudo-chunk, as described in
+ * FORMAT.markdown, which is not part of the trace data.
+ *
+ * Note:
+ * Currently the default size for a a to-be-compressed data is
+ * 1mb, meaning that the compressed data will be <= 1mb.
+ * The reason it's 1mb is because it seems
+ * to offer a pretty good compression/disk io speed ratio
+ * but that might change.
+ *
+ */
+
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "os_thread.hpp"
+#include "trace_codec.hpp"
+#include "trace_file.hpp"
+#include "trace_snappy.hpp"
+
+
+/*
+ * Maximum number of read-ahead decompression threads.  Each thread keeps
+ * about two chunks worth of memory busy, so there is little point in going
+ * much further than this.
+ */
+#define SNAPPY_MAX_READ_AHEAD_THREADS 4
+
+/*
+ * How much of a memory mapped file to prefetch after seeking.
+ */
+#define SNAPPY_MAP_WILLNEED_SIZE (8 * SNAPPY_CHUNK_SIZE)
+
+
+
+using namespace trace;
+
+
+/*
+ * Decompressed chunks are reference counted, so that blobs may point into
+ * them (see File::pinWindow).
+ */
+typedef std::shared_ptr<char> ChunkBuffer;
+
+
+/**
+ * Get a buffer of at least the given size to decompress into, replacing
+ * rather than overwriting the current one when it's still pinned.
+ */
+static char *
+reserveChunkBuffer(ChunkBuffer &buffer, size_t &maxSize, size_t size)
+{
+    if (!buffer || size > maxSize || buffer.use_count() > 1) {
+        maxSize = std::max(maxSize, size);
+        buffer.reset(new char[maxSize], std::default_delete<char[]>());
+    } else {
+        // Pair with the release of the last pin, possibly on another thread
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return buffer.get();
+}
+
+
+/**
+ * Uncompress a chunk into the given buffer, returning its size.
+ */
+static size_t
+uncompressChunk(ChunkCodec *codec, const char *compressed, size_t compressedLength,
+                bool partial, ChunkBuffer &buffer, size_t &maxSize)
+{
+    if (partial) {
+        std::cerr << "warning: unexpected end of file while reading trace\n";
+    }
+
+    size_t size;
+    if (!codec->getUncompressedLength(compressed, compressedLength, size)) {
+        return 0;
+    }
+
+    char *data = reserveChunkBuffer(buffer, maxSize, size);
+
+    return codec->uncompress(compressed, compressedLength, data, size, partial);
+}
+
+
+/**
+ * Source of compressed chunks.
+ *
+ * Whenever possible the whole file is memory mapped, so that chunks can be
+ * decompressed straight from the page cache without intermediate copies.
+ * Otherwise it falls back to reading through a std::ifstream.
+ */
+class ChunkReader {
+public:
+    ChunkReader(void) {}
+    ~ChunkReader();
+
+    /**
+     * Open the file, skip the header, and load the index if there is one.
+     */
+    bool open(const char *filename);
+    void close(void);
+
+    uint64_t size(void) const {
+        return m_size;
+    }
+
+    bool isMapped(void) const {
+        return m_mapping != nullptr;
+    }
+
+    bool eof(void) const {
+        return m_eof;
+    }
+
+    const std::string &index(void) const {
+        return m_index;
+    }
+
+    /**
+     * Create a codec for the chunks, for the exclusive use of the caller.
+     */
+    ChunkCodec *createCodec(void) const {
+        return createChunkCodec(m_options);
+    }
+
+    /**
+     * Size of the buffer to pass to read().
+     */
+    size_t maxCompressedLength(void) const {
+        return m_maxCompressedLength;
+    }
+
+    uint64_t tell(void) const {
+        return m_pos;
+    }
+
+    void seek(uint64_t offset);
+
+    /**
+     * Read the next chunk.
+     *
+     * Returns a pointer to the compressed data, which either points into the
+     * file mapping or to the given buffer, or null at the end of file.
+     * `partial` is set when the chunk was truncated.
+     */
+    const char *read(char *buffer, size_t &length, bool &partial);
+
+private:
+    std::ifstream m_stream;
+
+    const char *m_mapping = nullptr;
+    uint64_t m_size = 0;
+    uint64_t m_pos = 0;
+    bool m_eof = false;
+
+    /* Start of the chunks, right after the header */
+    uint64_t m_dataStart = 0;
+
+    /* End of the chunks, which is where the index starts, if any */
+    uint64_t m_dataEnd = 0;
+
+    CodecOptions m_options;
+    size_t m_maxCompressedLength = 0;
+
+    /* Uncompressed index */
+    std::string m_index;
+
+    bool map(const char *filename);
+    void unmap(void);
+    void willNeed(void);
+
+    bool readAt(uint64_t offset, void *buffer, size_t length);
+    void readIndex(ChunkCodec *codec);
+};
+
+
+ChunkReader::~ChunkReader()
+{
+    close();
+}
+
+
+bool
+ChunkReader::map(const char *filename)
+{
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize) ||
+        fileSize.QuadPart <= 0 ||
+        uint64_t(fileSize.QuadPart) != size_t(fileSize.QuadPart)) {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hFile);
+    if (!hMapping) {
+        return false;
+    }
+
+    // The view keeps the mapping and file objects alive
+    void *mapping = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hMapping);
+    if (!mapping) {
+        return false;
+    }
+
+    m_size = fileSize.QuadPart;
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        !S_ISREG(st.st_mode) ||
+        st.st_size <= 0 ||
+        uint64_t(st.st_size) != size_t(st.st_size)) {
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping keeps the file referenced
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+
+    m_size = st.st_size;
+#endif
+
+    m_mapping = static_cast<const char *>(mapping);
+    m_pos = 0;
+    m_eof = false;
+    willNeed();
+
+    return true;
+}
+
+
+void
+ChunkReader::unmap(void)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(m_mapping);
+#else
+    munmap(const_cast<char *>(m_mapping), m_size);
+#endif
+    m_mapping = nullptr;
+}
+
+
+/**
+ * Hint the kernel to start reading the pages following the current
+ * position.
+ */
+void
+ChunkReader::willNeed(void)
+{
+#ifndef _WIN32
+    static const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    uint64_t begin = m_pos & ~(pageSize - 1);
+    if (begin < m_size) {
+        uint64_t length = std::min(m_size - begin, uint64_t(SNAPPY_MAP_WILLNEED_SIZE));
+        madvise(const_cast<char *>(m_mapping) + begin, length, MADV_WILLNEED);
+    }
+#endif
+}
+
+
+/**
+ * Read from an absolute file offset.  Only meant to be used while opening,
+ * as it moves the stream position.
+ */
+bool
+ChunkReader::readAt(uint64_t offset, void *buffer, size_t length)
+{
+    if (offset > m_size || m_size - offset < length) {
+        return false;
+    }
+
+    if (m_mapping) {
+        memcpy(buffer, m_mapping + offset, length);
+        return true;
+    }
+
+    m_stream.clear();
+    m_stream.seekg(offset, std::ios::beg);
+    m_stream.read(static_cast<char *>(buffer), length);
+    return !m_stream.fail();
+}
+
+
+static inline uint32_t
+decodeUInt32(const unsigned char *buf)
+{
+    return  (uint32_t)buf[0]        |
+           ((uint32_t)buf[1] <<  8) |
+           ((uint32_t)buf[2] << 16) |
+           ((uint32_t)buf[3] << 24);
+}
+
+
+/**
+ * Look for the index pseudo-chunk at the end of the file.
+ */
+void
+ChunkReader::readIndex(ChunkCodec *codec)
+{
+    static const size_t minSize =
+        4 + SNAPPY_INDEX_MARKER_SIZE + SNAPPY_INDEX_TRAILER_SIZE;
+    if (m_size < m_dataStart + minSize) {
+        return;
+    }
+
+    unsigned char trailer[SNAPPY_INDEX_TRAILER_SIZE];
+    if (!readAt(m_size - sizeof trailer, trailer, sizeof trailer) ||
+        memcmp(trailer + 8, SNAPPY_INDEX_MAGIC, 4) != 0) {
+        return;
+    }
+
+    uint64_t offset = decodeUInt32(trailer) |
+                      (uint64_t(decodeUInt32(trailer + 4)) << 32);
+    if (offset < m_dataStart || offset > m_size - minSize) {
+        return;
+    }
+
+    // The pseudo-chunk must span until the end of file
+    unsigned char header[4 + SNAPPY_INDEX_MARKER_SIZE];
+    if (!readAt(offset, header, sizeof header) ||
+        decodeUInt32(header) != m_size - offset - 4) {
+        return;
+    }
+    for (size_t i = 4; i < sizeof header; ++i) {
+        if (header[i] != (unsigned char)SNAPPY_INDEX_MARKER_BYTE) {
+            return;
+        }
+    }
+
+    uint64_t compressedOffset = offset + sizeof header;
+    size_t compressedLength = m_size - SNAPPY_INDEX_TRAILER_SIZE - compressedOffset;
+    std::vector<char> compressed(compressedLength);
+    size_t length = 0;
+    if (readAt(compressedOffset, compressed.data(), compressedLength) &&
+        codec->getUncompressedLength(compressed.data(), compressedLength, length)) {
+        m_index.resize(length);
+    }
+    if (m_index.empty() ||
+        codec->uncompress(compressed.data(), compressedLength,
+                          &m_index[0], length, false) != length) {
+        std::cerr << "warning: ignoring corrupted trace index\n";
+        m_index.clear();
+        return;
+    }
+
+    m_dataEnd = offset;
+}
+
+
+bool
+ChunkReader::open(const char *filename)
+{
+    if (!map(filename)) {
+        m_stream.open(filename, std::fstream::binary | std::fstream::in);
+        if (!m_stream.is_open()) {
+            return false;
+        }
+
+        m_stream.seekg(0, std::ios::end);
+        m_size = m_stream.tellg();
+    }
+
+    auto readAtFunc = [this] (uint64_t offset, void *buffer, size_t length) {
+        return readAt(offset, buffer, length);
+    };
+    if (!readChunkedHeader(readAtFunc, m_options, m_dataStart)) {
+        close();
+        return false;
+    }
+
+    std::unique_ptr<ChunkCodec> codec(createCodec());
+    if (!codec) {
+        close();
+        return false;
+    }
+    m_maxCompressedLength = codec->maxCompressedLength(SNAPPY_CHUNK_SIZE);
+
+    m_dataEnd = m_size;
+    m_index.clear();
+    readIndex(codec.get());
+
+    seek(m_dataStart);
+
+    return true;
+}
+
+
+void
+ChunkReader::close(void)
+{
+    if (m_mapping) {
+        unmap();
+    }
+    m_stream.close();
+    m_index.clear();
+}
+
+
+void
+ChunkReader::seek(uint64_t offset)
+{
+    m_pos = std::min(offset, m_dataEnd);
+    m_eof = false;
+    if (m_mapping) {
+        willNeed();
+    } else {
+        // to remove eof bit
+        m_stream.clear();
+        m_stream.seekg(m_pos, std::ios::beg);
+    }
+}
+
+
+const char *
+ChunkReader::read(char *buffer, size_t &length, bool &partial)
+{
+    unsigned char buf[4];
+    partial = false;
+    length = 0;
+
+    if (m_dataEnd - m_pos < sizeof buf) {
+        m_pos = m_dataEnd;
+        m_eof = true;
+        return nullptr;
+    }
+
+    if (m_mapping) {
+        memcpy(buf, m_mapping + m_pos, sizeof buf);
+    } else {
+        m_stream.read((char *)buf, sizeof buf);
+        if (m_stream.fail()) {
+            m_eof = true;
+            return nullptr;
+        }
+    }
+    m_pos += sizeof buf;
+
+    length = decodeUInt32(buf);
+    if (!length) {
+        m_eof = true;
+        return nullptr;
+    }
+
+    if (m_dataEnd - m_pos < length) {
+        length = m_dataEnd - m_pos;
+        partial = true;
+    }
+
+    if (!m_mapping && length > m_maxCompressedLength) {
+        std::cerr << "warning: invalid chunk length while reading trace\n";
+        length = 0;
+        m_eof = true;
+        return nullptr;
+    }
+
+    const char *data;
+    if (m_mapping) {
+        data = m_mapping + m_pos;
+    } else {
+        m_stream.read(buffer, length);
+        if (m_stream.fail()) {
+            length = m_stream.gcount();
+            partial = true;
+        }
+        data = buffer;
+    }
+
+    m_pos += length;
+    if (partial || m_pos == m_dataEnd) {
+        m_eof = true;
+    }
+
+    return data;
+}
+
+
+/**
+ * Number of read-ahead threads to use, as specified by the
+ * APITRACE_READ_AHEAD environment variable.  Zero disables read-ahead.
+ */
+static unsigned
+getReadAheadThreads(void)
+{
+    const char *env = getenv("APITRACE_READ_AHEAD");
+    if (env) {
+        return std::min(unsigned(atoi(env)), unsigned(SNAPPY_MAX_READ_AHEAD_THREADS));
+    }
+
+    unsigned numCpus = os::thread::hardware_concurrency();
+    if (numCpus <= 1) {
+        return 0;
+    }
+    return std::min(numCpus - 1, unsigned(SNAPPY_MAX_READ_AHEAD_THREADS));
+}
+
+
+/**
+ * Pool of threads which read and decompress the chunks following the one
+ * currently being parsed into a ring of buffers.
+ *
+ * Reading from the file is serialized (and therefore sequential) but
+ * decompression happens concurrently.  Chunks are handed out to the consumer
+ * strictly in file order.
+ */
+class ChunkReadAhead {
+public:
+    struct Chunk {
+        enum State {
+            EMPTY = 0,
+            BUSY,
+            READY,
+        };
+
+        State state = EMPTY;
+
+        /* Offset of the chunk in the file */
+        uint64_t offset = 0;
+
+        /* Whether the end of file was reached while reading this chunk */
+        bool end = false;
+
+        /* Only used when the file is not memory mapped */
+        char *compressed = nullptr;
+
+        ChunkBuffer data;
+        size_t size = 0;
+        size_t maxSize = 0;
+    };
+
+    ChunkReadAhead(ChunkReader &reader, unsigned numThreads);
+    ~ChunkReadAhead();
+
+    /**
+     * Release the chunk previously returned and wait for the next one.
+     *
+     * Returns null once the last chunk has been consumed.
+     */
+    const Chunk *next(void);
+
+    /**
+     * Discard all chunks read so far, and restart reading at the given file
+     * offset.
+     */
+    void seek(uint64_t offset);
+
+private:
+    ChunkReader &m_reader;
+
+    os::mutex m_mutex;
+    os::condition_variable m_readyCond;
+    os::condition_variable m_freeCond;
+
+    std::vector<Chunk> m_chunks;
+
+    /* Sequence number of the next chunk to be read from the file */
+    uint64_t m_nextRead = 0;
+
+    /* Sequence number of the next chunk to be handed to the consumer */
+    uint64_t m_nextConsume = 0;
+
+    /* Whether the consumer still holds chunk m_nextConsume - 1 */
+    bool m_held = false;
+
+    /* Number of chunks being read/decompressed */
+    unsigned m_busy = 0;
+
+    bool m_eof = false;
+    bool m_paused = false;
+    bool m_stop = false;
+
+    std::vector<os::thread> m_threads;
+
+    void worker(void);
+};
+
+
+ChunkReadAhead::ChunkReadAhead(ChunkReader &reader, unsigned numThreads) :
+    m_reader(reader),
+    m_chunks(2 * numThreads + 1)
+{
+    for (auto & chunk : m_chunks) {
+        if (!m_reader.isMapped()) {
+            chunk.compressed = new char[m_reader.maxCompressedLength()];
+        }
+        chunk.maxSize = SNAPPY_CHUNK_SIZE;
+        reserveChunkBuffer(chunk.data, chunk.maxSize, chunk.maxSize);
+    }
+
+    for (unsigned i = 0; i < numThreads; ++i) {
+        m_threads.emplace_back(&ChunkReadAhead::worker, this);
+    }
+}
+
+
+ChunkReadAhead::~ChunkReadAhead()
+{
+    {
+        os::unique_lock<os::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_freeCond.notify_all();
+
+    for (auto & thread : m_threads) {
+        thread.join();
+    }
+
+    for (auto & chunk : m_chunks) {
+        delete [] chunk.compressed;
+    }
+}
+
+
+void
+ChunkReadAhead::worker(void)
+{
+    std::unique_ptr<ChunkCodec> codec(m_reader.createCodec());
+
+    os::unique_lock<os::mutex> lock(m_mutex);
+
+    while (true) {
+        while (!m_stop &&
+               (m_eof || m_paused ||
+                m_nextRead - (m_nextConsume - m_held) >= m_chunks.size())) {
+            m_freeCond.wait(lock);
+        }
+        if (m_stop) {
+            return;
+        }
+
+        Chunk &chunk = m_chunks[m_nextRead % m_chunks.size()];
+        ++m_nextRead;
+        assert(chunk.state == Chunk::EMPTY);
+        chunk.state = Chunk::BUSY;
+        ++m_busy;
+
+        // Read the compressed data while holding the lock, so that the file
+        // is read sequentially.
+        chunk.offset = m_reader.tell();
+        size_t compressedLength;
+        bool partial;
+        const char *compressed = m_reader.read(chunk.compressed, compressedLength, partial);
+        chunk.end = m_reader.eof();
+        if (chunk.end) {
+            m_eof = true;
+        }
+
+        lock.unlock();
+
+        if (compressed && codec) {
+            chunk.size = uncompressChunk(codec.get(), compressed, compressedLength,
+                                         partial, chunk.data, chunk.maxSize);
+        } else {
+            chunk.size = 0;
+        }
+
+        lock.lock();
+
+        chunk.state = Chunk::READY;
+        --m_busy;
+        m_readyCond.notify_all();
+    }
+}
+
+
+const ChunkReadAhead::Chunk *
+ChunkReadAhead::next(void)
+{
+    os::unique_lock<os::mutex> lock(m_mutex);
+
+    if (m_held) {
+        Chunk &prev = m_chunks[(m_nextConsume - 1) % m_chunks.size()];
+        if (prev.end) {
+            // Nothing follows the last chunk
+            return nullptr;
+        }
+        prev.state = Chunk::EMPTY;
+        m_held = false;
+        m_freeCond.notify_all();
+    }
+
+    Chunk &chunk = m_chunks[m_nextConsume % m_chunks.size()];
+    while (m_nextRead <= m_nextConsume || chunk.state != Chunk::READY) {
+        m_readyCond.wait(lock);
+    }
+
+    ++m_nextConsume;
+    m_held = true;
+
+    return &chunk;
+}
+
+
+void
+ChunkReadAhead::seek(uint64_t offset)
+{
+    os::unique_lock<os::mutex> lock(m_mutex);
+
+    // Wait for the chunks in flight
+    m_paused = true;
+    while (m_busy) {
+        m_readyCond.wait(lock);
+    }
+
+    for (auto & chunk : m_chunks) {
+        chunk.state = Chunk::EMPTY;
+    }
+    m_nextRead = 0;
+    m_nextConsume = 0;
+    m_held = false;
+    m_eof = false;
+
+    m_reader.seek(offset);
+
+    m_paused = false;
+    m_freeCond.notify_all();
+}
+
+
+class ChunkedFile : public File {
+public:
+    ChunkedFile(void);
+    virtual ~ChunkedFile();
+
+    virtual bool supportsOffsets(void) const override;
+    virtual File::Offset currentOffset(void) const override;
+    virtual void setCurrentOffset(const File::Offset &offset) override;
+    virtual bool getIndex(std::string &data) const override;
+    virtual std::shared_ptr<char> pinWindow(void) override;
+protected:
+    virtual bool rawOpen(const char *filename) override;
+    virtual size_t rawRead(void *buffer, size_t length) override;
+    virtual int rawGetc(void) override;
+    virtual void rawClose(void) override;
+    virtual bool rawSkip(size_t length) override;
+    virtual int rawPercentRead(void) override;
+
+private:
+    inline size_t usedCacheSize(void) const
+    {
+        assert(m_windowPtr >= m_cache);
+        return m_windowPtr - m_cache;
+    }
+    inline size_t freeCacheSize(void) const
+    {
+        assert(m_windowEnd >= m_windowPtr);
+        return m_windowEnd - m_windowPtr;
+    }
+    inline bool endOfData(void) const
+    {
+        return m_endOfFile && freeCacheSize() == 0;
+    }
+    void flushWriteCache(void);
+    void flushReadCache(size_t skipLength = 0);
+    void createCache(size_t size);
+    void setCache(const ChunkBuffer &buffer, size_t size);
+private:
+    ChunkReader m_reader;
+    size_t m_cacheMaxSize;
+    size_t m_cacheSize;
+    char *m_cache;
+
+    /* Buffer backing m_cache, if any */
+    ChunkBuffer m_cacheBuffer;
+
+    /* Codec and buffer for reading without read-ahead */
+    ChunkCodec *m_codec;
+    char *m_compressedCache;
+
+    uint64_t m_currentChunkOffset;
+    bool m_endOfFile;
+
+    /*
+     * When not null, chunks are decompressed by background threads, and
+     * m_cache points to memory owned by it.
+     */
+    ChunkReadAhead *m_readAheadPool;
+};
+
+ChunkedFile::ChunkedFile(void)
+    : File(),
+      m_cacheMaxSize(SNAPPY_CHUNK_SIZE),
+      m_cacheSize(0),
+      m_cache(nullptr),
+      m_codec(nullptr),
+      m_compressedCache(nullptr),
+      m_endOfFile(false),
+      m_readAheadPool(nullptr)
+{
+}
+
+ChunkedFile::~ChunkedFile()
+{
+    close();
+}
+
+bool ChunkedFile::rawOpen(const char *filename)
+{
+    if (!m_reader.open(filename)) {
+        return false;
+    }
+
+    unsigned numThreads = m_readAhead ? getReadAheadThreads() : 0;
+    if (numThreads) {
+        m_readAheadPool = new ChunkReadAhead(m_reader, numThreads);
+    } else {
+        m_codec = m_reader.createCodec();
+        if (!m_codec) {
+            m_reader.close();
+            return false;
+        }
+        m_compressedCache = new char[m_reader.maxCompressedLength()];
+    }
+
+    //read in the initial buffer
+    flushReadCache();
+
+    return true;
+}
+
+size_t ChunkedFile::rawRead(void *buffer, size_t length)
+{
+    if (endOfData()) {
+        return 0;
+    }
+
+    if (freeCacheSize() >= length) {
+        memcpy(buffer, m_windowPtr, length);
+        m_windowPtr += length;
+    } else {
+        size_t sizeToRead = length;
+        size_t offset = 0;
+        while (sizeToRead) {
+            size_t chunkSize = std::min(freeCacheSize(), sizeToRead);
+            offset = length - sizeToRead;
+            memcpy((char*)buffer + offset, m_windowPtr, chunkSize);
+            m_windowPtr += chunkSize;
+            sizeToRead -= chunkSize;
+            if (sizeToRead > 0) {
+                flushReadCache();
+            }
+            if (!m_cacheSize) {
+                return length - sizeToRead;
+            }
+        }
+    }
+
+    return length;
+}
+
+int ChunkedFile::rawGetc(void)
+{
+    unsigned char c = 0;
+    if (rawRead(&c, 1) != 1)
+        return -1;
+    return c;
+}
+
+void ChunkedFile::rawClose(void)
+{
+    if (m_readAheadPool) {
+        // Joins the read-ahead threads before the stream goes away
+        m_cacheBuffer.reset();
+        delete m_readAheadPool;
+        m_readAheadPool = nullptr;
+    }
+    m_reader.close();
+    delete m_codec;
+    m_codec = nullptr;
+    delete [] m_compressedCache;
+    m_compressedCache = nullptr;
+    m_cacheBuffer.reset();
+    m_cache = NULL;
+    m_cacheSize = 0;
+    m_windowPtr = NULL;
+    m_windowEnd = NULL;
+}
+
+void ChunkedFile::flushReadCache(size_t skipLength)
+{
+    if (m_readAheadPool) {
+        // Let the chunk be reused, unless pinned
+        m_cacheBuffer.reset();
+
+        const ChunkReadAhead::Chunk *chunk = m_readAheadPool->next();
+        if (!chunk) {
+            // Reached end of file
+            setCache(nullptr, 0);
+            m_endOfFile = true;
+            return;
+        }
+        m_currentChunkOffset = chunk->offset;
+        setCache(chunk->data, chunk->size);
+        m_endOfFile = chunk->end;
+        return;
+    }
+
+    //assert(m_windowPtr == m_windowEnd);
+    m_currentChunkOffset = m_reader.tell();
+    size_t compressedLength;
+    bool partial;
+    const char *compressed = m_reader.read(m_compressedCache, compressedLength, partial);
+    m_endOfFile = m_reader.eof();
+    if (!compressed) {
+        // Reached end of file
+        createCache(0);
+        return;
+    }
+
+    size_t size;
+    if (!partial && skipLength &&
+        m_codec->getUncompressedLength(compressed, compressedLength, size) &&
+        skipLength >= size) {
+        // The whole chunk is being skipped
+        createCache(size);
+        return;
+    }
+
+    size = uncompressChunk(m_codec, compressed, compressedLength, partial,
+                           m_cacheBuffer, m_cacheMaxSize);
+    setCache(m_cacheBuffer, size);
+}
+
+void ChunkedFile::createCache(size_t size)
+{
+    if (size) {
+        reserveChunkBuffer(m_cacheBuffer, m_cacheMaxSize, size);
+    }
+
+    setCache(m_cacheBuffer, size);
+}
+
+void ChunkedFile::setCache(const ChunkBuffer &buffer, size_t size)
+{
+    if (&buffer != &m_cacheBuffer) {
+        m_cacheBuffer = buffer;
+    }
+    m_cache = m_cacheBuffer.get();
+    m_cacheSize = size;
+    m_windowPtr = m_cache;
+    m_windowEnd = m_cache + size;
+}
+
+bool ChunkedFile::supportsOffsets(void) const
+{
+    return true;
+}
+
+File::Offset ChunkedFile::currentOffset(void) const
+{
+    File::Offset offset;
+    offset.chunk = m_currentChunkOffset;
+    offset.offsetInChunk = usedCacheSize();
+    return offset;
+}
+
+void ChunkedFile::setCurrentOffset(const File::Offset &offset)
+{
+    if (m_readAheadPool) {
+        // Avoid restarting the read-ahead when staying within the same chunk
+        if (offset.chunk != m_currentChunkOffset || !m_cacheSize) {
+            m_readAheadPool->seek(offset.chunk);
+            flushReadCache();
+        }
+    } else {
+        // seek to the start of a chunk
+        m_reader.seek(offset.chunk);
+        // load the chunk
+        flushReadCache();
+    }
+    assert(m_cacheSize >= offset.offsetInChunk);
+    // seek within our cache to the correct location within the chunk
+    m_windowPtr = m_cache + offset.offsetInChunk;
+
+}
+
+bool ChunkedFile::rawSkip(size_t length)
+{
+    if (endOfData()) {
+        return false;
+    }
+
+    if (freeCacheSize() >= length) {
+        m_windowPtr += length;
+    } else {
+        size_t sizeToRead = length;
+        while (sizeToRead) {
+            size_t chunkSize = std::min(freeCacheSize(), sizeToRead);
+            m_windowPtr += chunkSize;
+            sizeToRead -= chunkSize;
+            if (sizeToRead > 0) {
+                flushReadCache(sizeToRead);
+            }
+            if (!m_cacheSize) {
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
+std::shared_ptr<char> ChunkedFile::pinWindow(void)
+{
+    return m_cacheBuffer;
+}
+
+bool ChunkedFile::getIndex(std::string &data) const
+{
+    if (m_reader.index().empty()) {
+        return false;
+    }
+    data = m_reader.index();
+    return true;
+}
+
+int ChunkedFile::rawPercentRead(void)
+{
+    // The file position is owned by the read-ahead threads
+    uint64_t pos = m_readAheadPool ? m_currentChunkOffset : m_reader.tell();
+    return int(100 * (double(pos) / double(m_reader.size())));
+}
+
+
+File* File::createChunked(void) {
+    return new ChunkedFile;
+}
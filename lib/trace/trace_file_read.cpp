@@ -27,15 +27,15 @@
 #include <fstream>
 
 #include "os.hpp"
+#include "trace_codec.hpp"
 #include "trace_file.hpp"
-#include "trace_snappy.hpp"
 
 
 using namespace trace;
 
 
 File *
-File::createForRead(const char *filename)
+File::createForRead(const char *filename, bool readAhead)
 {
     std::ifstream stream(filename, std::ifstream::binary | std::ifstream::in);
     if (!stream.is_open()) {
@@ -48,8 +48,9 @@ File::createForRead(const char *filename)
     stream.close();
 
     File *file;
-    if (byte1 == SNAPPY_BYTE1 && byte2 == SNAPPY_BYTE2) {
-        file = File::createSnappy();
+    Codec codec;
+    if (getChunkedCodec(byte1, byte2, codec)) {
+        file = File::createChunked();
     } else if (byte1 == 0x1f && byte2 == 0x8b) {
         file = File::createZLib();
     } else  {
@@ -60,6 +61,8 @@ File::createForRead(const char *filename)
         return NULL;
     }
 
+    file->setReadAhead(readAhead);
+
     if (!file->open(filename)) {
         os::log("error: could not open %s for reading\n", filename);
         delete file;
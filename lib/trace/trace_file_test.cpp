@@ -0,0 +1,1287 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Round-trip tests for the trace writer, file and parser layers.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "os_process.hpp"
+#include "os_thread.hpp"
+#include "trace_dump.hpp"
+#include "trace_parser.hpp"
+#include "trace_parser_ahead.hpp"
+#include "trace_parser_loop.hpp"
+#include "trace_parser_parallel.hpp"
+#include "trace_writer.hpp"
+#include "trace_writer_local.hpp"
+
+#include "gtest/gtest.h"
+
+
+using namespace trace;
+
+
+#define NUM_CALLS 4096
+#define BLOB_SIZE 4096
+
+
+static const char *args[2] = {"n", "data"};
+static const FunctionSig sig = {0, "glFoo", 2, args};
+
+static const char *swap_args[1] = {"dpy"};
+static const FunctionSig swap_sig = {1, "glXSwapBuffers", 1, swap_args};
+
+
+static void
+fillBlob(std::vector<char> &blob, unsigned no)
+{
+    // Poorly compressible, so that the trace spans many chunks
+    unsigned state = no * 2654435761U + 1;
+    for (auto & c : blob) {
+        state = state * 1103515245U + 12345U;
+        c = char(state >> 16);
+    }
+}
+
+
+static void
+writeTrace(const char *filename, bool async = false,
+           const CodecOptions &options = CodecOptions(),
+           unsigned frameChunkFill = 0)
+{
+    Writer writer;
+    writer.setAsyncCompression(async);
+    writer.setCodec(options);
+    writer.setFrameChunkFill(frameChunkFill);
+    Properties properties;
+    ASSERT_TRUE(writer.open(filename, TRACE_VERSION, properties));
+
+    std::vector<char> blob(BLOB_SIZE);
+    for (unsigned no = 0; no < NUM_CALLS; ++no) {
+        bool swap = no % 64 == 63;
+        unsigned call = writer.beginEnter(swap ? &swap_sig : &sig, 0);
+        writer.beginArg(0);
+        writer.writeUInt(no);
+        writer.endArg();
+        if (!swap) {
+            fillBlob(blob, no);
+            writer.beginArg(1);
+            writer.writeBlob(blob.data(), blob.size());
+            writer.endArg();
+        }
+        writer.endEnter();
+        writer.beginLeave(call);
+        writer.endLeave();
+    }
+
+    writer.close();
+}
+
+
+static void
+checkCall(Call *call, unsigned no)
+{
+    ASSERT_NE(call, nullptr);
+    EXPECT_EQ(call->no, no);
+    EXPECT_EQ(call->arg(0).toUInt(), no);
+    if (no % 64 == 63) {
+        EXPECT_TRUE(call->flags & CALL_FLAG_END_FRAME);
+    } else {
+        std::vector<char> blob(BLOB_SIZE);
+        fillBlob(blob, no);
+        Blob *value = call->arg(1).toBlob();
+        ASSERT_NE(value, nullptr);
+        ASSERT_EQ(value->size, blob.size());
+        EXPECT_EQ(memcmp(value->buf, blob.data(), blob.size()), 0);
+    }
+}
+
+
+static void
+readTrace(const char *filename, bool useArenas = false)
+{
+    Parser parser;
+    parser.setUseArenas(useArenas);
+    ASSERT_TRUE(parser.open(filename));
+    ASSERT_TRUE(parser.supportsOffsets());
+
+    // Readable by releases predating deduplicated blobs
+    EXPECT_EQ(parser.getVersion(), TRACE_VERSION_DEDUP_BLOB - 1);
+
+    ParseBookmark bookmark;
+    unsigned bookmarkNo = NUM_CALLS / 2;
+
+    for (unsigned no = 0; no < NUM_CALLS; ++no) {
+        if (no == bookmarkNo) {
+            parser.getBookmark(bookmark);
+        }
+        std::unique_ptr<Call> call(parser.parse_call());
+        checkCall(call.get(), no);
+    }
+    EXPECT_EQ(parser.parse_call(), nullptr);
+
+    // Jump back, both to a chunk behind and to the current one
+    for (unsigned i = 0; i < 2; ++i) {
+        parser.setBookmark(bookmark);
+        for (unsigned no = bookmarkNo; no < bookmarkNo + 8; ++no) {
+            std::unique_ptr<Call> call(parser.parse_call());
+            checkCall(call.get(), no);
+        }
+    }
+
+    parser.close();
+}
+
+
+TEST(trace_file, read)
+{
+    const char *filename = "trace_file_test_read.trace";
+    writeTrace(filename);
+
+    os::setEnvironment("APITRACE_READ_AHEAD", "0");
+    readTrace(filename);
+    readTrace(filename, true);
+
+    os::unsetEnvironment("APITRACE_READ_AHEAD");
+    remove(filename);
+}
+
+
+TEST(trace_file, read_ahead)
+{
+    const char *filename = "trace_file_test_read_ahead.trace";
+    writeTrace(filename);
+
+    os::setEnvironment("APITRACE_READ_AHEAD", "1");
+    readTrace(filename);
+
+    os::setEnvironment("APITRACE_READ_AHEAD", "4");
+    readTrace(filename);
+
+    os::unsetEnvironment("APITRACE_READ_AHEAD");
+    remove(filename);
+}
+
+
+TEST(trace_file, arena_bound_blob)
+{
+    const char *filename = "trace_file_test_arena.trace";
+    writeTrace(filename);
+
+    Parser parser;
+    parser.setUseArenas(true);
+    ASSERT_TRUE(parser.open(filename));
+
+    // Bound blobs must outlive their call
+    Call *call = parser.parse_call();
+    ASSERT_NE(call, nullptr);
+    ASSERT_NE(call->arena, nullptr);
+    const char *buf = static_cast<const char *>(call->arg(1).toPointer(true));
+    delete call;
+
+    std::vector<char> blob(BLOB_SIZE);
+    fillBlob(blob, 0);
+    EXPECT_EQ(memcmp(buf, blob.data(), blob.size()), 0);
+
+    parser.close();
+    remove(filename);
+}
+
+
+TEST(trace_file, blob_views)
+{
+    const char *filename = "trace_file_test_blob_views.trace";
+    const size_t blobSize = 4 * TRACE_BLOB_VIEW_MIN_SIZE;
+    const unsigned numCalls = 256;
+
+    {
+        Writer writer;
+        Properties properties;
+        ASSERT_TRUE(writer.open(filename, TRACE_VERSION, properties));
+        std::vector<char> blob(blobSize);
+        for (unsigned no = 0; no < numCalls; ++no) {
+            unsigned call = writer.beginEnter(&sig, 0);
+            fillBlob(blob, no);
+            writer.beginArg(1);
+            writer.writeBlob(blob.data(), blob.size());
+            writer.endArg();
+            writer.endEnter();
+            writer.beginLeave(call);
+            writer.endLeave();
+        }
+        writer.close();
+    }
+
+    const char *readAhead[] = {"0", "2"};
+    for (const char *value : readAhead) {
+        os::setEnvironment("APITRACE_READ_AHEAD", value);
+
+        for (unsigned i = 0; i < 2; ++i) {
+            Parser parser;
+            parser.setUseBlobViews(true);
+            parser.setUseArenas(i);
+            ASSERT_TRUE(parser.open(filename));
+
+            // Keep all calls alive, so that chunks can't be recycled under them
+            std::vector<std::unique_ptr<Call>> calls;
+            unsigned views = 0;
+            Call *call;
+            while ((call = parser.parse_call())) {
+                calls.emplace_back(call);
+                if (call->arg(1).toBlob()->pin) {
+                    ++views;
+                }
+            }
+            ASSERT_EQ(calls.size(), numCalls);
+            EXPECT_GT(views, numCalls / 2);
+            EXPECT_LT(views, numCalls);
+
+            std::vector<char> blob(blobSize);
+            for (unsigned no = 0; no < numCalls; ++no) {
+                fillBlob(blob, no);
+                Blob *value = calls[no]->arg(1).toBlob();
+                ASSERT_EQ(value->size, blob.size());
+                EXPECT_EQ(memcmp(value->buf, blob.data(), blob.size()), 0);
+
+                // Bound views get their own copy
+                if (no % 2) {
+                    value->toPointer(true);
+                    EXPECT_FALSE(value->pin);
+                    EXPECT_EQ(memcmp(value->buf, blob.data(), blob.size()), 0);
+                }
+            }
+        }
+    }
+
+    os::unsetEnvironment("APITRACE_READ_AHEAD");
+    remove(filename);
+}
+
+
+TEST(trace_parser, pending_calls)
+{
+    PendingCalls pending;
+    EXPECT_TRUE(pending.empty());
+
+    // Spread calls over a window much wider than the initial ring
+    const unsigned nos[] = {100, 101, 5000, 102, 99, 70000};
+    for (unsigned no : nos) {
+        Call *call = new Call(&sig, 0, 0);
+        call->no = no;
+        pending.insert(call);
+    }
+
+    EXPECT_EQ(pending.remove(98), nullptr);
+    EXPECT_EQ(pending.remove(4999), nullptr);
+
+    std::unique_ptr<Call> call(pending.remove(101));
+    ASSERT_NE(call, nullptr);
+    EXPECT_EQ(call->no, 101);
+
+    const unsigned order[] = {99, 100, 102, 5000, 70000};
+    for (unsigned no : order) {
+        call.reset(pending.removeFirst());
+        ASSERT_NE(call, nullptr);
+        EXPECT_EQ(call->no, no);
+    }
+    EXPECT_TRUE(pending.empty());
+    EXPECT_EQ(pending.removeFirst(), nullptr);
+}
+
+
+TEST(trace_parser, pending_calls_outliers)
+{
+    // A small ring, so that calls which never return fall behind it
+    PendingCalls pending(64);
+
+    const unsigned stuck[] = {3, 7, 500};
+    unsigned next = 0;
+    for (unsigned no = 0; no < 10000; ++no) {
+        Call *call = new Call(&sig, 0, 0);
+        call->no = no;
+        pending.insert(call);
+
+        // Return all but the stuck calls with a lag of a few calls
+        if (no >= 4) {
+            unsigned done = no - 4;
+            if (next < 3 && done == stuck[next]) {
+                ++next;
+            } else {
+                std::unique_ptr<Call> returned(pending.remove(done));
+                ASSERT_NE(returned, nullptr);
+                EXPECT_EQ(returned->no, done);
+            }
+        }
+    }
+
+    // Calls both behind and ahead of the window come out in order
+    std::unique_ptr<Call> call(pending.remove(7));
+    ASSERT_NE(call, nullptr);
+    EXPECT_EQ(call->no, 7);
+
+    const unsigned order[] = {3, 500, 9996, 9997, 9998, 9999};
+    for (unsigned no : order) {
+        call.reset(pending.removeFirst());
+        ASSERT_NE(call, nullptr);
+        EXPECT_EQ(call->no, no);
+    }
+    EXPECT_TRUE(pending.empty());
+
+    // And late calls behind the window are still found
+    for (unsigned no : {1000, 900, 10}) {
+        call.reset(new Call(&sig, 0, 0));
+        call->no = no;
+        pending.insert(call.release());
+    }
+    call.reset(pending.remove(10));
+    ASSERT_NE(call, nullptr);
+    EXPECT_EQ(call->no, 10);
+    call.reset(pending.removeFirst());
+    ASSERT_NE(call, nullptr);
+    EXPECT_EQ(call->no, 900);
+    pending.clear();
+    EXPECT_TRUE(pending.empty());
+}
+
+
+static void
+checkIndexCalls(const std::vector<IndexCall> &one, const std::vector<IndexCall> &two)
+{
+    ASSERT_EQ(one.size(), two.size());
+    for (size_t i = 0; i < one.size(); ++i) {
+        EXPECT_EQ(one[i].no, two[i].no);
+        EXPECT_TRUE(one[i].offset == two[i].offset);
+    }
+}
+
+
+TEST(trace_file, index)
+{
+    const char *filename = "trace_file_test_index.trace";
+    writeTrace(filename);
+
+    Parser parser;
+    ASSERT_TRUE(parser.open(filename));
+    ASSERT_TRUE(parser.hasIndex());
+
+    const Index &index = parser.getIndex();
+    EXPECT_EQ(index.numCalls, NUM_CALLS);
+    EXPECT_EQ(index.frames.size(), NUM_CALLS / 64);
+    EXPECT_EQ(index.calls.size(), NUM_CALLS / TRACE_INDEX_CALL_INTERVAL);
+    EXPECT_EQ(index.sigs.size(), 2);
+
+    // Seek backwards and forwards, before the signatures are known
+    const unsigned frameNos[] = {17, 3, 63, 0};
+    for (unsigned frame : frameNos) {
+        ASSERT_TRUE(parser.seekToFrame(frame));
+        for (unsigned no = frame * 64; no < frame * 64 + 64; ++no) {
+            std::unique_ptr<Call> call(parser.parse_call());
+            checkCall(call.get(), no);
+        }
+    }
+    EXPECT_FALSE(parser.seekToFrame(NUM_CALLS / 64));
+
+    ASSERT_TRUE(parser.seekToCall(3000));
+    std::unique_ptr<Call> call;
+    do {
+        call.reset(parser.parse_call());
+        ASSERT_NE(call.get(), nullptr);
+    } while (call->no < 3000);
+    checkCall(call.get(), 3000);
+
+    // Rebuilding the index by scanning the trace should yield the same
+    Parser scanner;
+    ASSERT_TRUE(scanner.open(filename));
+    Index scanned;
+    scanner.scanIndex(scanned);
+    EXPECT_EQ(scanned.numCalls, index.numCalls);
+    ASSERT_EQ(scanned.sigs.size(), index.sigs.size());
+    for (size_t i = 0; i < index.sigs.size(); ++i) {
+        EXPECT_EQ(scanned.sigs[i].kind, index.sigs[i].kind);
+        EXPECT_EQ(scanned.sigs[i].id, index.sigs[i].id);
+    }
+    checkIndexCalls(scanned.frames, index.frames);
+    checkIndexCalls(scanned.calls, index.calls);
+
+    std::string data;
+    index.serialize(data);
+    Index copy;
+    ASSERT_TRUE(copy.deserialize(data.data(), data.size()));
+    checkIndexCalls(copy.frames, index.frames);
+    EXPECT_FALSE(copy.deserialize(data.data(), data.size() / 2));
+
+    parser.close();
+    scanner.close();
+    remove(filename);
+}
+
+
+static std::string
+readFile(const char *filename)
+{
+    std::ifstream stream(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(stream),
+                       std::istreambuf_iterator<char>());
+}
+
+
+TEST(trace_file, async_write)
+{
+    const char *syncFilename = "trace_file_test_sync_write.trace";
+    const char *asyncFilename = "trace_file_test_async_write.trace";
+    writeTrace(syncFilename);
+    writeTrace(asyncFilename, true);
+
+    // Including the index, whose offsets are only known after writing
+    std::string syncData = readFile(syncFilename);
+    std::string asyncData = readFile(asyncFilename);
+    EXPECT_GT(syncData.size(), NUM_CALLS * BLOB_SIZE / 2);
+    EXPECT_TRUE(asyncData == syncData);
+
+    readTrace(asyncFilename);
+
+    remove(syncFilename);
+    remove(asyncFilename);
+}
+
+
+TEST(trace_file, frame_chunks)
+{
+    const char *filename = "trace_file_test_frame_chunks.trace";
+
+    for (unsigned i = 0; i < 2; ++i) {
+        bool async = i != 0;
+        writeTrace(filename, async, CodecOptions(), 40);
+
+        readTrace(filename);
+
+        Parser parser;
+        ASSERT_TRUE(parser.open(filename));
+        ASSERT_TRUE(parser.hasIndex());
+
+        // Frames span a quarter of a chunk, so every other one past the
+        // first starts a new chunk
+        const Index &index = parser.getIndex();
+        ASSERT_EQ(index.frames.size(), NUM_CALLS / 64);
+        unsigned chunkStarts = 0;
+        for (auto & frame : index.frames) {
+            if (frame.offset.offsetInChunk == 0) {
+                ++chunkStarts;
+            }
+        }
+        EXPECT_GE(chunkStarts, index.frames.size() / 2 - 1);
+
+        ASSERT_TRUE(parser.seekToFrame(18));
+        EXPECT_EQ(index.frames[18].offset.offsetInChunk, 0);
+        for (unsigned no = 18 * 64; no < 19 * 64; ++no) {
+            std::unique_ptr<Call> call(parser.parse_call());
+            checkCall(call.get(), no);
+        }
+        parser.close();
+    }
+
+    remove(filename);
+}
+
+
+#if defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+static void
+checkChunkCodec(const CodecOptions &options)
+{
+    std::unique_ptr<ChunkCodec> codec(createChunkCodec(options));
+    ASSERT_TRUE(codec);
+
+    // Blobs repeat, so there is something to compress
+    std::vector<char> data;
+    std::vector<char> blob(BLOB_SIZE);
+    for (unsigned no = 0; data.size() < 1024 * 1024; ++no) {
+        fillBlob(blob, no % 4);
+        data.insert(data.end(), blob.begin(), blob.end());
+    }
+
+    std::vector<char> compressed(codec->maxCompressedLength(data.size()));
+    size_t compressedLength = codec->compress(data.data(), data.size(), compressed.data());
+    ASSERT_GT(compressedLength, 0);
+    EXPECT_LT(compressedLength, data.size() / 2);
+
+    size_t length = 0;
+    ASSERT_TRUE(codec->getUncompressedLength(compressed.data(), compressedLength, length));
+    ASSERT_EQ(length, data.size());
+    std::vector<char> uncompressed(length);
+    ASSERT_EQ(codec->uncompress(compressed.data(), compressedLength,
+                                uncompressed.data(), length, false), length);
+    EXPECT_TRUE(uncompressed == data);
+
+    // A truncated chunk yields a prefix of the data, if anything
+    std::fill(uncompressed.begin(), uncompressed.end(), 0);
+    size_t partialLength = codec->uncompress(compressed.data(), compressedLength / 2,
+                                             uncompressed.data(), length, true);
+    EXPECT_LT(partialLength, length);
+    EXPECT_TRUE(std::equal(data.begin(), data.begin() + partialLength, uncompressed.begin()));
+
+    // The header tells the codec and dictionary back
+    std::string header;
+    writeChunkedHeader(header, options);
+    auto readAt = [&header] (uint64_t offset, void *buffer, size_t size) {
+        if (offset + size > header.size()) {
+            return false;
+        }
+        memcpy(buffer, header.data() + offset, size);
+        return true;
+    };
+    CodecOptions headerOptions;
+    uint64_t dataOffset = 0;
+    ASSERT_TRUE(readChunkedHeader(readAt, headerOptions, dataOffset));
+    EXPECT_EQ(headerOptions.codec, options.codec);
+    EXPECT_EQ(headerOptions.dictionary, options.dictionary);
+    EXPECT_EQ(dataOffset, header.size());
+
+    // Readers don't know the level, which compressing doesn't depend on
+    std::unique_ptr<ChunkCodec> reader(createChunkCodec(headerOptions));
+    ASSERT_TRUE(reader);
+    std::fill(uncompressed.begin(), uncompressed.end(), 0);
+    ASSERT_EQ(reader->uncompress(compressed.data(), compressedLength,
+                                 uncompressed.data(), length, false), length);
+    EXPECT_TRUE(uncompressed == data);
+}
+
+
+static void
+checkCodec(const char *filename, const CodecOptions &options)
+{
+    checkChunkCodec(options);
+
+    // Writing synchronously or not makes no difference to the output
+    writeTrace(filename, false, options);
+    std::string syncData = readFile(filename);
+    writeTrace(filename, true, options);
+    EXPECT_TRUE(readFile(filename) == syncData);
+
+    os::setEnvironment("APITRACE_READ_AHEAD", "0");
+    readTrace(filename);
+    os::setEnvironment("APITRACE_READ_AHEAD", "2");
+    readTrace(filename);
+    os::unsetEnvironment("APITRACE_READ_AHEAD");
+
+    Parser parser;
+    ASSERT_TRUE(parser.open(filename));
+    ASSERT_TRUE(parser.hasIndex());
+    ASSERT_TRUE(parser.seekToFrame(17));
+    for (unsigned no = 17 * 64; no < 18 * 64; ++no) {
+        std::unique_ptr<Call> call(parser.parse_call());
+        checkCall(call.get(), no);
+    }
+    parser.close();
+
+    remove(filename);
+}
+#endif
+
+
+#ifdef HAVE_LZ4
+TEST(trace_file, lz4)
+{
+    CodecOptions options;
+    options.codec = CODEC_LZ4;
+    checkCodec("trace_file_test_lz4.trace", options);
+
+    options.level = 9;
+    checkCodec("trace_file_test_lz4hc.trace", options);
+}
+#endif
+
+
+#ifdef HAVE_ZSTD
+TEST(trace_file, zstd)
+{
+    CodecOptions options;
+    options.codec = CODEC_ZSTD;
+    checkCodec("trace_file_test_zstd.trace", options);
+
+    // Raw content dictionary
+    std::vector<char> blob(BLOB_SIZE);
+    fillBlob(blob, 0);
+    options.dictionary.assign(blob.begin(), blob.end());
+    options.level = 3;
+    checkCodec("trace_file_test_zstd_dict.trace", options);
+}
+#endif
+
+
+#define NUM_UNIQUE_BLOBS 100
+
+
+static void
+writeDedupTrace(const char *filename)
+{
+    Writer writer;
+    writer.setAsyncCompression(true);
+    writer.setBlobDedup(BLOB_SIZE);
+    Properties properties;
+    ASSERT_TRUE(writer.open(filename, TRACE_VERSION, properties));
+
+    std::vector<char> blob(BLOB_SIZE);
+    for (unsigned no = 0; no < NUM_CALLS; ++no) {
+        unsigned call = writer.beginEnter(&sig, 0);
+        writer.beginArg(0);
+        writer.writeUInt(no);
+        writer.endArg();
+        // Blobs below the threshold are written as usual
+        fillBlob(blob, no % NUM_UNIQUE_BLOBS);
+        writer.beginArg(1);
+        writer.writeBlob(blob.data(), no % 2 ? blob.size() : blob.size() / 4);
+        writer.endArg();
+        writer.endEnter();
+        writer.beginLeave(call);
+        writer.endLeave();
+    }
+
+    writer.close();
+}
+
+
+static void
+checkDedupCall(Call *call, unsigned no)
+{
+    ASSERT_NE(call, nullptr);
+    EXPECT_EQ(call->no, no);
+    std::vector<char> blob(BLOB_SIZE);
+    fillBlob(blob, no % NUM_UNIQUE_BLOBS);
+    blob.resize(no % 2 ? blob.size() : blob.size() / 4);
+    Blob *value = call->arg(1).toBlob();
+    ASSERT_NE(value, nullptr);
+    ASSERT_EQ(value->size, blob.size());
+    EXPECT_EQ(memcmp(value->buf, blob.data(), blob.size()), 0);
+}
+
+
+TEST(trace_file, dedup_blobs)
+{
+    const char *filename = "trace_file_test_dedup_blobs.trace";
+    writeDedupTrace(filename);
+
+    std::string data = readFile(filename);
+    EXPECT_LT(data.size(), NUM_CALLS * BLOB_SIZE / 4);
+
+    Parser parser;
+    ASSERT_TRUE(parser.open(filename));
+    EXPECT_EQ(parser.getVersion(), TRACE_VERSION_DEDUP_BLOB);
+    ASSERT_TRUE(parser.hasIndex());
+    EXPECT_EQ(parser.getIndex().blobs.size(), NUM_UNIQUE_BLOBS / 2);
+
+    // Seek past the definitions before any is known
+    ASSERT_TRUE(parser.seekToCall(3000));
+    std::unique_ptr<Call> call;
+    do {
+        call.reset(parser.parse_call());
+        ASSERT_NE(call.get(), nullptr);
+    } while (call->no < 3000);
+    checkDedupCall(call.get(), 3000);
+
+    // Then go back over them
+    ASSERT_TRUE(parser.seekToCall(0));
+    for (unsigned no = 0; no < NUM_CALLS; ++no) {
+        call.reset(parser.parse_call());
+        checkDedupCall(call.get(), no);
+    }
+    call.reset(parser.parse_call());
+    EXPECT_EQ(call.get(), nullptr);
+
+    // Rebuilding the index finds the same definitions
+    Parser scanner;
+    ASSERT_TRUE(scanner.open(filename));
+    Index scanned;
+    scanner.scanIndex(scanned);
+    ASSERT_EQ(scanned.blobs.size(), parser.getIndex().blobs.size());
+    for (size_t i = 0; i < scanned.blobs.size(); ++i) {
+        EXPECT_TRUE(scanned.blobs[i] == parser.getIndex().blobs[i]);
+    }
+
+    parser.close();
+    scanner.close();
+    remove(filename);
+}
+
+
+static void
+writeBuildIdTrace(const char *filename, bool moduleBuildIds)
+{
+    Writer writer;
+    writer.setModuleBuildIds(moduleBuildIds);
+    Properties properties;
+    ASSERT_TRUE(writer.open(filename, TRACE_VERSION, properties));
+
+    RawStackFrame frames[2];
+    frames[0].id = 0;
+    frames[0].module = "libfoo.so";
+    frames[0].offset = 0x1234;
+    frames[0].buildId = "0123456789abcdef";
+    frames[1].id = 1;
+    frames[1].module = "libfoo.so";
+    frames[1].offset = 0x5678;
+
+    for (unsigned no = 0; no < 2; ++no) {
+        unsigned call = writer.beginEnter(&sig, 0);
+        writer.beginBacktrace(2);
+        writer.writeStackFrame(&frames[0]);
+        writer.writeStackFrame(&frames[1]);
+        writer.endBacktrace();
+        writer.endEnter();
+        writer.beginLeave(call);
+        writer.endLeave();
+    }
+
+    writer.close();
+}
+
+
+TEST(trace_file, build_ids)
+{
+    const char *filename = "trace_file_test_build_ids.trace";
+
+    for (bool moduleBuildIds : {false, true}) {
+        writeBuildIdTrace(filename, moduleBuildIds);
+
+        Parser parser;
+        ASSERT_TRUE(parser.open(filename));
+        // Older releases can still read traces without build IDs
+        EXPECT_EQ(parser.getVersion(), moduleBuildIds ? TRACE_VERSION_BUILD_ID
+                                                      : TRACE_VERSION_DEDUP_BLOB - 1);
+
+        for (unsigned no = 0; no < 2; ++no) {
+            std::unique_ptr<Call> call(parser.parse_call());
+            ASSERT_NE(call.get(), nullptr);
+            ASSERT_NE(call->backtrace, nullptr);
+            ASSERT_EQ(call->backtrace->size(), 2);
+            const StackFrame *first = (*call->backtrace)[0];
+            const StackFrame *second = (*call->backtrace)[1];
+            EXPECT_STREQ(first->module, "libfoo.so");
+            EXPECT_EQ(first->offset, 0x1234);
+            if (moduleBuildIds) {
+                EXPECT_STREQ(first->buildId, "0123456789abcdef");
+            } else {
+                EXPECT_EQ(first->buildId, nullptr);
+            }
+            EXPECT_EQ(second->offset, 0x5678);
+            EXPECT_EQ(second->buildId, nullptr);
+        }
+        EXPECT_EQ(parser.parse_call(), nullptr);
+
+        parser.close();
+    }
+
+    remove(filename);
+}
+
+
+static const EnumValue mode_values[2] = {{"GL_POINTS", 0}, {"GL_LINES", 1}};
+static const EnumSig mode_sig = {0, 2, mode_values};
+
+
+/**
+ * Writer whose events are captured by the threads, and only numbered and
+ * written out on commit, as LocalWriter does when capturing per thread.
+ */
+class CapturingWriter : public Writer
+{
+public:
+    os::mutex mutex;
+
+    unsigned
+    enter(unsigned thread, unsigned value) {
+        CapturedEvent event;
+        _capture(&event);
+        _captureEnter(&sig, thread);
+        beginArg(0);
+        writeEnum(&mode_sig, value & 1);
+        endArg();
+        beginArg(1);
+        writeUInt(value);
+        endArg();
+        endEnter();
+        _capture(nullptr);
+        return commit(event);
+    }
+
+    void
+    leave(unsigned call) {
+        CapturedEvent event;
+        _capture(&event);
+        beginLeave(call);
+        endLeave();
+        _capture(nullptr);
+        commit(event);
+    }
+
+    unsigned
+    commit(const CapturedEvent &event) {
+        os::unique_lock<os::mutex> lock(mutex);
+        return _commit(event);
+    }
+
+    using Writer::_capture;
+    using Writer::_captureEnter;
+};
+
+
+#define NUM_CAPTURE_THREADS 4
+#define NUM_CAPTURE_CALLS 4096
+
+
+TEST(trace_file, captured_events)
+{
+    const char *filename = "trace_file_test_captured_events.trace";
+
+    {
+        CapturingWriter writer;
+        Properties properties;
+        ASSERT_TRUE(writer.open(filename, TRACE_VERSION, properties));
+
+        // A call captured while capturing another one goes first
+        CapturedEvent outer;
+        writer._capture(&outer);
+        writer._captureEnter(&sig, 0);
+        writer.beginArg(0);
+        writer.writeEnum(&mode_sig, 1);
+        writer.endArg();
+        unsigned inner = writer.enter(0, 0);
+        writer._capture(&outer);
+        writer.beginArg(1);
+        writer.writeUInt(1);
+        writer.endArg();
+        writer.endEnter();
+        writer._capture(nullptr);
+        EXPECT_EQ(inner, 0);
+        EXPECT_EQ(writer.commit(outer), 1);
+        writer.leave(inner);
+        writer.leave(1);
+
+        std::vector<os::thread> threads;
+        for (unsigned thread = 0; thread < NUM_CAPTURE_THREADS; ++thread) {
+            threads.emplace_back([&writer, thread] () {
+                for (unsigned i = 0; i < NUM_CAPTURE_CALLS; ++i) {
+                    unsigned value = thread * NUM_CAPTURE_CALLS + i;
+                    unsigned call = writer.enter(thread, value);
+                    writer.leave(call);
+                }
+            });
+        }
+        for (auto & thread : threads) {
+            thread.join();
+        }
+
+        writer.close();
+    }
+
+    Parser parser;
+    ASSERT_TRUE(parser.open(filename));
+
+    // Calls come out as they leave, so sort them by number
+    const unsigned numCalls = 2 + NUM_CAPTURE_THREADS * NUM_CAPTURE_CALLS;
+    std::vector<unsigned> values(numCalls, ~0U);
+    Call *call;
+    while ((call = parser.parse_call())) {
+        ASSERT_LT(call->no, numCalls);
+        unsigned value = call->arg(1).toUInt();
+        EXPECT_EQ(call->arg(0).toSInt(), (long long)(value & 1));
+        if (call->no >= 2) {
+            EXPECT_EQ(call->thread_id, value / NUM_CAPTURE_CALLS);
+        }
+        values[call->no] = value;
+        delete call;
+    }
+
+    EXPECT_EQ(values[0], 0);
+    EXPECT_EQ(values[1], 1);
+
+    // Each thread's calls are numbered in order
+    std::vector<unsigned> next(NUM_CAPTURE_THREADS, 0);
+    for (unsigned no = 2; no < numCalls; ++no) {
+        unsigned thread = values[no] / NUM_CAPTURE_CALLS;
+        ASSERT_LT(thread, NUM_CAPTURE_THREADS);
+        EXPECT_EQ(values[no] % NUM_CAPTURE_CALLS, next[thread]++);
+    }
+
+    parser.close();
+    remove(filename);
+}
+
+
+#ifndef _WIN32
+
+static const FunctionSig capture_sig = {4, "glDrawFoo", 2, args};
+
+
+/*
+ * Trace through LocalWriter, as wrappers do, from several threads at once,
+ * with a fake memcpy call nested inside some of the calls.
+ */
+TEST(trace_file, per_thread_capture)
+{
+    const char *filename = "trace_file_test_per_thread_capture.trace";
+
+    os::setEnvironment("TRACE_FILE", filename);
+    os::setEnvironment("APITRACE_PER_THREAD_CAPTURE", "1");
+    LocalWriter::allowPerThreadCapture();
+
+    std::vector<os::thread> threads;
+    for (unsigned thread = 0; thread < NUM_CAPTURE_THREADS; ++thread) {
+        threads.emplace_back([thread] () {
+            for (unsigned i = 0; i < NUM_CAPTURE_CALLS; ++i) {
+                unsigned value = thread * NUM_CAPTURE_CALLS + i;
+                unsigned call = localWriter.beginEnter(&capture_sig);
+                localWriter.beginArg(0);
+                localWriter.writeEnum(&mode_sig, value & 1);
+                localWriter.endArg();
+                localWriter.beginArg(1);
+                localWriter.writeUInt(value);
+                localWriter.endArg();
+                localWriter.endEnter();
+                if (i % 8 == 0) {
+                    fakeMemcpy(&value, sizeof value);
+                }
+                localWriter.beginLeave(call);
+                localWriter.beginReturn();
+                localWriter.writeUInt(2 * value);
+                localWriter.endReturn();
+                localWriter.endLeave();
+            }
+        });
+    }
+    for (auto & thread : threads) {
+        thread.join();
+    }
+
+    localWriter.close();
+    os::unsetEnvironment("APITRACE_PER_THREAD_CAPTURE");
+    os::unsetEnvironment("TRACE_FILE");
+
+    Parser parser;
+    ASSERT_TRUE(parser.open(filename));
+
+    const unsigned numMemcpys = NUM_CAPTURE_THREADS * NUM_CAPTURE_CALLS / 8;
+    const unsigned numCalls = NUM_CAPTURE_THREADS * NUM_CAPTURE_CALLS + numMemcpys;
+    std::vector<bool> seen(numCalls, false);
+    std::vector<unsigned> lastNo(NUM_CAPTURE_THREADS, 0);
+    std::vector<unsigned> next(NUM_CAPTURE_THREADS, 0);
+    std::vector<unsigned> threadIds(NUM_CAPTURE_THREADS, ~0U);
+    unsigned memcpys = 0;
+    Call *call;
+    while ((call = parser.parse_call())) {
+        ASSERT_LT(call->no, numCalls);
+        EXPECT_FALSE(seen[call->no]);
+        seen[call->no] = true;
+
+        if (call->flags & CALL_FLAG_FAKE) {
+            EXPECT_STREQ(call->name(), "memcpy");
+            Blob *blob = call->arg(1).toBlob();
+            ASSERT_TRUE(blob != nullptr);
+            ASSERT_EQ(blob->size, sizeof(unsigned));
+            unsigned value;
+            memcpy(&value, blob->buf, sizeof value);
+            EXPECT_EQ(value % 8, 0);
+            ++memcpys;
+            delete call;
+            continue;
+        }
+
+        unsigned value = call->arg(1).toUInt();
+        unsigned thread = value / NUM_CAPTURE_CALLS;
+        ASSERT_LT(thread, NUM_CAPTURE_THREADS);
+        EXPECT_EQ(call->arg(0).toSInt(), (long long)(value & 1));
+        ASSERT_TRUE(call->ret != nullptr);
+        EXPECT_EQ(call->ret->toUInt(), 2 * value);
+
+        // Each thread keeps its ID, and its calls are numbered in order
+        if (threadIds[thread] == ~0U) {
+            threadIds[thread] = call->thread_id;
+        }
+        EXPECT_EQ(call->thread_id, threadIds[thread]);
+        EXPECT_EQ(value % NUM_CAPTURE_CALLS, next[thread]++);
+        if (value % NUM_CAPTURE_CALLS) {
+            EXPECT_GT(call->no, lastNo[thread]);
+        }
+        lastNo[thread] = call->no;
+        delete call;
+    }
+
+    EXPECT_EQ(memcpys, numMemcpys);
+    for (unsigned thread = 0; thread < NUM_CAPTURE_THREADS; ++thread) {
+        EXPECT_EQ(next[thread], NUM_CAPTURE_CALLS);
+    }
+
+    parser.close();
+    remove(filename);
+}
+
+#endif /* !_WIN32 */
+
+
+#define NUM_PARALLEL_CALLS (64 * TRACE_INDEX_CALL_INTERVAL + 100)
+
+
+TEST(trace_file, parallel)
+{
+    const char *filename = "trace_file_test_parallel.trace";
+
+    {
+        Writer writer;
+        Properties properties;
+        ASSERT_TRUE(writer.open(filename, TRACE_VERSION, properties));
+
+        // Pairs of calls from two threads, returning in reverse order
+        for (unsigned no = 0; no < NUM_PARALLEL_CALLS; no += 2) {
+            unsigned first = writer.beginEnter(&sig, 0);
+            writer.beginArg(0);
+            writer.writeUInt(first);
+            writer.endArg();
+            writer.endEnter();
+            unsigned second = writer.beginEnter(&sig, 1);
+            writer.beginArg(0);
+            writer.writeUInt(second);
+            writer.endArg();
+            writer.endEnter();
+            writer.beginLeave(second);
+            writer.endLeave();
+            writer.beginLeave(first);
+            writer.endLeave();
+        }
+
+        writer.close();
+    }
+
+    ParallelParser parser(4);
+    parser.setUseArenas(true);
+    ASSERT_TRUE(parser.open(filename));
+    ASSERT_TRUE(parser.isParallel());
+
+    Call *call;
+    unsigned expected = 0;
+    ParseBookmark bookmark;
+    while ((call = parser.parse_call())) {
+        EXPECT_EQ(call->no, expected);
+        EXPECT_EQ(call->arg(0).toUInt(), expected);
+        ++expected;
+        delete call;
+        if (expected == 20000) {
+            parser.getBookmark(bookmark);
+        }
+    }
+    EXPECT_EQ(expected, NUM_PARALLEL_CALLS);
+
+    parser.setBookmark(bookmark);
+    call = parser.parse_call();
+    ASSERT_NE(call, nullptr);
+    EXPECT_EQ(call->no, 20000);
+    delete call;
+
+    // Seek back before the current shards are done
+    ASSERT_TRUE(parser.seekToCall(5000));
+    call = parser.parse_call();
+    ASSERT_NE(call, nullptr);
+    EXPECT_EQ(call->no, 4 * TRACE_INDEX_CALL_INTERVAL);
+    delete call;
+
+    parser.close();
+    remove(filename);
+}
+
+
+TEST(trace_file, parallel_unreturned)
+{
+    const char *filename = "trace_file_test_parallel_unreturned.trace";
+
+    // Calls of the first shard which return well past it, and never
+    const CallNo shardEnd = TRACE_PARALLEL_SHARD_INDEX_CALLS * TRACE_INDEX_CALL_INTERVAL;
+    const CallNo late = shardEnd - 2;
+    const CallNo never = 3;
+
+    {
+        Writer writer;
+        Properties properties;
+        ASSERT_TRUE(writer.open(filename, TRACE_VERSION, properties));
+
+        auto leave = [&writer] (unsigned call) {
+            writer.beginLeave(call);
+            writer.beginReturn();
+            writer.writeUInt(2 * call);
+            writer.endReturn();
+            writer.endLeave();
+        };
+
+        for (unsigned no = 0; no < NUM_PARALLEL_CALLS; ++no) {
+            bool pending = no == late || no == never;
+            unsigned call = writer.beginEnter(&sig, pending ? 1 : 0);
+            writer.beginArg(0);
+            writer.writeUInt(call);
+            writer.endArg();
+            writer.endEnter();
+            if (!pending) {
+                leave(call);
+            }
+            if (no == shardEnd + 10000) {
+                leave(late);
+            }
+        }
+
+        writer.close();
+    }
+
+    // Compare with what the sequential parser makes of each call
+    std::vector<std::string> dumps(NUM_PARALLEL_CALLS);
+    {
+        Parser parser;
+        ASSERT_TRUE(parser.open(filename));
+        Call *call;
+        while ((call = parser.parse_call())) {
+            ASSERT_LT(call->no, NUM_PARALLEL_CALLS);
+            std::ostringstream os;
+            dump(*call, os, DUMP_FLAG_NO_COLOR);
+            dumps[call->no] = os.str();
+            delete call;
+        }
+        parser.close();
+    }
+
+    ParallelParser parser(4);
+    ASSERT_TRUE(parser.open(filename));
+    ASSERT_TRUE(parser.isParallel());
+
+    Call *call;
+    unsigned expected = 0;
+    while ((call = parser.parse_call())) {
+        EXPECT_EQ(call->no, expected);
+        bool incomplete = call->flags & CALL_FLAG_INCOMPLETE;
+        EXPECT_EQ(incomplete, call->no == never);
+        if (call->no == late) {
+            ASSERT_TRUE(call->ret != nullptr);
+            EXPECT_EQ(call->ret->toUInt(), 2 * late);
+        }
+        std::ostringstream os;
+        dump(*call, os, DUMP_FLAG_NO_COLOR);
+        EXPECT_EQ(os.str(), dumps[call->no]);
+        ++expected;
+        delete call;
+    }
+    EXPECT_EQ(expected, NUM_PARALLEL_CALLS);
+
+    parser.close();
+    remove(filename);
+}
+
+
+TEST(trace_file, parse_ahead)
+{
+    const char *filename = "trace_file_test_parse_ahead.trace";
+    writeTrace(filename);
+
+    Parser *traceParser = new Parser;
+    traceParser->setUseArenas(true);
+    traceParser->setUseBlobViews(true);
+    ParseAheadParser parser(traceParser, 16);
+    ASSERT_TRUE(parser.open(filename));
+
+    ParseBookmark bookmark;
+    unsigned bookmarkNo = NUM_CALLS / 2;
+
+    // Consume from another thread half way through, as retrace's runners do
+    for (unsigned no = 0; no < bookmarkNo; ++no) {
+        std::unique_ptr<Call> call(parser.parse_call());
+        checkCall(call.get(), no);
+    }
+    parser.getBookmark(bookmark);
+    os::thread thread([&] () {
+        for (unsigned no = bookmarkNo; no < NUM_CALLS; ++no) {
+            std::unique_ptr<Call> call(parser.parse_call());
+            checkCall(call.get(), no);
+        }
+        EXPECT_EQ(parser.parse_call(), nullptr);
+    });
+    thread.join();
+
+    // Jump back, discarding whatever was queued
+    for (unsigned i = 0; i < 2; ++i) {
+        parser.setBookmark(bookmark);
+        for (unsigned no = bookmarkNo; no < bookmarkNo + 8; ++no) {
+            std::unique_ptr<Call> call(parser.parse_call());
+            checkCall(call.get(), no);
+        }
+    }
+
+    parser.close();
+    remove(filename);
+}
+
+
+TEST(trace_file, frame_range_loop)
+{
+    const char *filename = "trace_file_test_frame_range_loop.trace";
+    writeTrace(filename);
+
+    // Frames 2 and 3, three times over
+    FrameRangeLoopParser parser(new Parser, 2, 3, 2);
+    ASSERT_TRUE(parser.open(filename));
+
+    for (unsigned no = 0; no < 2 * 64; ++no) {
+        std::unique_ptr<Call> call(parser.parse_call());
+        checkCall(call.get(), no);
+    }
+    for (unsigned i = 0; i < 3; ++i) {
+        for (unsigned no = 2 * 64; no < 4 * 64; ++no) {
+            Call *call = parser.parse_call();
+            checkCall(call, no);
+            ASSERT_TRUE(call->reuse_call);
+        }
+    }
+    EXPECT_EQ(parser.parse_call(), nullptr);
+    EXPECT_EQ(parser.parse_call(), nullptr);
+
+    EXPECT_EQ(parser.getIterationTimes().size(), 3);
+    EXPECT_EQ(parser.getFrameTimes().size(), 6);
+
+    parser.close();
+    remove(filename);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -34,7 +34,19 @@
 namespace trace {
 
 
-#define TRACE_VERSION 6
+#define TRACE_VERSION 8
+
+/*
+ * First version with deduplicated blobs.  Traces are only stamped with it when
+ * they may contain some, so that older releases can read the others.
+ */
+#define TRACE_VERSION_DEDUP_BLOB 7
+
+/*
+ * First version with build IDs of modules in backtraces.  Likewise, traces
+ * are only stamped with it when they may contain some.
+ */
+#define TRACE_VERSION_BUILD_ID 8
 
 
 enum Event {
@@ -68,6 +80,7 @@ enum Type {
     TYPE_OPAQUE,
     TYPE_REPR,
     TYPE_WSTRING,
+    TYPE_DEDUP_BLOB,
 };
 
 enum BacktraceDetail {
@@ -77,6 +90,7 @@ enum BacktraceDetail {
     BACKTRACE_FILENAME,
     BACKTRACE_LINENUMBER,
     BACKTRACE_OFFSET,
+    BACKTRACE_BUILD_ID,
 };
 
 enum {
@@ -0,0 +1,262 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <assert.h>
+
+#include <algorithm>
+
+#include "trace_index.hpp"
+
+
+/*
+ * Version of the serialized index, which is independent from the trace
+ * format version.
+ */
+#define TRACE_INDEX_VERSION 1
+
+
+namespace trace {
+
+
+void
+Index::clear(void)
+{
+    sigs.clear();
+    frames.clear();
+    calls.clear();
+    blobs.clear();
+    numCalls = 0;
+}
+
+
+const IndexCall *
+Index::lookupCall(CallNo no) const
+{
+    auto it = std::upper_bound(calls.begin(), calls.end(), no,
+        [] (CallNo no, const IndexCall &call) {
+            return no < call.no;
+        });
+    if (it == calls.begin()) {
+        return nullptr;
+    }
+    return &*--it;
+}
+
+
+const IndexCall *
+Index::lookupFrame(unsigned frame) const
+{
+    if (frame >= frames.size()) {
+        return nullptr;
+    }
+    return &frames[frame];
+}
+
+
+static void
+writeUInt(std::string &data, unsigned long long value)
+{
+    do {
+        char c = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            c |= 0x80;
+        }
+        data.push_back(c);
+    } while (value);
+}
+
+
+/*
+ * Offsets are stored as deltas from the previous one, since they are sorted.
+ */
+static void
+writeOffset(std::string &data, File::Offset &prev, const File::Offset &offset)
+{
+    assert(offset.chunk >= prev.chunk);
+    writeUInt(data, offset.chunk - prev.chunk);
+    writeUInt(data, offset.offsetInChunk);
+    prev = offset;
+}
+
+
+static void
+writeCalls(std::string &data, const std::vector<IndexCall> &calls)
+{
+    writeUInt(data, calls.size());
+    CallNo prevNo = 0;
+    File::Offset prevOffset;
+    for (auto & call : calls) {
+        assert(call.no >= prevNo);
+        writeUInt(data, call.no - prevNo);
+        prevNo = call.no;
+        writeOffset(data, prevOffset, call.offset);
+    }
+}
+
+
+void
+Index::serialize(std::string &data) const
+{
+    data.clear();
+
+    writeUInt(data, TRACE_INDEX_VERSION);
+    writeUInt(data, numCalls);
+
+    writeUInt(data, sigs.size());
+    File::Offset prevOffset;
+    for (auto & sig : sigs) {
+        writeUInt(data, sig.kind);
+        writeUInt(data, sig.id);
+        writeOffset(data, prevOffset, sig.offset);
+    }
+
+    writeCalls(data, frames);
+    writeCalls(data, calls);
+
+    writeUInt(data, blobs.size());
+    prevOffset = File::Offset();
+    for (auto & blob : blobs) {
+        writeOffset(data, prevOffset, blob);
+    }
+}
+
+
+namespace {
+
+class IndexReader {
+public:
+    const char *ptr;
+    const char *end;
+    bool error = false;
+
+    IndexReader(const char *data, size_t size) :
+        ptr(data),
+        end(data + size)
+    {}
+
+    unsigned long long
+    readUInt(void) {
+        unsigned long long value = 0;
+        unsigned shift = 0;
+        unsigned char c;
+        do {
+            if (ptr == end || shift >= 64) {
+                error = true;
+                return 0;
+            }
+            c = *ptr++;
+            value |= (unsigned long long)(c & 0x7f) << shift;
+            shift += 7;
+        } while (c & 0x80);
+        return value;
+    }
+
+    /*
+     * Read an element count, rejecting counts that could not possibly fit in
+     * the remaining data, to avoid huge allocations on corrupted indices.
+     */
+    size_t
+    readCount(void) {
+        unsigned long long count = readUInt();
+        if (count > size_t(end - ptr)) {
+            error = true;
+            return 0;
+        }
+        return count;
+    }
+
+    void
+    readOffset(File::Offset &prev, File::Offset &offset) {
+        offset.chunk = prev.chunk + readUInt();
+        offset.offsetInChunk = readUInt();
+        prev = offset;
+    }
+
+    void
+    readCalls(std::vector<IndexCall> &calls) {
+        size_t count = readCount();
+        calls.resize(count);
+        CallNo prevNo = 0;
+        File::Offset prevOffset;
+        for (auto & call : calls) {
+            call.no = prevNo + readUInt();
+            prevNo = call.no;
+            readOffset(prevOffset, call.offset);
+        }
+    }
+};
+
+} /* anonymous namespace */
+
+
+bool
+Index::deserialize(const char *data, size_t size)
+{
+    clear();
+
+    IndexReader reader(data, size);
+
+    if (reader.readUInt() != TRACE_INDEX_VERSION) {
+        return false;
+    }
+
+    numCalls = reader.readUInt();
+
+    sigs.resize(reader.readCount());
+    File::Offset prevOffset;
+    for (auto & sig : sigs) {
+        unsigned long long kind = reader.readUInt();
+        if (kind > INDEX_SIG_STACK_FRAME) {
+            reader.error = true;
+        }
+        sig.kind = IndexSigKind(kind);
+        sig.id = reader.readUInt();
+        reader.readOffset(prevOffset, sig.offset);
+    }
+
+    reader.readCalls(frames);
+    reader.readCalls(calls);
+
+    // Absent from indices written before blob deduplication
+    if (reader.ptr != reader.end) {
+        blobs.resize(reader.readCount());
+        prevOffset = File::Offset();
+        for (auto & blob : blobs) {
+            reader.readOffset(prevOffset, blob);
+        }
+    }
+
+    if (reader.error) {
+        clear();
+        return false;
+    }
+
+    return true;
+}
+
+
+} /* namespace trace */
@@ -0,0 +1,150 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Trace index, allowing to seek to calls and frames without parsing
+ * everything that comes before them.
+ *
+ * See FORMAT.markdown for details.
+ */
+
+#pragma once
+
+
+#include <assert.h>
+
+#include <string>
+#include <vector>
+
+#include "trace_file.hpp"
+#include "trace_model.hpp"
+
+
+/*
+ * Interval between consecutive indexed calls.
+ */
+#define TRACE_INDEX_CALL_INTERVAL 1024
+
+
+namespace trace {
+
+
+/**
+ * Kinds of signatures, as they are defined inline in the trace.
+ */
+enum IndexSigKind {
+    INDEX_SIG_FUNCTION = 0,
+    INDEX_SIG_STRUCT,
+    INDEX_SIG_ENUM,
+    INDEX_SIG_BITMASK,
+    INDEX_SIG_STACK_FRAME,
+};
+
+
+/**
+ * Location of a signature definition, more precisely of the signature ID
+ * preceding the definition itself.
+ */
+struct IndexSig {
+    IndexSigKind kind;
+    Id id;
+    File::Offset offset;
+};
+
+
+/**
+ * Location of a call enter event.
+ */
+struct IndexCall {
+    CallNo no;
+    File::Offset offset;
+};
+
+
+class Index
+{
+public:
+    /* Signature definitions, sorted by offset */
+    std::vector<IndexSig> sigs;
+
+    /* First call of every frame */
+    std::vector<IndexCall> frames;
+
+    /* Every TRACE_INDEX_CALL_INTERVAL-th call */
+    std::vector<IndexCall> calls;
+
+    /* Definitions of deduplicated blobs, by ID */
+    std::vector<File::Offset> blobs;
+
+    /* Total number of calls */
+    CallNo numCalls = 0;
+
+    void clear(void);
+
+    bool empty(void) const {
+        return calls.empty();
+    }
+
+    void addSig(IndexSigKind kind, Id id, const File::Offset &offset) {
+        sigs.push_back({kind, id, offset});
+    }
+
+    void addFrame(CallNo no, const File::Offset &offset) {
+        frames.push_back({no, offset});
+    }
+
+    void addCall(CallNo no, const File::Offset &offset) {
+        calls.push_back({no, offset});
+    }
+
+    void addBlob(Id id, const File::Offset &offset) {
+        assert(id == blobs.size());
+        blobs.push_back(offset);
+    }
+
+    /**
+     * Find the definition of the given deduplicated blob.
+     */
+    const File::Offset *lookupBlob(Id id) const {
+        return id < blobs.size() ? &blobs[id] : nullptr;
+    }
+
+    /**
+     * Find the closest indexed call at or before the given call.
+     */
+    const IndexCall *lookupCall(CallNo no) const;
+
+    /**
+     * Find the first call of the given frame.
+     */
+    const IndexCall *lookupFrame(unsigned frame) const;
+
+    void serialize(std::string &data) const;
+    bool deserialize(const char *data, size_t size);
+};
+
+
+} /* namespace trace */
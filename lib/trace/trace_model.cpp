@@ -37,6 +37,12 @@ static Null null;
 
 
 Call::~Call() {
+    if (arena) {
+        // Releases all values at once
+        delete arena;
+        return;
+    }
+
     for (auto & arg : args) {
         delete arg.value;
     }
@@ -137,7 +143,9 @@ Blob::~Blob() {
     // bound blobs and keep the total size bounded.
 
     if (!bound) {
-        delete [] buf;
+        if (!pin) {
+            delete [] buf;
+        }
         return;
     }
 
@@ -154,6 +162,7 @@ StackFrame::~StackFrame() {
     delete [] module;
     delete [] function;
     delete [] filename;
+    delete [] buildId;
 }
 
 
@@ -226,7 +235,26 @@ void * Repr   ::toPointer(void) const { return machineValue->toPointer(); }
 
 void * Value  ::toPointer(bool bind) { assert(0); return NULL; }
 void * Null   ::toPointer(bool bind) { return NULL; }
-void * Blob   ::toPointer(bool bind) { if (bind) bound = true; return buf; }
+void * Blob   ::toPointer(bool bind) {
+    if (bind && !bound) {
+        if (arena || pin) {
+            // Bound blobs outlive the call, so move them out of the arena or
+            // the shared buffer, and leave them to the destructor.
+            char *heapBuf = new char[size];
+            memcpy(heapBuf, buf, size);
+            buf = heapBuf;
+            // (views have a finalizer from the start)
+            if (arena && !pin) {
+                arena->addFinalizer([] (void *blob) {
+                    static_cast<Blob *>(blob)->~Blob();
+                }, this);
+            }
+            pin.reset();
+        }
+        bound = true;
+    }
+    return buf;
+}
 void * Pointer::toPointer(bool bind) { return (void *)value; }
 void * Repr   ::toPointer(bool bind) { return machineValue->toPointer(bind); }
 
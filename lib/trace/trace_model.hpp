@@ -34,9 +34,12 @@
 #include <stdlib.h>
 
 #include <map>
+#include <memory>
 #include <vector>
 #include <ostream>
 
+#include "trace_arena.hpp"
+
 
 namespace trace {
 
@@ -95,6 +98,13 @@ class Null;
 class Struct;
 class Array;
 class Blob;
+class Value;
+
+
+/*
+ * Vector of child values, which shares the arena of the call, if any.
+ */
+typedef std::vector<Value *, ArenaAllocator<Value *> > ValueVector;
 
 
 class Value
@@ -292,7 +302,10 @@ public:
 class Struct : public Value
 {
 public:
-    Struct(StructSig *_sig) : sig(_sig), members(_sig->num_members) { }
+    Struct(StructSig *_sig, Arena *arena = nullptr) :
+        sig(_sig),
+        members(_sig->num_members, nullptr, ValueVector::allocator_type(arena))
+    {}
     ~Struct();
 
     bool toBool(void) const override;
@@ -302,14 +315,16 @@ public:
     Struct *toStruct(void) override { return this; }
 
     const StructSig *sig;
-    std::vector<Value *> members;
+    ValueVector members;
 };
 
 
 class Array : public Value
 {
 public:
-    Array(size_t len) : values(len) {}
+    Array(size_t len, Arena *arena = nullptr) :
+        values(len, nullptr, ValueVector::allocator_type(arena))
+    {}
     ~Array();
 
     bool toBool(void) const override;
@@ -318,7 +333,7 @@ public:
     const Array *toArray(void) const override { return this; }
     Array *toArray(void) override { return this; }
 
-    std::vector<Value *> values;
+    ValueVector values;
 
     inline size_t
     size(void) const {
@@ -330,10 +345,23 @@ public:
 class Blob : public Value
 {
 public:
-    Blob(size_t _size) {
+    Blob(size_t _size, Arena *_arena = nullptr) {
         size = _size;
-        buf = new char[_size];
+        buf = _arena ? _arena->allocateArray<char>(_size) : new char[_size];
         bound = false;
+        arena = _arena;
+    }
+
+    /**
+     * View into a buffer shared with the file reader, without copying.
+     */
+    Blob(char *_buf, size_t _size, std::shared_ptr<char> _pin, Arena *_arena = nullptr) :
+        pin(std::move(_pin))
+    {
+        size = _size;
+        buf = _buf;
+        bound = false;
+        arena = _arena;
     }
 
     ~Blob();
@@ -350,6 +378,12 @@ public:
     size_t size;
     char *buf;
     bool bound;
+
+    /* Arena holding buf, if any */
+    Arena *arena;
+
+    /* Buffer holding buf, for views */
+    std::shared_ptr<char> pin;
 };
 
 
@@ -401,12 +435,15 @@ struct RawStackFrame {
     const char * filename;
     int linenumber;
     long long offset;
+    // Hex build ID of the module, only given on the first frame of each
+    const char * buildId;
     RawStackFrame() :
         module(0),
         function(0),
         filename(0),
         linenumber(-1),
-        offset(-1)
+        offset(-1),
+        buildId(0)
     {
     }
 
@@ -556,21 +593,29 @@ public:
     unsigned thread_id;
     unsigned no;
     const FunctionSig *sig;
-    std::vector<Arg> args;
+    std::vector<Arg, ArenaAllocator<Arg> > args;
     Value *ret;
 
     CallFlags flags;
     Backtrace* backtrace;
     bool reuse_call;
 
-    Call(const FunctionSig *_sig, const CallFlags &_flags, unsigned _thread_id) :
+    /**
+     * Arena from which all the values of this call were allocated, if any.
+     * Owned by the call, and values in it must not be deleted individually.
+     */
+    Arena *arena;
+
+    Call(const FunctionSig *_sig, const CallFlags &_flags, unsigned _thread_id,
+         Arena *_arena = nullptr) :
         thread_id(_thread_id), 
         sig(_sig), 
-        args(_sig->num_args), 
+        args(_sig->num_args, Arg(), ArenaAllocator<Arg>(_arena)),
         ret(0),
         flags(_flags),
         backtrace(0),
-        reuse_call(false) {
+        reuse_call(false),
+        arena(_arena) {
     }
 
     ~Call();
@@ -29,6 +29,9 @@
 
 #include <stdlib.h>
 
+#include "trace_codec.hpp"
+#include "trace_file.hpp"
+
 
 namespace trace {
 
@@ -39,14 +42,70 @@ public:
 
     virtual bool write(const void *buffer, size_t length) = 0;
     virtual void flush(void) = 0;
+
+    /**
+     * Whether the stream can tell offsets of the data written so far, which
+     * match those of File::currentOffset when reading it back.
+     */
+    virtual bool supportsOffsets(void) const {
+        return false;
+    }
+
+    virtual File::Offset currentOffset(void) const {
+        return File::Offset();
+    }
+
+    /**
+     * Turn an offset obtained from currentOffset into its final value, for
+     * streams which only know where chunks land once they were written out.
+     * Only valid after flushing.
+     */
+    virtual File::Offset resolveOffset(const File::Offset &offset) const {
+        return offset;
+    }
+
+    /**
+     * Start a new chunk if the current one is more than the given percentage
+     * full, so that data written next can be read back without decompressing
+     * whatever preceded it.
+     */
+    virtual void startChunk(unsigned minFill) {
+    }
+
+    /**
+     * Append the serialized trace index.  No more data can be written
+     * afterwards.
+     */
+    virtual bool writeIndex(const void *data, size_t size) {
+        return false;
+    }
 };
 
 
+/**
+ * Create a stream of chunks compressed with the given codec, which is seekable
+ * and can be indexed.  When async is true, chunks are compressed and written
+ * by a background thread, so that the threads producing the trace don't stall
+ * on it.
+ */
 OutStream *
-createSnappyStream(const char *filename);
+createChunkedStream(const char *filename, const CodecOptions &options, bool async = false);
+
+inline OutStream *
+createSnappyStream(const char *filename, bool async = false) {
+    return createChunkedStream(filename, CodecOptions(), async);
+}
 
 OutStream *
 createZLibStream(const char *filename);
 
+/**
+ * Serialize the index pseudo-chunk for a serialized trace index, to be
+ * written at the given offset of a chunked trace, compressed by its codec.
+ */
+void
+buildChunkedIndex(std::string &chunk, ChunkCodec *codec, uint64_t offset,
+                  const void *data, size_t size);
+
 
 } /* namespace trace */
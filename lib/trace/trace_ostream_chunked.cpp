@@ -0,0 +1,453 @@
+/**************************************************************************
+ *
+ * Copyright 2015 VMware, Inc
+ * Copyright 2011 Zack Rusin
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include "trace_ostream.hpp"
+
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <assert.h>
+#include <string.h>
+
+#include "os.hpp"
+#include "os_thread.hpp"
+#include "os_time.hpp"
+#include "trace_codec.hpp"
+#include "trace_snappy.hpp"
+
+
+/*
+ * Number of chunk buffers when compressing asynchronously: one being filled
+ * and the rest queued for compression, past which writing blocks.
+ */
+#define SNAPPY_ASYNC_BUFFERS 3
+
+/*
+ * How many times flushing tries to take the lock of the compression queue,
+ * which other threads only ever hold briefly, before giving up.
+ */
+#define SNAPPY_FLUSH_LOCK_ATTEMPTS 1000
+
+
+using namespace trace;
+
+
+class ChunkedOutStream : public OutStream {
+public:
+    ChunkedOutStream(const char *filename, const CodecOptions &options, bool async);
+    ~ChunkedOutStream();
+
+    ChunkedOutStream(void);
+    bool write(const void *buffer, size_t length) override;
+    void flush(void) override;
+
+    bool supportsOffsets(void) const override {
+        return true;
+    }
+    File::Offset currentOffset(void) const override;
+    File::Offset resolveOffset(const File::Offset &offset) const override;
+    void startChunk(unsigned minFill) override;
+    bool writeIndex(const void *data, size_t size) override;
+
+    bool isOpen(void) {
+        return m_stream.is_open();
+    }
+
+
+private:
+    void close(void);
+
+    inline size_t usedCacheSize(void) const
+    {
+        assert(m_cachePtr >= m_cache);
+        return m_cachePtr - m_cache;
+    }
+    inline size_t freeCacheSize(void) const
+    {
+        assert(m_cacheSize >= usedCacheSize());
+        if (m_cacheSize > 0) {
+            return m_cacheSize - usedCacheSize();
+        } else {
+            return 0;
+        }
+    }
+    inline bool endOfData(void) const
+    {
+        return m_stream.eof() && freeCacheSize() == 0;
+    }
+    void flushWriteCache(void);
+    void createCache(size_t size);
+    void writeCompressedLength(size_t length);
+    void writeChunk(const char *data, size_t length);
+
+    void drain(void);
+    void compressor(void);
+private:
+    std::ofstream m_stream;
+    ChunkCodec *m_codec;
+    size_t m_cacheMaxSize;
+    size_t m_cacheSize;
+    char *m_cache;
+    char *m_cachePtr;
+
+    char *m_compressedCache;
+
+    /* File offset of the chunk being filled, or the end of the data written
+     * so far, when compressing asynchronously */
+    uint64_t m_chunkOffset;
+
+    /*
+     * Asynchronous compression state.  Offsets handed out refer to the chunk
+     * sequence number, until resolved from m_chunkOffsets.
+     */
+    bool m_async;
+    os::thread m_thread;
+    os::mutex m_mutex;
+    os::condition_variable m_queueCond;
+    os::condition_variable m_freeCond;
+    std::deque<std::pair<char *, size_t> > m_queue;
+    std::vector<char *> m_freeBuffers;
+    bool m_busy = false;
+    bool m_stop = false;
+    uint64_t m_chunkSeq = 0;
+    std::vector<uint64_t> m_chunkOffsets;
+};
+
+
+/* Whether the current thread is the compressor thread of some stream */
+static OS_THREAD_LOCAL bool isCompressorThread = false;
+
+ChunkedOutStream::ChunkedOutStream(const char *filename, const CodecOptions &options, bool async)
+    : m_codec(createChunkCodec(options)),
+      m_cacheMaxSize(SNAPPY_CHUNK_SIZE),
+      m_cacheSize(m_cacheMaxSize),
+      m_cache(new char [m_cacheMaxSize]),
+      m_cachePtr(m_cache),
+      m_compressedCache(nullptr),
+      m_chunkOffset(0),
+      m_async(async)
+{
+    if (!m_codec) {
+        return;
+    }
+
+    size_t maxCompressedLength =
+        m_codec->maxCompressedLength(SNAPPY_CHUNK_SIZE);
+    m_compressedCache = new char[maxCompressedLength];
+    
+    std::ios_base::openmode fmode = std::fstream::binary
+                                  | std::fstream::out
+                                  | std::fstream::trunc;
+    m_stream.open(filename, fmode);
+    if (m_stream.is_open()) {
+        std::string header;
+        writeChunkedHeader(header, options);
+        m_stream.write(header.data(), header.size());
+        m_stream.flush();
+        m_chunkOffset = header.size();
+
+        if (m_async) {
+            for (unsigned i = 1; i < SNAPPY_ASYNC_BUFFERS; ++i) {
+                m_freeBuffers.push_back(new char [m_cacheMaxSize]);
+            }
+            m_thread = os::thread(&ChunkedOutStream::compressor, this);
+        }
+    }
+}
+
+ChunkedOutStream::~ChunkedOutStream()
+{
+    close();
+    delete [] m_compressedCache;
+    delete [] m_cache;
+    delete m_codec;
+}
+
+bool ChunkedOutStream::write(const void *buffer, size_t length)
+{
+    if (freeCacheSize() > length) {
+        memcpy(m_cachePtr, buffer, length);
+        m_cachePtr += length;
+    } else if (freeCacheSize() == length) {
+        memcpy(m_cachePtr, buffer, length);
+        m_cachePtr += length;
+        flushWriteCache();
+    } else {
+        size_t sizeToWrite = length;
+
+        while (sizeToWrite >= freeCacheSize()) {
+            size_t endSize = freeCacheSize();
+            size_t offset = length - sizeToWrite;
+            memcpy(m_cachePtr, (const char*)buffer + offset, endSize);
+            sizeToWrite -= endSize;
+            m_cachePtr += endSize;
+            flushWriteCache();
+        }
+        if (sizeToWrite) {
+            size_t offset = length - sizeToWrite;
+            memcpy(m_cachePtr, (const char*)buffer + offset, sizeToWrite);
+            m_cachePtr += sizeToWrite;
+        }
+    }
+
+    return true;
+}
+
+void ChunkedOutStream::close(void)
+{
+    if (!m_stream.is_open()) {
+        return;
+    }
+
+    flushWriteCache();
+
+    if (m_thread.joinable()) {
+        {
+            os::unique_lock<os::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_queueCond.notify_all();
+        m_thread.join();
+        m_thread = os::thread();
+
+        for (auto buffer : m_freeBuffers) {
+            delete [] buffer;
+        }
+        m_freeBuffers.clear();
+    }
+
+    m_stream.close();
+    delete [] m_cache;
+    m_cache = NULL;
+    m_cachePtr = NULL;
+}
+
+void ChunkedOutStream::flush(void)
+{
+    if (isCompressorThread) {
+        // Crashed while compressing, so the queue will never drain
+        os::log("apitrace: warning: can't flush from the compressor thread\n");
+        return;
+    }
+
+    if (m_async) {
+        /*
+         * Flushing happens on crashes, possibly in a signal handler which
+         * interrupted this thread with the queue locked, in which case
+         * waiting on the lock, or on the compressor, would hang.
+         */
+        unsigned attempts = 0;
+        while (!m_mutex.try_lock()) {
+            if (++attempts == SNAPPY_FLUSH_LOCK_ATTEMPTS) {
+                os::log("apitrace: warning: can't flush while the trace is being written\n");
+                return;
+            }
+            os::sleep(100);
+        }
+        m_mutex.unlock();
+    }
+
+    flushWriteCache();
+    drain();
+    m_stream.flush();
+}
+
+void ChunkedOutStream::flushWriteCache(void)
+{
+    size_t inputLength = usedCacheSize();
+
+    if (inputLength) {
+        if (m_async) {
+            // Hand the chunk over, waiting for a free buffer if the
+            // compressor is lagging behind
+            os::unique_lock<os::mutex> lock(m_mutex);
+            while (m_freeBuffers.empty()) {
+                m_freeCond.wait(lock);
+            }
+            m_queue.emplace_back(m_cache, inputLength);
+            m_cache = m_freeBuffers.back();
+            m_freeBuffers.pop_back();
+            ++m_chunkSeq;
+            m_queueCond.notify_one();
+        } else {
+            writeChunk(m_cache, inputLength);
+        }
+        m_cachePtr = m_cache;
+    }
+    assert(m_cachePtr == m_cache);
+}
+
+void ChunkedOutStream::writeChunk(const char *data, size_t length)
+{
+    size_t compressedLength = m_codec->compress(data, length, m_compressedCache);
+    if (!compressedLength) {
+        os::log("apitrace: error: failed to compress trace chunk\n");
+        return;
+    }
+
+    writeCompressedLength(compressedLength);
+    m_stream.write(m_compressedCache, compressedLength);
+    m_chunkOffset += 4 + compressedLength;
+}
+
+/**
+ * Wait for the compressor thread to write all queued chunks.
+ */
+void ChunkedOutStream::drain(void)
+{
+    if (!m_async) {
+        return;
+    }
+
+    os::unique_lock<os::mutex> lock(m_mutex);
+    while (!m_queue.empty() || m_busy) {
+        m_freeCond.wait(lock);
+    }
+}
+
+void ChunkedOutStream::compressor(void)
+{
+    isCompressorThread = true;
+
+    os::unique_lock<os::mutex> lock(m_mutex);
+    while (true) {
+        while (!m_stop && m_queue.empty()) {
+            m_queueCond.wait(lock);
+        }
+        if (m_queue.empty()) {
+            // Only stop once everything queued was written
+            return;
+        }
+
+        std::pair<char *, size_t> chunk = m_queue.front();
+        m_queue.pop_front();
+        m_busy = true;
+        m_chunkOffsets.push_back(m_chunkOffset);
+
+        lock.unlock();
+        writeChunk(chunk.first, chunk.second);
+        lock.lock();
+
+        m_busy = false;
+        m_freeBuffers.push_back(chunk.first);
+        m_freeCond.notify_all();
+    }
+}
+
+void ChunkedOutStream::writeCompressedLength(size_t length)
+{
+    unsigned char buf[4];
+    buf[0] = length & 0xff; length >>= 8;
+    buf[1] = length & 0xff; length >>= 8;
+    buf[2] = length & 0xff; length >>= 8;
+    buf[3] = length & 0xff; length >>= 8;
+    assert(length == 0);
+    m_stream.write((const char *)buf, sizeof buf);
+}
+
+File::Offset ChunkedOutStream::currentOffset(void) const
+{
+    if (m_async) {
+        return File::Offset(m_chunkSeq, usedCacheSize());
+    }
+    return File::Offset(m_chunkOffset, usedCacheSize());
+}
+
+File::Offset ChunkedOutStream::resolveOffset(const File::Offset &offset) const
+{
+    if (!m_async) {
+        return offset;
+    }
+    assert(m_queue.empty() && !m_busy);
+    if (offset.chunk < m_chunkOffsets.size()) {
+        return File::Offset(m_chunkOffsets[offset.chunk], offset.offsetInChunk);
+    }
+    // The chunk still being filled, which will start where data ends
+    return File::Offset(m_chunkOffset, offset.offsetInChunk);
+}
+
+void ChunkedOutStream::startChunk(unsigned minFill)
+{
+    if (usedCacheSize() * 100 > m_cacheSize * minFill) {
+        flushWriteCache();
+    }
+}
+
+
+void
+trace::buildChunkedIndex(std::string &chunk, ChunkCodec *codec, uint64_t offset,
+                         const void *data, size_t size)
+{
+    std::string compressed(codec->maxCompressedLength(size), '\0');
+    compressed.resize(codec->compress(static_cast<const char *>(data), size, &compressed[0]));
+
+    size_t length = SNAPPY_INDEX_MARKER_SIZE + compressed.size() + SNAPPY_INDEX_TRAILER_SIZE;
+    assert(length <= 0xffffffff);
+
+    chunk.clear();
+    chunk.reserve(4 + length);
+    for (unsigned i = 0; i < 4; ++i) {
+        chunk.push_back(char(length >> (8 * i)));
+    }
+    chunk.append(SNAPPY_INDEX_MARKER_SIZE, SNAPPY_INDEX_MARKER_BYTE);
+    chunk.append(compressed);
+    for (unsigned i = 0; i < 8; ++i) {
+        chunk.push_back(char(offset >> (8 * i)));
+    }
+    chunk.append(SNAPPY_INDEX_MAGIC, 4);
+}
+
+bool ChunkedOutStream::writeIndex(const void *data, size_t size)
+{
+    flushWriteCache();
+    drain();
+
+    std::string chunk;
+    buildChunkedIndex(chunk, m_codec, m_chunkOffset, data, size);
+    m_stream.write(chunk.data(), chunk.size());
+    m_chunkOffset += chunk.size();
+
+    return !m_stream.fail();
+}
+
+
+OutStream *
+trace::createChunkedStream(const char *filename, const CodecOptions &options, bool async)
+{
+    ChunkedOutStream *outStream = new ChunkedOutStream(filename, options, async);
+    if (!outStream->isOpen()) {
+        os::log("error: could not open %s for writing\n", filename);
+        delete outStream;
+        outStream = nullptr;
+    }
+
+    return outStream;
+}
+
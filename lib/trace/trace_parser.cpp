@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <memory>
 
 #include "trace_file.hpp"
@@ -53,11 +54,18 @@ Parser::~Parser() {
 
 bool Parser::open(const char *filename) {
     assert(!file);
-    file = File::createForRead(filename);
+    File *file = File::createForRead(filename, readAhead);
     if (!file) {
         return false;
     }
 
+    return openFile(file);
+}
+
+bool Parser::openFile(File *_file) {
+    assert(!file);
+    file = _file;
+
     version = read_uint();
     if (version > TRACE_VERSION) {
         std::cerr << "error: unsupported trace format version " << version << "\n";
@@ -78,6 +86,13 @@ bool Parser::open(const char *filename) {
         parseProperties();
     }
 
+    std::string data;
+    if (file->getIndex(data) &&
+        !index.deserialize(data.data(), data.size())) {
+        std::cerr << "warning: ignoring unsupported trace index\n";
+    }
+    indexSigsLoaded = 0;
+
     return true;
 }
 
@@ -91,12 +106,159 @@ deleteAll(Iter begin, Iter end)
     }
 }
 
-template <typename Container>
-inline void
-deleteAll(Container &c)
-{
-    deleteAll(c.begin(), c.end());
-    c.clear();
+
+void PendingCalls::insert(Call *call) {
+    CallNo no = call->no;
+    if (m_count == 0) {
+        m_first = no;
+    } else if (no < m_first) {
+        CallNo last = m_first + (m_slots.size() - 1);
+        if (last - no >= m_maxSlots) {
+            // Too far behind the window
+            Call *&s = m_outliers[no];
+            delete s;
+            s = call;
+            return;
+        }
+        grow(no, last);
+        m_first = no;
+    } else if (no - m_first >= m_slots.size()) {
+        if (no - m_first >= m_maxSlots) {
+            evictBelow(no - (m_maxSlots - 1));
+        }
+        if (m_count == 0) {
+            m_first = no;
+        } else {
+            grow(m_first, no);
+        }
+    }
+
+    Call *&s = slot(no);
+    if (s) {
+        // Call number reused in a corrupt trace
+        delete s;
+        --m_count;
+    }
+    s = call;
+    ++m_count;
+}
+
+
+Call *PendingCalls::remove(CallNo no) {
+    if (m_count == 0 || no < m_first || no - m_first >= m_slots.size()) {
+        return removeOutlier(no);
+    }
+
+    Call *&s = slot(no);
+    Call *call = s;
+    if (!call) {
+        return removeOutlier(no);
+    }
+    assert(call->no == no);
+    s = NULL;
+    --m_count;
+
+    if (no == m_first && m_count) {
+        do {
+            ++m_first;
+        } while (!slot(m_first));
+    }
+
+    return call;
+}
+
+
+Call *PendingCalls::removeFirst(void) {
+    if (!m_outliers.empty()) {
+        auto lowest = std::min_element(m_outliers.begin(), m_outliers.end(),
+            [](const std::pair<const CallNo, Call *> &a,
+               const std::pair<const CallNo, Call *> &b) {
+                return a.first < b.first;
+            });
+        if (m_count == 0 || lowest->first < m_first) {
+            Call *call = lowest->second;
+            m_outliers.erase(lowest);
+            return call;
+        }
+    }
+
+    if (m_count == 0) {
+        return NULL;
+    }
+    return remove(m_first);
+}
+
+
+void PendingCalls::clear(void) {
+    if (m_count) {
+        deleteAll(m_slots.begin(), m_slots.end());
+        std::fill(m_slots.begin(), m_slots.end(), nullptr);
+        m_count = 0;
+    }
+
+    for (auto & kv : m_outliers) {
+        delete kv.second;
+    }
+    m_outliers.clear();
+}
+
+
+/**
+ * Grow the ring to cover call numbers [first, last], which must span less
+ * than m_maxSlots.
+ */
+void PendingCalls::grow(CallNo first, CallNo last) {
+    assert(last - first < m_maxSlots);
+
+    size_t size = m_slots.size();
+    while (size <= size_t(last - first)) {
+        size *= 2;
+    }
+    if (size == m_slots.size()) {
+        return;
+    }
+
+    std::vector<Call *> slots(size, nullptr);
+    for (auto call : m_slots) {
+        if (call) {
+            slots[call->no & (size - 1)] = call;
+        }
+    }
+    m_slots.swap(slots);
+}
+
+
+/**
+ * Move the calls of the ring numbered below the given one to the outliers.
+ */
+void PendingCalls::evictBelow(CallNo no) {
+    while (m_count && m_first < no) {
+        Call *&s = slot(m_first);
+        assert(s);
+        m_outliers[m_first] = s;
+        s = NULL;
+        --m_count;
+
+        if (m_count) {
+            do {
+                ++m_first;
+            } while (!slot(m_first));
+        }
+    }
+}
+
+
+Call *PendingCalls::removeOutlier(CallNo no) {
+    if (m_outliers.empty()) {
+        return NULL;
+    }
+    auto it = m_outliers.find(no);
+    if (it == m_outliers.end()) {
+        return NULL;
+    }
+    Call *call = it->second;
+    m_outliers.erase(it);
+    return call;
 }
 
 void Parser::close(void) {
@@ -107,8 +269,10 @@ void Parser::close(void) {
     }
 
     properties.clear();
+    index.clear();
+    indexSigsLoaded = 0;
 
-    deleteAll(calls);
+    calls.clear();
 
     // Delete all signature data.  Signatures are mere structures which don't
     // own their own memory, so we need to destroy all data we created here.
@@ -159,6 +323,10 @@ void Parser::close(void) {
     }
     bitmasks.clear();
 
+    dedupBlobs.clear();
+    dedupBlobCache.clear();
+    dedupBlobCacheSize = 0;
+
     next_call_no = 0;
 }
 
@@ -170,13 +338,116 @@ void Parser::getBookmark(ParseBookmark &bookmark) {
 
 
 void Parser::setBookmark(const ParseBookmark &bookmark) {
+    loadIndexSigs(bookmark.offset);
     file->setCurrentOffset(bookmark.offset);
     next_call_no = bookmark.next_call_no;
     
     // Simply ignore all pending calls
-    deleteAll(calls);
+    calls.clear();
+}
+
+bool Parser::isSigLoaded(const IndexSig &sig) {
+    switch (sig.kind) {
+    case INDEX_SIG_FUNCTION:
+        return sig.id < functions.size() && functions[sig.id];
+    case INDEX_SIG_STRUCT:
+        return sig.id < structs.size() && structs[sig.id];
+    case INDEX_SIG_ENUM:
+        return sig.id < enums.size() && enums[sig.id];
+    case INDEX_SIG_BITMASK:
+        return sig.id < bitmasks.size() && bitmasks[sig.id];
+    case INDEX_SIG_STACK_FRAME:
+        return sig.id < frames.size() && frames[sig.id];
+    }
+    return true;
+}
+
+
+/**
+ * Parse all signatures defined before the given offset which haven't been
+ * parsed yet, as parsing from there on will assume they are known.
+ */
+void Parser::loadIndexSigs(const File::Offset &offset) {
+    while (indexSigsLoaded < index.sigs.size()) {
+        const IndexSig &sig = index.sigs[indexSigsLoaded];
+        if (!(sig.offset < offset)) {
+            break;
+        }
+        ++indexSigsLoaded;
+
+        if (isSigLoaded(sig)) {
+            continue;
+        }
+
+        file->setCurrentOffset(sig.offset);
+        switch (sig.kind) {
+        case INDEX_SIG_FUNCTION:
+            parse_function_sig();
+            break;
+        case INDEX_SIG_STRUCT:
+            parse_struct_sig();
+            break;
+        case INDEX_SIG_ENUM:
+            if (version >= 3) {
+                parse_enum_sig();
+            } else {
+                parse_old_enum_sig();
+            }
+            break;
+        case INDEX_SIG_BITMASK:
+            parse_bitmask_sig();
+            break;
+        case INDEX_SIG_STACK_FRAME:
+            parse_backtrace_frame(FULL);
+            break;
+        }
+    }
+}
+
+
+void Parser::seekToIndexCall(const IndexCall &call) {
+    ParseBookmark bookmark;
+    bookmark.offset = call.offset;
+    bookmark.next_call_no = call.no;
+    setBookmark(bookmark);
+}
+
+
+bool Parser::seekToCall(CallNo no) {
+    const IndexCall *call = index.lookupCall(no);
+    if (!call) {
+        return false;
+    }
+    seekToIndexCall(*call);
+    return true;
+}
+
+
+bool Parser::seekToFrame(unsigned frame) {
+    const IndexCall *call = index.lookupFrame(frame);
+    if (!call) {
+        return false;
+    }
+    seekToIndexCall(*call);
+    return true;
+}
+
+
+void Parser::scanIndex(Index &result) {
+    result.clear();
+    indexBuilder = &result;
+    indexFrameStart = true;
+
+    Call *call;
+    while ((call = scan_call())) {
+        delete call;
+    }
+
+    result.numCalls = next_call_no;
+    indexBuilder = nullptr;
 }
 
+
 void Parser::parseProperties(void)
 {
     if (TRACE_VERBOSE) {
@@ -195,6 +466,9 @@ void Parser::parseProperties(void)
 Call *Parser::parse_call(Mode mode) {
     do {
         Call *call;
+        if (indexBuilder) {
+            eventOffset = file->currentOffset();
+        }
         int c = read_byte();
         switch (c) {
         case trace::EVENT_ENTER:
@@ -217,19 +491,22 @@ Call *Parser::parse_call(Mode mode) {
             std::cerr << "error: unknown event " << c << "\n";
             exit(1);
         case -1:
-            if (!calls.empty()) {
-                call = calls.front();
-                call->flags |= CALL_FLAG_INCOMPLETE;
-                calls.pop_front();
-                adjust_call_flags(call);
-                return call;
-            }
-            return NULL;
+            return removePendingCall();
         }
     } while(true);
 }
 
 
+Call *Parser::removePendingCall(void) {
+    Call *call = calls.removeFirst();
+    if (call) {
+        call->flags |= CALL_FLAG_INCOMPLETE;
+        adjust_call_flags(call);
+    }
+    return call;
+}
+
+
 /**
  * Helper function to lookup an ID in a vector, resizing the vector if it doesn't fit.
  */
@@ -246,6 +523,11 @@ T *lookup(std::vector<T *> &map, size_t index) {
 
 Parser::FunctionSigFlags *
 Parser::parse_function_sig(void) {
+    File::Offset offset;
+    if (indexBuilder) {
+        offset = file->currentOffset();
+    }
+
     size_t id = read_uint();
 
     FunctionSigState *sig = lookup(functions, id);
@@ -264,6 +546,9 @@ Parser::parse_function_sig(void) {
         sig->flags = lookupCallFlags(sig->name);
         sig->fileOffset = file->currentOffset();
         functions[id] = sig;
+        if (indexBuilder) {
+            indexBuilder->addSig(INDEX_SIG_FUNCTION, id, offset);
+        }
 
         /**
          * Try to autodetect the API.
@@ -315,6 +600,11 @@ Parser::parse_function_sig(void) {
 
 
 StructSig *Parser::parse_struct_sig() {
+    File::Offset offset;
+    if (indexBuilder) {
+        offset = file->currentOffset();
+    }
+
     size_t id = read_uint();
 
     StructSigState *sig = lookup(structs, id);
@@ -332,6 +622,9 @@ StructSig *Parser::parse_struct_sig() {
         sig->member_names = member_names;
         sig->fileOffset = file->currentOffset();
         structs[id] = sig;
+        if (indexBuilder) {
+            indexBuilder->addSig(INDEX_SIG_STRUCT, id, offset);
+        }
     } else if (file->currentOffset() < sig->fileOffset) {
         /* skip over the signature */
         skip_string(); /* name */
@@ -353,6 +646,11 @@ StructSig *Parser::parse_struct_sig() {
  *            | id
  */
 EnumSig *Parser::parse_old_enum_sig() {
+    File::Offset offset;
+    if (indexBuilder) {
+        offset = file->currentOffset();
+    }
+
     size_t id = read_uint();
 
     EnumSigState *sig = lookup(enums, id);
@@ -368,6 +666,9 @@ EnumSig *Parser::parse_old_enum_sig() {
         sig->values = values;
         sig->fileOffset = file->currentOffset();
         enums[id] = sig;
+        if (indexBuilder) {
+            indexBuilder->addSig(INDEX_SIG_ENUM, id, offset);
+        }
     } else if (file->currentOffset() < sig->fileOffset) {
         /* skip over the signature */
         skip_string(); /*name*/
@@ -380,6 +681,11 @@ EnumSig *Parser::parse_old_enum_sig() {
 
 
 EnumSig *Parser::parse_enum_sig() {
+    File::Offset offset;
+    if (indexBuilder) {
+        offset = file->currentOffset();
+    }
+
     size_t id = read_uint();
 
     EnumSigState *sig = lookup(enums, id);
@@ -397,6 +703,9 @@ EnumSig *Parser::parse_enum_sig() {
         sig->values = values;
         sig->fileOffset = file->currentOffset();
         enums[id] = sig;
+        if (indexBuilder) {
+            indexBuilder->addSig(INDEX_SIG_ENUM, id, offset);
+        }
     } else if (file->currentOffset() < sig->fileOffset) {
         /* skip over the signature */
         int num_values = read_uint();
@@ -412,6 +721,11 @@ EnumSig *Parser::parse_enum_sig() {
 
 
 BitmaskSig *Parser::parse_bitmask_sig() {
+    File::Offset offset;
+    if (indexBuilder) {
+        offset = file->currentOffset();
+    }
+
     size_t id = read_uint();
 
     BitmaskSigState *sig = lookup(bitmasks, id);
@@ -432,6 +746,9 @@ BitmaskSig *Parser::parse_bitmask_sig() {
         sig->flags = flags;
         sig->fileOffset = file->currentOffset();
         bitmasks[id] = sig;
+        if (indexBuilder) {
+            indexBuilder->addSig(INDEX_SIG_BITMASK, id, offset);
+        }
     } else if (file->currentOffset() < sig->fileOffset) {
         /* skip over the signature */
         int num_flags = read_uint();
@@ -457,12 +774,27 @@ void Parser::parse_enter(Mode mode) {
 
     FunctionSigFlags *sig = parse_function_sig();
 
-    Call *call = new Call(sig, sig->flags, thread_id);
+    if (next_call_no >= endCallNo) {
+        mode = SCAN;
+    }
+
+    Arena *arena = useArenas && mode == FULL ? new Arena : nullptr;
+    Call *call = new Call(sig, sig->flags, thread_id, arena);
 
     call->no = next_call_no++;
 
-    if (parse_call_details(call, mode)) {
-        calls.push_back(call);
+    if (indexBuilder) {
+        if (indexFrameStart) {
+            indexBuilder->addFrame(call->no, eventOffset);
+        }
+        if (call->no % TRACE_INDEX_CALL_INTERVAL == 0) {
+            indexBuilder->addCall(call->no, eventOffset);
+        }
+        indexFrameStart = sig->flags & CALL_FLAG_END_FRAME;
+    }
+
+    if (parse_call_details(call, mode) && call->no < endCallNo) {
+        calls.insert(call);
     } else {
         delete call;
     }
@@ -471,14 +803,7 @@ void Parser::parse_enter(Mode mode) {
 
 Call *Parser::parse_leave(Mode mode) {
     unsigned call_no = read_uint();
-    Call *call = NULL;
-    for (CallList::iterator it = calls.begin(); it != calls.end(); ++it) {
-        if ((*it)->no == call_no) {
-            call = *it;
-            calls.erase(it);
-            break;
-        }
-    }
+    Call *call = calls.remove(call_no);
     if (!call) {
         /* This might happen on random access, when an asynchronous call is stranded
          * between two frames.  We won't return this call, but we still need to skip 
@@ -501,6 +826,7 @@ Call *Parser::parse_leave(Mode mode) {
 
 
 bool Parser::parse_call_details(Call *call, Mode mode) {
+    valueArena = call->arena;
     do {
         int c = read_byte();
         switch (c) {
@@ -559,12 +885,18 @@ bool Parser::parse_call_backtrace(Call *call, Mode mode) {
 }
 
 StackFrame * Parser::parse_backtrace_frame(Mode mode) {
+    File::Offset offset;
+    if (indexBuilder) {
+        offset = file->currentOffset();
+    }
+
     size_t id = read_uint();
 
     StackFrameState *frame = lookup(frames, id);
 
     if (!frame) {
         frame = new StackFrameState;
+        frame->id = id;
         int c = read_byte();
         while (c != trace::BACKTRACE_END &&
                c != -1) {
@@ -584,6 +916,9 @@ StackFrame * Parser::parse_backtrace_frame(Mode mode) {
             case trace::BACKTRACE_OFFSET:
                 frame->offset = read_uint();
                 break;
+            case trace::BACKTRACE_BUILD_ID:
+                frame->buildId = read_string();
+                break;
             default:
                 std::cerr << "error: unknown backtrace detail "
                           << c << "\n";
@@ -594,6 +929,9 @@ StackFrame * Parser::parse_backtrace_frame(Mode mode) {
 
         frame->fileOffset = file->currentOffset();
         frames[id] = frame;
+        if (indexBuilder) {
+            indexBuilder->addSig(INDEX_SIG_STACK_FRAME, id, offset);
+        }
     } else if (file->currentOffset() < frame->fileOffset) {
         int c = read_byte();
         while (c != trace::BACKTRACE_END &&
@@ -614,6 +952,9 @@ StackFrame * Parser::parse_backtrace_frame(Mode mode) {
             case trace::BACKTRACE_OFFSET:
                 scan_uint();
                 break;
+            case trace::BACKTRACE_BUILD_ID:
+                scan_string();
+                break;
             default:
                 std::cerr << "error: unknown backtrace detail "
                           << c << "\n";
@@ -659,13 +1000,13 @@ Value *Parser::parse_value(void) {
     c = read_byte();
     switch (c) {
     case trace::TYPE_NULL:
-        value = new Null;
+        value = newValue<Null>();
         break;
     case trace::TYPE_FALSE:
-        value = new Bool(false);
+        value = newValue<Bool>(false);
         break;
     case trace::TYPE_TRUE:
-        value = new Bool(true);
+        value = newValue<Bool>(true);
         break;
     case trace::TYPE_SINT:
         value = parse_sint();
@@ -706,6 +1047,9 @@ Value *Parser::parse_value(void) {
     case trace::TYPE_WSTRING:
         value = parse_wstring();
         break;
+    case trace::TYPE_DEDUP_BLOB:
+        value = parse_dedup_blob();
+        break;
     default:
         std::cerr << "error: unknown type " << c << "\n";
         exit(1);
@@ -770,6 +1114,9 @@ void Parser::scan_value(void) {
     case trace::TYPE_WSTRING:
         scan_wstring();
         break;
+    case trace::TYPE_DEDUP_BLOB:
+        scan_dedup_blob();
+        break;
     default:
         std::cerr << "error: unknown type " << c << "\n";
         exit(1);
@@ -780,7 +1127,7 @@ void Parser::scan_value(void) {
 
 
 Value *Parser::parse_sint() {
-    return new SInt(-(signed long long)read_uint());
+    return newValue<SInt>(-(signed long long)read_uint());
 }
 
 
@@ -790,7 +1137,7 @@ void Parser::scan_sint() {
 
 
 Value *Parser::parse_uint() {
-    return new UInt(read_uint());
+    return newValue<UInt>(read_uint());
 }
 
 
@@ -802,7 +1149,7 @@ void Parser::scan_uint() {
 Value *Parser::parse_float() {
     float value;
     file->read(&value, sizeof value);
-    return new Float(value);
+    return newValue<Float>(value);
 }
 
 
@@ -814,7 +1161,7 @@ void Parser::scan_float() {
 Value *Parser::parse_double() {
     double value;
     file->read(&value, sizeof value);
-    return new Double(value);
+    return newValue<Double>(value);
 }
 
 
@@ -824,7 +1171,7 @@ void Parser::scan_double() {
 
 
 Value *Parser::parse_string() {
-    return new String(read_string());
+    return newValue<String>(read_string(valueArena));
 }
 
 
@@ -844,7 +1191,7 @@ Value *Parser::parse_enum() {
         assert(sig->num_values == 1);
         value = sig->values->value;
     }
-    return new Enum(sig, value);
+    return newValue<Enum>(sig, value);
 }
 
 
@@ -863,7 +1210,7 @@ Value *Parser::parse_bitmask() {
 
     unsigned long long value = read_uint();
 
-    return new Bitmask(sig, value);
+    return newValue<Bitmask>(sig, value);
 }
 
 
@@ -875,7 +1222,7 @@ void Parser::scan_bitmask() {
 
 Value *Parser::parse_array(void) {
     size_t len = read_uint();
-    Array *array = new Array(len);
+    Array *array = newValue<Array>(len, valueArena);
     for (size_t i = 0; i < len; ++i) {
         array->values[i] = parse_value();
     }
@@ -891,9 +1238,32 @@ void Parser::scan_array(void) {
 }
 
 
+Value *Parser::newBlobView(char *data, size_t size, std::shared_ptr<char> pin) {
+    Blob *blob = newValue<Blob>(data, size, std::move(pin), valueArena);
+    if (valueArena) {
+        valueArena->addFinalizer([] (void *blob) {
+            static_cast<Blob *>(blob)->~Blob();
+        }, blob);
+    }
+    return blob;
+}
+
+
 Value *Parser::parse_blob(void) {
     size_t size = read_uint();
-    Blob *blob = new Blob(size);
+
+    if (useBlobViews && size >= TRACE_BLOB_VIEW_MIN_SIZE) {
+        size_t available;
+        const char *data = file->peek(available);
+        std::shared_ptr<char> pin;
+        if (available >= size && (pin = file->pinWindow())) {
+            Value *blob = newBlobView(const_cast<char *>(data), size, std::move(pin));
+            file->advance(size);
+            return blob;
+        }
+    }
+
+    Blob *blob = newValue<Blob>(size, valueArena);
     if (size) {
         file->read(blob->buf, size);
     }
@@ -909,9 +1279,137 @@ void Parser::scan_blob(void) {
 }
 
 
+/**
+ * Read blob contents into a buffer of their own, as pinning whole chunks
+ * would make cached blobs much more expensive than their size.
+ */
+std::shared_ptr<char> Parser::read_blob_data(size_t size) {
+    std::shared_ptr<char> buf(new char[size ? size : 1], std::default_delete<char []>());
+    if (size) {
+        file->read(buf.get(), size);
+    }
+    return buf;
+}
+
+
+/**
+ * Look up a deduplicated blob, telling whether its definition follows.
+ */
+Parser::DedupBlobState *Parser::lookupDedupBlob(Id id, const File::Offset &offset, bool &definition) {
+    if (id >= dedupBlobs.size()) {
+        dedupBlobs.resize(id + 1);
+    }
+    DedupBlobState *state = &dedupBlobs[id];
+
+    if (state->defined) {
+        // The definition is parsed again after seeking back before it
+        definition = file->supportsOffsets() && offset == state->offset;
+    } else {
+        // After seeking, references may precede all the parsed definitions
+        const File::Offset *indexed = index.lookupBlob(id);
+        definition = !indexed || *indexed == offset;
+        state->defined = true;
+        state->offset = definition ? offset : *indexed;
+        if (definition && indexBuilder && id == indexBuilder->blobs.size()) {
+            indexBuilder->addBlob(id, offset);
+        }
+    }
+
+    return state;
+}
+
+
+void Parser::cacheDedupBlob(Id id, std::shared_ptr<char> data, size_t size) {
+    DedupBlobState &state = dedupBlobs[id];
+    if (state.data) {
+        return;
+    }
+
+    state.data = std::move(data);
+    state.size = size;
+    dedupBlobCache.push_back(id);
+    dedupBlobCacheSize += size;
+
+    // Blobs can only be evicted if they can be read again
+    if (!file->supportsOffsets()) {
+        return;
+    }
+
+    while (dedupBlobCacheSize > TRACE_DEDUP_BLOB_CACHE_SIZE &&
+           dedupBlobCache.size() > 1) {
+        DedupBlobState &oldest = dedupBlobs[dedupBlobCache.front()];
+        dedupBlobCache.pop_front();
+        dedupBlobCacheSize -= oldest.size;
+        oldest.data.reset();
+    }
+}
+
+
+/**
+ * Read the definition of a deduplicated blob which isn't cached.
+ */
+bool Parser::loadDedupBlob(Id id) {
+    if (!file->supportsOffsets()) {
+        return false;
+    }
+
+    const DedupBlobState &state = dedupBlobs[id];
+    File::Offset resume = file->currentOffset();
+    file->setCurrentOffset(state.offset);
+    bool loaded = false;
+    if (read_uint() == id) {
+        size_t size = read_uint();
+        cacheDedupBlob(id, read_blob_data(size), size);
+        loaded = true;
+    }
+    file->setCurrentOffset(resume);
+    return loaded;
+}
+
+
+Value *Parser::parse_dedup_blob(void) {
+    File::Offset offset = file->currentOffset();
+    Id id = read_uint();
+
+    bool definition;
+    DedupBlobState *state = lookupDedupBlob(id, offset, definition);
+    if (definition) {
+        size_t size = read_uint();
+        if (state->data) {
+            file->skip(size);
+        } else {
+            cacheDedupBlob(id, read_blob_data(size), size);
+        }
+    } else if (!state->data && !loadDedupBlob(id)) {
+        std::cerr << "error: failed to load blob " << id << "\n";
+        return newValue<Null>();
+    }
+
+    return newBlobView(state->data.get(), state->size, state->data);
+}
+
+
+void Parser::scan_dedup_blob(void) {
+    File::Offset offset = file->currentOffset();
+    Id id = read_uint();
+
+    bool definition;
+    DedupBlobState *state = lookupDedupBlob(id, offset, definition);
+    if (definition) {
+        size_t size = read_uint();
+        if (state->data || file->supportsOffsets()) {
+            file->skip(size);
+        } else {
+            // References can't be resolved later otherwise
+            cacheDedupBlob(id, read_blob_data(size), size);
+        }
+    }
+}
+
+
 Value *Parser::parse_struct() {
     StructSig *sig = parse_struct_sig();
-    Struct *value = new Struct(sig);
+    Struct *value = newValue<Struct>(sig, valueArena);
 
     for (size_t i = 0; i < sig->num_members; ++i) {
         value->members[i] = parse_value();
@@ -932,7 +1430,7 @@ void Parser::scan_struct() {
 Value *Parser::parse_opaque() {
     unsigned long long addr;
     addr = read_uint();
-    return new Pointer(addr);
+    return newValue<Pointer>(addr);
 }
 
 
@@ -944,7 +1442,7 @@ void Parser::scan_opaque() {
 Value *Parser::parse_repr() {
     Value *humanValue = parse_value();
     Value *machineValue = parse_value();
-    return new Repr(humanValue, machineValue);
+    return newValue<Repr>(humanValue, machineValue);
 }
 
 
@@ -956,7 +1454,8 @@ void Parser::scan_repr() {
 
 Value *Parser::parse_wstring() {
     size_t len = read_uint();
-    wchar_t * value = new wchar_t[len + 1];
+    wchar_t * value = valueArena ? valueArena->allocateArray<wchar_t>(len + 1)
+                                 : new wchar_t[len + 1];
     for (size_t i = 0; i < len; ++i) {
         value[i] = read_uint();
     }
@@ -964,7 +1463,7 @@ Value *Parser::parse_wstring() {
     if (TRACE_VERBOSE) {
         std::cerr << "\tWSTRING \"" << value << "\"\n";
     }
-    return new WString(value);
+    return newValue<WString>(value);
 }
 
 
@@ -976,9 +1475,10 @@ void Parser::scan_wstring() {
 }
 
 
-char * Parser::read_string(void) {
+char * Parser::read_string(Arena *arena) {
     size_t len = read_uint();
-    char * value = new char[len + 1];
+    char * value = arena ? arena->allocateArray<char>(len + 1)
+                         : new char[len + 1];
     if (len) {
         file->read(value, len);
     }
@@ -1027,6 +1527,26 @@ unsigned long long Parser::read_uint(void) {
     unsigned long long value = 0;
     int c;
     unsigned shift = 0;
+
+    // Fast path, decoding straight from the file buffer, provided the whole
+    // varint lies within it.
+    size_t available;
+    const unsigned char *start = (const unsigned char *)file->peek(available);
+    const unsigned char *end = start + std::min(available, size_t(10));
+    for (const unsigned char *ptr = start; ptr < end; shift += 7) {
+        c = *ptr++;
+        value |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            file->advance(ptr - start);
+            if (TRACE_VERBOSE) {
+                std::cerr << "\tUINT " << value << "\n";
+            }
+            return value;
+        }
+    }
+
+    value = 0;
+    shift = 0;
     do {
         c = file->getc();
         if (c == -1) {
@@ -1043,6 +1563,16 @@ unsigned long long Parser::read_uint(void) {
 
 
 void Parser::skip_uint(void) {
+    size_t available;
+    const unsigned char *start = (const unsigned char *)file->peek(available);
+    const unsigned char *end = start + std::min(available, size_t(10));
+    for (const unsigned char *ptr = start; ptr < end; ) {
+        if (!(*ptr++ & 0x80)) {
+            file->advance(ptr - start);
+            return;
+        }
+    }
+
     int c;
     do {
         c = file->getc();
@@ -26,15 +26,31 @@
 #pragma once
 
 
+#include <deque>
 #include <iostream>
-#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "trace_file.hpp"
 #include "trace_format.hpp"
+#include "trace_index.hpp"
 #include "trace_model.hpp"
 #include "trace_api.hpp"
 
 
+/*
+ * Smallest blob worth pointing into the decompressed data rather than
+ * copying, as views keep the whole chunk alive.
+ */
+#define TRACE_BLOB_VIEW_MIN_SIZE (16 * 1024)
+
+/*
+ * Total size of the deduplicated blobs kept around for further references.
+ */
+#define TRACE_DEDUP_BLOB_CACHE_SIZE (64 * 1024 * 1024)
+
+
 namespace trace {
 
 
@@ -45,6 +61,77 @@ struct ParseBookmark
 };
 
 
+/**
+ * Calls which were entered but didn't leave yet, keyed by call number.
+ *
+ * Call numbers of pending calls mostly span a narrow window, so they are kept
+ * in a ring indexed by call number, which grows as needed to cover the window.
+ * The ring grows to at most maxSlots, past which the calls falling behind the
+ * window, such as calls which never return, are moved to a hash map.
+ */
+class PendingCalls
+{
+public:
+    PendingCalls(size_t maxSlots = 64 * 1024) :
+        m_slots(16, nullptr),
+        m_maxSlots(maxSlots)
+    {
+        assert((maxSlots & (maxSlots - 1)) == 0 && maxSlots >= m_slots.size());
+    }
+
+    ~PendingCalls() {
+        clear();
+    }
+
+    bool
+    empty(void) const {
+        return m_count == 0 && m_outliers.empty();
+    }
+
+    void insert(Call *call);
+
+    /**
+     * Remove the call with the given number, if pending.
+     */
+    Call *remove(CallNo no);
+
+    /**
+     * Remove the pending call with the lowest number.
+     */
+    Call *removeFirst(void);
+
+    /**
+     * Delete all pending calls.
+     */
+    void clear(void);
+
+private:
+    // Power of two sized ring
+    std::vector<Call *> m_slots;
+    size_t m_maxSlots;
+
+    // Lowest call number in the ring, when not empty
+    CallNo m_first = 0;
+
+    // Calls in the ring
+    size_t m_count = 0;
+
+    // Calls outside the ring's window
+    std::unordered_map<CallNo, Call *> m_outliers;
+
+    inline Call *&
+    slot(CallNo no) {
+        return m_slots[no & (m_slots.size() - 1)];
+    }
+
+    void grow(CallNo first, CallNo last);
+
+    void evictBelow(CallNo no);
+
+    Call *removeOutlier(CallNo no);
+};
+
+
 // Parser interface
 class AbstractParser
 {
@@ -75,8 +162,7 @@ protected:
 
     Properties properties;
 
-    typedef std::list<Call *> CallList;
-    CallList calls;
+    PendingCalls calls;
 
     struct FunctionSigFlags : public FunctionSig {
         CallFlags flags;
@@ -110,15 +196,56 @@ protected:
     BitmaskMap bitmasks;
     StackFrameMap frames;
 
+    struct DedupBlobState {
+        bool defined = false;
+        // Offset of the ID preceding the definition
+        File::Offset offset;
+        // Contents, if cached
+        std::shared_ptr<char> data;
+        size_t size = 0;
+    };
+
+    std::vector<DedupBlobState> dedupBlobs;
+
+    // Cached deduplicated blobs, oldest first
+    std::deque<Id> dedupBlobCache;
+    size_t dedupBlobCacheSize = 0;
+
 
     FunctionSig *glGetErrorSig = nullptr;
 
     int next_event_type = -1;
     unsigned next_call_no = 0;
 
+    // Calls numbered from this one on are only scanned over.
+    CallNo endCallNo = ~CallNo(0);
+
     unsigned long long version = 0;
     unsigned long long semanticVersion = 0;
 
+    // Whether to allocate values from per-call arenas.
+    bool useArenas = false;
+
+    // Whether the file may be read ahead on background threads.
+    bool readAhead = true;
+
+    // Whether blobs may point into the decompressed data.
+    bool useBlobViews = false;
+
+    // Arena of the call whose details are being parsed, if any.
+    Arena *valueArena = nullptr;
+
+    // Index read from the trace file, if any.
+    Index index;
+
+    // Number of index signatures already considered by loadIndexSigs.
+    size_t indexSigsLoaded = 0;
+
+    // Index being built by scanIndex.
+    Index *indexBuilder = nullptr;
+    File::Offset eventOffset;
+    bool indexFrameStart = false;
+
 public:
     API api = API_UNKNOWN;
 
@@ -128,6 +255,11 @@ public:
 
     bool open(const char *filename) override;
 
+    /**
+     * Parse an opened file, which the parser takes ownership of.
+     */
+    bool openFile(File *file);
+
     void close(void) override;
 
     Call *parse_call(void) override {
@@ -156,13 +288,81 @@ public:
         return file->percentRead();
     }
 
+    bool hasIndex(void) const {
+        return !index.empty();
+    }
+
+    const Index & getIndex(void) const {
+        return index;
+    }
+
+    /**
+     * Use the index to seek to the closest indexed call at or before the
+     * given one.  Returns false when there is no index.
+     */
+    bool seekToCall(CallNo no);
+
+    /**
+     * Use the index to seek to the first call of the given frame.  Returns
+     * false when there is no index or no such frame.
+     */
+    bool seekToFrame(unsigned frame);
+
+    /**
+     * Scan the remainder of the trace, building its index.  Meant to be
+     * called right after opening.
+     */
+    void scanIndex(Index &result);
+
     Call *scan_call() {
         return parse_call(SCAN);
     }
 
+    /**
+     * Allocate all values of each parsed call from an arena owned by the
+     * call, which makes parsing and deleting calls much cheaper.  Values of
+     * such calls can't be replaced or deleted individually though.
+     */
+    void setUseArenas(bool enable) {
+        useArenas = enable;
+    }
+
+    /**
+     * Let blobs which lie within a single decompressed chunk point into it
+     * rather than being copied.  This saves copying large payloads, at the
+     * expense of keeping their chunks alive for as long as the calls.
+     */
+    void setUseBlobViews(bool enable) {
+        useBlobViews = enable;
+    }
+
+    /**
+     * Allow or prevent reading ahead on background threads, e.g., when the
+     * trace is being parsed by many parsers at once.  Must be called before
+     * open().
+     */
+    void setReadAhead(bool enable) {
+        readAhead = enable;
+    }
+
+    /**
+     * Only scan over calls numbered from the given one on, which are then
+     * never handed out, e.g., to wait for calls before it which return late
+     * without parsing the ones after.
+     */
+    void setEndCall(CallNo no) {
+        endCallNo = no;
+    }
+
 protected:
     Call *parse_call(Mode mode);
 
+    /**
+     * Hand out the lowest numbered call which was entered but didn't leave
+     * yet, flagged as incomplete, as at the end of a truncated trace.
+     */
+    Call *removePendingCall(void);
+
     FunctionSigFlags *parse_function_sig(void);
     StructSig *parse_struct_sig();
     EnumSig *parse_old_enum_sig();
@@ -176,6 +376,10 @@ public:
 protected:
     void parseProperties(void);
 
+    void loadIndexSigs(const File::Offset &offset);
+    bool isSigLoaded(const IndexSig &sig);
+    void seekToIndexCall(const IndexCall &call);
+
     Call *parse_Call(Mode mode);
 
     void parse_enter(Mode mode);
@@ -191,6 +395,15 @@ protected:
 
     void parse_arg(Call *call, Mode mode);
 
+    template< class T, class... Args >
+    inline T *
+    newValue(Args&&... args) {
+        if (valueArena) {
+            return valueArena->create<T>(std::forward<Args>(args)...);
+        }
+        return new T(std::forward<Args>(args)...);
+    }
+
     Value *parse_value(void);
     void scan_value(void);
     inline Value *parse_value(Mode mode) {
@@ -241,7 +454,16 @@ protected:
     Value *parse_wstring();
     void scan_wstring();
 
-    char * read_string(void);
+    Value *parse_dedup_blob();
+    void scan_dedup_blob();
+
+    DedupBlobState *lookupDedupBlob(Id id, const File::Offset &offset, bool &definition);
+    std::shared_ptr<char> read_blob_data(size_t size);
+    void cacheDedupBlob(Id id, std::shared_ptr<char> data, size_t size);
+    bool loadDedupBlob(Id id);
+    Value *newBlobView(char *data, size_t size, std::shared_ptr<char> pin);
+
+    char * read_string(Arena *arena = nullptr);
     void skip_string(void);
 
     signed long long read_sint(void);
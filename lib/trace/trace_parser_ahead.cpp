@@ -0,0 +1,183 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include "os_time.hpp"
+#include "trace_parser_ahead.hpp"
+
+
+namespace trace {
+
+
+ParseAheadParser::ParseAheadParser(AbstractParser *parser, size_t depth) :
+    m_parser(parser),
+    m_depth(depth ? depth : 1)
+{
+}
+
+
+ParseAheadParser::~ParseAheadParser()
+{
+    close();
+}
+
+
+bool
+ParseAheadParser::open(const char *filename)
+{
+    if (!m_parser->open(filename)) {
+        return false;
+    }
+
+    m_parser->getBookmark(m_bookmark);
+    m_stalls = 0;
+    m_stallTime = 0;
+    start();
+    return true;
+}
+
+
+void
+ParseAheadParser::close(void)
+{
+    stop();
+    m_parser->close();
+}
+
+
+void
+ParseAheadParser::start(void)
+{
+    m_eof = false;
+    m_stop = false;
+    m_thread = os::thread(&ParseAheadParser::run, this);
+}
+
+
+/**
+ * Stop the parser thread, and discard the calls it queued.
+ */
+void
+ParseAheadParser::stop(void)
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    {
+        os::unique_lock<os::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_freeCond.notify_all();
+    m_thread.join();
+    m_thread = os::thread();
+
+    for (auto & entry : m_queue) {
+        delete entry.call;
+    }
+    m_queue.clear();
+}
+
+
+void
+ParseAheadParser::getBookmark(ParseBookmark &bookmark)
+{
+    bookmark = m_bookmark;
+}
+
+
+void
+ParseAheadParser::setBookmark(const ParseBookmark &bookmark)
+{
+    stop();
+    m_parser->setBookmark(bookmark);
+    m_bookmark = bookmark;
+    start();
+}
+
+
+Call *
+ParseAheadParser::parse_call(void)
+{
+    os::unique_lock<os::mutex> lock(m_mutex);
+
+    if (m_queue.empty() && !m_eof) {
+        long long startTime = os::getTime();
+        do {
+            m_readyCond.wait(lock);
+        } while (m_queue.empty() && !m_eof);
+        ++m_stalls;
+        m_stallTime += os::getTime() - startTime;
+    }
+
+    if (m_queue.empty()) {
+        return nullptr;
+    }
+
+    Entry entry = m_queue.front();
+    m_queue.pop_front();
+    if (m_queue.size() + 1 == m_depth) {
+        m_freeCond.notify_one();
+    }
+
+    m_bookmark = entry.bookmark;
+    return entry.call;
+}
+
+
+void
+ParseAheadParser::run(void)
+{
+    while (true) {
+        Entry entry;
+        entry.call = m_parser->parse_call();
+        if (entry.call) {
+            m_parser->getBookmark(entry.bookmark);
+        }
+
+        os::unique_lock<os::mutex> lock(m_mutex);
+
+        if (!entry.call) {
+            m_eof = true;
+            m_readyCond.notify_one();
+            return;
+        }
+
+        while (!m_stop && m_queue.size() >= m_depth) {
+            m_freeCond.wait(lock);
+        }
+        if (m_stop) {
+            delete entry.call;
+            return;
+        }
+
+        m_queue.push_back(entry);
+        if (m_queue.size() == 1) {
+            m_readyCond.notify_one();
+        }
+    }
+}
+
+
+} /* namespace trace */
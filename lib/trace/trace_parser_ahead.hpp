@@ -0,0 +1,122 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Parser which decodes calls ahead on a separate thread.
+ */
+
+#pragma once
+
+
+#include <deque>
+#include <memory>
+
+#include "os_thread.hpp"
+#include "trace_parser.hpp"
+
+
+namespace trace {
+
+
+/**
+ * Decorator which runs another parser on a thread of its own, queueing up to
+ * a given number of calls ahead of the consumer, so that decompression and
+ * decoding stay off the consumer's thread.
+ *
+ * parse_call() may be called from different threads, but not concurrently.
+ */
+class ParseAheadParser : public AbstractParser
+{
+public:
+    /**
+     * Takes ownership of the given parser.
+     */
+    ParseAheadParser(AbstractParser *parser, size_t depth);
+
+    ~ParseAheadParser();
+
+    bool open(const char *filename) override;
+
+    void close(void) override;
+
+    Call *parse_call(void) override;
+
+    void getBookmark(ParseBookmark &bookmark) override;
+
+    void setBookmark(const ParseBookmark &bookmark) override;
+
+    unsigned long long getVersion(void) const override {
+        return m_parser->getVersion();
+    }
+
+    const Properties & getProperties(void) const override {
+        return m_parser->getProperties();
+    }
+
+    /**
+     * Number of times parse_call() found the queue empty and had to wait.
+     */
+    unsigned long long getStalls(void) const {
+        return m_stalls;
+    }
+
+    /**
+     * Total time spent waiting in those stalls, in os::getTime() units.
+     */
+    long long getStallTime(void) const {
+        return m_stallTime;
+    }
+
+private:
+    struct Entry {
+        Call *call;
+        // Where parsing resumes after the call
+        ParseBookmark bookmark;
+    };
+
+    std::unique_ptr<AbstractParser> m_parser;
+    size_t m_depth;
+
+    os::thread m_thread;
+    os::mutex m_mutex;
+    os::condition_variable m_readyCond;
+    os::condition_variable m_freeCond;
+
+    std::deque<Entry> m_queue;
+    bool m_eof = false;
+    bool m_stop = false;
+
+    /* Where parsing resumes after the last call handed out */
+    ParseBookmark m_bookmark;
+
+    unsigned long long m_stalls = 0;
+    long long m_stallTime = 0;
+
+    void start(void);
+    void stop(void);
+    void run(void);
+};
+
+
+} /* namespace trace */
@@ -0,0 +1,136 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Micro-benchmark for parsing traces with many calls pending at once, as
+ * recorded from multi-threaded applications.
+ *
+ * Usage: trace_parser_bench [THREADS [PENDING [CALLS]]]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <deque>
+
+#include "os_time.hpp"
+#include "trace_parser.hpp"
+#include "trace_writer.hpp"
+
+
+using namespace trace;
+
+
+static const char *args[1] = {"n"};
+static const FunctionSig sig = {0, "glFoo", 1, args};
+static const FunctionSig async_sig = {1, "glAsync", 1, args};
+
+
+static void
+writeTrace(const char *filename, unsigned numThreads, unsigned numPending,
+           unsigned numCalls)
+{
+    Writer writer;
+    Properties properties;
+    if (!writer.open(filename, TRACE_VERSION, properties)) {
+        exit(1);
+    }
+
+    std::deque<unsigned> pending;
+    std::vector<unsigned> entered(numThreads);
+
+    for (unsigned no = 0; no < numCalls; no += numThreads + 1) {
+        // One call per thread, all returning after every thread entered
+        for (unsigned thread = 0; thread < numThreads; ++thread) {
+            entered[thread] = writer.beginEnter(&sig, thread);
+            writer.beginArg(0);
+            writer.writeUInt(no);
+            writer.endArg();
+            writer.endEnter();
+        }
+        for (unsigned thread = numThreads; thread-- > 0; ) {
+            writer.beginLeave(entered[thread]);
+            writer.endLeave();
+        }
+
+        // Asynchronous calls which remain pending for a long while
+        pending.push_back(writer.beginEnter(&async_sig, 0));
+        writer.endEnter();
+        if (pending.size() > numPending) {
+            writer.beginLeave(pending.front());
+            writer.endLeave();
+            pending.pop_front();
+        }
+    }
+
+    writer.close();
+}
+
+
+static void
+parseTrace(const char *filename, bool scan)
+{
+    Parser parser;
+    if (!parser.open(filename)) {
+        exit(1);
+    }
+
+    long long startTime = os::getTime();
+
+    unsigned numCalls = 0;
+    Call *call;
+    while ((call = scan ? parser.scan_call() : parser.parse_call())) {
+        delete call;
+        ++numCalls;
+    }
+
+    double seconds = double(os::getTime() - startTime) / os::timeFrequency;
+    printf("%s: %u calls in %.3f s, %.2f Mcalls/s\n",
+           scan ? "scan" : "parse",
+           numCalls, seconds, numCalls / seconds * 1e-6);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    unsigned numThreads = argc > 1 ? atoi(argv[1]) : 16;
+    unsigned numPending = argc > 2 ? atoi(argv[2]) : 256;
+    unsigned numCalls = argc > 3 ? atoi(argv[3]) : 4000000;
+
+    const char *filename = "trace_parser_bench.trace";
+
+    printf("%u threads, %u pending asynchronous calls\n", numThreads, numPending);
+    writeTrace(filename, numThreads, numPending, numCalls);
+
+    parseTrace(filename, true);
+    parseTrace(filename, false);
+
+    remove(filename);
+
+    return 0;
+}
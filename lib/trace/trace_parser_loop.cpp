@@ -24,7 +24,8 @@
  **************************************************************************/
 
 
-#include "trace_parser.hpp"
+#include "os_time.hpp"
+#include "trace_parser_loop.hpp"
 
 
 namespace trace {
@@ -135,4 +136,114 @@ lastFrameLoopParser(AbstractParser *parser, int loopCount)
 }
 
 
+FrameRangeLoopParser::FrameRangeLoopParser(AbstractParser *parser,
+                                           unsigned firstFrame, unsigned lastFrame,
+                                           int loopCount) :
+    m_parser(parser),
+    m_firstFrame(firstFrame),
+    m_lastFrame(lastFrame),
+    m_loopCount(loopCount)
+{
+}
+
+FrameRangeLoopParser::~FrameRangeLoopParser()
+{
+    clear();
+    delete m_parser;
+}
+
+bool
+FrameRangeLoopParser::open(const char *filename)
+{
+    clear();
+    m_frameNo = 0;
+    m_loopsLeft = m_loopCount;
+    m_iterationTimes.clear();
+    m_frameTimes.clear();
+    return m_parser->open(filename);
+}
+
+void
+FrameRangeLoopParser::close(void)
+{
+    clear();
+    m_parser->close();
+}
+
+void
+FrameRangeLoopParser::clear(void)
+{
+    for (auto call : m_calls) {
+        delete call;
+    }
+    m_calls.clear();
+    m_pos = 0;
+    m_looping = false;
+    m_done = false;
+}
+
+/**
+ * Parse the range, which starts with the given call.
+ */
+void
+FrameRangeLoopParser::load(Call *call)
+{
+    unsigned frameNo = m_frameNo;
+    while (call) {
+        // Replayed many times, so not to be deleted after retracing
+        call->reuse_call = true;
+        m_calls.push_back(call);
+        if (call->flags & CALL_FLAG_END_FRAME) {
+            if (frameNo++ == m_lastFrame) {
+                break;
+            }
+        }
+        call = m_parser->parse_call();
+    }
+}
+
+Call *
+FrameRangeLoopParser::parse_call(void)
+{
+    if (m_done) {
+        return nullptr;
+    }
+
+    if (!m_looping) {
+        Call *call = m_parser->parse_call();
+        if (!call || m_frameNo < m_firstFrame) {
+            if (call && call->flags & CALL_FLAG_END_FRAME) {
+                ++m_frameNo;
+            }
+            return call;
+        }
+
+        load(call);
+        m_looping = true;
+        m_pos = 0;
+        m_iterationStart = m_frameStart = os::getTime();
+    } else {
+        // The previous call was just replayed
+        long long now = os::getTime();
+        if (m_calls[m_pos - 1]->flags & CALL_FLAG_END_FRAME) {
+            m_frameTimes.push_back(now - m_frameStart);
+            m_frameStart = now;
+        }
+        if (m_pos == m_calls.size()) {
+            m_iterationTimes.push_back(now - m_iterationStart);
+            if (m_loopsLeft == 0) {
+                m_done = true;
+                return nullptr;
+            }
+            if (m_loopsLeft > 0) {
+                --m_loopsLeft;
+            }
+            m_pos = 0;
+            m_iterationStart = m_frameStart = now;
+        }
+    }
+
+    return m_calls[m_pos++];
+}
+
 } /* namespace trace */
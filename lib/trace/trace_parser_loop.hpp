@@ -0,0 +1,125 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Parser which replays a range of frames over and over, for benchmarking.
+ */
+
+#pragma once
+
+
+#include <vector>
+
+#include "trace_parser.hpp"
+
+
+namespace trace {
+
+
+/**
+ * Decorator which passes calls through up to the given range of frames,
+ * then parses the whole range into memory at once and hands it out again and
+ * again, so that no parsing happens while it is being replayed.
+ *
+ * As the consumer asks for the next call once done with the previous one,
+ * the time between requests measures how long the range takes to replay.
+ */
+class FrameRangeLoopParser : public AbstractParser
+{
+public:
+    /**
+     * Takes ownership of the given parser.  Frames [firstFrame, lastFrame]
+     * are replayed loopCount + 1 times, or forever if loopCount is negative,
+     * after which the trace ends.
+     */
+    FrameRangeLoopParser(AbstractParser *parser,
+                         unsigned firstFrame, unsigned lastFrame,
+                         int loopCount);
+
+    ~FrameRangeLoopParser();
+
+    bool open(const char *filename) override;
+
+    void close(void) override;
+
+    Call *parse_call(void) override;
+
+    void getBookmark(ParseBookmark &bookmark) override {
+        m_parser->getBookmark(bookmark);
+    }
+
+    void setBookmark(const ParseBookmark &bookmark) override {
+        m_parser->setBookmark(bookmark);
+    }
+
+    unsigned long long getVersion(void) const override {
+        return m_parser->getVersion();
+    }
+
+    const Properties & getProperties(void) const override {
+        return m_parser->getProperties();
+    }
+
+    /**
+     * Durations of each replay of the range, in os::getTime() units.
+     */
+    const std::vector<long long> & getIterationTimes(void) const {
+        return m_iterationTimes;
+    }
+
+    /**
+     * Durations of each frame of every replay, in os::getTime() units.
+     */
+    const std::vector<long long> & getFrameTimes(void) const {
+        return m_frameTimes;
+    }
+
+private:
+    AbstractParser *m_parser;
+    unsigned m_firstFrame;
+    unsigned m_lastFrame;
+    int m_loopCount;
+
+    int m_loopsLeft = 0;
+
+    /* Frames passed through so far */
+    unsigned m_frameNo = 0;
+
+    /* Calls of the range, once parsed */
+    std::vector<Call *> m_calls;
+    size_t m_pos = 0;
+    bool m_looping = false;
+    bool m_done = false;
+
+    long long m_iterationStart = 0;
+    long long m_frameStart = 0;
+    std::vector<long long> m_iterationTimes;
+    std::vector<long long> m_frameTimes;
+
+    void load(Call *call);
+    void clear(void);
+};
+
+
+} /* namespace trace */
@@ -0,0 +1,342 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include <algorithm>
+
+#include "trace_parser_parallel.hpp"
+
+
+namespace trace {
+
+
+ParallelParser::ParallelParser(unsigned numThreads) :
+    m_numThreads(numThreads),
+    m_generation(0)
+{
+}
+
+
+ParallelParser::~ParallelParser()
+{
+    close();
+}
+
+
+bool
+ParallelParser::open(const char *filename)
+{
+    if (!m_parser.open(filename)) {
+        return false;
+    }
+
+    unsigned numThreads = m_numThreads;
+    if (!numThreads) {
+        numThreads = os::thread::hardware_concurrency();
+    }
+
+    // Not worth it for short or unindexed traces
+    const Index &index = m_parser.getIndex();
+    if (numThreads <= 1 ||
+        index.calls.size() <= TRACE_PARALLEL_SHARD_INDEX_CALLS) {
+        return true;
+    }
+
+    for (unsigned i = 0; i < numThreads; ++i) {
+        std::unique_ptr<Parser> parser(new Parser);
+        // Shards are far apart, so reading ahead would be wasted
+        parser->setReadAhead(false);
+        parser->setUseArenas(m_useArenas);
+        if (!parser->open(filename)) {
+            close();
+            return false;
+        }
+        m_workerParsers.push_back(std::move(parser));
+    }
+
+    m_stop = false;
+    restart(0);
+
+    for (auto & parser : m_workerParsers) {
+        m_workers.emplace_back(&ParallelParser::worker, this, parser.get());
+    }
+
+    return true;
+}
+
+
+void
+ParallelParser::close(void)
+{
+    if (!m_workers.empty()) {
+        {
+            os::unique_lock<os::mutex> lock(m_mutex);
+            m_stop = true;
+            ++m_generation;
+        }
+        m_freeCond.notify_all();
+
+        for (auto & thread : m_workers) {
+            thread.join();
+        }
+        m_workers.clear();
+    }
+
+    // Calls refer to the signatures of the parsers, so go first
+    clearShards();
+    m_shards.clear();
+    m_nextShard = 0;
+    m_currentShard = 0;
+    m_currentPos = 0;
+
+    m_workerParsers.clear();
+    m_parser.close();
+}
+
+
+void
+ParallelParser::clearShards(void)
+{
+    for (size_t index = m_currentShard; index < m_shards.size(); ++index) {
+        Shard &shard = m_shards[index];
+        // Calls already handed out belong to the caller
+        size_t i = index == m_currentShard ? m_currentPos : 0;
+        for (; i < shard.calls.size(); ++i) {
+            delete shard.calls[i];
+        }
+        shard.calls.clear();
+        shard.ready = false;
+    }
+}
+
+
+/**
+ * Lay out the shards again, starting from the indexed call at or before the
+ * given one.  Must be called with the mutex held, or before the workers
+ * start.
+ */
+void
+ParallelParser::restart(CallNo no)
+{
+    clearShards();
+    m_shards.clear();
+    ++m_generation;
+
+    m_nextShard = 0;
+    m_currentShard = 0;
+    m_currentPos = 0;
+
+    const Index &index = m_parser.getIndex();
+    const IndexCall *call = index.lookupCall(no);
+    if (!call) {
+        return;
+    }
+
+    for (size_t i = call - index.calls.data(); i < index.calls.size();
+         i += TRACE_PARALLEL_SHARD_INDEX_CALLS) {
+        Shard shard;
+        shard.start = index.calls[i].no;
+        shard.offset = index.calls[i].offset;
+        size_t next = i + TRACE_PARALLEL_SHARD_INDEX_CALLS;
+        shard.end = next < index.calls.size() ? index.calls[next].no : index.numCalls;
+        m_shards.push_back(std::move(shard));
+    }
+
+    m_nextCallNo = call->no;
+}
+
+
+bool
+ParallelParser::seekToCall(CallNo no)
+{
+    if (m_workers.empty()) {
+        return m_parser.seekToCall(no);
+    }
+
+    os::unique_lock<os::mutex> lock(m_mutex);
+    if (!m_parser.getIndex().lookupCall(no)) {
+        return false;
+    }
+    restart(no);
+    m_freeCond.notify_all();
+    return true;
+}
+
+
+void
+ParallelParser::getBookmark(ParseBookmark &bookmark)
+{
+    if (m_workers.empty()) {
+        m_parser.getBookmark(bookmark);
+        return;
+    }
+
+    // Only meaningful to this parser, which resumes by call number
+    os::unique_lock<os::mutex> lock(m_mutex);
+    const IndexCall *call = m_parser.getIndex().lookupCall(m_nextCallNo);
+    assert(call);
+    bookmark.offset = call->offset;
+    bookmark.next_call_no = m_nextCallNo;
+}
+
+
+void
+ParallelParser::setBookmark(const ParseBookmark &bookmark)
+{
+    if (m_workers.empty()) {
+        m_parser.setBookmark(bookmark);
+        return;
+    }
+
+    os::unique_lock<os::mutex> lock(m_mutex);
+    restart(bookmark.next_call_no);
+    m_nextCallNo = bookmark.next_call_no;
+    m_freeCond.notify_all();
+}
+
+
+Call *
+ParallelParser::parse_call(void)
+{
+    if (m_workers.empty()) {
+        return m_parser.parse_call();
+    }
+
+    os::unique_lock<os::mutex> lock(m_mutex);
+
+    while (m_currentShard < m_shards.size()) {
+        Shard &shard = m_shards[m_currentShard];
+        while (!shard.ready) {
+            m_readyCond.wait(lock);
+        }
+
+        while (m_currentPos < shard.calls.size()) {
+            Call *call = shard.calls[m_currentPos++];
+            if (call->no >= m_nextCallNo) {
+                m_nextCallNo = call->no + 1;
+                return call;
+            }
+            delete call;
+        }
+
+        shard.calls.clear();
+        shard.calls.shrink_to_fit();
+        ++m_currentShard;
+        m_currentPos = 0;
+        m_freeCond.notify_all();
+    }
+
+    return nullptr;
+}
+
+
+void
+ParallelParser::worker(Parser *parser)
+{
+    // Shards decoded ahead of the one being consumed
+    size_t maxAhead = 2 * m_workerParsers.size();
+
+    os::unique_lock<os::mutex> lock(m_mutex);
+
+    while (true) {
+        while (!m_stop &&
+               (m_nextShard >= m_shards.size() ||
+                m_nextShard >= m_currentShard + maxAhead)) {
+            m_freeCond.wait(lock);
+        }
+        if (m_stop) {
+            return;
+        }
+
+        size_t index = m_nextShard++;
+        Shard shard = m_shards[index];
+        unsigned generation = m_generation;
+
+        lock.unlock();
+
+        decode(*parser, shard, generation);
+
+        lock.lock();
+
+        if (generation == m_generation) {
+            m_shards[index].calls.swap(shard.calls);
+            m_shards[index].ready = true;
+            m_readyCond.notify_all();
+        } else {
+            for (auto call : shard.calls) {
+                delete call;
+            }
+        }
+    }
+}
+
+
+/**
+ * Parse the calls numbered [shard.start, shard.end) into shard.calls.
+ *
+ * Parsing goes on past the next shard's offset until the shard's calls
+ * which return late did, so that they come out as the sequential parser
+ * would hand them out, only scanning over the calls of later shards
+ * meanwhile.  Calls which never return make it go on to the end of the
+ * trace, where they are handed out as incomplete.
+ */
+void
+ParallelParser::decode(Parser &parser, Shard &shard, unsigned generation)
+{
+    ParseBookmark bookmark;
+    bookmark.offset = shard.offset;
+    bookmark.next_call_no = shard.start;
+    parser.setBookmark(bookmark);
+    parser.setEndCall(shard.end);
+
+    size_t numCalls = shard.end - shard.start;
+    shard.calls.reserve(numCalls);
+
+    size_t parsed = 0;
+    Call *call;
+    while (shard.calls.size() < numCalls &&
+           (call = parser.parse_call())) {
+        // Calls entered before the shard, but which returned within it,
+        // and calls past the shard are skipped by the parser
+        if (call->no >= shard.start && call->no < shard.end) {
+            shard.calls.push_back(call);
+        } else {
+            delete call;
+        }
+
+        if (++parsed % 256 == 0 && generation != m_generation) {
+            break;
+        }
+    }
+
+    // Calls of different threads may return out of order
+    std::sort(shard.calls.begin(), shard.calls.end(),
+              [] (const Call *a, const Call *b) {
+                  return a->no < b->no;
+              });
+}
+
+
+} /* namespace trace */
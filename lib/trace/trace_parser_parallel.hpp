@@ -0,0 +1,155 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Parser which decodes shards of an indexed trace on worker threads.
+ */
+
+#pragma once
+
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "os_thread.hpp"
+#include "trace_parser.hpp"
+
+
+/*
+ * Number of consecutive index entries, of TRACE_INDEX_CALL_INTERVAL calls
+ * each, that make up a shard.
+ */
+#define TRACE_PARALLEL_SHARD_INDEX_CALLS 16
+
+
+namespace trace {
+
+
+/**
+ * Drop-in replacement for Parser, for tools which make a single sequential
+ * pass over all calls.
+ *
+ * The trace is split at the calls recorded in the index, whose offsets
+ * are parser resync points: each worker parser loads the signatures
+ * defined before a shard from the index, and decodes the shard on its own.
+ * Calls are then handed out in call number order.
+ *
+ * Traces without an index are parsed sequentially.
+ */
+class ParallelParser : public AbstractParser
+{
+public:
+    /**
+     * Zero threads means one per CPU.
+     */
+    ParallelParser(unsigned numThreads = 0);
+
+    ~ParallelParser();
+
+    bool open(const char *filename) override;
+
+    void close(void) override;
+
+    Call *parse_call(void) override;
+
+    void getBookmark(ParseBookmark &bookmark) override;
+
+    void setBookmark(const ParseBookmark &bookmark) override;
+
+    unsigned long long getVersion(void) const override {
+        return m_parser.getVersion();
+    }
+
+    const Properties & getProperties(void) const override {
+        return m_parser.getProperties();
+    }
+
+    void setUseArenas(bool enable) {
+        m_useArenas = enable;
+        m_parser.setUseArenas(enable);
+    }
+
+    /**
+     * Seek to the closest indexed call at or before the given one, like
+     * Parser::seekToCall.
+     */
+    bool seekToCall(CallNo no);
+
+    bool isParallel(void) const {
+        return !m_workers.empty();
+    }
+
+private:
+    struct Shard {
+        CallNo start;
+        CallNo end;
+        File::Offset offset;
+        bool ready = false;
+        std::vector<Call *> calls;
+    };
+
+    unsigned m_numThreads;
+    bool m_useArenas = false;
+
+    /* Reads the header and index, and parses sequentially as fallback */
+    Parser m_parser;
+
+    std::vector<std::unique_ptr<Parser> > m_workerParsers;
+    std::vector<os::thread> m_workers;
+
+    os::mutex m_mutex;
+    os::condition_variable m_readyCond;
+    os::condition_variable m_freeCond;
+
+    std::vector<Shard> m_shards;
+
+    /* Next shard to be decoded */
+    size_t m_nextShard = 0;
+
+    /* Shard being consumed, and position in it */
+    size_t m_currentShard = 0;
+    size_t m_currentPos = 0;
+
+    /* Calls before this one are discarded, after seeking */
+    CallNo m_nextCallNo = 0;
+
+    /*
+     * Bumped whenever the shards are laid out again, so that workers can
+     * tell their shard is no longer wanted.
+     */
+    std::atomic<unsigned> m_generation;
+
+    bool m_stop = false;
+
+    void restart(CallNo no);
+    void clearShards(void);
+    void worker(Parser *parser);
+    void decode(Parser &parser, Shard &shard, unsigned generation);
+};
+
+
+} /* namespace trace */
@@ -31,4 +31,28 @@
 #define SNAPPY_BYTE1 'a'
 #define SNAPPY_BYTE2 't'
 
+/*
+ * Traces with LZ4 or Zstandard compressed chunks are told apart by the second
+ * byte of the header, see trace_codec.hpp.
+ */
+#define LZ4_BYTE2 '4'
+#define ZSTD_BYTE2 'z'
+
+/*
+ * Size of the uncompressed chunks, which readers size their buffers after.
+ */
+#define SNAPPY_CHUNK_SIZE (1 * 1024 * 1024)
+
+
+/*
+ * The optional trace index is stored in a trailing pseudo-chunk, whose data
+ * starts with an invalid snappy length so that older readers skip it, and
+ * which is followed by the offset of the pseudo-chunk and a magic.  See
+ * FORMAT.markdown.
+ */
+#define SNAPPY_INDEX_MARKER_SIZE 5
+#define SNAPPY_INDEX_MARKER_BYTE '\xff'
+#define SNAPPY_INDEX_MAGIC "atix"
+#define SNAPPY_INDEX_TRAILER_SIZE (8 + 4)
+
 
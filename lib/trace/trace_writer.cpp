@@ -30,18 +30,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <wchar.h>
+
+#include <algorithm>
 #include <vector>
 
 #include "os.hpp"
+#include "os_thread.hpp"
 #include "trace_ostream.hpp"
+#include "trace_parser.hpp"
 #include "trace_writer.hpp"
 #include "trace_format.hpp"
 
 namespace trace {
 
 
+/* Event being captured by the current thread, if any */
+static OS_THREAD_LOCAL CapturedEvent *capturedEvent = nullptr;
+
+
 Writer::Writer() :
-    call_no(0)
+    call_no(0),
+    indexing(false),
+    frameStart(false)
 {
     m_file = nullptr;
 }
@@ -53,6 +63,29 @@ Writer::~Writer()
 
 void
 Writer::close(void) {
+    if (m_file && indexing) {
+        // Offsets may only be final once all data was written
+        m_file->flush();
+        for (auto &sig : index.sigs) {
+            sig.offset = m_file->resolveOffset(sig.offset);
+        }
+        for (auto &frame : index.frames) {
+            frame.offset = m_file->resolveOffset(frame.offset);
+        }
+        for (auto &call : index.calls) {
+            call.offset = m_file->resolveOffset(call.offset);
+        }
+        for (auto &blob : index.blobs) {
+            blob = m_file->resolveOffset(blob);
+        }
+
+        index.numCalls = call_no;
+        std::string data;
+        index.serialize(data);
+        m_file->writeIndex(data.data(), data.size());
+    }
+    index.clear();
+
     delete m_file;
     m_file = nullptr;
 }
@@ -64,7 +97,7 @@ Writer::open(const char *filename,
 {
     close();
 
-    m_file = createSnappyStream(filename);
+    m_file = createChunkedStream(filename, codecOptions, asyncCompression);
     if (!m_file) {
         return false;
     }
@@ -75,11 +108,20 @@ Writer::open(const char *filename,
     enums.clear();
     bitmasks.clear();
     frames.clear();
+    frameFunctions.clear();
+    dedupBlobs.clear();
+
+    index.clear();
+    indexing = m_file->supportsOffsets();
+    frameStart = true;
 
-    _writeUInt(TRACE_VERSION);
+    unsigned version = moduleBuildIds ? TRACE_VERSION_BUILD_ID
+                     : blobDedupMinSize ? TRACE_VERSION_DEDUP_BLOB
+                     : TRACE_VERSION_DEDUP_BLOB - 1;
+    _writeUInt(version);
 
     assert(semanticVersion <= TRACE_VERSION);
-    _writeUInt(semanticVersion);
+    _writeUInt(std::min(semanticVersion, version));
 
     beginProperties();
     for (auto & kv : properties) {
@@ -92,6 +134,12 @@ Writer::open(const char *filename,
 
 void inline
 Writer::_write(const void *sBuffer, size_t dwBytesToWrite) {
+    CapturedEvent *event = capturedEvent;
+    if (event) {
+        const char *data = static_cast<const char *>(sBuffer);
+        event->data.insert(event->data.end(), data, data + dwBytesToWrite);
+        return;
+    }
     m_file->write(sBuffer, dwBytesToWrite);
 }
 
@@ -147,6 +195,48 @@ inline bool lookup(std::vector<bool> &map, size_t index) {
     }
 }
 
+/**
+ * Note down where a signature is about to be defined, so that the parser
+ * can load it when seeking past its definition.
+ */
+void inline
+Writer::_indexSig(IndexSigKind kind, Id id) {
+    if (indexing) {
+        index.addSig(kind, id, m_file->currentOffset());
+    }
+}
+
+/**
+ * Note down frame starts and every TRACE_INDEX_CALL_INTERVAL-th call, right
+ * before the call's enter event.  Frames may also start a new chunk.
+ */
+void
+Writer::_indexEnter(const FunctionSig *sig) {
+    if (!indexing) {
+        return;
+    }
+
+    if (frameStart && frameChunkFill) {
+        m_file->startChunk(frameChunkFill);
+    }
+
+    if (frameStart || call_no % TRACE_INDEX_CALL_INTERVAL == 0) {
+        File::Offset offset = m_file->currentOffset();
+        if (frameStart) {
+            index.addFrame(call_no, offset);
+        }
+        if (call_no % TRACE_INDEX_CALL_INTERVAL == 0) {
+            index.addCall(call_no, offset);
+        }
+    }
+
+    if (!lookup(frameFunctions, sig->id) &&
+        !lookup(functions, sig->id)) {
+        frameFunctions[sig->id] = Parser::lookupCallFlags(sig->name) & CALL_FLAG_END_FRAME;
+    }
+    frameStart = frameFunctions[sig->id];
+}
+
 void Writer::beginBacktrace(unsigned num_frames) {
     if (num_frames) {
         _writeByte(trace::CALL_BACKTRACE);
@@ -155,8 +245,21 @@ void Writer::beginBacktrace(unsigned num_frames) {
 }
 
 void Writer::writeStackFrame(const RawStackFrame *frame) {
+    CapturedEvent *event = capturedEvent;
+    if (event) {
+        event->sigs.push_back({event->data.size(), INDEX_SIG_STACK_FRAME, nullptr, *frame});
+        return;
+    }
+    _writeStackFrame(frame);
+}
+
+void Writer::_writeStackFrame(const RawStackFrame *frame) {
+    bool defined = lookup(frames, frame->id);
+    if (!defined) {
+        _indexSig(INDEX_SIG_STACK_FRAME, frame->id);
+    }
     _writeUInt(frame->id);
-    if (!lookup(frames, frame->id)) {
+    if (!defined) {
         if (frame->module != NULL) {
             _writeByte(trace::BACKTRACE_MODULE);
             _writeString(frame->module);
@@ -177,6 +280,10 @@ void Writer::writeStackFrame(const RawStackFrame *frame) {
             _writeByte(trace::BACKTRACE_OFFSET);
             _writeUInt(frame->offset);
         }
+        if (frame->buildId != NULL && moduleBuildIds) {
+            _writeByte(trace::BACKTRACE_BUILD_ID);
+            _writeString(frame->buildId);
+        }
         _writeByte(trace::BACKTRACE_END);
         frames[frame->id] = true;
     }
@@ -206,11 +313,96 @@ Writer::endProperties(void)
     _writeUInt(0);  // zero-length string
 }
 
+/**
+ * Write a reference to a signature, defining it on first use, or note it
+ * down when capturing.
+ */
+void inline
+Writer::_writeSigRef(IndexSigKind kind, const void *sig) {
+    CapturedEvent *event = capturedEvent;
+    if (event) {
+        event->sigs.push_back({event->data.size(), kind, sig, RawStackFrame()});
+        return;
+    }
+    switch (kind) {
+    case INDEX_SIG_FUNCTION:
+        _writeFunctionSig(static_cast<const FunctionSig *>(sig));
+        break;
+    case INDEX_SIG_STRUCT:
+        _writeStructSig(static_cast<const StructSig *>(sig));
+        break;
+    case INDEX_SIG_ENUM:
+        _writeEnumSig(static_cast<const EnumSig *>(sig));
+        break;
+    case INDEX_SIG_BITMASK:
+        _writeBitmaskSig(static_cast<const BitmaskSig *>(sig));
+        break;
+    default:
+        assert(0);
+    }
+}
+
+CapturedEvent *
+Writer::_capture(CapturedEvent *event) {
+    CapturedEvent *previous = capturedEvent;
+    capturedEvent = event;
+    return previous;
+}
+
+void Writer::_captureEnter(const FunctionSig *sig, unsigned thread_id) {
+    assert(capturedEvent);
+    capturedEvent->enterSig = sig;
+    _writeByte(trace::EVENT_ENTER);
+    _writeUInt(thread_id);
+    _writeSigRef(INDEX_SIG_FUNCTION, sig);
+}
+
+unsigned Writer::_commit(const CapturedEvent &event) {
+    // Write to the stream even if capturing an outer event
+    CapturedEvent *outer = _capture(nullptr);
+
+    unsigned no = 0;
+    if (event.enterSig) {
+        _indexEnter(event.enterSig);
+        no = call_no++;
+    }
+
+    const char *data = event.data.data();
+    size_t offset = 0;
+    for (auto & ref : event.sigs) {
+        if (ref.offset > offset) {
+            _write(data + offset, ref.offset - offset);
+            offset = ref.offset;
+        }
+        if (ref.kind == INDEX_SIG_STACK_FRAME) {
+            _writeStackFrame(&ref.frame);
+        } else {
+            _writeSigRef(ref.kind, ref.sig);
+        }
+    }
+    if (event.data.size() > offset) {
+        _write(data + offset, event.data.size() - offset);
+    }
+
+    _capture(outer);
+    return no;
+}
+
 unsigned Writer::beginEnter(const FunctionSig *sig, unsigned thread_id) {
+    _indexEnter(sig);
     _writeByte(trace::EVENT_ENTER);
     _writeUInt(thread_id);
+    _writeFunctionSig(sig);
+    return call_no++;
+}
+
+void Writer::_writeFunctionSig(const FunctionSig *sig) {
+    bool defined = lookup(functions, sig->id);
+    if (!defined) {
+        _indexSig(INDEX_SIG_FUNCTION, sig->id);
+    }
     _writeUInt(sig->id);
-    if (!lookup(functions, sig->id)) {
+    if (!defined) {
         _writeString(sig->name);
         _writeUInt(sig->num_args);
         for (unsigned i = 0; i < sig->num_args; ++i) {
@@ -218,8 +410,6 @@ unsigned Writer::beginEnter(const FunctionSig *sig, unsigned thread_id) {
         }
         functions[sig->id] = true;
     }
-
-    return call_no++;
 }
 
 void Writer::endEnter(void) {
@@ -251,8 +441,16 @@ void Writer::beginArray(size_t length) {
 
 void Writer::beginStruct(const StructSig *sig) {
     _writeByte(trace::TYPE_STRUCT);
+    _writeSigRef(INDEX_SIG_STRUCT, sig);
+}
+
+void Writer::_writeStructSig(const StructSig *sig) {
+    bool defined = lookup(structs, sig->id);
+    if (!defined) {
+        _indexSig(INDEX_SIG_STRUCT, sig->id);
+    }
     _writeUInt(sig->id);
-    if (!lookup(structs, sig->id)) {
+    if (!defined) {
         _writeString(sig->name);
         _writeUInt(sig->num_members);
         for (unsigned i = 0; i < sig->num_members; ++i) {
@@ -335,11 +533,123 @@ void Writer::writeWString(const wchar_t *str) {
     writeWString(str, len);
 }
 
+/*
+ * MurmurHash3_x64_128, by Austin Appleby, which is in the public domain.
+ */
+static inline uint64_t
+rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static void
+hashBlob(const void *data, size_t size, uint64_t hash[2]) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const size_t nblocks = size / 16;
+
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+
+    for (size_t i = 0; i < nblocks; ++i) {
+        uint64_t k1, k2;
+        memcpy(&k1, p + i * 16, sizeof k1);
+        memcpy(&k2, p + i * 16 + 8, sizeof k2);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const uint8_t *tail = p + nblocks * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (size & 15) {
+    case 15: k2 ^= uint64_t(tail[14]) << 48; /* fall-through */
+    case 14: k2 ^= uint64_t(tail[13]) << 40; /* fall-through */
+    case 13: k2 ^= uint64_t(tail[12]) << 32; /* fall-through */
+    case 12: k2 ^= uint64_t(tail[11]) << 24; /* fall-through */
+    case 11: k2 ^= uint64_t(tail[10]) << 16; /* fall-through */
+    case 10: k2 ^= uint64_t(tail[ 9]) << 8;  /* fall-through */
+    case  9: k2 ^= uint64_t(tail[ 8]);
+             k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+             /* fall-through */
+    case  8: k1 ^= uint64_t(tail[ 7]) << 56; /* fall-through */
+    case  7: k1 ^= uint64_t(tail[ 6]) << 48; /* fall-through */
+    case  6: k1 ^= uint64_t(tail[ 5]) << 40; /* fall-through */
+    case  5: k1 ^= uint64_t(tail[ 4]) << 32; /* fall-through */
+    case  4: k1 ^= uint64_t(tail[ 3]) << 24; /* fall-through */
+    case  3: k1 ^= uint64_t(tail[ 2]) << 16; /* fall-through */
+    case  2: k1 ^= uint64_t(tail[ 1]) << 8;  /* fall-through */
+    case  1: k1 ^= uint64_t(tail[ 0]);
+             k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    hash[0] = h1;
+    hash[1] = h2;
+}
+
+/**
+ * Write the blob only the first time its contents are seen, and just its ID
+ * afterwards.
+ */
+void Writer::_writeDedupBlob(const void *data, size_t size) {
+    BlobKey key;
+    hashBlob(data, size, key.hash);
+    key.size = size;
+
+    auto result = dedupBlobs.emplace(key, Id(dedupBlobs.size()));
+    const Id id = result.first->second;
+    const bool defined = !result.second;
+
+    _writeByte(trace::TYPE_DEDUP_BLOB);
+    if (!defined && indexing) {
+        index.addBlob(id, m_file->currentOffset());
+    }
+    _writeUInt(id);
+    if (!defined) {
+        _writeUInt(size);
+        _write(data, size);
+    }
+}
+
 void Writer::writeBlob(const void *data, size_t size) {
     if (!data) {
         Writer::writeNull();
         return;
     }
+
+    // Captured events are written out of order, so their blobs can't be
+    // referred back to
+    if (blobDedupMinSize && size >= blobDedupMinSize && !capturedEvent) {
+        _writeDedupBlob(data, size);
+        return;
+    }
     _writeByte(trace::TYPE_BLOB);
     _writeUInt(size);
     if (size) {
@@ -349,8 +659,17 @@ void Writer::writeBlob(const void *data, size_t size) {
 
 void Writer::writeEnum(const EnumSig *sig, signed long long value) {
     _writeByte(trace::TYPE_ENUM);
+    _writeSigRef(INDEX_SIG_ENUM, sig);
+    writeSInt(value);
+}
+
+void Writer::_writeEnumSig(const EnumSig *sig) {
+    bool defined = lookup(enums, sig->id);
+    if (!defined) {
+        _indexSig(INDEX_SIG_ENUM, sig->id);
+    }
     _writeUInt(sig->id);
-    if (!lookup(enums, sig->id)) {
+    if (!defined) {
         _writeUInt(sig->num_values);
         for (unsigned i = 0; i < sig->num_values; ++i) {
             _writeString(sig->values[i].name);
@@ -358,13 +677,21 @@ void Writer::writeEnum(const EnumSig *sig, signed long long value) {
         }
         enums[sig->id] = true;
     }
-    writeSInt(value);
 }
 
 void Writer::writeBitmask(const BitmaskSig *sig, unsigned long long value) {
     _writeByte(trace::TYPE_BITMASK);
+    _writeSigRef(INDEX_SIG_BITMASK, sig);
+    _writeUInt(value);
+}
+
+void Writer::_writeBitmaskSig(const BitmaskSig *sig) {
+    bool defined = lookup(bitmasks, sig->id);
+    if (!defined) {
+        _indexSig(INDEX_SIG_BITMASK, sig->id);
+    }
     _writeUInt(sig->id);
-    if (!lookup(bitmasks, sig->id)) {
+    if (!defined) {
         _writeUInt(sig->num_flags);
         for (unsigned i = 0; i < sig->num_flags; ++i) {
             if (i != 0 && sig->flags[i].value == 0) {
@@ -375,7 +702,6 @@ void Writer::writeBitmask(const BitmaskSig *sig, unsigned long long value) {
         }
         bitmasks[sig->id] = true;
     }
-    _writeUInt(value);
 }
 
 void Writer::writeNull(void) {
@@ -31,13 +31,49 @@
 
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include <unordered_map>
 #include <vector>
 
+#include "trace_codec.hpp"
+#include "trace_index.hpp"
 #include "trace_model.hpp"
 
 namespace trace {
     class OutStream;
+    class CompactCall;
+
+    /**
+     * An event encoded in memory rather than into the output stream, so that
+     * it can be written out later in one go.
+     *
+     * References to signatures are recorded aside, as whether they need to be
+     * defined is only known once the event lands in the stream.
+     */
+    class CapturedEvent {
+    public:
+        struct SigRef {
+            // Where in data the reference goes
+            size_t offset;
+            IndexSigKind kind;
+            const void *sig;
+            // Stack frames are copied, as the originals are transient
+            RawStackFrame frame;
+        };
+
+        std::vector<char> data;
+        std::vector<SigRef> sigs;
+
+        // Function of enter events, whose numbers are assigned on commit
+        const FunctionSig *enterSig = nullptr;
+
+        void clear(void) {
+            data.clear();
+            sigs.clear();
+            enterSig = nullptr;
+        }
+    };
 
     class Writer {
     protected:
@@ -50,6 +86,48 @@ namespace trace {
         std::vector<bool> bitmasks;
         std::vector<bool> frames;
 
+        /* Functions which end a frame */
+        std::vector<bool> frameFunctions;
+
+        Index index;
+        bool indexing;
+        bool frameStart;
+
+        /* Whether to compress on a background thread */
+        bool asyncCompression = false;
+
+        CodecOptions codecOptions;
+
+        /* Chunk fill percentage past which frames start a new chunk, or zero
+         * when disabled */
+        unsigned frameChunkFill = 0;
+
+        /* Smallest blob to deduplicate, or zero when disabled */
+        size_t blobDedupMinSize = 0;
+
+        /* Whether to write the build IDs of backtrace modules */
+        bool moduleBuildIds = false;
+
+        struct BlobKey {
+            uint64_t hash[2];
+            size_t size;
+
+            bool operator == (const BlobKey &other) const {
+                return hash[0] == other.hash[0] &&
+                       hash[1] == other.hash[1] &&
+                       size == other.size;
+            }
+        };
+
+        struct BlobKeyHash {
+            size_t operator () (const BlobKey &key) const {
+                return size_t(key.hash[0]);
+            }
+        };
+
+        /* IDs of the deduplicated blobs written so far */
+        std::unordered_map<BlobKey, Id, BlobKeyHash> dedupBlobs;
+
     public:
         Writer();
         ~Writer();
@@ -59,6 +137,50 @@ namespace trace {
                   const Properties &properties);
         void close(void);
 
+        /**
+         * Compress and write chunks on a background thread.  Must be called
+         * before open().
+         */
+        void setAsyncCompression(bool enable) {
+            asyncCompression = enable;
+        }
+
+        /**
+         * Compress chunks with the given codec.  Must be called before
+         * open().
+         */
+        void setCodec(const CodecOptions &options) {
+            codecOptions = options;
+        }
+
+        /**
+         * Start a new chunk at the first call of a frame when the current
+         * chunk is more than the given percentage full, so that seeking to
+         * frames mostly lands on chunk starts.  Zero disables it.
+         */
+        void setFrameChunkFill(unsigned percent) {
+            frameChunkFill = percent;
+        }
+
+        /**
+         * Write blobs of at least the given size only once, referring back to
+         * the first copy when the same contents are written again.  Blobs are
+         * matched by a 128-bit hash of their contents.  Zero disables it.
+         * Must be called before open(), as it bumps the trace version.
+         */
+        void setBlobDedup(size_t minSize) {
+            blobDedupMinSize = minSize;
+        }
+
+        /**
+         * Write the build IDs of the modules of stack frames, which are
+         * dropped otherwise.  Must be called before open(), as it bumps the
+         * trace version.
+         */
+        void setModuleBuildIds(bool enable) {
+            moduleBuildIds = enable;
+        }
+
         unsigned beginEnter(const FunctionSig *sig, unsigned thread_id);
         void endEnter(void);
 
@@ -105,6 +227,7 @@ namespace trace {
         void writePointer(unsigned long long addr);
 
         void writeCall(Call *call);
+        void writeCall(CompactCall *call);
 
     private:
         inline void beginProperties(void) {}
@@ -119,6 +242,36 @@ namespace trace {
         void inline _writeDouble(double value);
         void inline _writeString(const char *str);
 
+        void inline _indexSig(IndexSigKind kind, Id id);
+        void _indexEnter(const FunctionSig *sig);
+
+        void _writeFunctionSig(const FunctionSig *sig);
+        void _writeStructSig(const StructSig *sig);
+        void _writeEnumSig(const EnumSig *sig);
+        void _writeBitmaskSig(const BitmaskSig *sig);
+        void _writeDedupBlob(const void *data, size_t size);
+        void _writeStackFrame(const RawStackFrame *frame);
+        void inline _writeSigRef(IndexSigKind kind, const void *sig);
+
+        /**
+         * Direct everything written by the current thread into the given
+         * event, or back to the stream when null.  Returns the previous
+         * event.
+         */
+        static CapturedEvent *_capture(CapturedEvent *event);
+
+        /**
+         * Start capturing an enter event, which unlike beginEnter() doesn't
+         * number the call yet.
+         */
+        void _captureEnter(const FunctionSig *sig, unsigned thread_id);
+
+        /**
+         * Write out a captured event.  For enter events, returns the call
+         * number it got.
+         */
+        unsigned _commit(const CapturedEvent &event);
+
     };
 
 } /* namespace trace */
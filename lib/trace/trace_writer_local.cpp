@@ -30,6 +30,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
 #include "os.hpp"
 #include "os_thread.hpp"
 #include "os_string.hpp"
@@ -60,6 +67,21 @@ static const char *realloc_args[2] = {"ptr", "size"};
 const FunctionSig realloc_sig = {3, "realloc", 2, realloc_args};
 
 
+/*
+ * Set by wrappers during static initialization, hence before any call is
+ * traced, and possibly before localWriter is constructed.
+ */
+static bool perThreadCaptureEnabled = false;
+
+
+static bool
+perThreadCaptureRequested(void)
+{
+    const char *perThread = getenv("APITRACE_PER_THREAD_CAPTURE");
+    return perThread && strcmp(perThread, "0") != 0;
+}
+
+
 static void exceptionCallback(void)
 {
     localWriter.flush();
@@ -69,6 +91,49 @@ static void exceptionCallback(void)
 LocalWriter::LocalWriter() :
     acquired(0)
 {
+#ifndef _WIN32
+    // Compress on a separate thread.  Not on Windows though, as threads are
+    // terminated before DLLs are unloaded, which would lose queued chunks.
+    asyncCompression = true;
+#endif
+
+    // Raw backtraces identify their modules by build ID
+    moduleBuildIds = os::backtrace_is_raw();
+
+    // Write repeated blobs of at least this many bytes only once
+    const char *dedup = getenv("APITRACE_DEDUP_BLOBS");
+    if (dedup) {
+        blobDedupMinSize = strtoul(dedup, nullptr, 0);
+    }
+
+    // Start frames on a new chunk past this percentage of chunk fill
+    const char *frameFill = getenv("APITRACE_FRAME_CHUNK_FILL");
+    if (frameFill) {
+        frameChunkFill = strtoul(frameFill, nullptr, 0);
+    }
+
+    // Codec for the trace chunks, as "snappy", "lz4" or "zstd[:LEVEL]"
+    const char *compression = getenv("APITRACE_COMPRESSION");
+    if (compression) {
+        if (!parseCodecOptions(compression, codecOptions)) {
+            os::log("apitrace: warning: ignoring unknown compression %s\n", compression);
+            codecOptions = CodecOptions();
+        } else if (!std::unique_ptr<ChunkCodec>(createChunkCodec(codecOptions))) {
+            os::log("apitrace: warning: falling back to snappy compression\n");
+            codecOptions = CodecOptions();
+        }
+    }
+    const char *dictionary = getenv("APITRACE_ZSTD_DICTIONARY");
+    if (dictionary && codecOptions.codec == CODEC_ZSTD) {
+        std::ifstream stream(dictionary, std::ios::binary);
+        if (stream) {
+            codecOptions.dictionary.assign(std::istreambuf_iterator<char>(stream),
+                                           std::istreambuf_iterator<char>());
+        } else {
+            os::log("apitrace: warning: failed to read %s\n", dictionary);
+        }
+    }
+
     os::String process = os::getProcessName();
     os::log("apitrace: loaded into %s\n", process.str());
 
@@ -140,6 +205,10 @@ LocalWriter::open(void) {
 
     os::log("apitrace: tracing to %s\n", lpFileName);
 
+    if (!perThreadCaptureEnabled && perThreadCaptureRequested()) {
+        os::log("apitrace: warning: per-thread capture is not supported by this wrapper\n");
+    }
+
     Properties properties;
     os::String processName = os::getProcessName();
     properties["process.name"] = processName;
@@ -157,10 +226,144 @@ LocalWriter::open(void) {
 #endif
 }
 
-static uintptr_t next_thread_num = 1;
+static std::atomic<uintptr_t> next_thread_num(1);
 
 static OS_THREAD_LOCAL uintptr_t thread_num;
 
+
+#ifndef _WIN32
+
+/*
+ * Number of calls a thread may enter between entering and leaving any call
+ * before their call numbers spill into a hash map, when capturing per thread.
+ */
+#define CAPTURE_MAX_PENDING_CALLS 1024
+
+/*
+ * Per-thread capture state.  Events are nested when a traced call happens
+ * while another event is being captured (e.g., from a signal handler), and
+ * are kept around to reuse their buffers.
+ */
+struct CaptureState {
+    std::vector< std::unique_ptr<CapturedEvent> > events;
+    std::vector<unsigned> handles;
+    size_t depth = 0;
+
+    // Call numbers of entered calls, keyed by the handle beginEnter returned
+    unsigned callNos[CAPTURE_MAX_PENDING_CALLS];
+    unsigned callHandles[CAPTURE_MAX_PENDING_CALLS];
+    bool callPending[CAPTURE_MAX_PENDING_CALLS] = {};
+    unsigned nextHandle = 0;
+
+    // Calls whose slot above was still taken by an earlier call
+    std::unordered_map<unsigned, unsigned> outlierCallNos;
+};
+
+static thread_local CaptureState captureState;
+
+
+/**
+ * Start capturing an event.  Returns the handle for the call, for enter
+ * events.
+ */
+unsigned LocalWriter::beginCapture(bool enter) {
+    CaptureState &state = captureState;
+    if (state.depth == state.events.size()) {
+        state.events.emplace_back(new CapturedEvent);
+        state.handles.push_back(0);
+    }
+    CapturedEvent *event = state.events[state.depth].get();
+    event->clear();
+    unsigned handle = enter ? state.nextHandle++ : 0;
+    state.handles[state.depth] = handle;
+    ++state.depth;
+    _capture(event);
+    return handle;
+}
+
+/**
+ * Number and write out the event captured last.
+ */
+void LocalWriter::endCapture(void) {
+    CaptureState &state = captureState;
+    assert(state.depth);
+    --state.depth;
+    CapturedEvent *event = state.events[state.depth].get();
+    _capture(state.depth ? state.events[state.depth - 1].get() : nullptr);
+
+    mutex.lock();
+    ++acquired;
+
+    checkProcessId();
+    if (!m_file) {
+        open();
+    }
+
+    unsigned call_no = _commit(*event);
+
+    --acquired;
+    mutex.unlock();
+
+    if (event->enterSig) {
+        unsigned handle = state.handles[state.depth];
+        unsigned slot = handle % CAPTURE_MAX_PENDING_CALLS;
+        if (state.callPending[slot]) {
+            state.outlierCallNos[handle] = call_no;
+        } else {
+            state.callNos[slot] = call_no;
+            state.callHandles[slot] = handle;
+            state.callPending[slot] = true;
+        }
+    }
+}
+
+unsigned LocalWriter::capturedCallNo(unsigned handle) {
+    CaptureState &state = captureState;
+    unsigned slot = handle % CAPTURE_MAX_PENDING_CALLS;
+    if (state.callPending[slot] && state.callHandles[slot] == handle) {
+        state.callPending[slot] = false;
+        return state.callNos[slot];
+    }
+    auto it = state.outlierCallNos.find(handle);
+    if (it == state.outlierCallNos.end()) {
+        os::log("apitrace: warning: leaving call that wasn't entered\n");
+        return 0;
+    }
+    unsigned call_no = it->second;
+    state.outlierCallNos.erase(it);
+    return call_no;
+}
+
+#else /* _WIN32 */
+
+unsigned LocalWriter::beginCapture(bool enter) {
+    assert(0);
+    return 0;
+}
+
+void LocalWriter::endCapture(void) {
+    assert(0);
+}
+
+unsigned LocalWriter::capturedCallNo(unsigned handle) {
+    assert(0);
+    return 0;
+}
+
+#endif /* _WIN32 */
+
+
+void LocalWriter::allowPerThreadCapture(void) {
+#ifndef _WIN32
+    // Not on Windows, as it relies on TLS of non-POD types
+    perThreadCaptureEnabled = perThreadCaptureRequested();
+#endif
+}
+
+bool LocalWriter::capturingPerThread(void) const {
+    return perThreadCaptureEnabled;
+}
+
 void LocalWriter::checkProcessId(void) {
     if (m_file &&
         os::getCurrentProcessId() != pid) {
@@ -168,7 +371,7 @@ void LocalWriter::checkProcessId(void) {
         // create a new file.  We can't call any method of the current
         // file, as it may cause it to flush and corrupt the parent's
         // trace, so we effectively leak the old file object.
-        close();
+        m_file = nullptr;
         // Don't want to open the same file again
         os::unsetEnvironment("TRACE_FILE");
         open();
@@ -176,14 +379,6 @@ void LocalWriter::checkProcessId(void) {
 }
 
 unsigned LocalWriter::beginEnter(const FunctionSig *sig, bool fake) {
-    mutex.lock();
-    ++acquired;
-
-    checkProcessId();
-    if (!m_file) {
-        open();
-    }
-
     uintptr_t this_thread_num = thread_num;
     if (!this_thread_num) {
         this_thread_num = next_thread_num++;
@@ -192,7 +387,24 @@ unsigned LocalWriter::beginEnter(const FunctionSig *sig, bool fake) {
 
     assert(this_thread_num);
     unsigned thread_id = this_thread_num - 1;
-    unsigned call_no = Writer::beginEnter(sig, thread_id);
+
+    unsigned call_no;
+    if (capturingPerThread()) {
+        // The call is only numbered once written out, so hand out a handle
+        call_no = beginCapture(true);
+        _captureEnter(sig, thread_id);
+    } else {
+        mutex.lock();
+        ++acquired;
+
+        checkProcessId();
+        if (!m_file) {
+            open();
+        }
+
+        call_no = Writer::beginEnter(sig, thread_id);
+    }
+
     if (fake) {
         writeFlags(FLAG_FAKE);
     } else if (os::backtrace_is_needed(sig->name)) {
@@ -208,11 +420,20 @@ unsigned LocalWriter::beginEnter(const FunctionSig *sig, bool fake) {
 
 void LocalWriter::endEnter(void) {
     Writer::endEnter();
+    if (capturingPerThread()) {
+        endCapture();
+        return;
+    }
     --acquired;
     mutex.unlock();
 }
 
 void LocalWriter::beginLeave(unsigned call) {
+    if (capturingPerThread()) {
+        beginCapture(false);
+        Writer::beginLeave(capturedCallNo(call));
+        return;
+    }
     mutex.lock();
     ++acquired;
     Writer::beginLeave(call);
@@ -220,6 +441,10 @@ void LocalWriter::beginLeave(unsigned call) {
 
 void LocalWriter::endLeave(void) {
     Writer::endLeave();
+    if (capturingPerThread()) {
+        endCapture();
+        return;
+    }
     --acquired;
     mutex.unlock();
 }
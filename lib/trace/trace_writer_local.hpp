@@ -52,6 +52,12 @@ namespace trace {
      * - uses mutexes to allow tracing from multiple threades
      * - flushes the output to ensure the last call is traced in event of
      *   abnormal termination
+     *
+     * When APITRACE_PER_THREAD_CAPTURE is set, each thread encodes its events
+     * into its own buffers without locking, and the mutex is only held while
+     * the finished event gets numbered and copied into the trace file.  The
+     * wrappers' own state is then no longer serialized by the mutex, so this
+     * only happens for wrappers which opted in with allowPerThreadCapture().
      */
     class LocalWriter : public Writer {
     protected:
@@ -75,8 +81,17 @@ namespace trace {
          */
         os::ProcessId pid;
 
+        /**
+         * Whether threads capture events in their own buffers.
+         */
+        bool capturingPerThread(void) const;
+
         void checkProcessId();
 
+        unsigned beginCapture(bool enter);
+        void endCapture(void);
+        unsigned capturedCallNo(unsigned handle);
+
     public:
         /**
          * Should never called directly -- use localWriter singleton below
@@ -87,8 +102,18 @@ namespace trace {
 
         void open(void);
 
+        /**
+         * Let APITRACE_PER_THREAD_CAPTURE take effect.  Called during static
+         * initialization by wrappers whose state doesn't rely on the mutex,
+         * as it must not change once calls are traced.
+         */
+        static void allowPerThreadCapture(void);
+
         /**
          * It will acquire the mutex.
+         *
+         * Returns the handle to pass to beginLeave, which is the call number
+         * unless capturing per thread.
          */
         unsigned beginEnter(const FunctionSig *sig, bool fake = false);
 
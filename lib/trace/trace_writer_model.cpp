@@ -24,6 +24,7 @@
  **************************************************************************/
 
 
+#include "trace_compact.hpp"
 #include "trace_writer.hpp"
 #include "trace_format.hpp"
 
@@ -112,7 +113,24 @@ public:
         writer.endRepr();
     }
 
-    void visit(Call *call) {
+    using Visitor::_visit;
+
+    inline void _visit(const CompactValue &value) {
+        value.visit(*this);
+    }
+
+    static inline Value *
+    argValue(const Arg &arg) {
+        return arg.value;
+    }
+
+    static inline const CompactValue &
+    argValue(const CompactValue &arg) {
+        return arg;
+    }
+
+    template< typename C >
+    void visit(C *call) {
         unsigned call_no = writer.beginEnter(call->sig, call->thread_id);
         if (call->flags & CALL_FLAG_FAKE) {
             writer.writeFlags(FLAG_FAKE);
@@ -125,9 +143,9 @@ public:
             writer.endBacktrace();
         }
         for (unsigned i = 0; i < call->args.size(); ++i) {
-            if (call->args[i].value) {
+            if (argValue(call->args[i])) {
                 writer.beginArg(i);
-                _visit(call->args[i].value);
+                _visit(argValue(call->args[i]));
                 writer.endArg();
             }
         }
@@ -149,5 +167,11 @@ void Writer::writeCall(Call *call) {
 }
 
 
+void Writer::writeCall(CompactCall *call) {
+    ModelWriter visitor(*this);
+    visitor.visit(call);
+}
+
+
 } /* namespace trace */
 
@@ -25,6 +25,7 @@
 
 #pragma once
 
+#include "glstate.hpp"
 #include "glws.hpp"
 #include "retrace.hpp"
 #include "metric_backend.hpp"
@@ -83,6 +84,9 @@ public:
 
     bool used = false;
 
+    // Snapshots being read back, if asynchronously
+    glstate::AsyncDrawBufferReader *snapshotReader = nullptr;
+
     bool KHR_debug = false;
     GLsizei maxDebugMessageLength = 0;
 
@@ -822,6 +822,27 @@ public:
         return glstate::getDrawBufferImage(n);
     }
 
+    bool
+    getSnapshotAsync(int n, const SnapshotCallback &callback) override {
+        glretrace::Context *currentContext = glretrace::getCurrentContext();
+        if (!currentContext) {
+            return false;
+        }
+        if (!currentContext->snapshotReader) {
+            currentContext->snapshotReader =
+                new glstate::AsyncDrawBufferReader(retrace::snapshotAsync);
+        }
+        return currentContext->snapshotReader->read(n, callback);
+    }
+
+    void
+    flushSnapshots(void) override {
+        glretrace::Context *currentContext = glretrace::getCurrentContext();
+        if (currentContext && currentContext->snapshotReader) {
+            currentContext->snapshotReader->flush();
+        }
+    }
+
     bool
     canDump(void) override {
         glretrace::Context *currentContext = glretrace::getCurrentContext();
@@ -871,6 +892,10 @@ void
 retrace::flushRendering(void) {
     glretrace::Context *currentContext = glretrace::getCurrentContext();
     if (currentContext) {
+        // Before another thread takes over, to keep snapshots in order
+        if (currentContext->snapshotReader) {
+            currentContext->snapshotReader->flush();
+        }
         glretrace::flushQueries();
         if (currentContext->needsFlush) {
             glFlush();
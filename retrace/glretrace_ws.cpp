@@ -140,7 +140,10 @@ Context::~Context()
     //assert(this != getCurrentContext());
     if (this != getCurrentContext()) {
         delete wsContext;
+    } else if (snapshotReader) {
+        snapshotReader->flush();
     }
+    delete snapshotReader;
 }
 
 
@@ -170,6 +173,11 @@ makeCurrent(trace::Call &call, glws::Drawable *drawable,
     }
 
     if (currentContext) {
+        // Readbacks can only be finished while the context is current
+        if (currentContext->snapshotReader && context != currentContext) {
+            currentContext->snapshotReader->flush();
+        }
+
         glFlush();
         currentContext->needsFlush = false;
         if (!retrace::doubleBuffer) {
@@ -26,7 +26,10 @@
 #pragma once
 
 
+#include <deque>
+#include <functional>
 #include <ostream>
+#include <vector>
 
 #include "glimports.hpp"
 
@@ -71,6 +74,57 @@ image::Image *
 getDrawBufferImage(int n);
 
 
+typedef std::function<void (image::Image *)> ImageCallback;
+
+/**
+ * Reads back draw buffers into a ring of pixel pack buffers, only mapping
+ * each once a fence tells the GPU got past it, so that snapshots don't stall
+ * rendering.  Belongs to one context, which must be current when using it.
+ */
+class AsyncDrawBufferReader
+{
+public:
+    AsyncDrawBufferReader(unsigned maxPending);
+    ~AsyncDrawBufferReader();
+
+    /**
+     * Start reading back a draw buffer, as getDrawBufferImage.  The callback
+     * gets the image, or null on failure, once the readback is finished and
+     * all previous ones were handed over.  Returns false if the context
+     * lacks the means for it.
+     */
+    bool
+    read(int n, const ImageCallback &callback);
+
+    /**
+     * Hand over the readbacks which are finished already.
+     */
+    void
+    poll(void);
+
+    /**
+     * Wait for all readbacks, and hand them over.
+     */
+    void
+    flush(void);
+
+private:
+    struct Readback {
+        GLuint buffer;
+        GLsync sync;
+        image::Image *image;
+        ImageCallback callback;
+    };
+
+    unsigned maxPending;
+    std::deque<Readback> pending;
+    std::vector<GLuint> freeBuffers;
+
+    void
+    finishOldest(void);
+};
+
+
 } /* namespace glstate */
 
 
@@ -1241,11 +1241,13 @@ getDrawBufferImageCount()
 }
 
 
-image::Image *
-getDrawBufferImage(int n)
+/**
+ * Read the given draw buffer into an image or, when packBuffer isn't zero,
+ * into that buffer, leaving the image's pixels to be filled from it later.
+ */
+static image::Image *
+readDrawBufferImage(Context &context, int n, GLuint packBuffer)
 {
-    Context context;
-
     GLenum format = GL_RGB;
     GLenum type = GL_UNSIGNED_BYTE;
     if (context.ES) {
@@ -1361,7 +1363,13 @@ getDrawBufferImage(int n)
     {
         // TODO: reset imaging state too
         PixelPackState pps(context);
-        glReadPixels(0, 0, desc.width, desc.height, format, type, image->pixels);
+        if (packBuffer) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, image->height * image->_stride(), NULL, GL_STREAM_READ);
+            glReadPixels(0, 0, desc.width, desc.height, format, type, 0);
+        } else {
+            glReadPixels(0, 0, desc.width, desc.height, format, type, image->pixels);
+        }
     }
 
 
@@ -1386,6 +1394,124 @@ getDrawBufferImage(int n)
 }
 
 
+image::Image *
+getDrawBufferImage(int n)
+{
+    Context context;
+    return readDrawBufferImage(context, n, 0);
+}
+
+
+AsyncDrawBufferReader::AsyncDrawBufferReader(unsigned maxPending) :
+    maxPending(maxPending ? maxPending : 1)
+{
+}
+
+
+AsyncDrawBufferReader::~AsyncDrawBufferReader()
+{
+    // Buffers and fences are left to go away with their context, which
+    // might not be current any more
+    for (auto & readback : pending) {
+        delete readback.image;
+    }
+}
+
+
+bool
+AsyncDrawBufferReader::read(int n, const ImageCallback &callback)
+{
+    Context context;
+    if (!context.pixel_buffer_object ||
+        !context.map_buffer_range ||
+        !context.sync) {
+        return false;
+    }
+
+    poll();
+    while (pending.size() >= maxPending) {
+        finishOldest();
+    }
+
+    Readback readback;
+    if (freeBuffers.empty()) {
+        glGenBuffers(1, &readback.buffer);
+    } else {
+        readback.buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+    }
+    readback.image = readDrawBufferImage(context, n, readback.buffer);
+    readback.sync = readback.image ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+    readback.callback = callback;
+
+    // Make sure the fence gets signaled eventually
+    glFlush();
+
+    pending.push_back(readback);
+    return true;
+}
+
+
+/**
+ * Hand over the readbacks which completed, in order.
+ */
+void
+AsyncDrawBufferReader::poll(void)
+{
+    while (!pending.empty()) {
+        GLsync sync = pending.front().sync;
+        if (sync &&
+            glClientWaitSync(sync, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        finishOldest();
+    }
+}
+
+
+void
+AsyncDrawBufferReader::flush(void)
+{
+    while (!pending.empty()) {
+        finishOldest();
+    }
+}
+
+
+void
+AsyncDrawBufferReader::finishOldest(void)
+{
+    Readback readback = pending.front();
+    pending.pop_front();
+
+    image::Image *image = readback.image;
+    if (readback.sync) {
+        glClientWaitSync(readback.sync, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(readback.sync);
+
+        GLint pixel_pack_buffer_binding = 0;
+        glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pixel_pack_buffer_binding);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+
+        size_t size = image->height * image->_stride();
+        const void *map = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+        if (map) {
+            memcpy(image->pixels, map, size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        } else {
+            std::cerr << "warning: failed to map snapshot pixels\n";
+            delete image;
+            image = nullptr;
+        }
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixel_pack_buffer_binding);
+    }
+    freeBuffers.push_back(readback.buffer);
+
+    readback.callback(image);
+}
+
+
 /**
  * Dump the image of the currently bound read buffer.
  */
@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <string.h>
 
+#include <functional>
 #include <list>
 #include <map>
 #include <ostream>
@@ -129,6 +130,18 @@ extern bool snapshotMRT;
  */
 extern bool snapshotAlpha;
 
+/**
+ * Most snapshots to read back asynchronously at a time, or zero to read
+ * them back synchronously.
+ */
+extern unsigned snapshotAsync;
+
+/**
+ * Threads to deflate each PNG snapshot on with the fast encoder, or zero to
+ * encode them with libpng.
+ */
+extern unsigned snapshotPNGThreads;
+
 /**
  * Whether to force windowed. Recommeded, as there is no guarantee that the
  * original display mode is available.
@@ -252,6 +265,26 @@ public:
     virtual image::Image *
     getSnapshot(int n) = 0;
 
+    typedef std::function<void (image::Image *)> SnapshotCallback;
+
+    /**
+     * Start reading back a snapshot without waiting for rendering to finish.
+     * The callback gets the image, or null on failure, once available, and
+     * at the latest on flushSnapshots().  Returns false when not supported,
+     * in which case getSnapshot() must be used instead.
+     */
+    virtual bool
+    getSnapshotAsync(int n, const SnapshotCallback &callback) {
+        return false;
+    }
+
+    /**
+     * Hand over all the snapshots being read back.
+     */
+    virtual void
+    flushSnapshots(void) {
+    }
+
     virtual bool
     canDump(void) = 0;
 
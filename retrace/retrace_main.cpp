@@ -27,6 +27,7 @@
 
 
 #include <string.h>
+#include <algorithm>
 #include <limits.h> // for CHAR_MAX
 #include <memory> // for unique_ptr
 #include <iostream>
@@ -51,6 +52,8 @@
 #include "trace_callset.hpp"
 #include "trace_dump.hpp"
 #include "trace_option.hpp"
+#include "trace_parser_ahead.hpp"
+#include "trace_parser_loop.hpp"
 #include "retrace.hpp"
 #include "state_writer.hpp"
 #include "ws.hpp"
@@ -71,6 +74,16 @@ static unsigned snapshotInterval = 0;
 
 static unsigned dumpStateCallNo = ~0;
 
+/* Number of calls to parse ahead on a separate thread, or zero */
+static unsigned parseAheadDepth = 0;
+static trace::ParseAheadParser *parseAheadParser = nullptr;
+
+/* Range of frames to replay over and over, if any */
+static bool loopFrames = false;
+static unsigned loopFirstFrame = 0;
+static unsigned loopLastFrame = 0;
+static trace::FrameRangeLoopParser *frameRangeLoopParser = nullptr;
+
 retrace::Retracer retracer;
 
 
@@ -86,6 +99,8 @@ int debug = 1;
 bool markers = false;
 bool snapshotMRT = false;
 bool snapshotAlpha = false;
+unsigned snapshotAsync = 0;
+unsigned snapshotPNGThreads = 0;
 bool forceWindowed = true;
 bool dumpingState = false;
 bool dumpingSnapshots = false;
@@ -184,15 +199,12 @@ static Snapshotter *snapshotter;
 
 
 /**
- * Take snapshots.
+ * Write out a snapshot, taking ownership of it.
  */
 static void
-takeSnapshot(unsigned call_no, int mrt, unsigned snapshot_no) {
-
-    assert(dumpingSnapshots);
-    assert(snapshotPrefix);
+writeSnapshot(image::Image *image, unsigned call_no, int mrt, unsigned snapshot_no) {
 
-    std::unique_ptr<image::Image> src(dumper->getSnapshot(mrt));
+    std::unique_ptr<image::Image> src(image);
     if (!src) {
         /* TODO for mrt>0 we probably don't want to treat this as an error: */
         if (mrt == 0)
@@ -247,6 +259,29 @@ takeSnapshot(unsigned call_no, int mrt, unsigned snapshot_no) {
     return;
 }
 
+/**
+ * Take snapshots.
+ */
+static void
+takeSnapshot(unsigned call_no, int mrt, unsigned snapshot_no) {
+
+    assert(dumpingSnapshots);
+    assert(snapshotPrefix);
+
+    if (retrace::snapshotAsync) {
+        auto callback = [call_no, mrt, snapshot_no] (image::Image *image) {
+            writeSnapshot(image, call_no, mrt, snapshot_no);
+        };
+        if (dumper->getSnapshotAsync(mrt, callback)) {
+            return;
+        }
+        // Keep snapshots in order
+        dumper->flushSnapshots();
+    }
+
+    writeSnapshot(dumper->getSnapshot(mrt), call_no, mrt, snapshot_no);
+}
+
 static void
 takeSnapshot(unsigned call_no)
 {
@@ -598,6 +633,25 @@ RelayRace::stopRunners(void) {
 }
 
 
+/**
+ * Print the minimum, median and 99th percentile of the given durations.
+ */
+static void
+printTimeStats(const char *what, std::vector<long long> times) {
+    if (times.empty()) {
+        return;
+    }
+
+    std::sort(times.begin(), times.end());
+    double msecs = 1000.0 / os::timeFrequency;
+    std::cout <<
+        what << " times over " << times.size() << " samples:"
+        " min " << times.front() * msecs << " ms,"
+        " median " << times[times.size() / 2] * msecs << " ms,"
+        " p99 " << times[(times.size() - 1) * 99 / 100] * msecs << " ms\n";
+}
+
+
 static void
 mainLoop() {
     addCallbacks(retracer);
@@ -618,6 +672,7 @@ mainLoop() {
         RelayRace race;
         race.run();
     }
+    dumper->flushSnapshots();
     finishRendering();
 
     long long endTime = os::getTime();
@@ -628,6 +683,17 @@ mainLoop() {
             "Rendered " << frameNo << " frames"
             " in " <<  timeInterval << " secs,"
             " average of " << (frameNo/timeInterval) << " fps\n";
+
+        if (parseAheadParser) {
+            std::cout <<
+                "Waited for the parser " << parseAheadParser->getStalls() << " times,"
+                " for " << parseAheadParser->getStallTime() * (1.0 / os::timeFrequency) << " secs\n";
+        }
+
+        if (frameRangeLoopParser) {
+            printTimeStats("Frame range", frameRangeLoopParser->getIterationTimes());
+            printTimeStats("Frame", frameRangeLoopParser->getFrameTimes());
+        }
     }
 
     if (waitOnFinish) {
@@ -675,12 +741,17 @@ usage(const char *argv0) {
         "  -S, --snapshot=CALLSET  calls to snapshot (default is every frame)\n"
         "      --snapshot-interval=N    specify a frame interval when generating snaphots (default is 0)\n"
         "  -t, --snapshot-threaded encode screenshots on multiple threads\n"
+        "      --snapshot-async[=N]  read back up to N screenshots without waiting for rendering (default is 3)\n"
+        "      --snapshot-queue=N  most screenshots waiting to be encoded on threads (default is twice the threads)\n"
+        "      --snapshot-fast-png[=N]  encode PNG screenshots faster, deflating each on N threads (default is 1 with -t, otherwise the number of CPUs)\n"
         "  -v, --verbose           increase output verbosity\n"
         "  -D, --dump-state=CALL   dump state at specific call no\n"
         "      --dump-format=FORMAT dump state format (`json` or `ubjson`)\n"
         "  -w, --wait              waitOnFinish on final frame\n"
         "      --loop[=N]          loop N times (N<0 continuously) replaying final frame.\n"
+        "      --loop-frames=FIRST[-LAST]  loop over these frames instead, parsed up front, and report timings\n"
         "      --singlethread      use a single thread to replay command stream\n"
+        "      --parse-ahead[=N]   parse up to N calls ahead on a separate thread (default is 256)\n"
         "      --ignore-retvals    ignore return values in wglMakeCurrent, etc\n"
         "      --no-context-check  don't check that the actual GL context version matches the requested version\n"
         "      --min-cpu-time=NANOSECONDS  ignore calls with less than this CPU time when profiling (default is 1000)\n"
@@ -716,6 +787,11 @@ enum {
     DUMP_FORMAT_OPT,
     MARKERS_OPT,
     MIN_CPU_TIME_OPT,
+    PARSE_AHEAD_OPT,
+    LOOP_FRAMES_OPT,
+    SNAPSHOT_QUEUE_OPT,
+    SNAPSHOT_ASYNC_OPT,
+    SNAPSHOT_FAST_PNG_OPT,
 };
 
 const static char *
@@ -754,13 +830,18 @@ longOptions[] = {
     {"snapshot-interval", required_argument, 0, SNAPSHOT_INTERVAL_OPT},
     {"snapshot-prefix", required_argument, 0, 's'},
     {"snapshot-threaded", no_argument, 0, 't'},
+    {"snapshot-queue", required_argument, 0, SNAPSHOT_QUEUE_OPT},
+    {"snapshot-async", optional_argument, 0, SNAPSHOT_ASYNC_OPT},
+    {"snapshot-fast-png", optional_argument, 0, SNAPSHOT_FAST_PNG_OPT},
     {"verbose", no_argument, 0, 'v'},
     {"wait", no_argument, 0, 'w'},
     {"loop", optional_argument, 0, LOOP_OPT},
+    {"loop-frames", required_argument, 0, LOOP_FRAMES_OPT},
     {"singlethread", no_argument, 0, SINGLETHREAD_OPT},
     {"ignore-retvals", no_argument, 0, IGNORE_RETVALS_OPT},
     {"no-context-check", no_argument, 0, NO_CONTEXT_CHECK},
     {"min-cpu-time", required_argument, 0, MIN_CPU_TIME_OPT},
+    {"parse-ahead", optional_argument, 0, PARSE_AHEAD_OPT},
     {0, 0, 0, 0}
 };
 
@@ -947,6 +1028,8 @@ int main(int argc, char **argv)
     int loopCount = 0;
     int i;
     bool snapshotThreaded = false;
+    unsigned snapshotQueue = 0;
+    bool snapshotFastPNG = false;
 
     os::setDebugOutput(os::OUTPUT_STDERR);
 
@@ -1102,6 +1185,16 @@ int main(int argc, char **argv)
         case 't':
             snapshotThreaded = true;
             break;
+        case SNAPSHOT_QUEUE_OPT:
+            snapshotQueue = trace::intOption(optarg);
+            break;
+        case SNAPSHOT_ASYNC_OPT:
+            retrace::snapshotAsync = trace::intOption(optarg, 3);
+            break;
+        case SNAPSHOT_FAST_PNG_OPT:
+            snapshotFastPNG = true;
+            retrace::snapshotPNGThreads = trace::intOption(optarg, 0);
+            break;
         case 'v':
             ++retrace::verbosity;
             break;
@@ -1111,6 +1204,18 @@ int main(int argc, char **argv)
         case LOOP_OPT:
             loopCount = trace::intOption(optarg, -1);
             break;
+        case LOOP_FRAMES_OPT:
+            {
+                char *end;
+                loopFirstFrame = strtoul(optarg, &end, 0);
+                loopLastFrame = *end == '-' ? strtoul(end + 1, &end, 0) : loopFirstFrame;
+                if (end == optarg || *end || loopLastFrame < loopFirstFrame) {
+                    std::cerr << "error: invalid frame range `" << optarg << "`\n";
+                    return EXIT_FAILURE;
+                }
+                loopFrames = true;
+            }
+            break;
         case PGPU_OPT:
             retrace::debug = 0;
             retrace::profiling = true;
@@ -1177,6 +1282,9 @@ int main(int argc, char **argv)
         case MIN_CPU_TIME_OPT:
             retrace::minCpuTime = atol(optarg);
             break;
+        case PARSE_AHEAD_OPT:
+            parseAheadDepth = trace::intOption(optarg, 256);
+            break;
         default:
             std::cerr << "error: unknown option " << opt << "\n";
             usage(argv[0]);
@@ -1184,6 +1292,11 @@ int main(int argc, char **argv)
         }
     }
 
+    if (snapshotQueue && !snapshotThreaded) {
+        std::cerr << "error: --snapshot-queue requires --snapshot-threaded\n";
+        return 1;
+    }
+
 #ifndef _WIN32
     if (!isatty(STDOUT_FILENO)) {
         dumpFlags |= trace::DUMP_FLAG_NO_COLOR;
@@ -1200,8 +1313,15 @@ int main(int argc, char **argv)
     }
 #endif
 
+    if (snapshotFastPNG && !retrace::snapshotPNGThreads) {
+        // Snapshots are already encoded in parallel with -t
+        retrace::snapshotPNGThreads = snapshotThreaded ? 1 : os::thread::hardware_concurrency();
+    }
+
     if (snapshotThreaded) {
-        snapshotter = new ThreadedSnapshotter(os::thread::hardware_concurrency());
+        unsigned numThreads = os::thread::hardware_concurrency();
+        snapshotter = new ThreadedSnapshotter(numThreads,
+                                              snapshotQueue ? snapshotQueue : 2 * numThreads);
     } else {
         snapshotter = new Snapshotter();
     }
@@ -1221,8 +1341,19 @@ int main(int argc, char **argv)
          retrace::curPass++)
     {
         for (i = optind; i < argc; ++i) {
-            parser = new trace::Parser;
-            if (loopCount) {
+            trace::Parser *traceParser = new trace::Parser;
+            // Calls are never modified, so their values can live in arenas
+            traceParser->setUseArenas(true);
+            traceParser->setUseBlobViews(true);
+            parser = traceParser;
+            if (parseAheadDepth) {
+                parseAheadParser = new trace::ParseAheadParser(parser, parseAheadDepth);
+                parser = parseAheadParser;
+            }
+            if (loopFrames) {
+                frameRangeLoopParser = new trace::FrameRangeLoopParser(parser, loopFirstFrame, loopLastFrame, loopCount);
+                parser = frameRangeLoopParser;
+            } else if (loopCount) {
                 parser = lastFrameLoopParser(parser, loopCount);
             }
 
@@ -1242,6 +1373,8 @@ int main(int argc, char **argv)
 
             delete parser;
             parser = NULL;
+            parseAheadParser = nullptr;
+            frameRangeLoopParser = nullptr;
         }
     }
 
@@ -25,10 +25,12 @@
 
 #pragma once
 
+#include <atomic>
 #include <iostream>
 
 #include "image.hpp"
 #include "os_string.hpp"
+#include "os_time.hpp"
 #include "thread_pool.hpp"
 #include "retrace.hpp"
 
@@ -40,8 +42,15 @@ namespace image {
 static void
 actuallyWritePNG(const os::String& filename, image::Image *image)
 {
-    if (image->writePNG(filename, !retrace::snapshotAlpha) &&
-        retrace::verbosity >= 0) {
+    bool written;
+    if (retrace::snapshotPNGThreads) {
+        written = image->writePNGFast(filename, !retrace::snapshotAlpha,
+                                      retrace::snapshotPNGThreads);
+    } else {
+        written = image->writePNG(filename, !retrace::snapshotAlpha);
+    }
+
+    if (written && retrace::verbosity >= 0) {
         std::cout << "Wrote " << filename << "\n";
     }
 
@@ -67,18 +76,63 @@ public:
 
 /**
  * Write nb_thread snapshots at a time, to better use the available CPU resources.
+ *
+ * At most max_queued snapshots wait to be written, past which retracing
+ * blocks, so that memory use stays flat however fast snapshots are taken.
+ * Their pixel buffers are recycled through a pool.
  */
 class ThreadedSnapshotter : public Snapshotter
 {
 private:
+    // Must outlive the images being written
+    image::Pool imagePool;
     ThreadPool pool;
+
+    long long startTime = 0;
+    std::atomic<unsigned long long> numImages;
+    std::atomic<unsigned long long> numBytes;
+
     ThreadedSnapshotter() = delete;
 
+    void
+    write(const os::String& filename, image::Image *image) {
+        size_t size = size_t(image->height) * image->width * image->bytesPerPixel;
+        actuallyWritePNG(filename, image);
+        numImages += 1;
+        numBytes += size;
+    }
+
 public:
-    ThreadedSnapshotter(size_t nb_threads) : pool(nb_threads) {}
+    ThreadedSnapshotter(size_t nb_threads, size_t max_queued) :
+        // Enough for the queued images, those being written, and the next one
+        imagePool(max_queued + nb_threads + 1),
+        pool(nb_threads, max_queued),
+        numImages(0),
+        numBytes(0)
+    {
+        image::setPool(&imagePool);
+    }
+
+    ~ThreadedSnapshotter() {
+        pool.finish();
+        image::setPool(nullptr);
+
+        if (numImages && retrace::verbosity >= -1) {
+            double secs = (os::getTime() - startTime) * (1.0 / os::timeFrequency);
+            std::cout <<
+                "Wrote " << numImages << " snapshots"
+                " at " << numImages / secs << " per sec"
+                " (" << numBytes / secs / (1024.0 * 1024.0) << " MiB/s of pixels),"
+                " with up to " << pool.maxQueued() << " queued"
+                " and " << pool.numWaits() << " waits for the queue\n";
+        }
+    }
 
     virtual void
     writePNG(const os::String& filename, image::Image *image) override {
-        pool.enqueue(actuallyWritePNG, filename, image);
+        if (!startTime) {
+            startTime = os::getTime();
+        }
+        pool.enqueue(&ThreadedSnapshotter::write, this, filename, image);
     }
 };
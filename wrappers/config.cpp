@@ -356,26 +356,28 @@ readConfigFile(const char *filename)
 }
 
 
+static configuration *
+loadConfig(void)
+{
+    os::String configPath;
+    const char *envConfigPath = getenv("GLTRACE_CONF");
+    if (envConfigPath) {
+        configPath = envConfigPath;
+    } else {
+        configPath = os::getConfigDir();
+        configPath.join("apitrace");
+        configPath.join("gltrace.conf");
+    }
+    return gltrace::readConfigFile(configPath);
+}
+
+
 // Get pointer to configuration object or NULL if there was no config file.
 const configuration *
 getConfig(void)
 {
-    static bool configured = false;
-    static configuration *config = NULL;
-
-    if (!configured) {
-        os::String configPath;
-        const char *envConfigPath = getenv("GLTRACE_CONF");
-        if (envConfigPath) {
-            configPath = envConfigPath;
-        } else {
-            configPath = os::getConfigDir();
-            configPath.join("apitrace");
-            configPath.join("gltrace.conf");
-        }
-        config = gltrace::readConfigFile(configPath);
-        configured = true;
-    }
+    // Loaded once, even if several threads get here at the same time
+    static configuration *config = loadConfig();
 
     return config;
 }
@@ -43,6 +43,7 @@
 #include "glproc.hpp"
 #include "gltrace.hpp"
 #include "os.hpp"
+#include "os_thread.hpp"
 #include "config.hpp"
 
 
@@ -53,6 +54,7 @@ typedef std::map<std::string, const char *> ExtensionsMap;
 
 // Cache of the translated extensions strings
 static ExtensionsMap extensionsMap;
+static os::mutex extensionsMapMutex;
 
 
 // Additional extensions to be advertised
@@ -122,6 +124,8 @@ overrideExtensionsString(const char *extensions)
     const ExtensionsDesc *desc = getExtraExtensions(ctx);
     size_t i;
 
+    os::unique_lock<os::mutex> lock(extensionsMapMutex);
+
     ExtensionsMap::const_iterator it = extensionsMap.find(extensions);
     if (it != extensionsMap.end()) {
         return it->second;
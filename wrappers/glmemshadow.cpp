@@ -23,8 +23,11 @@
 
 #include "glmemshadow.hpp"
 
-#include <unordered_map>
+
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 #include <assert.h>
 
@@ -40,17 +43,62 @@
 
 #endif
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#ifdef UFFDIO_WRITEPROTECT_MODE_WP
+#define HAVE_USERFAULTFD 1
+#endif
+#endif
+
 #include "gltrace.hpp"
 #include "os_thread.hpp"
 #include "os.hpp"
 
 static bool sInitialized = false;
 
-static std::unordered_map<size_t, GLMemoryShadow*> sPages;
 static size_t sPageSize;
 
+/*
+ * Range of pages belonging to a shadow.
+ */
+struct PageRange {
+    size_t startPage;
+    size_t endPage;
+    GLMemoryShadow *shadow;
+};
+
+/*
+ * Page ranges of all shadows, sorted by start page.
+ *
+ * Faults look pages up without locking.  Updates, serialized by the mutex,
+ * publish a modified copy of the table, and wait for the faults which may
+ * still be using the old one to finish before releasing it (and, on
+ * destruction, the shadow itself).
+ *
+ * Faults count themselves in the reader slot of the current generation, and
+ * updates start a new generation before waiting, so that they only wait for
+ * the faults which began earlier, rather than for a moment when there are no
+ * faults at all, which may never come while other threads keep writing.
+ */
+typedef std::vector<PageRange> PageTable;
+
+static std::atomic<const PageTable *> sPageTable(nullptr);
+static std::atomic<unsigned> sPageTableGeneration(0);
+static std::atomic<unsigned> sPageTableReaders[2];
+
 static os::mutex mutex;
 
+/* Protects the mapped shadow lists of contexts */
+static os::mutex mappedMutex;
+
+#ifdef HAVE_USERFAULTFD
+/* Userfaultfd descriptor, when used instead of page protections */
+static int sUffd = -1;
+#endif
+
 enum class MemProtection {
 #ifdef _WIN32
     NO_ACCESS = PAGE_NOACCESS,
@@ -92,11 +140,104 @@ void memProtect(void *addr, size_t size, MemProtection protection) {
 #endif
 }
 
+#ifdef HAVE_USERFAULTFD
+static void uffdWriteProtect(void *addr, size_t size, bool protect) {
+    struct uffdio_writeprotect wp;
+    wp.range.start = reinterpret_cast<uintptr_t>(addr);
+    wp.range.len = size;
+    wp.mode = protect ? UFFDIO_WRITEPROTECT_MODE_WP : 0;
+    if (ioctl(sUffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+        os::log("apitrace: error: UFFDIO_WRITEPROTECT failed with error \"%s\"\n", strerror(errno));
+        os::abort();
+    }
+}
+#endif
+
+/*
+ * Have writes to the range fault, so that they're noticed.
+ */
+static void protectForWrites(void *addr, size_t size) {
+#ifdef HAVE_USERFAULTFD
+    if (sUffd >= 0) {
+        uffdWriteProtect(addr, size, true);
+        return;
+    }
+#endif
+    memProtect(addr, size, MemProtection::READ_ONLY);
+}
+
+/*
+ * Let writes to the range through, resuming any thread blocked writing to
+ * it.
+ */
+static void unprotectForWrites(void *addr, size_t size) {
+#ifdef HAVE_USERFAULTFD
+    if (sUffd >= 0) {
+        uffdWriteProtect(addr, size, false);
+        return;
+    }
+#endif
+    memProtect(addr, size, MemProtection::READ_WRITE);
+}
+
 template<typename T, typename U>
 auto divRoundUp(T a, U b) -> decltype(a / b) {
     return (a + b - 1) / b;
 }
 
+/*
+ * Replace the page table, waiting until no fault may be using the old one.
+ * Must be called with the mutex held.
+ */
+static void publishPageTable(const PageTable *table)
+{
+    const PageTable *oldTable = sPageTable.exchange(table);
+    unsigned generation = sPageTableGeneration.fetch_add(1);
+    while (sPageTableReaders[generation & 1].load() != 0) {
+        std::this_thread::yield();
+    }
+    delete oldTable;
+}
+
+/*
+ * Notify the shadow holding the address of a write to it.  Returns false
+ * when the address isn't shadowed.
+ */
+static bool handleWriteFault(uintptr_t addr)
+{
+    const size_t page = addr / sPageSize;
+    bool found = false;
+
+    // Count in the current generation, retrying if a new one started
+    // meanwhile, as the update may not wait for this slot then
+    unsigned generation = sPageTableGeneration.load();
+    while (true) {
+        sPageTableReaders[generation & 1].fetch_add(1);
+        unsigned current = sPageTableGeneration.load();
+        if (current == generation) {
+            break;
+        }
+        sPageTableReaders[generation & 1].fetch_sub(1);
+        generation = current;
+    }
+
+    const PageTable *table = sPageTable.load();
+    if (table) {
+        auto it = std::upper_bound(table->begin(), table->end(), page,
+            [] (size_t page, const PageRange &range) {
+                return page < range.startPage;
+            });
+        if (it != table->begin() && page < (--it)->endPage) {
+            it->shadow->onAddressWrite(addr, page);
+            found = true;
+        }
+    }
+
+    sPageTableReaders[generation & 1].fetch_sub(1);
+
+    return found;
+}
+
 #ifdef _WIN32
 static LONG CALLBACK
 VectoredHandler(PEXCEPTION_POINTERS pExceptionInfo)
@@ -109,14 +250,8 @@ VectoredHandler(PEXCEPTION_POINTERS pExceptionInfo)
         pExceptionRecord->ExceptionInformation[0] == 1) { // writing
 
         const uintptr_t addr = static_cast<uintptr_t>(pExceptionRecord->ExceptionInformation[1]);
-        const size_t page = addr / sPageSize;
-
-        os::unique_lock<os::mutex> lock(mutex);
 
-        const auto it = sPages.find(page);
-        if (it != sPages.end()) {
-            GLMemoryShadow *shadow = it->second;
-            shadow->onAddressWrite(addr, page);
+        if (handleWriteFault(addr)) {
             return EXCEPTION_CONTINUE_EXECUTION;
         } else {
             os::log("apitrace: error: %s: access violation at non-tracked page\n", __FUNCTION__);
@@ -132,15 +267,8 @@ VectoredHandler(PEXCEPTION_POINTERS pExceptionInfo)
 void PageGuardExceptionHandler(int sig, siginfo_t *si, void *unused) {
     if (sig == SIGSEGV && si->si_code == SEGV_ACCERR) {
         const uintptr_t addr = reinterpret_cast<uintptr_t>(si->si_addr);
-        const size_t page = addr / sPageSize;
 
-        os::unique_lock<os::mutex> lock(mutex);
-
-        const auto it = sPages.find(page);
-        if (it != sPages.end()) {
-            GLMemoryShadow *shadow = it->second;
-            shadow->onAddressWrite(addr, page);
-        } else {
+        if (!handleWriteFault(addr)) {
             os::log("apitrace: error: %s: access violation at non-tracked page\n", __FUNCTION__);
             os::abort();
         }
@@ -148,10 +276,79 @@ void PageGuardExceptionHandler(int sig, siginfo_t *si, void *unused) {
 }
 #endif
 
+#ifdef HAVE_USERFAULTFD
+
+/*
+ * Serve write faults on write-protected shadow pages.  The faulting threads
+ * are blocked by the kernel meanwhile, without any signal being raised.
+ */
+static void userfaultfdHandler(int fd)
+{
+    struct uffd_msg msg;
+    while (read(fd, &msg, sizeof msg) == sizeof msg) {
+        if (msg.event != UFFD_EVENT_PAGEFAULT) {
+            continue;
+        }
+
+        const uintptr_t addr = static_cast<uintptr_t>(msg.arg.pagefault.address);
+        if (!handleWriteFault(addr)) {
+            os::log("apitrace: error: %s: write fault at non-tracked page\n", __FUNCTION__);
+            os::abort();
+        }
+
+        // The page may have been dirtied already by another thread, in
+        // which case the faulting thread still needs waking up
+        struct uffdio_range range;
+        range.start = addr & ~static_cast<uintptr_t>(sPageSize - 1);
+        range.len = sPageSize;
+        ioctl(fd, UFFDIO_WAKE, &range);
+    }
+}
+
+static bool initializeUserfaultfd()
+{
+    int fd = -1;
+#ifdef UFFD_USER_MODE_ONLY
+    // Unprivileged processes may only handle faults from user space
+    fd = syscall(__NR_userfaultfd, O_CLOEXEC | UFFD_USER_MODE_ONLY);
+#endif
+    if (fd < 0) {
+        fd = syscall(__NR_userfaultfd, O_CLOEXEC);
+    }
+    if (fd < 0) {
+        os::log("apitrace: warning: userfaultfd failed with error \"%s\"\n", strerror(errno));
+        return false;
+    }
+
+    struct uffdio_api api;
+    memset(&api, 0, sizeof api);
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+    if (ioctl(fd, UFFDIO_API, &api) == -1) {
+        os::log("apitrace: warning: userfaultfd write protection is not supported\n");
+        close(fd);
+        return false;
+    }
+
+    os::thread(userfaultfdHandler, fd).detach();
+
+    sUffd = fd;
+    return true;
+}
+
+#endif /* HAVE_USERFAULTFD */
+
 void initializeGlobals()
 {
     sPageSize = getSystemPageSize();
 
+#ifdef HAVE_USERFAULTFD
+    const char *env = getenv("APITRACE_SHADOW_USERFAULTFD");
+    if (env && strcmp(env, "0") != 0 && initializeUserfaultfd()) {
+        return;
+    }
+#endif
+
 #ifdef _WIN32
     if (AddVectoredExceptionHandler(1, VectoredHandler) == NULL) {
         os::log("apitrace: error: %s: add vectored exception handler failed\n", __FUNCTION__);
@@ -169,11 +366,23 @@ void initializeGlobals()
 
 GLMemoryShadow::~GLMemoryShadow()
 {
-    os::unique_lock<os::mutex> lock(mutex);
+    if (!shadowMemory) {
+        // init() failed
+        return;
+    }
+
+    if (registered) {
+        os::unique_lock<os::mutex> lock(mutex);
 
-    const size_t startPage = reinterpret_cast<uintptr_t>(shadowMemory) / sPageSize;
-    for (size_t i = 0; i < nPages; i++) {
-        sPages.erase(startPage + i);
+        const PageTable *oldTable = sPageTable.load();
+        assert(oldTable);
+        PageTable *table = new PageTable;
+        for (const PageRange &range : *oldTable) {
+            if (range.shadow != this) {
+                table->push_back(range);
+            }
+        }
+        publishPageTable(table);
     }
 
 #ifdef _WIN32
@@ -196,7 +405,17 @@ bool GLMemoryShadow::init(const void *data, size_t size)
 #ifdef _WIN32
     shadowMemory = reinterpret_cast<uint8_t*>(VirtualAlloc(nullptr, adjustedSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
 #else
-    shadowMemory = reinterpret_cast<uint8_t*>(mmap(nullptr, adjustedSize, PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    int mmapFlags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef HAVE_USERFAULTFD
+    if (sUffd >= 0) {
+        // Write protection doesn't stick to pages not populated yet
+        mmapFlags |= MAP_POPULATE;
+    }
+#endif
+    shadowMemory = reinterpret_cast<uint8_t*>(mmap(nullptr, adjustedSize, PROT_READ | PROT_WRITE, mmapFlags, -1, 0));
+    if (shadowMemory == MAP_FAILED) {
+        shadowMemory = nullptr;
+    }
 #endif
 
     if (!shadowMemory) {
@@ -204,28 +423,68 @@ bool GLMemoryShadow::init(const void *data, size_t size)
         return false;
     }
 
+#ifdef HAVE_USERFAULTFD
+    if (sUffd >= 0) {
+        struct uffdio_register reg;
+        memset(&reg, 0, sizeof reg);
+        reg.range.start = reinterpret_cast<uintptr_t>(shadowMemory);
+        reg.range.len = adjustedSize;
+        reg.mode = UFFDIO_REGISTER_MODE_WP;
+        if (ioctl(sUffd, UFFDIO_REGISTER, &reg) == -1) {
+            os::log("apitrace: error: %s: UFFDIO_REGISTER failed with error \"%s\"\n", __FUNCTION__, strerror(errno));
+            os::abort();
+        }
+    }
+#endif
+
     if (data != nullptr) {
         memcpy(shadowMemory, data, size);
     }
 
     memProtect(shadowMemory, adjustedSize, MemProtection::NO_ACCESS);
 
+    nDirtyWords = divRoundUp(nPages, 32);
+    dirtyPages.reset(new std::atomic<uint32_t>[nDirtyWords]);
+    for (size_t i = 0; i < nDirtyWords; ++i) {
+        dirtyPages[i].store(0, std::memory_order_relaxed);
+    }
+
     {
         os::unique_lock<os::mutex> lock(mutex);
 
-        const size_t startPage = reinterpret_cast<uintptr_t>(shadowMemory) / sPageSize;
-        for (size_t i = 0; i < nPages; i++) {
-            sPages.emplace(startPage + i, this);
-        }
+        const PageRange range = {
+            reinterpret_cast<uintptr_t>(shadowMemory) / sPageSize,
+            reinterpret_cast<uintptr_t>(shadowMemory) / sPageSize + nPages,
+            this
+        };
+
+        const PageTable *oldTable = sPageTable.load();
+        PageTable *table = oldTable ? new PageTable(*oldTable) : new PageTable;
+        table->insert(std::upper_bound(table->begin(), table->end(), range,
+                                       [] (const PageRange &a, const PageRange &b) {
+                                           return a.startPage < b.startPage;
+                                       }),
+                      range);
+        publishPageTable(table);
     }
 
-    dirtyPages.resize(divRoundUp(nPages, 32));
+    registered = true;
 
     return true;
 }
 
 void *GLMemoryShadow::map(gltrace::Context *_ctx, void *_glMemory, GLbitfield _flags, size_t start, size_t size)
 {
+    {
+        os::unique_lock<os::mutex> lock(mappedMutex);
+        auto &shadows = _ctx->sharedRes->mappedShadows;
+        if (std::find(shadows.begin(), shadows.end(), this) == shadows.end()) {
+            shadows.push_back(this);
+        }
+    }
+
+    os::unique_lock<os::mutex> lock(writeMutex);
+
     sharedRes = _ctx->sharedRes;
     glMemory = reinterpret_cast<uint8_t*>(_glMemory);
     flags = _flags;
@@ -238,39 +497,41 @@ void *GLMemoryShadow::map(gltrace::Context *_ctx, void *_glMemory, GLbitfield _f
     uint8_t *protectStart = shadowMemory + mappedStartPage * sPageSize;
     const size_t protectSize = (mappedEndPage - mappedStartPage) * sPageSize;
 
+    memProtect(protectStart, protectSize, MemProtection::READ_WRITE);
+
     // The buffer may have been updated before the mapping.
     // TODO: handle write only buffers
     if (flags & GL_MAP_READ_BIT) {
-        memProtect(protectStart, protectSize, MemProtection::READ_WRITE);
+        unprotectForWrites(protectStart, protectSize);
         memcpy(shadowMemory + start, glMemory, size);
     }
 
-    memProtect(protectStart, protectSize, MemProtection::READ_ONLY);
+    protectForWrites(protectStart, protectSize);
 
     return shadowMemory + start;
 }
 
 void GLMemoryShadow::unmap(Callback callback)
 {
-    if (isDirty) {
-        os::unique_lock<os::mutex> lock(mutex);
-        commitWrites(callback);
-    }
-
     {
-        os::unique_lock<os::mutex> lock(mutex);
+        os::unique_lock<os::mutex> lock(mappedMutex);
 
         shared_context_res_ptr_t res = sharedRes.lock();
         if (res) {
-            auto it = std::find(res->dirtyShadows.begin(), res->dirtyShadows.end(), this);
-            if (it != res->dirtyShadows.end()) {
-                res->dirtyShadows.erase(it);
+            auto it = std::find(res->mappedShadows.begin(), res->mappedShadows.end(), this);
+            if (it != res->mappedShadows.end()) {
+                res->mappedShadows.erase(it);
             }
         } else {
             os::log("apitrace: error: %s: context(s) are destroyed!\n", __FUNCTION__);
         }
     }
 
+    os::unique_lock<os::mutex> lock(writeMutex);
+    if (isDirty) {
+        commitWrites(callback);
+    }
+
     memProtect(shadowMemory, nPages * sPageSize, MemProtection::NO_ACCESS);
 
     sharedRes.reset();
@@ -281,32 +542,45 @@ void GLMemoryShadow::unmap(Callback callback)
     pagesToDirtyOnConsecutiveWrites = 1;
 }
 
+/*
+ * Called from write faults, possibly in a signal handler, so it must not take
+ * any lock: dirty pages are marked with atomics.  A fault on a page already
+ * marked dirty, which is being committed, just returns, and the write is
+ * retried until the commit lets it through.
+ */
 void GLMemoryShadow::onAddressWrite(uintptr_t addr, size_t page)
 {
+    faultsInFlight.fetch_add(1);
+
     const size_t relativePage = (addr - reinterpret_cast<uintptr_t>(shadowMemory)) / sPageSize;
     if (isPageDirty(relativePage)) {
         // It is possible if writing to the same buffer from two threads
+        faultsInFlight.fetch_sub(1);
         return;
     }
 
-    if ((relativePage == lastDirtiedRelativePage + 1) && isPageDirty(relativePage - 1)) {
+    uint32_t pagesToDirty = 1;
+    if ((relativePage == lastDirtiedRelativePage.load(std::memory_order_relaxed) + 1) &&
+        isPageDirty(relativePage - 1)) {
         /* Ensure that we would have log(n) page exceptions if traced application writes
          * to n consecutive pages.
          */
-        pagesToDirtyOnConsecutiveWrites *= 2;
-    } else {
-        pagesToDirtyOnConsecutiveWrites = 1;
+        pagesToDirty = pagesToDirtyOnConsecutiveWrites.load(std::memory_order_relaxed) * 2;
     }
+    pagesToDirtyOnConsecutiveWrites.store(pagesToDirty, std::memory_order_relaxed);
 
-    const size_t endPageToDirty = std::min(relativePage + pagesToDirtyOnConsecutiveWrites, nPages);
+    const size_t endPageToDirty = std::min(relativePage + pagesToDirty, nPages);
     for (size_t pageToDirty = relativePage; pageToDirty < endPageToDirty; pageToDirty++) {
         setPageDirty(pageToDirty);
     }
+    isDirty.store(true);
 
-    lastDirtiedRelativePage = endPageToDirty - 1;
+    lastDirtiedRelativePage.store(uint32_t(endPageToDirty - 1), std::memory_order_relaxed);
 
-    memProtect(reinterpret_cast<void*>(page * sPageSize),
-               (endPageToDirty - relativePage) * sPageSize, MemProtection::READ_WRITE);
+    unprotectForWrites(reinterpret_cast<void*>(page * sPageSize),
+                       (endPageToDirty - relativePage) * sPageSize);
+
+    faultsInFlight.fetch_sub(1);
 }
 
 GLbitfield GLMemoryShadow::getMapFlags() const
@@ -317,28 +591,19 @@ GLbitfield GLMemoryShadow::getMapFlags() const
 void GLMemoryShadow::setPageDirty(size_t relativePage)
 {
     assert(relativePage < nPages);
-    dirtyPages[relativePage / 32] |= 1U << (relativePage % 32);
-
-    if (!isDirty) {
-        shared_context_res_ptr_t res = sharedRes.lock();
-        if (res) {
-            res->dirtyShadows.push_back(this);
-            isDirty = true;
-        } else {
-            os::log("apitrace: error: %s: context(s) are destroyed!\n", __FUNCTION__);
-        }
-    }
+    dirtyPages[relativePage / 32].fetch_or(1U << (relativePage % 32));
 }
 
 bool GLMemoryShadow::isPageDirty(size_t relativePage)
 {
     assert(relativePage < nPages);
-    return dirtyPages[relativePage / 32] & (1U << (relativePage % 32));
+    return dirtyPages[relativePage / 32].load() & (1U << (relativePage % 32));
 }
 
 void GLMemoryShadow::commitWrites(Callback callback)
 {
-    assert(isDirty);
+    // Pages dirtied from now on are left to the next commit
+    isDirty.store(false);
 
     uint8_t *shadowSlice = shadowMemory + mappedStartPage * sPageSize;
     const size_t glStartOffset = mappedStart % sPageSize;
@@ -347,17 +612,31 @@ void GLMemoryShadow::commitWrites(Callback callback)
      * so we need to protect pages before we read from them.
      * The other thread will have to wait until we commit all writes we want.
      */
+    std::vector<uint32_t> committed(nDirtyWords);
+    for (size_t w = 0; w < nDirtyWords; ++w) {
+        committed[w] = dirtyPages[w].load();
+    }
+    auto isCommitted = [&committed] (size_t page) {
+        return (committed[page / 32] & (1U << (page % 32))) != 0;
+    };
+
+    // A fault which marked a page before the snapshot may still be about to
+    // unprotect it, so let it finish first.  Later faults on these pages see
+    // them dirty and leave them protected.
+    while (faultsInFlight.load() != 0) {
+        std::this_thread::yield();
+    }
+
     for (size_t i = mappedStartPage; i < mappedEndPage; i++) {
-        if (isPageDirty(i)) {
-            memProtect(shadowMemory + i * sPageSize, sPageSize, MemProtection::READ_ONLY);
+        if (isCommitted(i)) {
+            protectForWrites(shadowMemory + i * sPageSize, sPageSize);
         }
     }
-
     for (size_t i = mappedStartPage; i < mappedEndPage; i++) {
-        if (isPageDirty(i)) {
+        if (isCommitted(i)) {
             // We coalesce consecutive writes into one
             size_t firstDirty = i;
-            while (++i < mappedEndPage && isPageDirty(i)) { }
+            while (++i < mappedEndPage && isCommitted(i)) { }
 
             const size_t pages = i - firstDirty;
             if (firstDirty != mappedStartPage) {
@@ -376,47 +655,52 @@ void GLMemoryShadow::commitWrites(Callback callback)
         }
     }
 
-    std::fill(dirtyPages.begin(), dirtyPages.end(), 0);
-    isDirty = false;
-    pagesToDirtyOnConsecutiveWrites = 1;
-    lastDirtiedRelativePage = UINT32_MAX - 1;
+    // Only clear the pages committed, which stayed protected meanwhile;
+    // others may have been dirtied since
+    for (size_t w = 0; w < nDirtyWords; ++w) {
+        if (committed[w]) {
+            dirtyPages[w].fetch_and(~committed[w]);
+        }
+    }
+    pagesToDirtyOnConsecutiveWrites.store(1, std::memory_order_relaxed);
+    lastDirtiedRelativePage.store(UINT32_MAX - 1, std::memory_order_relaxed);
 }
 
 void GLMemoryShadow::updateForReads()
 {
+    os::unique_lock<os::mutex> lock(writeMutex);
+
     uint8_t *protectStart = shadowMemory + mappedStartPage * sPageSize;
     const size_t protectSize = (mappedEndPage - mappedStartPage) * sPageSize;
 
-    memProtect(protectStart, protectSize, MemProtection::READ_WRITE);
+    unprotectForWrites(protectStart, protectSize);
 
     memcpy(shadowMemory + mappedStart, glMemory, mappedSize);
 
-    memProtect(protectStart, protectSize, MemProtection::READ_ONLY);
+    protectForWrites(protectStart, protectSize);
 }
 
 void GLMemoryShadow::commitAllWrites(gltrace::Context *_ctx, Callback callback)
 {
-    if (!_ctx->sharedRes->dirtyShadows.empty()) {
-        os::unique_lock<os::mutex> lock(mutex);
+    // Held throughout, so that shadows can't be unmapped and destroyed
+    // meanwhile
+    os::unique_lock<os::mutex> mappedLock(mappedMutex);
 
-        for (GLMemoryShadow *memoryShadow : _ctx->sharedRes->dirtyShadows) {
+    for (GLMemoryShadow *memoryShadow : _ctx->sharedRes->mappedShadows) {
+        if (memoryShadow->isDirty.load()) {
+            os::unique_lock<os::mutex> lock(memoryShadow->writeMutex);
             memoryShadow->commitWrites(callback);
         }
-
-        _ctx->sharedRes->dirtyShadows.clear();
     }
 }
 
 void GLMemoryShadow::syncAllForReads(gltrace::Context *_ctx)
 {
-    if (!_ctx->sharedRes->bufferToShadowMemory.empty()) {
-        os::unique_lock<os::mutex> lock(mutex);
-
-        for (auto& it : _ctx->sharedRes->bufferToShadowMemory) {
-            GLMemoryShadow* memoryShadow = it.second.get();
-            if (memoryShadow->getMapFlags() & GL_MAP_READ_BIT) {
-                memoryShadow->updateForReads();
-            }
+    os::unique_lock<os::mutex> lock(_ctx->sharedRes->mutex);
+    for (auto& it : _ctx->sharedRes->bufferToShadowMemory) {
+        GLMemoryShadow* memoryShadow = it.second.get();
+        if (memoryShadow->getMapFlags() & GL_MAP_READ_BIT) {
+            memoryShadow->updateForReads();
         }
     }
 }
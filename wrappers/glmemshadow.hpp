@@ -24,10 +24,12 @@
 #pragma once
 
 #include "glimports.hpp"
+#include "os_thread.hpp"
 
 #include <stdlib.h>
 #include <stdint.h>
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -58,10 +60,20 @@ private:
     size_t mappedStartPage = 0;
     size_t mappedEndPage = 0;
 
-    bool isDirty = false;
-    std::vector<uint32_t> dirtyPages;
-    uint32_t pagesToDirtyOnConsecutiveWrites = 1;
-    uint32_t lastDirtiedRelativePage = UINT32_MAX - 1;
+    // Set by write faults, which take no lock, so that they are safe in
+    // signal handlers
+    std::atomic<bool> isDirty{false};
+    std::unique_ptr<std::atomic<uint32_t>[]> dirtyPages;
+    size_t nDirtyWords = 0;
+    std::atomic<uint32_t> pagesToDirtyOnConsecutiveWrites{1};
+    std::atomic<uint32_t> lastDirtiedRelativePage{UINT32_MAX - 1};
+    std::atomic<unsigned> faultsInFlight{0};
+
+    // Whether init() added the shadow to the page table
+    bool registered = false;
+
+    // Serializes map/commit/unmap of this shadow.
+    os::mutex writeMutex;
 
 public:
 
@@ -74,6 +86,7 @@ public:
     void *map(gltrace::Context *_ctx, void *_glMemory, GLbitfield _flags, size_t start, size_t size);
     void unmap(Callback callback);
 
+    // Must be called with writeMutex held.
     void commitWrites(Callback callback);
     void updateForReads();
 
@@ -0,0 +1,194 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Micro-benchmark for tracking writes to persistently mapped buffers, as
+ * done by GLMemoryShadow, without any GL implementation.
+ *
+ * Usage: glmemshadow_bench [THREADS [PAGES [ROUNDS [random] [churn]]]]
+ *
+ * With churn, another thread keeps creating and destroying shadows while the
+ * others write, which measures how long updates of the page table wait for
+ * the faults in flight.
+ *
+ * Set APITRACE_SHADOW_USERFAULTFD=1 to measure the userfaultfd backend.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "os_thread.hpp"
+#include "os_time.hpp"
+#include "gltrace.hpp"
+#include "glmemshadow.hpp"
+
+
+/*
+ * No GL implementation is ever needed.
+ */
+void *
+_getPublicProcAddress(const char *procName)
+{
+    return nullptr;
+}
+
+void *
+_getPrivateProcAddress(const char *procName)
+{
+    return nullptr;
+}
+
+
+static std::atomic<size_t> committedBytes(0);
+
+
+static void
+countCommit(const void *ptr, size_t size)
+{
+    committedBytes += size;
+}
+
+
+static void
+writePages(gltrace::Context *ctx, size_t numPages, unsigned numRounds,
+           bool random, unsigned seed)
+{
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const size_t size = numPages * pageSize;
+
+    std::vector<uint8_t> glMemory(size);
+
+    GLMemoryShadow shadow;
+    if (!shadow.init(nullptr, size)) {
+        exit(1);
+    }
+
+    std::vector<size_t> order(numPages);
+    for (size_t i = 0; i < numPages; ++i) {
+        order[i] = i;
+    }
+    if (random) {
+        std::shuffle(order.begin(), order.end(), std::minstd_rand(seed));
+    }
+
+    for (unsigned round = 0; round < numRounds; ++round) {
+        uint8_t *ptr = static_cast<uint8_t *>(
+            shadow.map(ctx, glMemory.data(), GL_MAP_WRITE_BIT, 0, size));
+        for (size_t page : order) {
+            ptr[page * pageSize] = uint8_t(round);
+        }
+        shadow.unmap(countCommit);
+    }
+}
+
+
+static void
+churnShadows(const std::atomic<bool> &done, unsigned &count, long long &maxTime)
+{
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    count = 0;
+    maxTime = 0;
+    while (!done.load()) {
+        long long startTime = os::getTime();
+        {
+            GLMemoryShadow shadow;
+            shadow.init(nullptr, pageSize);
+        }
+        maxTime = std::max(maxTime, os::getTime() - startTime);
+        ++count;
+    }
+}
+
+
+int
+main(int argc, char **argv)
+{
+    unsigned numThreads = argc > 1 ? atoi(argv[1]) : 4;
+    size_t numPages = argc > 2 ? atoi(argv[2]) : 4096;
+    unsigned numRounds = argc > 3 ? atoi(argv[3]) : 16;
+    bool random = false;
+    bool churn = false;
+    for (int i = 4; i < argc; ++i) {
+        random = random || strcmp(argv[i], "random") == 0;
+        churn = churn || strcmp(argv[i], "churn") == 0;
+    }
+
+    gltrace::Context ctx;
+
+    // Initialize the globals before timing
+    {
+        GLMemoryShadow shadow;
+        shadow.init(nullptr, 1);
+    }
+
+    long long startTime = os::getTime();
+
+    std::atomic<bool> done(false);
+    unsigned churnCount = 0;
+    long long churnMaxTime = 0;
+    os::thread churner;
+    if (churn) {
+        churner = os::thread(churnShadows, std::cref(done),
+                             std::ref(churnCount), std::ref(churnMaxTime));
+    }
+
+    std::vector<os::thread> threads;
+    for (unsigned i = 0; i < numThreads; ++i) {
+        threads.emplace_back(writePages, &ctx, numPages, numRounds, random, i);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    long long endTime = os::getTime();
+    double seconds = double(endTime - startTime) / os::timeFrequency;
+
+    done = true;
+    if (churn) {
+        churner.join();
+    }
+
+    size_t totalPages = size_t(numThreads) * numPages * numRounds;
+    printf("%u threads, %zu pages, %u rounds, %s: %.3f s, %.0f pages/s, %zu bytes committed\n",
+           numThreads, numPages, numRounds, random ? "random" : "sequential",
+           seconds, totalPages / seconds, committedBytes.load());
+    if (churn) {
+        printf("%u shadows created and destroyed meanwhile, slowest in %.3f ms\n",
+               churnCount, 1000.0 * churnMaxTime / os::timeFrequency);
+    }
+
+    return 0;
+}
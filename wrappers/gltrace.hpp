@@ -31,6 +31,7 @@
 #include "glfeatures.hpp"
 
 #include "glmemshadow.hpp"
+#include "os_thread.hpp"
 
 #include <map>
 #include <vector>
@@ -43,9 +44,14 @@ namespace gltrace {
 
 class ShareableContextResources {
 public:
+    // Guards bufferToShadowMemory, as shared contexts may be current on
+    // different threads
+    os::mutex mutex;
+
     std::map<GLint, std::unique_ptr<GLMemoryShadow>> bufferToShadowMemory;
 
-    std::vector<GLMemoryShadow*> dirtyShadows;
+    // Shadows mapped for writing, whose writes are committed before draws
+    std::vector<GLMemoryShadow*> mappedShadows;
 };
 
 class Context {
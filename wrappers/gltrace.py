@@ -96,6 +96,10 @@ class TypeGetter(stdapi.Visitor):
 
 class GlTracer(Tracer):
 
+    # Context state is per thread, and state shared by contexts has its own
+    # locks
+    perThreadCapture = True
+
     arrays = [
         ("Vertex", "VERTEX"),
         ("Normal", "NORMAL"),
@@ -144,6 +148,7 @@ class GlTracer(Tracer):
         Tracer.header(self, api)
 
         print('#include <algorithm>')
+        print('#include <atomic>')
         print('#include "cxx_compat.hpp"')
         print()
         print('#include "gltrace.hpp"')
@@ -217,10 +222,10 @@ class GlTracer(Tracer):
 
         # Buffer mappings
         print('// whether glMapBufferRange(GL_MAP_WRITE_BIT) has ever been called')
-        print('static bool _checkBufferMapRange = false;')
+        print('static std::atomic<bool> _checkBufferMapRange(false);')
         print()
         print('// whether glBufferParameteriAPPLE(GL_BUFFER_FLUSHING_UNMAP_APPLE, GL_FALSE) has ever been called')
-        print('static bool _checkBufferFlushingUnmapAPPLE = false;')
+        print('static std::atomic<bool> _checkBufferFlushingUnmapAPPLE(false);')
         print()
 
         # Generate a helper function to determine whether a parameter name
@@ -553,6 +558,7 @@ class GlTracer(Tracer):
             print('    if ((access_flags & GL_MAP_COHERENT_BIT) && (access_flags & GL_MAP_WRITE_BIT)) {')
             print('        gltrace::Context *_ctx = gltrace::getContext();')
             print('        GLint buffer = getBufferName(target);')
+            print('        os::unique_lock<os::mutex> _lock(_ctx->sharedRes->mutex);')
             print('        auto it = _ctx->sharedRes->bufferToShadowMemory.find(buffer);')
             print('        if (it != _ctx->sharedRes->bufferToShadowMemory.end()) {')
             print('            it->second->unmap(trace::fakeMemcpy);')
@@ -625,6 +631,7 @@ class GlTracer(Tracer):
             print('    _glGetNamedBufferParameteriv(buffer, GL_BUFFER_ACCESS_FLAGS, &access_flags);')
             print('    if ((access_flags & GL_MAP_COHERENT_BIT) && (access_flags & GL_MAP_WRITE_BIT)) {')
             print('        gltrace::Context *_ctx = gltrace::getContext();')
+            print('        os::unique_lock<os::mutex> _lock(_ctx->sharedRes->mutex);')
             print('        auto it = _ctx->sharedRes->bufferToShadowMemory.find(buffer);')
             print('        if (it != _ctx->sharedRes->bufferToShadowMemory.end()) {')
             print('            it->second->unmap(trace::fakeMemcpy);')
@@ -646,6 +653,7 @@ class GlTracer(Tracer):
             print('    _glGetNamedBufferParameterivEXT(buffer, GL_BUFFER_ACCESS_FLAGS, &access_flags);')
             print('    if ((access_flags & GL_MAP_COHERENT_BIT) && (access_flags & GL_MAP_WRITE_BIT)) {')
             print('        gltrace::Context *_ctx = gltrace::getContext();')
+            print('        os::unique_lock<os::mutex> _lock(_ctx->sharedRes->mutex);')
             print('        auto it = _ctx->sharedRes->bufferToShadowMemory.find(buffer);')
             print('        if (it != _ctx->sharedRes->bufferToShadowMemory.end()) {')
             print('            it->second->unmap(trace::fakeMemcpy);')
@@ -712,6 +720,7 @@ class GlTracer(Tracer):
             print(r'        auto memoryShadow = std::make_unique<GLMemoryShadow>();')
             print(r'        const bool success = memoryShadow->init(data, size);')
             print(r'        if (success) {')
+            print(r'            os::unique_lock<os::mutex> _lock(_ctx->sharedRes->mutex);')
             print(r'            _ctx->sharedRes->bufferToShadowMemory.insert(std::make_pair(buffer, std::move(memoryShadow)));')
             print(r'        } else {')
             print(r'            os::log("apitrace: error: %s: cannot create memory shadow\n", __FUNCTION__);')
@@ -910,6 +919,7 @@ class GlTracer(Tracer):
             print(r'        gltrace::Context *_ctx = gltrace::getContext();')
             if function.name in ('glMapBufferRange', 'glMapBufferRangeEXT'):
                 print(r'        GLint buffer = getBufferName(target);')
+            print(r'        os::unique_lock<os::mutex> _lock(_ctx->sharedRes->mutex);')
             print(r'        auto it = _ctx->sharedRes->bufferToShadowMemory.find(buffer);')
             print(r'        if (it != _ctx->sharedRes->bufferToShadowMemory.end()) {')
             print(r'            _result = it->second->map(_ctx, _result, access, offset, length);')
@@ -26,6 +26,7 @@
 
 #include "gltrace_arrays.hpp"
 #include "gltrace.hpp"
+#include "glindices.hpp"
 
 
 /* FIXME take in consideration instancing */
@@ -87,54 +88,16 @@ _glDraw_count(gltrace::Context *ctx, const DrawElementsParams &params)
         }
     }
 
-    GLuint maxindex = 0;
-
     GLboolean restart_enabled = GL_FALSE;
     GLuint restart_index = 0;
     if (ctx->features.primitive_restart) {
-        _glIsEnabled(GL_PRIMITIVE_RESTART);
+        restart_enabled = _glIsEnabled(GL_PRIMITIVE_RESTART);
         if (restart_enabled) {
             restart_index = (GLuint)_glGetInteger(GL_PRIMITIVE_RESTART_INDEX);
         }
     }
 
-    GLsizei i;
-    if (type == GL_UNSIGNED_BYTE) {
-        const GLubyte *p = (const GLubyte *)indices;
-        for (i = 0; i < count; ++i) {
-            GLuint index = p[i];
-            if (restart_enabled && index == restart_index) {
-                continue;
-            }
-            if (index > maxindex) {
-                maxindex = index;
-            }
-        }
-    } else if (type == GL_UNSIGNED_SHORT) {
-        const GLushort *p = (const GLushort *)indices;
-        for (i = 0; i < count; ++i) {
-            GLuint index = p[i];
-            if (restart_enabled && index == restart_index) {
-                continue;
-            }
-            if (index > maxindex) {
-                maxindex = index;
-            }
-        }
-    } else if (type == GL_UNSIGNED_INT) {
-        const GLuint *p = (const GLuint *)indices;
-        for (i = 0; i < count; ++i) {
-            GLuint index = p[i];
-            if (restart_enabled && index == restart_index) {
-                continue;
-            }
-            if (index > maxindex) {
-                maxindex = index;
-            }
-        }
-    } else {
-        os::log("apitrace: warning: %s: unknown GLenum 0x%04X\n", __FUNCTION__, type);
-    }
+    GLuint maxindex = _gl_max_index(type, indices, count, restart_enabled, restart_index);
 
     if (element_array_buffer) {
         free(temp);
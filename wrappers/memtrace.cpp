@@ -22,8 +22,6 @@
  * THE SOFTWARE.
  *
  **************************************************************************/
-
-
 #include "memtrace.hpp"
 
 #include <assert.h>
@@ -33,33 +31,28 @@
 #include <algorithm>
 
 #include "crc32c.hpp"
+#include "os.hpp"
+#include "os_cpu.hpp"
+#include "os_thread.hpp"
 
 
-#if \
-    (defined(__i386__) && defined(__SSE2__)) /* gcc */ || \
-    defined(_M_IX86) /* msvc */ || \
-    defined(__x86_64__) /* gcc */ || \
-    defined(_M_X64) /* msvc */ || \
-    defined(_M_AMD64) /* msvc */
-
-#  define HAVE_SSE2
-
-// TODO: Detect and leverage SSE 4.1 and 4.2 at runtime
-
-#endif
-
-
-#if defined(HAVE_SSE42)
-#  include <nmmintrin.h>
-#elif defined(HAVE_SSE41)
-#  include <smmintrin.h>
-#elif defined(HAVE_SSE2)
-#  include <emmintrin.h>
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#  define HAVE_X86_SIMD
+#  include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#  define HAVE_ARM_CRC32
+#  include <arm_acle.h>
 #endif
 
 
 #define BLOCK_SIZE 512
 
+/*
+ * Mappings at least this large are hashed by several threads.
+ */
+#define PARALLEL_MIN_SIZE (8 * 1024 * 1024)
+#define PARALLEL_MAX_THREADS 8
+
 
 template< class T >
 static inline T *
@@ -77,94 +70,251 @@ rAlignPtr(T *p, uintptr_t alignment)
 }
 
 
-#ifdef HAVE_SSE2
+/*
+ * Block hashing kernels.
+ *
+ * Hashes are only ever compared against hashes obtained with the same kernel
+ * in the same process, so kernels are free to compute different functions.
+ */
 
-#ifdef HAVE_SSE41
-    #define mm_stream_load_si128 _mm_stream_load_si128
-    #define mm_extract_epi32_0(x) _mm_extract_epi32(x, 0)
-    #define mm_extract_epi32_1(x) _mm_extract_epi32(x, 1)
-    #define mm_extract_epi32_2(x) _mm_extract_epi32(x, 2)
-    #define mm_extract_epi32_3(x) _mm_extract_epi32(x, 3)
-#else /* !HAVE_SSE41 */
-    #define mm_stream_load_si128 _mm_load_si128
-    #define mm_extract_epi32_0(x) _mm_cvtsi128_si32(x)
-    #define mm_extract_epi32_1(x) _mm_cvtsi128_si32(_mm_shuffle_epi32(x,_MM_SHUFFLE(1,1,1,1)))
-    #define mm_extract_epi32_2(x) _mm_cvtsi128_si32(_mm_shuffle_epi32(x,_MM_SHUFFLE(2,2,2,2)))
-    #define mm_extract_epi32_3(x) _mm_cvtsi128_si32(_mm_shuffle_epi32(x,_MM_SHUFFLE(3,3,3,3)))
-#endif /* !HAVE_SSE41 */
 
-#ifdef HAVE_SSE42
+static uint32_t
+hashBlockTable(const void *p)
+{
+    return crc32c_8bytes(p, BLOCK_SIZE);
+}
 
-#define mm_crc32_u32 _mm_crc32_u32
 
-#else /* !HAVE_SSE42 */
+#ifdef HAVE_X86_SIMD
 
-static inline uint32_t
-mm_crc32_u32(uint32_t crc, uint32_t current)
+/*
+ * CRC32C of three interleaved streams, which hides the latency of the crc32
+ * instruction, with the stream CRCs folded together at the end.
+ */
+OS_TARGET_SSE42 static uint32_t
+hashBlockSse42(const void *p)
 {
-    uint32_t one = current ^ crc;
-    crc  = crc32c_8x256_table[0][ one >> 24        ] ^
-           crc32c_8x256_table[1][(one >> 16) & 0xff] ^
-           crc32c_8x256_table[2][(one >>  8) & 0xff] ^
-           crc32c_8x256_table[3][ one        & 0xff];
-    return crc;
+    const unsigned STREAM_WORDS = BLOCK_SIZE / (3 * 8);
+    const uint64_t *q = static_cast<const uint64_t *>(p);
+
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t a = ~0U, b = ~0U, c = ~0U;
+    for (unsigned i = 0; i < STREAM_WORDS; ++i) {
+        a = _mm_crc32_u64(a, q[i]);
+        b = _mm_crc32_u64(b, q[i + STREAM_WORDS]);
+        c = _mm_crc32_u64(c, q[i + 2 * STREAM_WORDS]);
+    }
+    for (unsigned i = 3 * STREAM_WORDS; i < BLOCK_SIZE / 8; ++i) {
+        c = _mm_crc32_u64(c, q[i]);
+    }
+#else
+    const uint32_t *d = static_cast<const uint32_t *>(p);
+    uint32_t a = ~0U, b = ~0U, c = ~0U;
+    for (unsigned i = 0; i < 2 * STREAM_WORDS; ++i) {
+        a = _mm_crc32_u32(a, d[i]);
+        b = _mm_crc32_u32(b, d[i + 2 * STREAM_WORDS]);
+        c = _mm_crc32_u32(c, d[i + 4 * STREAM_WORDS]);
+    }
+    for (unsigned i = 6 * STREAM_WORDS; i < BLOCK_SIZE / 4; ++i) {
+        c = _mm_crc32_u32(c, d[i]);
+    }
+    (void)q;
+#endif
+
+    uint32_t crc = _mm_crc32_u32(uint32_t(a), uint32_t(b));
+    crc = _mm_crc32_u32(crc, uint32_t(c));
+    return ~crc;
 }
 
-#endif /* !HAVE_SSE42 */
 
-#endif /* HAVE_SSE2 */
+/*
+ * Per-position keys for the wide hash, so that swapping words of a block
+ * changes its hash.
+ */
+struct WideHashKeys
+{
+    alignas(32) uint64_t keys[BLOCK_SIZE / 8];
+};
+
+static constexpr WideHashKeys
+makeWideHashKeys(void)
+{
+    // splitmix64
+    WideHashKeys result = {};
+    uint64_t x = 0;
+    for (auto &key : result.keys) {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        key = z ^ (z >> 31);
+    }
+    return result;
+}
 
+static constexpr WideHashKeys wideHashKeys = makeWideHashKeys();
 
-uint32_t
-hashBlock(const void *p)
+/*
+ * Multiply-accumulate hash in the style of XXH3, four 64-bit lanes at a time.
+ * Besides the keyed products, each word is added as is to the neighbouring
+ * lane, as products alone would lose words whose key happens to cancel half
+ * of them.
+ */
+OS_TARGET_AVX2 static uint32_t
+hashBlockAvx2(const void *p)
 {
-    assert((uintptr_t)p % BLOCK_SIZE == 0);
+    const __m256i *q = static_cast<const __m256i *>(p);
+    const __m256i *k = reinterpret_cast<const __m256i *>(wideHashKeys.keys);
+
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    for (unsigned i = 0; i < BLOCK_SIZE / sizeof *q; i += 2) {
+        __m256i d0 = _mm256_loadu_si256(q + i);
+        __m256i d1 = _mm256_loadu_si256(q + i + 1);
+        __m256i dk0 = _mm256_xor_si256(d0, _mm256_load_si256(k + i));
+        __m256i dk1 = _mm256_xor_si256(d1, _mm256_load_si256(k + i + 1));
+        __m256i m0 = _mm256_mul_epu32(dk0, _mm256_srli_epi64(dk0, 32));
+        __m256i m1 = _mm256_mul_epu32(dk1, _mm256_srli_epi64(dk1, 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc0 = _mm256_add_epi64(acc0, m0);
+        acc1 = _mm256_add_epi64(acc1, m1);
+    }
 
-    uint32_t crc;
+    alignas(32) uint64_t lanes[8];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), acc0);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes + 4), acc1);
 
-#ifdef HAVE_SSE2
-    crc = 0;
+    // Fold the lanes into 32 bits with the crc32 instruction, which AVX2
+    // capable CPUs always have
+    uint32_t crc = ~0U;
+    for (uint64_t lane : lanes) {
+        crc = _mm_crc32_u32(crc, uint32_t(lane));
+        crc = _mm_crc32_u32(crc, uint32_t(lane >> 32));
+    }
+    return ~crc;
+}
 
-    __m128i *q = (__m128i *)(void *)p;
+#endif /* HAVE_X86_SIMD */
 
-    crc = ~crc;
 
-    for (unsigned c = BLOCK_SIZE / (4 * sizeof *q); c; --c) {
-        __m128i m0 = mm_stream_load_si128(q++);
-        __m128i m1 = mm_stream_load_si128(q++);
-        __m128i m2 = mm_stream_load_si128(q++);
-        __m128i m3 = mm_stream_load_si128(q++);
+#ifdef HAVE_ARM_CRC32
 
-        crc = mm_crc32_u32(crc, mm_extract_epi32_0(m0));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_1(m0));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_2(m0));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_3(m0));
+OS_TARGET_ARM_CRC32 static uint32_t
+hashBlockArmCrc32(const void *p)
+{
+    const unsigned STREAM_WORDS = BLOCK_SIZE / (3 * 8);
+    const uint64_t *q = static_cast<const uint64_t *>(p);
+
+    uint32_t a = ~0U, b = ~0U, c = ~0U;
+    for (unsigned i = 0; i < STREAM_WORDS; ++i) {
+        a = __crc32cd(a, q[i]);
+        b = __crc32cd(b, q[i + STREAM_WORDS]);
+        c = __crc32cd(c, q[i + 2 * STREAM_WORDS]);
+    }
+    for (unsigned i = 3 * STREAM_WORDS; i < BLOCK_SIZE / 8; ++i) {
+        c = __crc32cd(c, q[i]);
+    }
 
-        crc = mm_crc32_u32(crc, mm_extract_epi32_0(m1));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_1(m1));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_2(m1));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_3(m1));
+    uint32_t crc = __crc32cw(a, b);
+    crc = __crc32cw(crc, c);
+    return ~crc;
+}
 
-        crc = mm_crc32_u32(crc, mm_extract_epi32_0(m2));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_1(m2));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_2(m2));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_3(m2));
+#endif /* HAVE_ARM_CRC32 */
 
-        crc = mm_crc32_u32(crc, mm_extract_epi32_0(m3));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_1(m3));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_2(m3));
-        crc = mm_crc32_u32(crc, mm_extract_epi32_3(m3));
-    }
 
-    crc = ~crc;
+std::vector<HashBlockKernel>
+getHashBlockKernels(void)
+{
+    std::vector<HashBlockKernel> kernels;
 
-#else /* !HAVE_SSE2 */
+    const unsigned features = os::getCpuFeatures();
+    (void)features;
 
-    crc = crc32c_8bytes(p, BLOCK_SIZE);
+#ifdef HAVE_X86_SIMD
+    if (features & os::CPU_AVX2) {
+        kernels.push_back({"avx2", hashBlockAvx2});
+    }
+    if (features & os::CPU_SSE42) {
+        kernels.push_back({"sse42", hashBlockSse42});
+    }
+#endif
 
+#ifdef HAVE_ARM_CRC32
+    if (features & os::CPU_ARM_CRC32) {
+        kernels.push_back({"armcrc32", hashBlockArmCrc32});
+    }
 #endif
 
-    return crc;
+    kernels.push_back({"table", hashBlockTable});
+
+    return kernels;
+}
+
+
+static HashBlockFunc
+selectHashBlock(void)
+{
+    std::vector<HashBlockKernel> kernels = getHashBlockKernels();
+
+    const char *name = getenv("APITRACE_MEMTRACE_HASH");
+    if (name) {
+        for (auto &kernel : kernels) {
+            if (strcmp(kernel.name, name) == 0) {
+                return kernel.func;
+            }
+        }
+        os::log("apitrace: warning: unsupported block hash kernel %s\n", name);
+    }
+
+    return kernels.front().func;
+}
+
+
+static inline HashBlockFunc
+getHashBlock(void)
+{
+    static const HashBlockFunc func = selectHashBlock();
+    return func;
+}
+
+
+uint32_t
+hashBlock(const void *p)
+{
+    assert((uintptr_t)p % BLOCK_SIZE == 0);
+
+    return getHashBlock()(p);
+}
+
+
+/*
+ * Call func(begin, end) over consecutive ranges of blocks, spread over
+ * several threads for large mappings.
+ */
+template< class Func >
+static void
+forEachBlockRange(size_t nBlocks, Func func)
+{
+    size_t nThreads = std::min<size_t>(os::thread::hardware_concurrency(), PARALLEL_MAX_THREADS);
+    nThreads = std::min(nThreads, nBlocks * BLOCK_SIZE / PARALLEL_MIN_SIZE);
+    if (nThreads <= 1) {
+        func(0, nBlocks);
+        return;
+    }
+
+    const size_t blocksPerThread = (nBlocks + nThreads - 1) / nThreads;
+
+    std::vector<os::thread> threads;
+    for (size_t begin = blocksPerThread; begin < nBlocks; begin += blocksPerThread) {
+        threads.emplace_back(func, begin, std::min(begin + blocksPerThread, nBlocks));
+    }
+
+    func(0, blocksPerThread);
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
 }
 
 
@@ -197,36 +347,58 @@ void MemoryShadow::cover(void *_ptr, size_t _size, bool _discard)
         zero(_ptr, size);
     }
 
+    const HashBlockFunc hash = getHashBlock();
     const uint8_t *p = lAlignPtr((const uint8_t *)_ptr, BLOCK_SIZE);
     if (_discard) {
-        hashPtr[0] = hashBlock(p);
+        hashPtr[0] = hash(p);
         for (size_t i = 1; i < nBlocks; ++i) {
             hashPtr[i] = hashPtr[0];
         }
     } else {
-        for (size_t i = 0; i < nBlocks; ++i) {
-            hashPtr[i] = hashBlock(p);
-            p += BLOCK_SIZE;
-        }
+        uint32_t *hashes = hashPtr;
+        forEachBlockRange(nBlocks, [=] (size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                hashes[i] = hash(p + i * BLOCK_SIZE);
+            }
+        });
     }
 }
 
 
 void MemoryShadow::update(Callback callback) const
 {
-    const uint8_t *realStart   = realPtr   + size;
-    const uint8_t *realStop    = realPtr;
-
+    const HashBlockFunc hash = getHashBlock();
     const uint8_t *p = lAlignPtr(realPtr, BLOCK_SIZE);
-    for (size_t i = 0; i < nBlocks; ++i) {
-        uint32_t crc = hashBlock(p);
-        if (crc != hashPtr[i]) {
-            realStart = std::min(realStart, p);
-            realStop  = std::max(realStop,  p + BLOCK_SIZE);
+    const uint32_t *hashes = hashPtr;
+
+    // Range of changed blocks
+    os::mutex mutex;
+    size_t firstChanged = nBlocks;
+    size_t lastChanged = 0;
+
+    forEachBlockRange(nBlocks, [&] (size_t begin, size_t end) {
+        size_t first = end;
+        size_t last = begin;
+        for (size_t i = begin; i < end; ++i) {
+            if (hash(p + i * BLOCK_SIZE) != hashes[i]) {
+                first = std::min(first, i);
+                last = i + 1;
+            }
+        }
+        if (first < last) {
+            os::unique_lock<os::mutex> lock(mutex);
+            firstChanged = std::min(firstChanged, first);
+            lastChanged = std::max(lastChanged, last);
         }
-        p += BLOCK_SIZE;
+    });
+
+    if (firstChanged >= lastChanged) {
+        return;
     }
 
+    const uint8_t *realStart = p + firstChanged * BLOCK_SIZE;
+    const uint8_t *realStop  = p + lastChanged * BLOCK_SIZE;
+
     realStart = std::max(realStart, realPtr);
     realStop  = std::min(realStop,  realPtr + size);
 
@@ -31,11 +31,29 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <vector>
+
 
 uint32_t
 hashBlock(const void *p);
 
 
+typedef uint32_t (*HashBlockFunc)(const void *p);
+
+struct HashBlockKernel
+{
+    const char *name;
+    HashBlockFunc func;
+};
+
+/*
+ * Block hashing kernels supported by this CPU, starting with the one used by
+ * hashBlock (unless overridden with APITRACE_MEMTRACE_HASH).
+ */
+std::vector<HashBlockKernel>
+getHashBlockKernels(void);
+
+
 class MemoryShadow
 {
     size_t size = 0;
@@ -0,0 +1,89 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/*
+ * Micro-benchmark for the block hashing of MemoryShadow.
+ *
+ * Usage: memtrace_bench [MEGABYTES]
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "os_time.hpp"
+#include "memtrace.hpp"
+
+
+static size_t updatedBytes = 0;
+
+static void
+countUpdate(const void *ptr, size_t size)
+{
+    updatedBytes += size;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    size_t size = (argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+
+    std::vector<uint8_t> buffer(size + 512);
+    uint8_t *data = reinterpret_cast<uint8_t *>((uintptr_t(buffer.data()) + 511) & ~uintptr_t(511));
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = uint8_t(i * 2654435761U >> 24);
+    }
+
+    // Hashing of blocks that stay in cache
+    const unsigned rounds = 1 << 20;
+    for (auto &kernel : getHashBlockKernels()) {
+        uint32_t sum = 0;
+        long long startTime = os::getTime();
+        for (unsigned i = 0; i < rounds; ++i) {
+            sum += kernel.func(data + (i % 64) * 512);
+        }
+        long long endTime = os::getTime();
+        double seconds = double(endTime - startTime) / os::timeFrequency;
+        printf("%-10s %8.1f MB/s (%08x)\n", kernel.name,
+               rounds * 512.0 / (1024 * 1024) / seconds, sum);
+    }
+
+    // Whole mappings, as hashed on lock and unlock
+    MemoryShadow shadow;
+    long long startTime = os::getTime();
+    shadow.cover(data, size, false);
+    data[size / 2] ^= 1;
+    shadow.update(countUpdate);
+    long long endTime = os::getTime();
+    double seconds = double(endTime - startTime) / os::timeFrequency;
+    printf("%-10s %8.1f MB/s (%zu bytes updated)\n", "shadow",
+           2.0 * size / (1024 * 1024) / seconds, updatedBytes);
+
+    return 0;
+}
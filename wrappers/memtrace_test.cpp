@@ -0,0 +1,111 @@
+/**************************************************************************
+ *
+ * Copyright 2026 apitrace contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ **************************************************************************/
+
+#include "memtrace.hpp"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+
+static const uint8_t *updatedPtr;
+static size_t updatedSize;
+
+static void
+recordUpdate(const void *ptr, size_t size)
+{
+    updatedPtr = static_cast<const uint8_t *>(ptr);
+    updatedSize = size;
+}
+
+
+TEST(memtrace, kernels)
+{
+    alignas(512) static uint8_t block[512];
+
+    for (auto &kernel : getHashBlockKernels()) {
+        // Any change to a word must be noticed
+        for (size_t i = 0; i < sizeof block; i += 4) {
+            memset(block, 0, sizeof block);
+            uint32_t hash = kernel.func(block);
+            block[i] = 1;
+            EXPECT_NE(kernel.func(block), hash) << kernel.name << " " << i;
+            block[i] = 0;
+            EXPECT_EQ(kernel.func(block), hash) << kernel.name << " " << i;
+        }
+    }
+}
+
+
+static void
+testUpdate(size_t size)
+{
+    std::vector<uint8_t> buffer(size + 1024);
+    // Start off block boundaries
+    uint8_t *data = buffer.data() + 100;
+
+    MemoryShadow shadow;
+    shadow.cover(data, size, false);
+
+    updatedSize = 0;
+    shadow.update(recordUpdate);
+    EXPECT_EQ(updatedSize, 0);
+
+    data[10] = 1;
+    data[size - 10] = 1;
+    updatedSize = 0;
+    shadow.update(recordUpdate);
+    EXPECT_EQ(updatedPtr, data);
+    EXPECT_EQ(updatedSize, size);
+
+    shadow.cover(data, size, false);
+    data[size / 2] = 2;
+    updatedSize = 0;
+    shadow.update(recordUpdate);
+    EXPECT_LE(updatedPtr, data + size / 2);
+    EXPECT_GT(updatedPtr + updatedSize, data + size / 2);
+    EXPECT_LE(updatedSize, 1024);
+}
+
+
+TEST(memtrace, update)
+{
+    testUpdate(4096);
+}
+
+
+TEST(memtrace, update_large)
+{
+    // Large enough to be hashed by several threads
+    testUpdate(64 * 1024 * 1024);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
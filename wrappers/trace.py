@@ -468,6 +468,11 @@ class Tracer:
     # 0-3 are reserved to memcpy, malloc, free, and realloc
     __id = 4
 
+    # Whether the generated wrappers keep no state relying on
+    # trace::LocalWriter::mutex, so that APITRACE_PER_THREAD_CAPTURE may
+    # capture their calls without holding it
+    perThreadCapture = False
+
     def __init__(self):
         self.api = None
 
@@ -533,6 +538,11 @@ class Tracer:
         print(r' * This lock is hold during the beginEnter/endEnter and beginLeave/endLeave sections')
         print(r' */')
         print('static std::map<void *, void *> g_WrappedObjects;')
+        if self.perThreadCapture:
+            print()
+            print('static struct _PerThreadCapture {')
+            print('    _PerThreadCapture() { trace::LocalWriter::allowPerThreadCapture(); }')
+            print('} _perThreadCapture;')
 
     def footer(self, api):
         pass